@@ -0,0 +1,109 @@
+#pragma once
+
+#include <CodeGen/X86Backend.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace koda {
+
+class ProgramGraph;
+
+struct AotCacheStats {
+  // Entries found in file with valid header.
+  size_t num_loaded = 0;
+  size_t num_hits = 0;
+  size_t num_misses = 0;
+  // Entries failed validation, they are dropped on save.
+  size_t num_rejected = 0;
+  size_t num_inserted = 0;
+};
+
+// Machine code of functions persisted between runs. Entries are keyed by
+// structural hash of IR and name of pass pipeline, so changed functions
+// miss and are compiled again.
+//
+// File is mapped read-only. It starts with header and table of entries,
+// code and relocations of entries follow. File of other version or target,
+// or with broken table is ignored as a whole. Entry is validated on lookup:
+// its bounds, relocations and checksum of its bytes, corrupted entry is
+// reported as miss.
+class AotCache final {
+public:
+  static constexpr uint32_t FORMAT_VERSION = 1;
+
+  struct Entry {
+    std::vector<uint8_t> code;
+    std::vector<CallRelocation> relocations;
+  };
+
+private:
+  // File layout, all fields are in host byte order.
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t target;
+    uint64_t num_entries;
+    uint64_t file_size;
+    uint64_t table_checksum;
+  };
+
+  struct FileEntry {
+    uint64_t key;
+    uint64_t code_offset;
+    uint64_t code_size;
+    uint64_t relocs_offset;
+    uint64_t num_relocs;
+    // Checksum of code and relocations.
+    uint64_t checksum;
+  };
+
+  std::string m_path;
+
+  const uint8_t *m_data = nullptr;
+
+  size_t m_size = 0;
+
+  // Entries of mapped file, removed once validated.
+  std::map<uint64_t, FileEntry> m_stored;
+
+  std::map<uint64_t, Entry> m_entries;
+
+  AotCacheStats m_stats;
+
+  void load();
+
+  std::optional<Entry> read_entry(const FileEntry &entry) const;
+
+public:
+  // Missing file is an empty cache. Throws std::system_error if existing
+  // file can't be read.
+  explicit AotCache(std::string path);
+
+  AotCache(const AotCache &) = delete;
+  AotCache &operator=(const AotCache &) = delete;
+
+  ~AotCache();
+
+  std::optional<Entry> lookup(uint64_t key);
+
+  void insert(uint64_t key, Entry entry);
+
+  // Writes all valid entries to temporary file and renames it over the
+  // cache file, so readers never see partial file. Throws std::system_error
+  // on I/O errors.
+  void save();
+
+  AotCacheStats get_stats() const { return m_stats; }
+
+  // Key of graph compiled with pipeline, also depends on format version
+  // and backend register set.
+  static uint64_t get_key(ProgramGraph &graph, std::string_view pipeline);
+};
+
+} // namespace koda
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace koda {
+
+struct CodeCacheStats {
+  size_t num_regions = 0;
+  size_t reserved_bytes = 0;
+  // Bytes of live chunks, including alignment padding.
+  size_t used_bytes = 0;
+  size_t num_live_chunks = 0;
+  // Free chunk counters are computed on request.
+  size_t num_free_chunks = 0;
+  size_t largest_free_chunk = 0;
+  size_t num_allocations = 0;
+  size_t num_evictions = 0;
+  // Number of mprotect calls.
+  size_t num_protection_flips = 0;
+};
+
+// One "code_cache.<name> <value>" line per counter.
+std::ostream &operator<<(std::ostream &os, const CodeCacheStats &stats);
+
+// Executable memory shared by many functions. Large regions are reserved
+// with mmap and split into chunks aligned to cache line. Free chunks are
+// binned by size class (powers of two), allocation takes the best fit from
+// the class of requested size or the smallest chunk of larger classes.
+// Freed chunks are coalesced with free neighbours of the same region.
+//
+// Regions are either writable or executable (W^X). Allocation makes its
+// region writable, make_executable() flips all written regions back in one
+// batch, so code of the cache must not run between them.
+class CodeCache final {
+public:
+  static constexpr size_t ALIGNMENT = 64;
+  static constexpr size_t NUM_SIZE_CLASSES = 16;
+  // Size of transparent huge page on x86-64.
+  static constexpr size_t DEFAULT_REGION_SIZE = 2 << 20;
+
+private:
+  struct Region {
+    uint8_t *base;
+    size_t size;
+    bool is_writable;
+  };
+
+  size_t m_region_size;
+
+  bool m_use_huge_pages;
+
+  // Keyed by base address.
+  std::map<uint8_t *, Region> m_regions;
+
+  // Free chunks by address, for coalescing.
+  std::map<uint8_t *, size_t> m_free;
+
+  // Free chunks by size class, ordered by size for best fit.
+  std::array<std::set<std::pair<size_t, uint8_t *>>, NUM_SIZE_CLASSES> m_bins;
+
+  std::unordered_map<const uint8_t *, size_t> m_chunks;
+
+  CodeCacheStats m_stats;
+
+  static size_t get_size_class(size_t size);
+
+  Region &get_region(const uint8_t *addr);
+
+  Region &reserve_region(size_t size);
+
+  void protect(Region &region, bool is_writable);
+
+  void add_free_chunk(uint8_t *addr, size_t size);
+
+  void remove_free_chunk(uint8_t *addr, size_t size);
+
+public:
+  // Region size is rounded up to page size. With huge pages regions are
+  // aligned to their size and advised to be backed by transparent huge
+  // pages where the system supports it.
+  explicit CodeCache(size_t region_size = DEFAULT_REGION_SIZE,
+                     bool use_huge_pages = false);
+
+  CodeCache(const CodeCache &) = delete;
+  CodeCache &operator=(const CodeCache &) = delete;
+
+  ~CodeCache();
+
+  // Returns writable chunk of at least size bytes. Throws std::system_error
+  // if memory can't be reserved.
+  uint8_t *allocate(size_t size);
+
+  // Copies code into new chunk, it becomes executable after
+  // make_executable().
+  const void *add(const std::vector<uint8_t> &code);
+
+  // Returns chunk of evicted code to the cache.
+  void free(const void *code);
+
+  // Makes all written regions read-only and executable.
+  void make_executable();
+
+  // Size of chunk holding code.
+  size_t get_chunk_size(const void *code) const;
+
+  CodeCacheStats get_stats() const;
+};
+
+} // namespace koda
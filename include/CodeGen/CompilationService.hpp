@@ -0,0 +1,107 @@
+#pragma once
+
+#include <CodeGen/Jit.hpp>
+#include <CodeGen/X86Backend.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace koda {
+
+class Module;
+class ProgramGraph;
+
+// Code of function compiled by CompilationService. Error holds message of
+// exception thrown by compilation, code is empty then.
+struct CompiledFunction {
+  std::vector<uint8_t> code;
+  std::vector<CallRelocation> relocations;
+  std::string error;
+};
+
+// Compiles independent functions on a pool of threads. Every worker owns a
+// Compiler, which is reset between functions, so its arenas and the
+// registered pipeline are reused. Batch is split into contiguous ranges of
+// workers, worker takes functions from the front of its range and steals
+// from the back of other ranges when its own is exhausted. Function is
+// compiled from its own copy of IR, so code doesn't depend on which worker
+// compiled it or when, and results follow the order of input.
+class CompilationService final {
+  struct Worker {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+    std::thread thread;
+  };
+
+  CodeTier m_tier;
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+
+  // Serializes batches of concurrent callers.
+  std::mutex m_batch_mutex;
+
+  std::mutex m_mutex;
+
+  std::condition_variable m_wake;
+
+  std::condition_variable m_done;
+
+  // Incremented for every batch, workers wait for its change.
+  uint64_t m_generation = 0;
+
+  bool m_is_stopping = false;
+
+  std::function<void(Compiler &, size_t)> m_task;
+
+  std::atomic<size_t> m_num_pending = 0;
+
+  std::atomic<size_t> m_num_steals = 0;
+
+  bool pop_task(size_t worker, size_t &task);
+
+  bool steal_task(size_t worker, size_t &task);
+
+  void run_worker(size_t worker);
+
+  // Runs task for indices below num_tasks and waits for all of them.
+  void run_batch(size_t num_tasks,
+                 std::function<void(Compiler &, size_t)> task);
+
+public:
+  // Zero threads means one per hardware thread.
+  explicit CompilationService(size_t num_threads = 0,
+                              CodeTier tier = CodeTier::OPTIMIZING);
+
+  CompilationService(const CompilationService &) = delete;
+  CompilationService &operator=(const CompilationService &) = delete;
+
+  ~CompilationService();
+
+  size_t get_num_threads() const { return m_workers.size(); }
+
+  CodeTier get_tier() const { return m_tier; }
+
+  // Graphs are only read and may be compiled concurrently with reads by
+  // other threads. Calls go through call_table as in X86Backend::emit().
+  std::vector<CompiledFunction>
+  compile(const std::vector<ProgramGraph *> &graphs,
+          const void *const *call_table = nullptr);
+
+  // Results are indexed by function ids.
+  std::vector<CompiledFunction> compile(const Module &module,
+                                        const void *const *call_table);
+
+  // Tasks taken from ranges of other workers since construction.
+  size_t get_num_steals() const { return m_num_steals; }
+};
+
+} // namespace koda
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace koda {
+
+// Anonymous pages holding generated code. Pages are writable until they are
+// sealed and only executable after that, never both (W^X).
+class ExecutableMemory final {
+  uint8_t *m_data = nullptr;
+
+  size_t m_size = 0;
+
+  bool m_is_sealed = false;
+
+  void release();
+
+public:
+  ExecutableMemory() = default;
+
+  // Maps at least size bytes. Throws std::system_error if mapping fails.
+  explicit ExecutableMemory(size_t size);
+
+  ExecutableMemory(const ExecutableMemory &) = delete;
+  ExecutableMemory &operator=(const ExecutableMemory &) = delete;
+
+  ExecutableMemory(ExecutableMemory &&other) noexcept;
+  ExecutableMemory &operator=(ExecutableMemory &&other) noexcept;
+
+  ~ExecutableMemory() { release(); }
+
+  // Sealed memory is not writable.
+  uint8_t *data() { return m_data; }
+  const uint8_t *data() const { return m_data; }
+
+  size_t size() const { return m_size; }
+
+  bool is_sealed() const { return m_is_sealed; }
+
+  // Make pages read-only and executable.
+  void seal();
+
+  // Sealed copy of code.
+  static ExecutableMemory from_code(const std::vector<uint8_t> &code);
+};
+
+} // namespace koda
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <CodeGen/CodeCache.hpp>
+#include <CodeGen/ExecutableMemory.hpp>
+#include <IR/IRTypes.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace koda {
+
+class AotCache;
+class Compiler;
+class Module;
+class ProgramGraph;
+
+// Code generators of JIT. Baseline code is emitted in a single pass and is
+// ready sooner, optimizing one selects instructions and allocates registers.
+enum class CodeTier { BASELINE, OPTIMIZING };
+
+// Function compiled into executable memory. All parameters and result are
+// int64_t.
+class JitFunction final {
+  const void *m_entry = nullptr;
+
+  size_t m_code_size = 0;
+
+  // Empty if code is owned by CodeCache.
+  ExecutableMemory m_memory;
+
+public:
+  JitFunction() = default;
+
+  explicit JitFunction(ExecutableMemory code)
+      : m_entry(code.data()), m_code_size(code.size()),
+        m_memory(std::move(code)) {}
+
+  // Code placed in cache, which must outlive the function.
+  JitFunction(const void *entry, size_t code_size)
+      : m_entry(entry), m_code_size(code_size) {}
+
+  const void *get_entry() const { return m_entry; }
+
+  size_t get_code_size() const { return m_code_size; }
+
+  // Pointer to function taking sizeof...(Args) parameters.
+  template <typename... Args> auto get() const {
+    using Entry = int64_t (*)(std::conditional_t<true, int64_t, Args>...);
+    return reinterpret_cast<Entry>(m_entry);
+  }
+
+  template <typename... Args> int64_t operator()(Args... args) const {
+    return get<Args...>()(static_cast<int64_t>(args)...);
+  }
+};
+
+// Calls native function with parameters taken from array, so callers don't
+// need to know number of parameters at compile time. Stub is placed in
+// cache and can be called after CodeCache::make_executable().
+class ArrayCallStub final {
+  const void *m_code;
+
+public:
+  ArrayCallStub(CodeCache &cache, const void *entry, size_t num_params);
+
+  int64_t operator()(const int64_t *args) const {
+    return reinterpret_cast<int64_t (*)(const int64_t *)>(m_code)(args);
+  }
+};
+
+// Compiles function without calls.
+JitFunction jit_compile(Compiler &comp);
+
+// Compiles function without calls by the baseline code generator.
+JitFunction jit_compile_baseline(ProgramGraph &graph);
+
+// All functions of module compiled together. Calls go through the table of
+// entry points, so functions may call each other recursively. Code shares
+// pages of one cache. With AOT cache, code of unchanged functions is taken
+// from it instead of compiling them, and new code is inserted into it.
+// Code of both tiers is cached under different keys.
+class JitModule final {
+  CodeCache m_code_cache;
+
+  std::unique_ptr<const void *[]> m_call_table;
+
+  std::vector<JitFunction> m_functions;
+
+public:
+  static constexpr const char *PIPELINE = "none";
+
+  static constexpr const char *BASELINE_PIPELINE = "baseline";
+
+  explicit JitModule(const Module &module, AotCache *aot_cache = nullptr,
+                     CodeTier tier = CodeTier::OPTIMIZING);
+
+  const JitFunction &get_function(funcid_t id) const {
+    return m_functions[id];
+  }
+
+  size_t size() const { return m_functions.size(); }
+
+  const CodeCache &get_code_cache() const { return m_code_cache; }
+};
+
+// Module whose functions are compiled on their first call. Entry of every
+// function in the call table starts at its resolver stub, which compiles the
+// function by the baseline code generator, atomically replaces the entry
+// with the code and jumps into it. tier_up() replaces entries the same way,
+// so threads calling through the table are never stopped: each call sees
+// either the old or the new code. Replaced code stays mapped until the
+// module is destroyed, since other threads may still run it. Function which
+// can't be compiled aborts the program on its first call.
+class LazyJitModule final {
+  using Entry = std::atomic<const void *>;
+  static_assert(sizeof(Entry) == sizeof(const void *) &&
+                    Entry::is_always_lock_free,
+                "Generated code reads entries as plain pointers");
+
+  const Module &m_module;
+
+  std::unique_ptr<Entry[]> m_call_table;
+
+  CodeCache m_stub_cache;
+
+  std::vector<JitFunction> m_functions;
+
+  // Guards compilation and the fields below.
+  mutable std::mutex m_mutex;
+
+  // Every function has own pages, which are sealed before they are
+  // published, since CodeCache makes its regions writable to add code.
+  std::vector<ExecutableMemory> m_code;
+
+  std::vector<std::optional<CodeTier>> m_tiers;
+
+  size_t m_num_compiled = 0;
+
+  static const void *resolve(void *context, uint64_t id) noexcept;
+
+  const void *compile(funcid_t id, CodeTier tier);
+
+public:
+  explicit LazyJitModule(const Module &module);
+
+  LazyJitModule(const LazyJitModule &) = delete;
+  LazyJitModule &operator=(const LazyJitModule &) = delete;
+
+  // Stable entry of function, which jumps to its current code.
+  const JitFunction &get_function(funcid_t id) const {
+    return m_functions[id];
+  }
+
+  size_t size() const { return m_functions.size(); }
+
+  // Compiles function by the optimizing code generator and replaces its
+  // entry. Throws CodeGenError if function can't be compiled, entry is kept
+  // then.
+  void tier_up(funcid_t id);
+
+  // std::nullopt if function wasn't called yet.
+  std::optional<CodeTier> get_tier(funcid_t id) const;
+
+  // Number of compilations of all tiers.
+  size_t get_num_compiled() const;
+};
+
+} // namespace koda
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <CodeGen/X86Assembler.hpp>
+#include <Core/Analysis.hpp>
+#include <IR/IRTypes.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace koda {
+
+using vreg_t = uint32_t;
+
+// Operand of LIR instruction. Instruction selection produces virtual
+// registers and immediates, register assignment replaces virtual registers
+// with physical ones or frame slots.
+struct LirOperand {
+  enum Kind : uint8_t { NONE, VREG, PREG, SLOT, IMM };
+
+  Kind kind = NONE;
+  int64_t value = 0;
+
+  static LirOperand make_vreg(vreg_t vreg) { return {VREG, vreg}; }
+
+  static LirOperand make_preg(X86Reg reg) { return {PREG, reg}; }
+
+  static LirOperand make_slot(size_t slot) {
+    return {SLOT, static_cast<int64_t>(slot)};
+  }
+
+  static LirOperand make_imm(int64_t imm) { return {IMM, imm}; }
+
+  bool is_none() const { return kind == NONE; }
+  bool is_vreg() const { return kind == VREG; }
+  bool is_preg() const { return kind == PREG; }
+  bool is_slot() const { return kind == SLOT; }
+  bool is_imm() const { return kind == IMM; }
+
+  vreg_t get_vreg() const { return static_cast<vreg_t>(value); }
+  X86Reg get_preg() const { return static_cast<X86Reg>(value); }
+  size_t get_slot() const { return static_cast<size_t>(value); }
+  int64_t get_imm() const { return value; }
+};
+
+inline bool operator==(const LirOperand &lhs, const LirOperand &rhs) {
+  return lhs.kind == rhs.kind && lhs.value == rhs.value;
+}
+
+inline bool operator!=(const LirOperand &lhs, const LirOperand &rhs) {
+  return !(lhs == rhs);
+}
+
+std::ostream &operator<<(std::ostream &os, const LirOperand &operand);
+
+// Instructions are three address, emitter turns them into x86 two address
+// forms.
+enum LirOpcode : uint8_t {
+  // dst = src0
+  LIR_MOV,
+  // dst = src0 + src1 * scale + disp, src1 is optional
+  LIR_LEA,
+  // dst = src0 op src1, op is X86AluOp
+  LIR_ALU,
+  // dst = src0 * src1
+  LIR_IMUL,
+  // dst = src0 op src1, op is X86ShiftOp
+  LIR_SHIFT,
+  // dst = op src0, op is X86UnaryOp
+  LIR_UNARY,
+  // dst = high half of src0 * src1
+  LIR_MULH,
+  LIR_DIV,
+  LIR_MOD,
+  // dst = parameter number index
+  LIR_PARAM,
+  // dst = src0 op src1 ? src2 : src3, op is X86Cond
+  LIR_SELECT,
+  // dst = function number index called with srcs
+  LIR_CALL,
+  // Goes to the true edge if src0 op src1, to the false edge otherwise.
+  LIR_BRANCH,
+  // Goes to the only edge.
+  LIR_JUMP,
+  // Returns src0
+  LIR_RET,
+};
+
+const char *lir_opc_to_str(LirOpcode opcode);
+
+struct LirInst {
+  LirOpcode opcode;
+  uint8_t op = 0;
+  uint8_t scale = 1;
+  int32_t disp = 0;
+  uint32_t index = 0;
+  LirOperand dst;
+  std::vector<LirOperand> srcs;
+
+  // Instruction without side effects, which is dropped if dst is unused.
+  bool is_pure() const {
+    return opcode != LIR_CALL && opcode != LIR_BRANCH &&
+           opcode != LIR_JUMP && opcode != LIR_RET;
+  }
+};
+
+struct LirMove {
+  LirOperand dst;
+  LirOperand src;
+};
+
+// Edge to successor with parallel moves into its phis.
+struct LirEdge {
+  bbid_t succ;
+  std::vector<LirMove> moves;
+};
+
+struct LirBlock {
+  bbid_t id;
+  // Values of phis, defined on entry.
+  std::vector<LirOperand> phis;
+  std::vector<LirInst> insts;
+  // False edge precedes the true one.
+  std::vector<LirEdge> edges;
+};
+
+// Function in low-level IR. Blocks keep ids of IR blocks and follow in order
+// of emission.
+class LirFunction final {
+  std::vector<LirBlock> m_blocks;
+
+  bbid_t m_entry = 0;
+
+  size_t m_num_vregs = 0;
+
+  size_t m_num_params = 0;
+
+  size_t m_num_slots = 0;
+
+public:
+  explicit LirFunction(size_t num_params = 0) : m_num_params(num_params) {}
+
+  vreg_t create_vreg() { return static_cast<vreg_t>(m_num_vregs++); }
+
+  size_t get_num_vregs() const { return m_num_vregs; }
+
+  LirBlock &create_block(bbid_t id) {
+    m_blocks.push_back({id, {}, {}, {}});
+    return m_blocks.back();
+  }
+
+  size_t size() const { return m_blocks.size(); }
+
+  auto begin() { return m_blocks.begin(); }
+  auto end() { return m_blocks.end(); }
+  auto begin() const { return m_blocks.begin(); }
+  auto end() const { return m_blocks.end(); }
+
+  bbid_t get_entry() const { return m_entry; }
+  void set_entry(bbid_t entry) { m_entry = entry; }
+
+  size_t get_num_params() const { return m_num_params; }
+
+  // Frame slots of spilled values, known after assign_locations().
+  size_t get_num_slots() const { return m_num_slots; }
+
+  // Number of instructions, moves of edges aren't counted.
+  size_t get_num_insts() const;
+
+  // Live intervals of virtual registers. Positions are numbers of
+  // instructions in block order, phis are defined on block entry and moves
+  // of edges read their sources on block exit. Virtual registers which are
+  // never read have no interval.
+  std::vector<RegAlloc::Interval> get_live_intervals() const;
+
+  // Replaces virtual registers with locations of regalloc. Register number
+  // idx is regs[idx], registers beyond num_regs and spilled values are kept
+  // in frame slots. Virtual registers without location become NONE.
+  void assign_locations(RegAlloc &regalloc, const X86Reg *regs,
+                        size_t num_regs);
+
+  void dump(std::ostream &os) const;
+};
+
+} // namespace koda
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace koda {
+
+enum X86Reg : uint8_t {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+// Condition codes of jcc and cmovcc. Condition with lowest bit flipped is
+// the negated one.
+enum X86Cond : uint8_t {
+  COND_E = 0x4,
+  COND_NE = 0x5,
+  COND_L = 0xc,
+  COND_GE = 0xd,
+  COND_LE = 0xe,
+  COND_G = 0xf,
+};
+
+inline constexpr X86Cond invert_cond(X86Cond cond) {
+  return static_cast<X86Cond>(cond ^ 1);
+}
+
+// Two operand instructions. Values are opcodes of "op r/m64, r64" form,
+// opcode >> 3 is the extension of "op r/m64, imm32" form.
+enum X86AluOp : uint8_t {
+  ALU_ADD = 0x01,
+  ALU_OR = 0x09,
+  ALU_AND = 0x21,
+  ALU_SUB = 0x29,
+  ALU_XOR = 0x31,
+  ALU_CMP = 0x39,
+};
+
+// Extensions of F7 group.
+enum X86UnaryOp : uint8_t {
+  UNARY_NOT = 2,
+  UNARY_NEG = 3,
+  // rdx:rax = rax * operand
+  UNARY_IMUL_WIDE = 5,
+  // rax = rdx:rax / operand, rdx = rdx:rax % operand
+  UNARY_IDIV = 7,
+};
+
+// Extensions of D3 group, shift amount is in cl.
+enum X86ShiftOp : uint8_t {
+  SHIFT_SHL = 4,
+  SHIFT_SHR = 5,
+  SHIFT_SAR = 7,
+};
+
+// Memory operand [base + index * scale + disp]. rsp can't be index, so it
+// means no index.
+struct X86Mem {
+  X86Reg base;
+  int32_t disp;
+  X86Reg index = RSP;
+  uint8_t scale = 1;
+};
+
+// Encoder of 64-bit x86 instructions. Jumps to labels use rel32
+// displacements, which are patched when code is finalized.
+class X86Assembler final {
+public:
+  using Label = size_t;
+
+private:
+  static constexpr int64_t UNBOUND = -1;
+
+  std::vector<uint8_t> m_code;
+
+  std::vector<int64_t> m_labels;
+
+  // Positions of rel32 fields and their targets.
+  std::vector<std::pair<size_t, Label>> m_fixups;
+
+  void emit_byte(uint8_t byte) { m_code.push_back(byte); }
+
+  void emit_imm32(int32_t imm);
+
+  void emit_imm64(int64_t imm);
+
+  // REX prefix is omitted if it has no bits set.
+  void emit_rex(bool is_wide, unsigned reg, unsigned base, unsigned index = 0);
+
+  void emit_rex(bool is_wide, unsigned reg, const X86Mem &mem) {
+    emit_rex(is_wide, reg, mem.base, mem.index);
+  }
+
+  void emit_modrm(unsigned reg, X86Reg rm);
+
+  void emit_modrm(unsigned reg, const X86Mem &mem);
+
+  void emit_rel32(Label label);
+
+public:
+  Label make_label();
+
+  void bind(Label label);
+
+  size_t size() const { return m_code.size(); }
+
+  // Returns code with resolved jumps. All used labels must be bound.
+  std::vector<uint8_t> finalize();
+
+  void mov(X86Reg dst, X86Reg src);
+  void mov(X86Reg dst, const X86Mem &src);
+  void mov(const X86Mem &dst, X86Reg src);
+  void mov(X86Reg dst, int64_t imm);
+  void mov(const X86Mem &dst, int32_t imm);
+  // Always uses movabs, so immediate can be patched later. Returns offset of
+  // the immediate in code.
+  size_t mov_imm64(X86Reg dst, int64_t imm);
+
+  void lea(X86Reg dst, const X86Mem &src);
+
+  void alu(X86AluOp op, X86Reg dst, X86Reg src);
+  void alu(X86AluOp op, X86Reg dst, const X86Mem &src);
+  void alu(X86AluOp op, X86Reg dst, int32_t imm);
+
+  // dst = dst * src
+  void imul(X86Reg dst, X86Reg src);
+  void imul(X86Reg dst, const X86Mem &src);
+  // dst = src * imm
+  void imul(X86Reg dst, X86Reg src, int32_t imm);
+
+  void unary(X86UnaryOp op, X86Reg reg);
+
+  void shift_cl(X86ShiftOp op, X86Reg reg);
+  // Amount is masked to 6 bits.
+  void shift(X86ShiftOp op, X86Reg reg, uint8_t amount);
+
+  // Sign extend rax into rdx:rax
+  void cqo();
+
+  void cmov(X86Cond cond, X86Reg dst, X86Reg src);
+  void cmov(X86Cond cond, X86Reg dst, const X86Mem &src);
+
+  void push(X86Reg reg);
+  void push(const X86Mem &mem);
+  // Pushes sign extended imm.
+  void push(int32_t imm);
+  void pop(X86Reg reg);
+
+  // Indirect call of address stored in memory.
+  void call(const X86Mem &target);
+  void call(X86Reg target);
+
+  void jmp(Label label);
+  // Indirect jump to address stored in memory.
+  void jmp(const X86Mem &target);
+  void jmp(X86Reg target);
+  void jcc(X86Cond cond, Label label);
+
+  void ret();
+};
+
+} // namespace koda
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <CodeGen/LIR.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace koda {
+
+class Compiler;
+
+struct CodeGenError : std::runtime_error {
+  CodeGenError(const char *msg) : std::runtime_error(msg) {}
+  CodeGenError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+// Position of call table address in code of function calling callee.
+struct CallRelocation {
+  uint32_t offset;
+  uint32_t callee;
+};
+
+// Called by resolver stub of function id, returns code of the function.
+using ResolveFn = const void *(*)(void *context, uint64_t id);
+
+// Stubs of lazily compiled functions, offsets are relative to the code.
+struct LazyStubCode {
+  std::vector<uint8_t> code;
+  // Entries jumping to call table entries of functions.
+  std::vector<size_t> entries;
+  // Resolver stubs of functions.
+  std::vector<size_t> resolvers;
+};
+
+// x86-64 code generator. Function is lowered to LIR by X86ISel, RegAlloc
+// assigns registers to virtual registers of LIR, and LIR is encoded with
+// spilled values as memory operands. Phis are resolved by parallel moves on
+// incoming edges. Generated function follows System V ABI: parameters come
+// in rdi, rsi, rdx, rcx, r8, r9 and on stack, result is returned in rax.
+class X86Backend final {
+public:
+  // Allocatable registers are callee saved rbx, r12-r15 and caller saved
+  // rsi, rdi, r8-r10. rax, rcx, rdx and r11 are scratch. Register locations
+  // beyond NUM_REGS are kept in frame slots.
+  static constexpr size_t NUM_REGS = 10;
+
+  // Selects instructions of function and allocates compiler's number of
+  // registers. Returns LIR with physical registers and frame slots.
+  static LirFunction lower(Compiler &comp);
+
+  // Encodes function of compiler. Call of function id jumps to address
+  // stored in call_table[id], so table entries may be set after emission.
+  // Throws CodeGenError if function has non integer values or calls without
+  // table. Positions of table addresses are appended to relocations, so the
+  // code can be moved to another table with relocate().
+  static std::vector<uint8_t>
+  emit(Compiler &comp, const void *const *call_table = nullptr,
+       std::vector<CallRelocation> *relocations = nullptr);
+
+  // Points calls of code to call_table.
+  static void relocate(std::vector<uint8_t> &code,
+                       const std::vector<CallRelocation> &relocations,
+                       const void *const *call_table);
+
+  // Encodes stub taking pointer to array of num_params values and calling
+  // entry with them as parameters.
+  static std::vector<uint8_t> emit_array_stub(const void *entry,
+                                              size_t num_params);
+
+  // Encodes stubs of num_functions functions. Entry of function id jumps to
+  // call_table[id]. Resolver stub calls resolve(context, id) and jumps to
+  // the returned code with the original parameters, so it can stand in the
+  // table for function which isn't compiled yet.
+  static LazyStubCode emit_lazy_stubs(const void *const *call_table,
+                                      size_t num_functions, ResolveFn resolve,
+                                      void *context);
+};
+
+} // namespace koda
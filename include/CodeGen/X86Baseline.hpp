@@ -0,0 +1,28 @@
+#pragma once
+
+#include <CodeGen/X86Backend.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace koda {
+
+class ProgramGraph;
+
+// Single pass x86-64 code generator for code which runs once. Blocks are
+// visited in RPO and every instruction is encoded as soon as it's seen,
+// without passes, liveness or register allocation. Each value has its own
+// frame slot and is stored there when computed. Values loaded or computed
+// in the current block are remembered in a small cache of caller saved
+// registers, so temporaries are reused without reloading them from frame.
+// The cache is dropped on block entry and after calls. Generated code
+// follows the same ABI and call table convention as X86Backend.
+class X86Baseline final {
+public:
+  // Same contract as X86Backend::emit().
+  static std::vector<uint8_t>
+  emit(ProgramGraph &graph, const void *const *call_table = nullptr,
+       std::vector<CallRelocation> *relocations = nullptr);
+};
+
+} // namespace koda
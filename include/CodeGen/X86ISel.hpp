@@ -0,0 +1,28 @@
+#pragma once
+
+#include <CodeGen/LIR.hpp>
+
+namespace koda {
+
+class Compiler;
+
+// Condition code of jcc and cmov for comparison flag.
+X86Cond get_x86_cond(CmpFlag flag);
+
+// Instruction selection for x86-64 by bottom-up rewriting (BURS). Values
+// used once in the same block are folded into expression trees of their
+// users, constants are folded into every user. Rules of rule table match
+// one IR node whose inputs are derived to nonterminals: register,
+// immediate, scaled index and address parts. Trees are labeled bottom-up
+// with the cheapest rule for every nonterminal, then reduced top-down from
+// the root, so add of shifted value becomes single lea and constants
+// become immediate operands. Phis are resolved by moves on edges. Blocks
+// follow LinearOrder.
+class X86ISel final {
+public:
+  // Throws CodeGenError if function has non integer values or unsupported
+  // instructions.
+  static LirFunction select(Compiler &comp);
+};
+
+} // namespace koda
@@ -1,13 +1,16 @@
 #pragma once
 
+#include "Core/KnownBits.hpp"
 #include "Core/LoopInfo.hpp"
+#include "Core/ValueRange.hpp"
 #include "DataStructures/DominatorTree.hpp"
 #include "DataStructures/Tree.hpp"
 #include "IR/BasicBlock.hpp"
 
+#include <cstdint>
+#include <optional>
 #include <set>
 #include <unordered_map>
-#include <optional>
 
 namespace koda {
 
@@ -72,16 +75,152 @@ public:
   LoopTree &get() { return m_loop_tree; }
   const LoopTree &get() const { return m_loop_tree; }
   const LoopInfo &get_loop(const BasicBlock &bb) const;
+  // Number of loops containing bb, 0 for blocks outside of loops.
+  size_t get_depth(const BasicBlock &bb) const;
 };
 
-class LinearOrder : public AnalysisBase {
+// Affine function of loop header phi: value = scale * base + offset.
+// Header phis recognized as basic induction variables have scale 1 and
+// offset 0.
+struct InductionVariable {
+  PhiInstruction *base = nullptr;
+  int64_t scale = 1;
+  int64_t offset = 0;
+
+  bool is_basic() const { return scale == 1 && offset == 0; }
+};
+
+// Header phi incremented by constant step on every iteration.
+struct BasicInductionVariable {
+  using loop_id_t = LoopInfo::loop_id_t;
+
+  PhiInstruction *phi = nullptr;
+  // Value which comes to phi from latches.
+  Instruction *update = nullptr;
+  int64_t step = 0;
+  loop_id_t loop = LoopInfo::INVALID_LOOP_ID;
+};
+
+class InductionVariableAnalysis : public AnalysisBase {
+  using loop_id_t = LoopInfo::loop_id_t;
+
+  std::unordered_map<instid_t, InductionVariable> m_ivs;
+
+  std::unordered_map<instid_t, BasicInductionVariable> m_basic_ivs;
+
+  std::unordered_map<loop_id_t, std::vector<PhiInstruction *>> m_loop_ivs;
+
+  const std::vector<PhiInstruction *> m_no_ivs{};
+
+  void analyze_loop(const LoopInfo &loop);
+
+public:
+  virtual ~InductionVariableAnalysis() = default;
+
+  void run(Compiler &comp);
+
+  // Returns nullptr if value is not an affine function of basic IV.
+  const InductionVariable *get(const Instruction &inst) const;
+
+  // Returns nullptr if instruction is not a basic IV.
+  const BasicInductionVariable *get_basic(const Instruction &phi) const;
+
+  // Basic IVs of loop with given header.
+  const std::vector<PhiInstruction *> &get_basic_ivs(loop_id_t loop) const;
+};
+
+// Sparse range analysis over SSA. Ranges are narrowed by conditions of
+// dominating branches and widened at loop headers, so analysis of loops
+// terminates quickly.
+class RangeAnalysis : public AnalysisBase {
+  // Condition which holds on entry to block with single predecessor.
+  struct Guard {
+    const ConditionalBranchInstruction *branch = nullptr;
+    bool is_true_edge = false;
+  };
+
+  std::vector<ValueRange> m_ranges;
+
+  std::vector<Guard> m_guards;
+
+  DomsTreeAnalysis::DomsTree *m_doms = nullptr;
+
+  ValueRange apply_guard(const Guard &guard, const Instruction &inst,
+                         const ValueRange &range) const;
+
+  ValueRange get_range_on_edge(const Instruction &inst, BasicBlock *pred,
+                               const BasicBlock &succ) const;
+
+  ValueRange compute(const Instruction &inst) const;
 
+public:
+  virtual ~RangeAnalysis() = default;
+
+  void run(Compiler &comp);
+
+  // Range of value at its definition. Values created after analysis and
+  // non integer values have full range.
+  ValueRange get_range(const Instruction &inst) const;
+
+  // Range of value in bb, narrowed by conditions which dominate bb.
+  ValueRange get_range_at(const Instruction &inst, const BasicBlock &bb) const;
+
+  // Returns outcome of branch if it is implied by ranges of its operands.
+  std::optional<bool>
+  get_branch_outcome(const ConditionalBranchInstruction &branch) const;
+};
+
+// Bits of integer values known to be zero or one. Values are propagated
+// optimistically through loop phis, so bits which don't change in loop stay
+// known.
+class KnownBitsAnalysis : public AnalysisBase {
+  std::vector<KnownBits> m_bits;
+
+  std::vector<bool> m_is_computed;
+
+  KnownBits compute(const Instruction &inst) const;
+
+public:
+  virtual ~KnownBitsAnalysis() = default;
+
+  void run(Compiler &comp);
+
+  // Nothing is known about values created after analysis and non integer
+  // values.
+  KnownBits get(const Instruction &inst) const;
+};
+
+// Bits of integer values which are read by some user. Other bits may be
+// computed arbitrarily.
+class DemandedBitsAnalysis : public AnalysisBase {
+  std::vector<uint64_t> m_demanded;
+
+  static uint64_t get_demanded_by(const Instruction &user, size_t input_idx,
+                                  uint64_t demanded,
+                                  const KnownBitsAnalysis &known);
+
+public:
+  virtual ~DemandedBitsAnalysis() = default;
+
+  void run(Compiler &comp);
+
+  // All bits of values created after analysis are demanded.
+  uint64_t get(const Instruction &inst) const;
+};
+
+// Order of blocks for liveness and code emission. Loops are contiguous and
+// start with header. If compiler has a profile, blocks are merged into chains
+// along the hottest edges (Pettis-Hansen), so hot successor becomes the
+// fallthrough, and cold blocks are placed after hot ones of the same loop.
+class LinearOrder : public AnalysisBase {
   std::vector<BasicBlock *> m_linear_order;
 
   void linearize_graph(Compiler &comp);
   void linearize_loop(const BasicBlock &header, const LoopTreeAnalysis &loops,
                       std::vector<bool> &visited);
 
+  void linearize_with_profile(Compiler &comp);
+
 public:
   virtual ~LinearOrder() = default;
   void run(Compiler &comp);
@@ -131,8 +270,13 @@ inline bool operator<(const Interval &lhs, const Interval &rhs) {
 
 };
 
+// Linear scan register allocation. Runs on live ranges of IR values or on
+// intervals of other values, e.g. virtual registers of LIR.
 class RegAlloc : public AnalysisBase {
+public:
   using Interval = _detailRegalloc::Interval;
+
+private:
   using locid_t = int;
 
   constexpr static locid_t INVALID_REG = -1;
@@ -159,7 +303,9 @@ class RegAlloc : public AnalysisBase {
     return m_slotmap.find(inst) != m_slotmap.end();
   }
 
-  void reset(Compiler &compiler);
+  void reset(size_t num_values, size_t num_regs);
+
+  void allocate(const std::vector<Interval> &intervals);
 
 public:
   struct Location {
@@ -171,6 +317,11 @@ public:
 
   void run(Compiler &compiler);
 
+  // Allocates num_regs registers to intervals of values numbered below
+  // num_values. Field inst of interval is the value number.
+  void run(const std::vector<Interval> &intervals, size_t num_values,
+           size_t num_regs);
+
   std::optional<Location> get_location(instid_t inst) {
     auto slot = m_slotmap.find(inst);
     if (slot == m_slotmap.end()) {
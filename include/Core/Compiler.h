@@ -2,6 +2,7 @@
 
 #include <Core/Analysis.hpp>
 #include <Core/Passes.hpp>
+#include <Core/ProfileInfo.hpp>
 #include <DataStructures/DominatorTree.hpp>
 #include <IR/ProgramGraph.hpp>
 
@@ -18,12 +19,22 @@ class Compiler final {
 
   LoopTreeAnalysis m_loop_tree;
 
+  InductionVariableAnalysis m_induction_vars;
+
+  RangeAnalysis m_ranges;
+
+  KnownBitsAnalysis m_known_bits;
+
+  DemandedBitsAnalysis m_demanded_bits;
+
   LinearOrder m_linear_order;
 
   Liveness m_liveness;
 
   RegAlloc m_regalloc;
 
+  ProfileInfo m_profile;
+
   size_t m_num_pregs = 30;
 
 public:
@@ -38,6 +49,10 @@ public:
 
   size_t get_num_pregs() const { return m_num_pregs; }
 
+  // Execution counts used by profile-guided analyses. Profile isn't dropped
+  // on invalidation, passes changing the CFG must update it.
+  ProfileInfo &profile() { return m_profile; }
+
   template <typename Analysis> Analysis &get();
 
   template <typename Analysis, typename... Args>
@@ -59,6 +74,32 @@ public:
     m_passes.emplace_back(std::make_unique<Pass>(std::forward<Args>(args)...));
   }
 
+  // Drop results of all analyses. Passes which modify the graph must call it
+  // to make analyses run again on next request.
+  void invalidate_analyses() {
+    m_rpo.set_ready(false);
+    m_dom_tree.set_ready(false);
+    m_loop_tree.set_ready(false);
+    m_induction_vars.set_ready(false);
+    m_ranges.set_ready(false);
+    m_known_bits.set_ready(false);
+    m_demanded_bits.set_ready(false);
+    m_linear_order.set_ready(false);
+    m_liveness.set_ready(false);
+    m_regalloc.set_ready(false);
+  }
+
+  // Prepares compiler for another function: graph is emptied, analyses and
+  // profile are dropped, registered passes are kept.
+  void reset() {
+    m_graph.clear();
+    m_profile.clear();
+    invalidate_analyses();
+  }
+
+  // Full optimization pipeline used by the top tier.
+  void register_default_passes();
+
   void run_all_passes() {
     for (const auto &pass : m_passes) {
       pass->run(*this);
@@ -76,6 +117,24 @@ template <> inline LoopTreeAnalysis &Compiler::get<LoopTreeAnalysis>() {
   return m_loop_tree;
 }
 
+template <>
+inline InductionVariableAnalysis &Compiler::get<InductionVariableAnalysis>() {
+  return m_induction_vars;
+}
+
+template <> inline RangeAnalysis &Compiler::get<RangeAnalysis>() {
+  return m_ranges;
+}
+
+template <> inline KnownBitsAnalysis &Compiler::get<KnownBitsAnalysis>() {
+  return m_known_bits;
+}
+
+template <>
+inline DemandedBitsAnalysis &Compiler::get<DemandedBitsAnalysis>() {
+  return m_demanded_bits;
+}
+
 template <> inline LinearOrder &Compiler::get<LinearOrder>() {
   return m_linear_order;
 }
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <IR/Instruction.hpp>
+#include <IR/Module.hpp>
+#include <IR/ProgramGraph.hpp>
+
+#include <vector>
+
+namespace koda {
+
+// Replaces calls with bodies of callees. Functions are processed bottom-up
+// over call graph, so callees are already inlined into when their bodies
+// are copied. Calls inside strongly connected components of call graph
+// (recursion) are kept.
+//
+// Cost of callee is the number of its instructions, which remain after
+// inlining. Callee is inlined if its cost doesn't exceed threshold and
+// caller stays within budget.
+//
+class Inliner final {
+public:
+  static constexpr size_t DEFAULT_CALLEE_THRESHOLD = 32;
+  static constexpr size_t DEFAULT_CALLER_BUDGET = 1024;
+
+private:
+  size_t m_callee_threshold;
+
+  size_t m_caller_budget;
+
+public:
+  Inliner(size_t callee_threshold = DEFAULT_CALLEE_THRESHOLD,
+          size_t caller_budget = DEFAULT_CALLER_BUDGET)
+      : m_callee_threshold(callee_threshold), m_caller_budget(caller_budget) {
+  }
+
+  // Strongly connected components of call graph. Callees go before callers.
+  static std::vector<std::vector<funcid_t>> get_call_sccs(const Module &module);
+
+  static size_t get_inline_cost(ProgramGraph &function);
+
+  static bool can_inline(ProgramGraph &callee);
+
+  // Replace call in caller with copy of callee. Values returned by callee
+  // are merged with phi in the block following the call.
+  // Returns value which replaced the call.
+  static Instruction *inline_call(ProgramGraph &caller, CallInstruction *call,
+                                  ProgramGraph &callee);
+
+  // Returns true if module was changed.
+  bool run(Module &module);
+};
+
+} // namespace koda
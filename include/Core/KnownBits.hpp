@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+
+namespace koda {
+
+// Bits of 64-bit value which are known to be zero or one. Bit set in both
+// masks means that value is never computed.
+struct KnownBits {
+  uint64_t zeros = 0;
+  uint64_t ones = 0;
+
+  static constexpr KnownBits constant(int64_t value) {
+    return {~static_cast<uint64_t>(value), static_cast<uint64_t>(value)};
+  }
+
+  constexpr bool is_constant() const { return (zeros | ones) == ~uint64_t(0); }
+
+  constexpr int64_t get_constant() const { return static_cast<int64_t>(ones); }
+
+  // Bits which may be one in some execution.
+  constexpr uint64_t get_possible_ones() const { return ~zeros; }
+};
+
+inline constexpr bool operator==(const KnownBits &lhs, const KnownBits &rhs) {
+  return lhs.zeros == rhs.zeros && lhs.ones == rhs.ones;
+}
+
+inline constexpr bool operator!=(const KnownBits &lhs, const KnownBits &rhs) {
+  return !(lhs == rhs);
+}
+
+// Bits known in both values.
+inline constexpr KnownBits meet(const KnownBits &lhs, const KnownBits &rhs) {
+  return {lhs.zeros & rhs.zeros, lhs.ones & rhs.ones};
+}
+
+inline constexpr uint64_t low_bits_mask(unsigned num) {
+  return num >= 64 ? ~uint64_t(0) : (uint64_t(1) << num) - 1;
+}
+
+inline constexpr KnownBits known_and(const KnownBits &lhs,
+                                     const KnownBits &rhs) {
+  return {lhs.zeros | rhs.zeros, lhs.ones & rhs.ones};
+}
+
+inline constexpr KnownBits known_or(const KnownBits &lhs,
+                                    const KnownBits &rhs) {
+  return {lhs.zeros & rhs.zeros, lhs.ones | rhs.ones};
+}
+
+inline constexpr KnownBits known_xor(const KnownBits &lhs,
+                                     const KnownBits &rhs) {
+  return {(lhs.zeros & rhs.zeros) | (lhs.ones & rhs.ones),
+          (lhs.zeros & rhs.ones) | (lhs.ones & rhs.zeros)};
+}
+
+inline constexpr KnownBits known_not(const KnownBits &value) {
+  return {value.ones, value.zeros};
+}
+
+// Shifts by known amount. Amount is masked as in eval_shl.
+inline constexpr KnownBits known_shl(const KnownBits &value, unsigned shift) {
+  shift &= 63;
+  return {(value.zeros << shift) | low_bits_mask(shift), value.ones << shift};
+}
+
+inline constexpr KnownBits known_shr(const KnownBits &value, unsigned shift) {
+  shift &= 63;
+  return {(value.zeros >> shift) | ~(~uint64_t(0) >> shift),
+          value.ones >> shift};
+}
+
+inline constexpr KnownBits known_ashr(const KnownBits &value, unsigned shift) {
+  shift &= 63;
+  return {static_cast<uint64_t>(static_cast<int64_t>(value.zeros) >> shift),
+          static_cast<uint64_t>(static_cast<int64_t>(value.ones) >> shift)};
+}
+
+// lhs + rhs + carry. Bit of sum is known if bits of both operands and
+// incoming carry are known. Carry is known if it is the same for minimal
+// and maximal possible sums.
+inline constexpr KnownBits known_add(const KnownBits &lhs, const KnownBits &rhs,
+                                     bool carry = false) {
+  uint64_t max_sum = ~lhs.zeros + ~rhs.zeros + carry;
+  uint64_t min_sum = lhs.ones + rhs.ones + carry;
+  uint64_t carry_zeros = ~(max_sum ^ lhs.zeros ^ rhs.zeros);
+  uint64_t carry_ones = min_sum ^ lhs.ones ^ rhs.ones;
+  uint64_t known = (lhs.zeros | lhs.ones) & (rhs.zeros | rhs.ones) &
+                   (carry_zeros | carry_ones);
+  return {~max_sum & known, min_sum & known};
+}
+
+// lhs - rhs == lhs + ~rhs + 1
+inline constexpr KnownBits known_sub(const KnownBits &lhs,
+                                     const KnownBits &rhs) {
+  return known_add(lhs, known_not(rhs), true);
+}
+
+// Only trailing zeros of product are known.
+inline constexpr KnownBits known_mul(const KnownBits &lhs,
+                                     const KnownBits &rhs) {
+  auto trailing_zeros = [](const KnownBits &value) -> unsigned {
+    return ~value.zeros == 0 ? 64 : __builtin_ctzll(~value.zeros);
+  };
+  return {low_bits_mask(trailing_zeros(lhs) + trailing_zeros(rhs)), 0};
+}
+
+} // namespace koda
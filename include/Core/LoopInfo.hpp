@@ -16,6 +16,9 @@ class LoopInfo {
 
   std::vector<BasicBlock *> m_latches{};
 
+  // Indexed by block id, so membership check is constant time.
+  std::vector<bool> m_block_set{};
+
 public:
   using loop_id_t = bbid_t;
   constexpr static loop_id_t NIL_LOOP_ID = INVALID_BB;
@@ -33,7 +36,12 @@ public:
 
   std::vector<BasicBlock *> &get_latches() { return m_latches; }
 
-  void add_block(BasicBlock *bb) { m_blocks.push_back(bb); }
+  const std::vector<BasicBlock *> &get_latches() const { return m_latches; }
+
+  void add_block(BasicBlock *bb);
+
+  // Check if block belongs to this loop or to one of its inner loops.
+  bool contains(const BasicBlock *bb) const;
 
   auto begin() const { return m_blocks.begin(); }
 
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <Core/Analysis.hpp>
 #include <DataStructures/Tree.hpp>
 #include <IR/BasicBlock.hpp>
 #include <IR/Instruction.hpp>
 
+#include <array>
+#include <memory>
 #include <optional>
+#include <string_view>
+#include <vector>
 
 namespace koda {
 
@@ -25,54 +30,226 @@ public:
   void run(Compiler &comp) override;
 };
 
+// Folds instructions with constant inputs and conditional branches on
+// constants. Users of folded instructions are queued again, so chains of
+// constants are folded in a single run.
 class ConstantFolding : public PassI {
 public:
   using ConstInst = LoadConstant<int64_t>;
 
 private:
-  static bool is_computable(const Instruction &inst);
-
   static bool has_const_input(const Instruction &inst);
 
-  int64_t fold(const Instruction &act);
-
-  using Evaluator = std::function<int64_t(const Instruction &)>;
+  // Returns false if inst can't be folded, e.g. on division by zero.
+  static bool fold(const Instruction &inst, int64_t &result);
 
-  std::unordered_map<InstOpcode, Evaluator> m_evaluators;
+  // Replaces branch on constants with unconditional one.
+  static bool fold_branch(IRBuilder &builder,
+                          ConditionalBranchInstruction &branch);
 
 public:
   virtual ~ConstantFolding() = default;
 
-  ConstantFolding();
-
   void run(Compiler &compiler) override;
 };
 
+// Local rewrites driven by worklist. Rules are indexed by opcode, so each
+// instruction is checked only against rules for its opcode. Users of
+// rewritten instructions are queued again, so chains of rewrites are applied
+// in a single run.
 class Peephole : public PassI {
-  std::optional<Instruction *> peephole_and(IRBuilder &builder,
-                                            Instruction *inst);
+public:
+  // Returns value replacing inst or nullptr if rule doesn't apply. New
+  // instructions must be inserted before inst.
+  using RewriteRule = Instruction *(*)(IRBuilder &builder, Instruction *inst);
+
+private:
+  std::array<std::vector<RewriteRule>, INST_NUM_OPCODES> m_rules{};
+
+public:
+  virtual ~Peephole() = default;
+
+  Peephole();
 
-  std::optional<Instruction *> peephole_sub(IRBuilder &builder,
-                                            Instruction *inst);
+  // Rules are tried in order of addition.
+  void add_rule(InstOpcode opcode, RewriteRule rule) {
+    m_rules[opcode].push_back(rule);
+  }
 
-  std::optional<Instruction *> peephole_shr(IRBuilder &builder,
-                                            Instruction *inst);
+  void run(Compiler &compiler) override;
+};
 
-  // Substitute division by power of 2 with shift right
-  // div v1, 2^n -> shr v1, n
-  std::optional<Instruction *> peephole_div(IRBuilder &builder,
-                                            Instruction *inst);
+// Uses RangeAnalysis to remove branches implied by dominating conditions,
+// replace values with single possible value by constants and lower division
+// of non-negative values by power of two to shifts.
+class RangeSimplification : public PassI {
+public:
+  virtual ~RangeSimplification() = default;
 
-  static bool is_const_eq(Instruction *inst, int64_t value);
+  void run(Compiler &compiler) override;
+};
 
-  static bool is_const(Instruction *inst);
+// Uses known bits to remove redundant masks, replace or of disjoint values
+// with add and fold shift pairs which move out only known zeros. Then uses
+// demanded bits to drop operations which change only unread bits.
+class BitSimplification : public PassI {
+public:
+  virtual ~BitSimplification() = default;
 
-  static int64_t get_const_value(Instruction *const_inst);
+  void run(Compiler &compiler) override;
+};
 
+// Flattens trees of single-use add, mul, and, or and xor into list of
+// operands, merges constants and rebuilds the tree with operands ordered by
+// loop depth and definition order. Constant and loop invariant operands are
+// combined first, so the prefix can be folded or hoisted.
+//   (a + 1) + (b + 2)  ->  (3 + a) + b
+class Reassociation : public PassI {
 public:
-  virtual ~Peephole() = default;
+  virtual ~Reassociation() = default;
+
+  static bool is_associative(InstOpcode opcode);
+
+  void run(Compiler &compiler) override;
+};
+
+// Removes phis which forward single value: phis whose operands are the
+// same value or the phi itself, and SCCs of phis which have only one operand
+// from outside (Braun et al.). Users are redirected to forwarded value.
+class RedundantPhiElimination : public PassI {
+  // Returns true if some phis were removed.
+  static bool remove_redundant_phis(const std::vector<Instruction *> &phis);
+
+public:
+  virtual ~RedundantPhiElimination() = default;
+
+  void run(Compiler &compiler) override;
+};
+
+// Click's global code motion. Pure instructions are scheduled early after
+// the deepest block of their inputs and late at the common dominator of
+// their uses. The final block is the one with the smallest loop depth on the
+// dominator path between them, so values are hoisted out of loops and sunk
+// into branches which use them.
+class GlobalCodeMotion : public PassI {
+public:
+  virtual ~GlobalCodeMotion() = default;
+
+  // Instructions with side effects, phis, params and possibly trapping
+  // divisions stay in their blocks.
+  static bool is_pinned(const Instruction &inst);
+
+  void run(Compiler &compiler) override;
+};
+
+// Replaces small diamonds and triangles with selects. Pure instructions of
+// their sides are executed speculatively in head block, and merge phis
+// choose the value by branch condition:
+//   if (a > b) x = a; else x = b;   ->   x = select gt a, b, a, b
+// Cost is number of speculated instructions and created selects.
+class IfConversion : public PassI {
+public:
+  static constexpr size_t DEFAULT_MAX_COST = 8;
+
+private:
+  size_t m_max_cost;
+
+  bool try_convert(IRBuilder &builder, BasicBlock *head) const;
+
+public:
+  virtual ~IfConversion() = default;
+
+  IfConversion(size_t max_cost = DEFAULT_MAX_COST) : m_max_cost(max_cost) {}
+
+  void run(Compiler &compiler) override;
+};
+
+// Replaces multiplications of induction variables by constant with additive
+// recurrences and removes redundant induction variables.
+//   i = phi [i0, i + s]         i = phi [i0, i + s]
+//   j = mul i, c           ->   j = phi [c * i0, j + c * s]
+class LoopStrengthReduction : public PassI {
+  using loop_id_t = LoopInfo::loop_id_t;
+
+  static PhiInstruction *create_recurrence(IRBuilder &builder,
+                                           const LoopInfo &loop,
+                                           const BasicInductionVariable &basic,
+                                           int64_t scale, int64_t offset);
+
+  static bool merge_duplicate_ivs(IRBuilder &builder, const LoopInfo &loop,
+                                  const InductionVariableAnalysis &ivs);
+
+  static bool remove_dead_ivs(IRBuilder &builder, const LoopInfo &loop,
+                              const InductionVariableAnalysis &ivs);
+
+public:
+  virtual ~LoopStrengthReduction() = default;
 
   void run(Compiler &compiler) override;
 };
 
+// Turns loops which test exit condition in header into do-while loops.
+// Header test is copied into guard before the loop and old header becomes
+// latch with conditional backedge, so each iteration runs one branch. Guard
+// is followed by dedicated preheader.
+class LoopRotation : public PassI {
+public:
+  static constexpr size_t DEFAULT_MAX_HEADER_SIZE = 16;
+
+private:
+  size_t m_max_header_size;
+
+public:
+  virtual ~LoopRotation() = default;
+
+  LoopRotation(size_t max_header_size = DEFAULT_MAX_HEADER_SIZE)
+      : m_max_header_size(max_header_size) {}
+
+  void run(Compiler &compiler) override;
+};
+
+// Unrolls innermost loops whose exit test compares induction variable with
+// constant. Loops with small trip count are unrolled completely. Larger ones
+// have body replicated factor times, remaining trip_count % factor
+// iterations are peeled before the loop. Size budget bounds number of
+// instructions added per loop.
+class LoopUnroll : public PassI {
+public:
+  static constexpr size_t DEFAULT_FACTOR = 4;
+  static constexpr size_t DEFAULT_SIZE_BUDGET = 256;
+  static constexpr size_t DEFAULT_MAX_FULL_TRIPS = 16;
+
+private:
+  size_t m_factor;
+
+  size_t m_size_budget;
+
+  size_t m_max_full_trips;
+
+public:
+  virtual ~LoopUnroll() = default;
+
+  LoopUnroll(size_t factor = DEFAULT_FACTOR,
+             size_t size_budget = DEFAULT_SIZE_BUDGET,
+             size_t max_full_trips = DEFAULT_MAX_FULL_TRIPS)
+      : m_factor(factor), m_size_budget(size_budget),
+        m_max_full_trips(max_full_trips) {}
+
+  // Number of body executions of loop which exits from header.
+  static std::optional<uint64_t>
+  get_trip_count(const LoopInfo &loop, const InductionVariableAnalysis &ivs);
+
+  void run(Compiler &compiler) override;
+};
+
+// Creates pass by its name, e.g. "peephole", with default parameters.
+// Returns nullptr for unknown name.
+std::unique_ptr<PassI> create_pass(std::string_view name);
+
+// Names of all passes known to create_pass().
+const std::vector<std::string_view> &get_pass_names();
+
+// Names of passes of Compiler::register_default_passes() in order.
+const std::vector<std::string_view> &get_default_pipeline();
+
 } // namespace koda
\ No newline at end of file
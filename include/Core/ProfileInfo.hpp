@@ -0,0 +1,57 @@
+#pragma once
+
+#include "IR/BasicBlock.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <unordered_map>
+
+namespace koda {
+
+// Execution counts of blocks and CFG edges. Edge is identified by source
+// block and successor index. Edges without own count are estimated by counts
+// of their ends.
+class ProfileInfo {
+  std::unordered_map<uint64_t, uint64_t> m_edge_counts;
+
+  std::unordered_map<bbid_t, uint64_t> m_block_counts;
+
+  static uint64_t get_edge_key(const BasicBlock &from, size_t succ_idx) {
+    return (static_cast<uint64_t>(from.get_id()) << 1) | (succ_idx & 1);
+  }
+
+public:
+  bool empty() const { return m_edge_counts.empty() && m_block_counts.empty(); }
+
+  void clear() {
+    m_edge_counts.clear();
+    m_block_counts.clear();
+  }
+
+  void set_edge_count(const BasicBlock &from, size_t succ_idx,
+                      uint64_t count) {
+    m_edge_counts[get_edge_key(from, succ_idx)] = count;
+  }
+
+  void set_block_count(const BasicBlock &bb, uint64_t count) {
+    m_block_counts[bb.get_id()] = count;
+  }
+
+  uint64_t get_block_count(const BasicBlock &bb) const {
+    auto it = m_block_counts.find(bb.get_id());
+    return it == m_block_counts.end() ? 0 : it->second;
+  }
+
+  // Edge can't be executed more times than any of its ends.
+  uint64_t get_edge_count(BasicBlock &from, size_t succ_idx) const {
+    auto it = m_edge_counts.find(get_edge_key(from, succ_idx));
+    if (it != m_edge_counts.end()) {
+      return it->second;
+    }
+    auto &&to = **std::next(from.succ_begin(), succ_idx);
+    return std::min(get_block_count(from), get_block_count(to));
+  }
+};
+
+} // namespace koda
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "IR/IRTypes.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+
+namespace koda {
+
+// Closed interval [min, max] of signed 64-bit values. Range with min > max
+// is empty and means that value is never computed.
+struct ValueRange {
+  static constexpr int64_t k_min = std::numeric_limits<int64_t>::min();
+  static constexpr int64_t k_max = std::numeric_limits<int64_t>::max();
+
+  int64_t min = k_min;
+  int64_t max = k_max;
+
+  static constexpr ValueRange full() { return {k_min, k_max}; }
+
+  static constexpr ValueRange empty() { return {k_max, k_min}; }
+
+  static constexpr ValueRange constant(int64_t value) { return {value, value}; }
+
+  constexpr bool is_empty() const { return min > max; }
+
+  constexpr bool is_full() const { return min == k_min && max == k_max; }
+
+  constexpr bool is_constant() const { return min == max; }
+
+  constexpr bool is_non_negative() const { return !is_empty() && min >= 0; }
+
+  constexpr bool contains(int64_t value) const {
+    return min <= value && value <= max;
+  }
+
+  constexpr bool contains(const ValueRange &other) const {
+    return other.is_empty() || (min <= other.min && other.max <= max);
+  }
+};
+
+inline constexpr bool operator==(const ValueRange &lhs,
+                                 const ValueRange &rhs) {
+  return (lhs.is_empty() && rhs.is_empty()) ||
+         (lhs.min == rhs.min && lhs.max == rhs.max);
+}
+
+inline constexpr bool operator!=(const ValueRange &lhs,
+                                 const ValueRange &rhs) {
+  return !(lhs == rhs);
+}
+
+// Smallest range containing both ranges.
+inline constexpr ValueRange join(const ValueRange &lhs, const ValueRange &rhs) {
+  if (lhs.is_empty()) {
+    return rhs;
+  }
+  if (rhs.is_empty()) {
+    return lhs;
+  }
+  return {std::min(lhs.min, rhs.min), std::max(lhs.max, rhs.max)};
+}
+
+inline constexpr ValueRange intersect(const ValueRange &lhs,
+                                      const ValueRange &rhs) {
+  if (lhs.is_empty() || rhs.is_empty()) {
+    return ValueRange::empty();
+  }
+  return {std::max(lhs.min, rhs.min), std::min(lhs.max, rhs.max)};
+}
+
+// Values of range which satisfy (value flag other) for some value of other.
+inline constexpr ValueRange narrow(const ValueRange &range, CmpFlag flag,
+                                   const ValueRange &other) {
+  if (range.is_empty() || other.is_empty()) {
+    return ValueRange::empty();
+  }
+  ValueRange res = range;
+  switch (flag) {
+  case CMP_EQ:
+    return intersect(range, other);
+  case CMP_NE:
+    if (other.is_constant() && res.min == other.min) {
+      return res.min == ValueRange::k_max ? ValueRange::empty()
+                                          : ValueRange{res.min + 1, res.max};
+    }
+    if (other.is_constant() && res.max == other.max) {
+      return ValueRange{res.min, res.max - 1};
+    }
+    return res;
+  case CMP_L:
+    if (other.max == ValueRange::k_min) {
+      return ValueRange::empty();
+    }
+    res.max = std::min(res.max, other.max - 1);
+    return res;
+  case CMP_LE:
+    res.max = std::min(res.max, other.max);
+    return res;
+  case CMP_G:
+    if (other.min == ValueRange::k_max) {
+      return ValueRange::empty();
+    }
+    res.min = std::max(res.min, other.min + 1);
+    return res;
+  case CMP_GE:
+    res.min = std::max(res.min, other.min);
+    return res;
+  default:
+    return res;
+  }
+}
+
+// Result of (lhs flag rhs) if it is the same for all values of ranges.
+inline constexpr std::optional<bool> compare(CmpFlag flag,
+                                             const ValueRange &lhs,
+                                             const ValueRange &rhs) {
+  if (lhs.is_empty() || rhs.is_empty()) {
+    return std::nullopt;
+  }
+  switch (flag) {
+  case CMP_EQ:
+    if (lhs.is_constant() && lhs == rhs) {
+      return true;
+    }
+    if (intersect(lhs, rhs).is_empty()) {
+      return false;
+    }
+    return std::nullopt;
+  case CMP_NE: {
+    auto is_equal = compare(CMP_EQ, lhs, rhs);
+    return is_equal ? std::optional<bool>(!*is_equal) : std::nullopt;
+  }
+  case CMP_L:
+    if (lhs.max < rhs.min) {
+      return true;
+    }
+    if (lhs.min >= rhs.max) {
+      return false;
+    }
+    return std::nullopt;
+  case CMP_LE:
+    if (lhs.max <= rhs.min) {
+      return true;
+    }
+    if (lhs.min > rhs.max) {
+      return false;
+    }
+    return std::nullopt;
+  case CMP_G:
+  case CMP_GE:
+    return compare(swap_flag(flag), rhs, lhs);
+  default:
+    return std::nullopt;
+  }
+}
+
+} // namespace koda
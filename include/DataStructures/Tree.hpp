@@ -131,7 +131,10 @@ public:
     m_tree.erase(key);
   }
 
-  void clear() { m_tree.clear(); }
+  void clear() {
+    m_tree.clear();
+    m_root = m_none;
+  }
 
   bool set_root(Key key) {
     if (!contains(key))
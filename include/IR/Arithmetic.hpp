@@ -0,0 +1,120 @@
+#pragma once
+
+#include <IR/IRTypes.hpp>
+
+#include <cstdint>
+
+namespace koda {
+
+// Integer instructions operate on 64-bit two's complement values, so
+// overflow wraps around. These helpers compute the same results at compile
+// time without signed overflow UB.
+
+inline constexpr int64_t wrap_add(int64_t lhs, int64_t rhs) {
+  return static_cast<int64_t>(static_cast<uint64_t>(lhs) +
+                              static_cast<uint64_t>(rhs));
+}
+
+inline constexpr int64_t wrap_sub(int64_t lhs, int64_t rhs) {
+  return static_cast<int64_t>(static_cast<uint64_t>(lhs) -
+                              static_cast<uint64_t>(rhs));
+}
+
+inline constexpr int64_t wrap_mul(int64_t lhs, int64_t rhs) {
+  return static_cast<int64_t>(static_cast<uint64_t>(lhs) *
+                              static_cast<uint64_t>(rhs));
+}
+
+// Division by -1 is negation, so INT64_MIN / -1 wraps to INT64_MIN. Divisor
+// must not be 0.
+inline constexpr int64_t eval_div(int64_t lhs, int64_t rhs) {
+  return rhs == -1 ? wrap_sub(0, lhs) : lhs / rhs;
+}
+
+inline constexpr int64_t eval_mod(int64_t lhs, int64_t rhs) {
+  return rhs == -1 ? 0 : lhs % rhs;
+}
+
+// High 64 bits of signed 128-bit product.
+inline constexpr int64_t eval_mulh(int64_t lhs, int64_t rhs) {
+  return static_cast<int64_t>((static_cast<__int128>(lhs) * rhs) >> 64);
+}
+
+// Shifts use only 6 lower bits of shift amount.
+inline constexpr int64_t eval_shl(int64_t value, int64_t shift) {
+  return static_cast<int64_t>(static_cast<uint64_t>(value) << (shift & 63));
+}
+
+inline constexpr int64_t eval_shr(int64_t value, int64_t shift) {
+  return static_cast<int64_t>(static_cast<uint64_t>(value) >> (shift & 63));
+}
+
+inline constexpr int64_t eval_ashr(int64_t value, int64_t shift) {
+  return value >> (shift & 63);
+}
+
+// Multiplier and shift replacing signed division by constant:
+//   x / d == ashr(mulh(x, multiplier) [+/- x], shift) + sign bit
+// Computed as in Hacker's Delight, 10-1. Divisor must not be -1, 0 or 1.
+struct SignedMagic {
+  int64_t multiplier;
+  unsigned shift;
+};
+
+inline constexpr SignedMagic get_signed_magic(int64_t divisor) {
+  constexpr uint64_t two63 = uint64_t(1) << 63;
+  uint64_t udiv = static_cast<uint64_t>(divisor);
+  uint64_t abs_div = divisor < 0 ? -udiv : udiv;
+  uint64_t t = two63 + (udiv >> 63);
+  // Absolute value of nc
+  uint64_t abs_nc = t - 1 - t % abs_div;
+  unsigned p = 63;
+  uint64_t q1 = two63 / abs_nc;
+  uint64_t r1 = two63 - q1 * abs_nc;
+  uint64_t q2 = two63 / abs_div;
+  uint64_t r2 = two63 - q2 * abs_div;
+  uint64_t delta = 0;
+  do {
+    ++p;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= abs_nc) {
+      ++q1;
+      r1 -= abs_nc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= abs_div) {
+      ++q2;
+      r2 -= abs_div;
+    }
+    delta = abs_div - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  uint64_t multiplier = q2 + 1;
+  if (divisor < 0) {
+    multiplier = -multiplier;
+  }
+  return {static_cast<int64_t>(multiplier), p - 64};
+}
+
+template <typename T>
+inline constexpr bool eval_cmp(CmpFlag flag, T lhs, T rhs) {
+  switch (flag) {
+  case CMP_EQ:
+    return lhs == rhs;
+  case CMP_NE:
+    return lhs != rhs;
+  case CMP_L:
+    return lhs < rhs;
+  case CMP_LE:
+    return lhs <= rhs;
+  case CMP_G:
+    return lhs > rhs;
+  case CMP_GE:
+    return lhs >= rhs;
+  default:
+    return false;
+  }
+}
+
+} // namespace koda
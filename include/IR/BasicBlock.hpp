@@ -30,7 +30,7 @@ private:
 
   BBVector m_predecessors{};
 
-  // Max 2 successors are possible, since ISA doesn't have select operator
+  // Max 2 successors are possible, since ISA doesn't have switch operator
   BBVector m_successors{};
 
   ProgramGraph *m_graph = nullptr;
@@ -97,6 +97,19 @@ public:
 
   void add_predecessor(BasicBlock *pred) { m_predecessors.push_back(pred); }
 
+  // Removes single occurrence of pred.
+  void remove_predecessor(BasicBlock *pred);
+
+  // Redirect all edges to old_succ into new_succ.
+  void replace_successor(BasicBlock *old_succ, BasicBlock *new_succ);
+
+  // Drop all outgoing edges. Terminator must be updated by caller.
+  void clear_successors();
+
+  size_t get_num_predecessors() const { return m_predecessors.size(); }
+
+  size_t get_num_successors() const { return m_successors.size(); }
+
   OperandType get_type() const override { return OperandType::LABEL; }
 
   bool is_in_loop() const { return m_loop_id != INVALID_BB; }
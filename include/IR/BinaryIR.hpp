@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace koda {
+
+class Module;
+class ProgramGraph;
+
+struct IRFormatError : std::runtime_error {
+  IRFormatError(const char *msg) : std::runtime_error(msg) {}
+  IRFormatError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+// Compact binary form of IR. All numbers are LEB128 varints, there are no
+// strings except function names of module. Reachable blocks are written in
+// reverse postorder, so entry is the first block and operands other than
+// phi inputs always precede their users. They are encoded as distance back
+// from the user, phi inputs as signed distance. Read graph has blocks and
+// instructions numbered in the order of the buffer.
+//
+// Graph:  "KIRG" version params blocks
+// Module: "KIRM" version num_functions (name graph_size graph)...
+//
+// Unreachable blocks are dropped together with phi options coming from
+// them. Writer throws IRInvalidArgument for non-integer constants and for
+// graphs where a value isn't defined before its user.
+std::vector<uint8_t> write_binary_ir(ProgramGraph &graph);
+
+std::vector<uint8_t> write_binary_module(const Module &module);
+
+// Builds graph directly from the buffer into empty graph, without copying
+// it. Throws IRFormatError if the buffer is malformed. Only the structure
+// is validated, callees of graph outside of module aren't checked.
+void read_binary_ir(const uint8_t *data, size_t size, ProgramGraph &graph);
+
+// Adds functions to empty module.
+void read_binary_module(const uint8_t *data, size_t size, Module &module);
+
+// Maps file and reads module from it. Throws std::system_error if the file
+// can't be mapped.
+void read_binary_module_file(const std::string &path, Module &module);
+
+} // namespace koda
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace koda {
+
+class ProgramGraph;
+
+// Order dependent hash of 64-bit words and strings.
+class HashBuilder final {
+  uint64_t m_hash = 0x6b6f64614a495431;
+
+public:
+  HashBuilder &add(uint64_t value);
+
+  HashBuilder &add(std::string_view str);
+
+  uint64_t get() const { return m_hash; }
+};
+
+// Structural hash of graph: parameters, opcodes, types, constants,
+// comparison flags, callees, operands and CFG edges. Blocks are numbered in
+// DFS order from entry and values in order of their blocks, so instruction
+// and block ids don't change the hash. Unreachable blocks are ignored.
+// Throws IRInvalidArgument for non-integer constants.
+uint64_t hash_graph(ProgramGraph &graph);
+
+} // namespace koda
@@ -32,8 +32,8 @@ class IRBuilder final {
   BasicBlock *m_insert_bb;
 
   template <typename InstT, OperandType OutType = OperandType::TYPE_INVALID>
-  InstT *create_binary_op(InstOpcode opcode, OperandType type, Instruction *lhs,
-                          Instruction *rhs) {
+  InstT *make_binary_op(InstOpcode opcode, OperandType type, Instruction *lhs,
+                        Instruction *rhs) {
     if (lhs->get_type() != type || rhs->get_type() != type) {
       auto &&errmsg = IROperandError::make_error_str({lhs, rhs}, {type, type});
       throw IROperandError(errmsg);
@@ -44,11 +44,18 @@ class IRBuilder final {
     } else {
       inst = m_graph->create_instruction<InstT>(opcode, OutType, lhs, rhs);
     }
-    add_instruction(inst);
     add_user_to(inst, {lhs, rhs});
     return inst;
   }
 
+  template <typename InstT, OperandType OutType = OperandType::TYPE_INVALID>
+  InstT *create_binary_op(InstOpcode opcode, OperandType type, Instruction *lhs,
+                          Instruction *rhs) {
+    auto inst = make_binary_op<InstT, OutType>(opcode, type, lhs, rhs);
+    add_instruction(inst);
+    return inst;
+  }
+
   void add_instruction(Instruction *inst) {
     m_insert_bb->add_instruction(inst);
   }
@@ -72,12 +79,21 @@ public:
 
   void insert_before(Instruction *inst, Instruction *point);
 
+  // Insert instruction at the end of block, but before its terminator.
+  void insert_before_terminator(Instruction *inst, BasicBlock *bb);
+
+  // Insert phi after all phis of the block.
+  void insert_phi(PhiInstruction *phi, BasicBlock *bb);
+
   static void move_users(Instruction *from, Instruction *to);
 
   static Instruction *rm_instruction(Instruction *inst);
 
   static Instruction *replace(Instruction *old_inst, Instruction *new_inst);
 
+  // Remove phi options of bb which come from pred.
+  static void rm_phi_options(BasicBlock *bb, BasicBlock *pred);
+
   LoadParam *create_param_load(size_t param_idx);
 
   LoadConstant<int64_t> *create_int_constant(int64_t value);
@@ -87,11 +103,29 @@ public:
 
   BranchInstruction *create_branch(BasicBlock *target);
 
+  // Replace terminator of bb with unconditional branch to target. Edges to
+  // other successors are removed together with their phi options.
+  BranchInstruction *replace_with_branch(BasicBlock *bb, BasicBlock *target);
+
+  // Detach blocks which can't be reached from entry and remove their
+  // instructions. Returns true if graph was changed.
+  bool rm_unreachable_blocks();
+
   ConditionalBranchInstruction *
   create_conditional_branch(CmpFlag cmp_flag, BasicBlock *false_block,
                             BasicBlock *true_block, Instruction *lhs,
                             Instruction *rhs);
 
+  // flag(lhs, rhs) ? true_value : false_value
+  SelectInstruction *create_select(CmpFlag cmp_flag, Instruction *lhs,
+                                   Instruction *rhs, Instruction *true_value,
+                                   Instruction *false_value);
+
+  // Same as create_ but doesn't add instruction to the basic block
+  SelectInstruction *make_select(CmpFlag cmp_flag, Instruction *lhs,
+                                 Instruction *rhs, Instruction *true_value,
+                                 Instruction *false_value);
+
   ArithmeticInstruction *create_iadd(Instruction *lhs, Instruction *rhs) {
     return create_binary_op<ArithmeticInstruction, OperandType::INTEGER>(
         INST_ADD, OperandType::INTEGER, lhs, rhs);
@@ -117,6 +151,35 @@ public:
         INST_MOD, OperandType::INTEGER, lhs, rhs);
   }
 
+  // Same as create_ but doesn't add instruction to the basic block
+  ArithmeticInstruction *make_iadd(Instruction *lhs, Instruction *rhs) {
+    return make_binary_op<ArithmeticInstruction, OperandType::INTEGER>(
+        INST_ADD, OperandType::INTEGER, lhs, rhs);
+  }
+
+  ArithmeticInstruction *make_isub(Instruction *lhs, Instruction *rhs) {
+    return make_binary_op<ArithmeticInstruction, OperandType::INTEGER>(
+        INST_SUB, OperandType::INTEGER, lhs, rhs);
+  }
+
+  ArithmeticInstruction *make_imul(Instruction *lhs, Instruction *rhs) {
+    return make_binary_op<ArithmeticInstruction, OperandType::INTEGER>(
+        INST_MUL, OperandType::INTEGER, lhs, rhs);
+  }
+
+  // High half of signed 128-bit product
+  ArithmeticInstruction *create_mulh(Instruction *lhs, Instruction *rhs) {
+    return create_binary_op<ArithmeticInstruction, OperandType::INTEGER>(
+        INST_MULH, OperandType::INTEGER, lhs, rhs);
+  }
+
+  ArithmeticInstruction *make_mulh(Instruction *lhs, Instruction *rhs) {
+    return make_binary_op<ArithmeticInstruction, OperandType::INTEGER>(
+        INST_MULH, OperandType::INTEGER, lhs, rhs);
+  }
+
+  PhiInstruction *make_phi(OperandType type);
+
   PhiInstruction *create_phi(OperandType type);
 
   BitShift *create_shl(Instruction *val, Instruction *shift) {
@@ -131,11 +194,26 @@ public:
 
   BitShift *make_shr(Instruction *val, Instruction *shift);
 
+  // Arithmetic shift right, fills with sign bit
+  BitShift *create_ashr(Instruction *val, Instruction *shift) {
+    return create_binary_op<BitShift>(INST_ASHR, OperandType::INTEGER, val,
+                                      shift);
+  }
+
+  BitShift *make_ashr(Instruction *val, Instruction *shift) {
+    return make_binary_op<BitShift>(INST_ASHR, OperandType::INTEGER, val,
+                                    shift);
+  }
+
   BitOperation *create_and(Instruction *lhs, Instruction *rhs) {
     return create_binary_op<BitOperation>(INST_AND, OperandType::INTEGER, lhs,
                                           rhs);
   }
 
+  BitOperation *make_and(Instruction *lhs, Instruction *rhs) {
+    return make_bit_op(INST_AND, lhs, rhs);
+  }
+
   BitOperation *create_or(Instruction *lhs, Instruction *rhs) {
     return create_binary_op<BitOperation>(INST_OR, OperandType::INTEGER, lhs,
                                           rhs);
@@ -146,9 +224,23 @@ public:
                                           rhs);
   }
 
+  // Same as create_ for and, or and xor, but doesn't add instruction to the
+  // basic block.
+  BitOperation *make_bit_op(InstOpcode opcode, Instruction *lhs,
+                            Instruction *rhs) {
+    return make_binary_op<BitOperation>(opcode, OperandType::INTEGER, lhs, rhs);
+  }
+
   BitNot *create_not(Instruction *val);
 
   ReturnInstruction *create_ret(Instruction *val);
+
+  CallInstruction *create_call(funcid_t callee, OperandType type,
+                               const std::vector<Instruction *> &args);
+
+  // Move instructions following point into new block. New block takes
+  // successors of point's block, which is left without terminator.
+  BasicBlock *split_block(Instruction *point);
 };
 
 } // namespace koda
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <IR/BasicBlock.hpp>
+#include <IR/Instruction.hpp>
+#include <IR/ProgramGraph.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+namespace koda {
+
+// Copies blocks into destination graph. Operands and successors which were
+// copied (or mapped explicitly before cloning) are replaced by their copies,
+// all others are left pointing to the original values.
+//
+class IRCloner final {
+  ProgramGraph *m_graph;
+
+  std::unordered_map<const Instruction *, Instruction *> m_values;
+
+  std::unordered_map<const BasicBlock *, BasicBlock *> m_blocks;
+
+  void remap_operands(const Instruction &orig, Instruction &copy);
+
+public:
+  IRCloner(ProgramGraph &dst) : m_graph(&dst) {}
+
+  // Use existing value instead of copying orig. Mapped instructions are not
+  // cloned.
+  void map_value(const Instruction *orig, Instruction *value) {
+    m_values[orig] = value;
+  }
+
+  void map_block(const BasicBlock *orig, BasicBlock *bb) {
+    m_blocks[orig] = bb;
+  }
+
+  Instruction *get_value(Instruction *orig) const {
+    auto value = m_values.find(orig);
+    return value == m_values.end() ? orig : value->second;
+  }
+
+  BasicBlock *get_block(BasicBlock *orig) const {
+    auto bb = m_blocks.find(orig);
+    return bb == m_blocks.end() ? orig : bb->second;
+  }
+
+  // Create copy of instruction with original operands. Doesn't register
+  // copy in users lists.
+  Instruction *clone_instruction(const Instruction &inst);
+
+  // Clone blocks with their instructions and edges. Edges to blocks out of
+  // the set are kept, so phis there must be updated by caller.
+  // Returns copies in the same order.
+  std::vector<BasicBlock *> clone_blocks(const std::vector<BasicBlock *> &bbs);
+
+  // Copy parameters and all blocks of src into empty destination graph.
+  void clone_graph(ProgramGraph &src);
+};
+
+} // namespace koda
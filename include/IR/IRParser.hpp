@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace koda {
+
+class Module;
+
+struct IRParseError : std::runtime_error {
+  IRParseError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+// Reads functions in textual form produced by IRPrinter::print_function():
+//
+//   func fact(int) {
+//   bb0:
+//     i0: param int0
+//     i1: const int 1
+//     i2: b.if gt i0, i1 F: bb1 T: bb2
+//   ...
+//   }
+//
+// One instruction per line, '#' starts comment. The first block is entry,
+// block without terminator names its successors with "-> bb1". Blocks keep
+// their numbers, values are numbered in order of the text, both may be used
+// before their definition. Callee "fN" is function N of module, functions
+// of text are appended to it in order.
+//
+// Graph is built in a single pass with IRBuilder. Throws IRParseError with
+// line and column of the error, module may contain partially parsed
+// functions then.
+void parse_module(std::string_view text, Module &module);
+
+} // namespace koda
@@ -5,8 +5,12 @@
 #include <IR/ProgramGraph.hpp>
 
 #include <ostream>
+#include <string>
+
 namespace koda {
 
+class Module;
+
 class IRPrinter final {
 
   std::ostream &m_out_stream;
@@ -17,6 +21,11 @@ public:
   void print_prog_graph(ProgramGraph &graph);
 
   void print_block(const BasicBlock &bb);
+
+  // Textual form read by parse_module(). Entry block goes first.
+  void print_function(ProgramGraph &graph, const std::string &name);
+
+  void print_module(const Module &module);
 };
 
 } // namespace koda
\ No newline at end of file
@@ -7,11 +7,14 @@ namespace koda {
 using bbid_t = long long int;
 constexpr bbid_t INVALID_BB = -1;
 using instid_t = size_t;
+// Index of function in Module
+using funcid_t = size_t;
 
 enum InstOpcode : unsigned {
 #define INAME_DEF(name, dummy) INST_##name,
 #include "IRInstEnum.def"
 #undef INAME_DEF
+  INST_NUM_OPCODES
 };
 
 inline constexpr bool is_terminator_opcode(InstOpcode opc) {
@@ -42,6 +45,42 @@ enum CmpFlag {
   CMP_GE,
 };
 
+// Flag for negated condition: !(a < b) == (a >= b)
+inline constexpr CmpFlag invert_flag(CmpFlag flag) {
+  switch (flag) {
+  case CMP_EQ:
+    return CMP_NE;
+  case CMP_NE:
+    return CMP_EQ;
+  case CMP_L:
+    return CMP_GE;
+  case CMP_LE:
+    return CMP_G;
+  case CMP_G:
+    return CMP_LE;
+  case CMP_GE:
+    return CMP_L;
+  default:
+    return CMP_INVALID;
+  }
+}
+
+// Flag for condition with swapped operands: (a < b) == (b > a)
+inline constexpr CmpFlag swap_flag(CmpFlag flag) {
+  switch (flag) {
+  case CMP_L:
+    return CMP_G;
+  case CMP_LE:
+    return CMP_GE;
+  case CMP_G:
+    return CMP_L;
+  case CMP_GE:
+    return CMP_LE;
+  default:
+    return flag;
+  }
+}
+
 inline constexpr const char *flag_to_str(CmpFlag flag) {
   switch (flag) {
   case CMP_INVALID:
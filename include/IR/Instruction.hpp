@@ -92,6 +92,12 @@ public:
 
   void switch_input(Instruction *oldin, Instruction *newin);
 
+  // Doesn't update users lists.
+  void set_input(size_t idx, Instruction *input) {
+    assert(idx < get_num_inputs() && "Invalid input index");
+    m_inputs[idx] = input;
+  }
+
   auto inputs_begin() { return m_inputs.begin(); }
 
   auto inputs_end() { return m_inputs.end(); }
@@ -106,7 +112,7 @@ public:
 
   bool has_side_effects() const {
     return m_opcode == INST_BRANCH || m_opcode == INST_COND_BR ||
-           m_opcode == INST_RET;
+           m_opcode == INST_RET || m_opcode == INST_CALL;
   }
 
   void dump(std::ostream &os) const {
@@ -165,6 +171,40 @@ private:
   void dump_(std::ostream &os) const override;
 };
 
+// flag(lhs, rhs) ? true_value : false_value. Comparison has the same
+// semantics as in conditional branch.
+class SelectInstruction : public Instruction {
+  CmpFlag m_flag = CMP_INVALID;
+
+  OperandType m_type;
+
+public:
+  enum InputIdx : unsigned { LHS = 0, RHS = 1, TRUE_VALUE = 2, FALSE_VALUE = 3 };
+
+  SelectInstruction(instid_t id, CmpFlag flag, Instruction *lhs,
+                    Instruction *rhs, Instruction *true_value,
+                    Instruction *false_value)
+      : Instruction(id, INST_SELECT), m_flag(flag),
+        m_type(true_value->get_type()) {
+    m_inputs = {lhs, rhs, true_value, false_value};
+  }
+
+  CmpFlag get_flag() const { return m_flag; }
+
+  Instruction *get_lhs() const { return m_inputs[LHS]; }
+
+  Instruction *get_rhs() const { return m_inputs[RHS]; }
+
+  Instruction *get_true_value() const { return m_inputs[TRUE_VALUE]; }
+
+  Instruction *get_false_value() const { return m_inputs[FALSE_VALUE]; }
+
+  OperandType get_type() const override { return m_type; }
+
+private:
+  void dump_(std::ostream &os) const override;
+};
+
 class ArithmeticInstruction : public BinaryOpInstructionBase {
   OperandType m_type;
 
@@ -188,10 +228,28 @@ public:
 
   OperandType get_type() const override { return m_type; }
 
-  std::pair<BasicBlock *, Instruction *> get_option(size_t idx) {
+  std::pair<BasicBlock *, Instruction *> get_option(size_t idx) const {
     return {m_incoming_blocks[idx], m_inputs[idx]};
   }
 
+  size_t get_num_options() const { return m_incoming_blocks.size(); }
+
+  BasicBlock *get_incoming_block(size_t idx) const {
+    return m_incoming_blocks[idx];
+  }
+
+  // Returns number of options if bb is not incoming block.
+  size_t get_option_idx(const BasicBlock *bb) const {
+    auto bb_pos =
+        std::find(m_incoming_blocks.begin(), m_incoming_blocks.end(), bb);
+    return std::distance(m_incoming_blocks.begin(), bb_pos);
+  }
+
+  // Replace option with new incoming edge and value.
+  void set_option(size_t idx, BasicBlock *incoming_bb, Instruction *value);
+
+  void remove_option(size_t idx);
+
   Instruction *get_value_for(BasicBlock *bb) {
     assert(m_inputs.size() == m_incoming_blocks.size());
     auto bb_pos =
@@ -300,4 +358,28 @@ public:
   Instruction *get_input() const { return m_inputs[0]; }
 };
 
+// Call of module function. Inputs are arguments, i-th argument is loaded by
+// LoadParam with index i in the callee.
+class CallInstruction : public Instruction {
+  funcid_t m_callee;
+
+  OperandType m_type;
+
+public:
+  virtual ~CallInstruction() = default;
+
+  CallInstruction(instid_t id, funcid_t callee, OperandType type,
+                  const std::vector<Instruction *> &args)
+      : Instruction(id, INST_CALL), m_callee(callee), m_type(type) {
+    m_inputs = args;
+  }
+
+  OperandType get_type() const override { return m_type; }
+
+  funcid_t get_callee() const { return m_callee; }
+
+private:
+  void dump_(std::ostream &os) const override;
+};
+
 }; // namespace koda
\ No newline at end of file
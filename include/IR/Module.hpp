@@ -0,0 +1,38 @@
+#pragma once
+
+#include <IR/IRTypes.hpp>
+#include <IR/ProgramGraph.hpp>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace koda {
+
+// Set of functions which may call each other. Each function is a separate
+// ProgramGraph, CallInstruction refers to callee by its id.
+//
+class Module final {
+  std::vector<std::unique_ptr<ProgramGraph>> m_functions{};
+
+  std::vector<std::string> m_names{};
+
+public:
+  Module() = default;
+  Module(const Module &) = delete;
+  Module &operator=(const Module &) = delete;
+
+  // Create empty function. Return its id.
+  funcid_t create_function(const std::string &name);
+
+  ProgramGraph &get_function(funcid_t id) const { return *m_functions[id]; }
+
+  const std::string &get_name(funcid_t id) const { return m_names[id]; }
+
+  std::optional<funcid_t> find_function(const std::string &name) const;
+
+  size_t size() const { return m_functions.size(); }
+};
+
+} // namespace koda
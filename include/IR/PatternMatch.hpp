@@ -0,0 +1,147 @@
+#pragma once
+
+#include <IR/Instruction.hpp>
+
+#include <cstdint>
+
+// Composable matchers for instruction trees:
+//   Instruction *x;
+//   if (match(inst, m_Add(m_Value(x), m_Const(0)))) ...
+// Matchers bind subtrees while matching, so bound values are valid only if
+// the whole pattern matched.
+//
+namespace koda::pattern {
+
+template <typename Pattern> bool match(Instruction *inst, const Pattern &pat) {
+  return pat.match(inst);
+}
+
+struct AnyValue {
+  bool match(Instruction *) const { return true; }
+};
+
+struct BindValue {
+  Instruction *&m_bound;
+
+  bool match(Instruction *inst) const {
+    m_bound = inst;
+    return true;
+  }
+};
+
+// Matches value bound earlier in the same pattern.
+struct SameValue {
+  Instruction *const &m_bound;
+
+  bool match(Instruction *inst) const { return inst == m_bound; }
+};
+
+inline bool is_int_const(const Instruction *inst) {
+  return inst->get_opcode() == INST_CONST && inst->get_type() == INTEGER;
+}
+
+inline int64_t get_int_const(const Instruction *inst) {
+  return static_cast<const LoadConstant<int64_t> *>(inst)->get_value();
+}
+
+struct BindConst {
+  int64_t &m_value;
+
+  bool match(Instruction *inst) const {
+    if (!is_int_const(inst)) {
+      return false;
+    }
+    m_value = get_int_const(inst);
+    return true;
+  }
+};
+
+struct SpecificConst {
+  int64_t m_value;
+
+  bool match(Instruction *inst) const {
+    return is_int_const(inst) && get_int_const(inst) == m_value;
+  }
+};
+
+// Binds value if it matches inner pattern.
+template <typename Pattern> struct BindIf {
+  Instruction *&m_bound;
+  Pattern m_pattern;
+
+  bool match(Instruction *inst) const {
+    if (!m_pattern.match(inst)) {
+      return false;
+    }
+    m_bound = inst;
+    return true;
+  }
+};
+
+template <InstOpcode Opcode, typename LHS, typename RHS, bool Commutable>
+struct BinaryPattern {
+  LHS m_lhs;
+  RHS m_rhs;
+
+  bool match(Instruction *inst) const {
+    if (inst->get_opcode() != Opcode) {
+      return false;
+    }
+    auto lhs = inst->get_input(BinaryOpInstructionBase::LHS);
+    auto rhs = inst->get_input(BinaryOpInstructionBase::RHS);
+    if (m_lhs.match(lhs) && m_rhs.match(rhs)) {
+      return true;
+    }
+    return Commutable && m_lhs.match(rhs) && m_rhs.match(lhs);
+  }
+};
+
+template <InstOpcode Opcode, typename Input> struct UnaryPattern {
+  Input m_input;
+
+  bool match(Instruction *inst) const {
+    return inst->get_opcode() == Opcode && m_input.match(inst->get_input(0));
+  }
+};
+
+inline AnyValue m_Value() { return {}; }
+
+inline BindValue m_Value(Instruction *&bound) { return {bound}; }
+
+inline SameValue m_Same(Instruction *const &bound) { return {bound}; }
+
+inline BindConst m_AnyConst(int64_t &value) { return {value}; }
+
+inline SpecificConst m_Const(int64_t value) { return {value}; }
+
+template <typename Pattern>
+BindIf<Pattern> m_Bind(Instruction *&bound, const Pattern &pat) {
+  return {bound, pat};
+}
+
+#define BINARY_MATCHER(name, opcode, commutable)                               \
+  template <typename LHS, typename RHS>                                        \
+  BinaryPattern<opcode, LHS, RHS, commutable> name(const LHS &lhs,            \
+                                                   const RHS &rhs) {           \
+    return {lhs, rhs};                                                         \
+  }
+
+// Commutable patterns also match with swapped operands.
+BINARY_MATCHER(m_Add, INST_ADD, true)
+BINARY_MATCHER(m_Sub, INST_SUB, false)
+BINARY_MATCHER(m_Mul, INST_MUL, true)
+BINARY_MATCHER(m_Div, INST_DIV, false)
+BINARY_MATCHER(m_Mod, INST_MOD, false)
+BINARY_MATCHER(m_And, INST_AND, true)
+BINARY_MATCHER(m_Or, INST_OR, true)
+BINARY_MATCHER(m_Xor, INST_XOR, true)
+BINARY_MATCHER(m_Shl, INST_SHL, false)
+BINARY_MATCHER(m_Shr, INST_SHR, false)
+
+#undef BINARY_MATCHER
+
+template <typename Input> UnaryPattern<INST_NOT, Input> m_Not(const Input &in) {
+  return {in};
+}
+
+} // namespace koda::pattern
@@ -86,6 +86,21 @@ public:
 
   BasicBlock *create_basic_block();
 
+  // Removes all blocks, instructions and parameters. Arenas keep their
+  // capacity for the next graph.
+  void clear() {
+    m_entry = nullptr;
+    m_params.clear();
+    m_inst_arena.clear();
+    m_bb_arena.clear();
+  }
+
+  // Preallocate arenas for graph of known size.
+  void reserve(size_t num_blocks, size_t num_insts) {
+    m_bb_arena.reserve(m_bb_arena.size() + num_blocks);
+    m_inst_arena.reserve(m_inst_arena.size() + num_insts);
+  }
+
   template <class InstT, typename... Args>
   InstT *create_instruction(Args &&...args) {
     instid_t id = m_inst_arena.size();
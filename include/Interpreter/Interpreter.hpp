@@ -0,0 +1,170 @@
+#pragma once
+
+#include <IR/IRTypes.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace koda {
+
+class Module;
+class ProgramGraph;
+
+struct InterpreterError : std::runtime_error {
+  InterpreterError(const char *msg) : std::runtime_error(msg) {}
+  InterpreterError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+enum BytecodeOp : uint32_t {
+#define BC_OP_DEF(name) BC_##name,
+#include "BytecodeOps.def"
+#undef BC_OP_DEF
+  BC_NUM_OPS
+};
+
+// Execution counters of function.
+struct BytecodeProfile {
+  uint64_t calls = 0;
+
+  // Indexed by loop number.
+  std::vector<uint64_t> backedges;
+};
+
+// Function lowered into register based bytecode. Every IR value has frame
+// slot equal to its instid_t, constants are preloaded into the frame, so
+// they cost nothing at run time. Phis become moves on incoming edges. Code
+// is a stream of opcodes followed by their operands, jump targets are
+// offsets in the stream.
+//
+// Backedges are counted per outermost reducible loop (from LoopTreeAnalysis),
+// backedges of inner loops add to the counter of their outermost loop.
+// Frame at outermost backedge holds values at loop header, so execution can
+// continue from there in other tier.
+class BytecodeFunction final {
+  std::vector<uint32_t> m_code;
+
+  // Frame at function entry.
+  std::vector<int64_t> m_initial_frame;
+
+  size_t m_num_params = 0;
+
+  // Headers of counted loops.
+  std::vector<bbid_t> m_loop_headers;
+
+  // Counters are updated by interpreter through const references.
+  mutable BytecodeProfile m_profile;
+
+public:
+  // Throws InterpreterError if graph has non integer values.
+  explicit BytecodeFunction(ProgramGraph &graph);
+
+  const std::vector<uint32_t> &get_code() const { return m_code; }
+
+  const std::vector<int64_t> &get_initial_frame() const {
+    return m_initial_frame;
+  }
+
+  size_t get_num_slots() const { return m_initial_frame.size(); }
+
+  size_t get_num_params() const { return m_num_params; }
+
+  const std::vector<bbid_t> &get_loop_headers() const {
+    return m_loop_headers;
+  }
+
+  BytecodeProfile &get_profile() const { return m_profile; }
+};
+
+// Receiver of hot code found by interpreter. Hooks return true if they
+// executed the code themselves, result is stored to result then. On false
+// interpretation goes on and counter starts again.
+class TieringHooks {
+public:
+  virtual ~TieringHooks() = default;
+
+  // Called on call of module function, which was called call_threshold
+  // times.
+  virtual bool on_hot_call(funcid_t id, const int64_t *args,
+                           int64_t &result) = 0;
+
+  // Called on backedge of outermost loop, which took backedge_threshold
+  // iterations. Hooks execute the rest of the function starting from loop
+  // header, frame holds values of the function at header.
+  virtual bool on_hot_loop(funcid_t id, bbid_t header, const int64_t *frame,
+                           int64_t &result) = 0;
+};
+
+// Tier-0 executor of bytecode. Handlers are chained with computed goto where
+// compiler supports it, switch dispatch is the portable fallback. Frames of
+// nested calls are allocated on interpreter stack of fixed size.
+class Interpreter final {
+public:
+  enum class Dispatch { THREADED, SWITCH };
+
+#if defined(__GNUC__)
+  static constexpr Dispatch DEFAULT_DISPATCH = Dispatch::THREADED;
+#else
+  static constexpr Dispatch DEFAULT_DISPATCH = Dispatch::SWITCH;
+#endif
+
+  // In 64-bit slots
+  static constexpr size_t DEFAULT_STACK_SIZE = 1 << 20;
+
+  // Id of function run outside of module.
+  static constexpr funcid_t NO_FUNCTION = static_cast<funcid_t>(-1);
+
+private:
+  const Module *m_module = nullptr;
+
+  // Functions of module are lowered on their first call.
+  std::vector<std::unique_ptr<BytecodeFunction>> m_functions;
+
+  std::vector<int64_t> m_stack;
+
+  Dispatch m_dispatch;
+
+  TieringHooks *m_hooks = nullptr;
+
+  uint64_t m_call_threshold = UINT64_MAX;
+
+  uint64_t m_backedge_threshold = UINT64_MAX;
+
+  int64_t enter(const BytecodeFunction &func, funcid_t id,
+                const std::vector<int64_t> &args);
+
+  int64_t invoke(const BytecodeFunction &func, funcid_t id, int64_t *frame,
+                 const int64_t *args);
+
+  template <Dispatch D>
+  int64_t execute(const BytecodeFunction &func, funcid_t id, int64_t *frame,
+                  const int64_t *args);
+
+public:
+  explicit Interpreter(Dispatch dispatch = DEFAULT_DISPATCH,
+                       size_t stack_size = DEFAULT_STACK_SIZE);
+
+  explicit Interpreter(const Module &module,
+                       Dispatch dispatch = DEFAULT_DISPATCH,
+                       size_t stack_size = DEFAULT_STACK_SIZE);
+
+  const BytecodeFunction &get_function(funcid_t id);
+
+  // Hot code of module functions is passed to hooks.
+  void set_tiering(TieringHooks *hooks, uint64_t call_threshold,
+                   uint64_t backedge_threshold) {
+    m_hooks = hooks;
+    m_call_threshold = call_threshold;
+    m_backedge_threshold = backedge_threshold;
+  }
+
+  // Throws InterpreterError on division by zero, stack overflow and calls
+  // without module.
+  int64_t run(const BytecodeFunction &func, const std::vector<int64_t> &args);
+
+  int64_t run(funcid_t id, const std::vector<int64_t> &args);
+};
+
+} // namespace koda
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <CodeGen/Jit.hpp>
+#include <IR/IRTypes.hpp>
+#include <Interpreter/Interpreter.hpp>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace koda {
+
+class Module;
+class ProgramGraph;
+
+// Mixed mode execution of module. Functions start in interpreter, which
+// counts their calls and loop backedges. Function called call_threshold
+// times is compiled with the default pass pipeline into native code
+// together with its callees. Outermost loop which took backedge_threshold
+// iterations is compiled as separate function entered at loop header, and
+// interpreter frame is transferred into it (on-stack replacement), so long
+// running loop speeds up without waiting for the next call. Compiled code
+// is installed into code cache in batches.
+class TieredRuntime final : TieringHooks {
+public:
+  static constexpr uint64_t DEFAULT_CALL_THRESHOLD = 100;
+  static constexpr uint64_t DEFAULT_BACKEDGE_THRESHOLD = 10000;
+
+private:
+  enum class Tier { INTERPRETED, OPTIMIZED, FAILED };
+
+  // Code of loop entered from interpreter. Parameters are values of frame
+  // slots.
+  struct OsrCode {
+    std::vector<instid_t> slots;
+    ArrayCallStub stub;
+  };
+
+  const Module &m_module;
+
+  CodeCache m_code_cache;
+
+  Interpreter m_interpreter;
+
+  std::unique_ptr<const void *[]> m_call_table;
+
+  std::vector<Tier> m_tiers;
+
+  // Entries from interpreter.
+  std::vector<std::optional<ArrayCallStub>> m_stubs;
+
+  // Keyed by function and loop header. Loops which can't be compiled have
+  // std::nullopt.
+  std::map<std::pair<funcid_t, bbid_t>, std::optional<OsrCode>> m_osr_code;
+
+  size_t m_num_osr_entries = 0;
+
+  // Compile functions and all functions reachable from them over calls.
+  // Returns false if some of them can't be compiled.
+  bool compile(const std::vector<funcid_t> &roots);
+
+  std::optional<OsrCode> compile_osr(funcid_t id, bbid_t header);
+
+  bool on_hot_call(funcid_t id, const int64_t *args,
+                   int64_t &result) override;
+
+  bool on_hot_loop(funcid_t id, bbid_t header, const int64_t *frame,
+                   int64_t &result) override;
+
+public:
+  explicit TieredRuntime(
+      const Module &module, uint64_t call_threshold = DEFAULT_CALL_THRESHOLD,
+      uint64_t backedge_threshold = DEFAULT_BACKEDGE_THRESHOLD);
+
+  int64_t run(funcid_t id, const std::vector<int64_t> &args);
+
+  bool is_compiled(funcid_t id) const {
+    return m_tiers[id] == Tier::OPTIMIZED;
+  }
+
+  // Number of transfers of interpreted loops into native code.
+  size_t get_num_osr_entries() const { return m_num_osr_entries; }
+
+  const CodeCache &get_code_cache() const { return m_code_cache; }
+
+  // Builds function in empty graph osr, which continues func from loop
+  // header. Its parameters are header phis followed by values defined before
+  // the loop, returns their ids in func. Returns std::nullopt if header isn't
+  // entered only from dominating code, e.g. for inner loops.
+  static std::optional<std::vector<instid_t>>
+  build_osr_graph(ProgramGraph &func, bbid_t header, ProgramGraph &osr);
+};
+
+} // namespace koda
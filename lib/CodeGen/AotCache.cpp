@@ -0,0 +1,261 @@
+#include <CodeGen/AotCache.hpp>
+#include <IR/GraphHash.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace koda {
+
+namespace {
+
+constexpr char MAGIC[8] = "KODAAOT";
+
+// x86-64, little endian.
+constexpr uint32_t TARGET_TAG = 0x8664;
+
+// FNV-1a
+uint64_t get_checksum(const uint8_t *data, size_t size,
+                      uint64_t hash = 0xcbf29ce484222325) {
+  for (size_t idx = 0; idx < size; ++idx) {
+    hash = (hash ^ data[idx]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// offset + size <= limit without overflow.
+bool is_in_bounds(uint64_t offset, uint64_t size, uint64_t limit) {
+  return offset <= limit && size <= limit - offset;
+}
+
+[[noreturn]] void throw_errno(const char *what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+void write_all(int fd, const void *data, size_t size) {
+  auto bytes = static_cast<const uint8_t *>(data);
+  while (size != 0) {
+    auto written = ::write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw_errno("write");
+    }
+    bytes += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+uint64_t align_up(uint64_t value) { return (value + 7) / 8 * 8; }
+
+} // namespace
+
+AotCache::AotCache(std::string path) : m_path(std::move(path)) { load(); }
+
+AotCache::~AotCache() {
+  if (m_data != nullptr) {
+    munmap(const_cast<uint8_t *>(m_data), m_size);
+  }
+}
+
+void AotCache::load() {
+  int fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return;
+    }
+    throw_errno("open");
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    auto error = errno;
+    ::close(fd);
+    throw std::system_error(error, std::generic_category(), "fstat");
+  }
+  auto size = static_cast<size_t>(info.st_size);
+  if (size < sizeof(FileHeader)) {
+    ::close(fd);
+    return;
+  }
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  auto error = errno;
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    throw std::system_error(error, std::generic_category(), "mmap");
+  }
+  m_data = static_cast<const uint8_t *>(data);
+  m_size = size;
+
+  FileHeader header;
+  std::memcpy(&header, m_data, sizeof(header));
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != FORMAT_VERSION || header.target != TARGET_TAG ||
+      header.file_size != m_size ||
+      header.num_entries > (m_size - sizeof(header)) / sizeof(FileEntry)) {
+    return;
+  }
+  auto table = m_data + sizeof(header);
+  auto table_size = header.num_entries * sizeof(FileEntry);
+  if (get_checksum(table, table_size) != header.table_checksum) {
+    return;
+  }
+  for (uint64_t idx = 0; idx < header.num_entries; ++idx) {
+    FileEntry entry;
+    std::memcpy(&entry, table + idx * sizeof(FileEntry), sizeof(entry));
+    m_stored.emplace(entry.key, entry);
+  }
+  m_stats.num_loaded = m_stored.size();
+}
+
+std::optional<AotCache::Entry>
+AotCache::read_entry(const FileEntry &stored) const {
+  if (!is_in_bounds(stored.code_offset, stored.code_size, m_size) ||
+      stored.num_relocs > m_size / sizeof(CallRelocation) ||
+      !is_in_bounds(stored.relocs_offset,
+                    stored.num_relocs * sizeof(CallRelocation), m_size)) {
+    return std::nullopt;
+  }
+  auto code = m_data + stored.code_offset;
+  auto relocs = m_data + stored.relocs_offset;
+  auto relocs_size = stored.num_relocs * sizeof(CallRelocation);
+  auto checksum = get_checksum(relocs, relocs_size,
+                               get_checksum(code, stored.code_size));
+  if (checksum != stored.checksum) {
+    return std::nullopt;
+  }
+  Entry entry;
+  entry.code.assign(code, code + stored.code_size);
+  entry.relocations.resize(stored.num_relocs);
+  std::memcpy(entry.relocations.data(), relocs, relocs_size);
+  for (auto &&reloc : entry.relocations) {
+    if (!is_in_bounds(reloc.offset, sizeof(int64_t), stored.code_size)) {
+      return std::nullopt;
+    }
+  }
+  return entry;
+}
+
+std::optional<AotCache::Entry> AotCache::lookup(uint64_t key) {
+  if (auto stored = m_stored.find(key); stored != m_stored.end()) {
+    auto entry = read_entry(stored->second);
+    m_stored.erase(stored);
+    if (!entry) {
+      ++m_stats.num_rejected;
+    } else {
+      m_entries.emplace(key, std::move(*entry));
+    }
+  }
+  auto entry = m_entries.find(key);
+  if (entry == m_entries.end()) {
+    ++m_stats.num_misses;
+    return std::nullopt;
+  }
+  ++m_stats.num_hits;
+  return entry->second;
+}
+
+void AotCache::insert(uint64_t key, Entry entry) {
+  m_stored.erase(key);
+  m_entries.insert_or_assign(key, std::move(entry));
+  ++m_stats.num_inserted;
+}
+
+void AotCache::save() {
+  for (auto &&[key, stored] : m_stored) {
+    if (auto entry = read_entry(stored)) {
+      m_entries.emplace(key, std::move(*entry));
+    } else {
+      ++m_stats.num_rejected;
+    }
+  }
+  m_stored.clear();
+
+  std::vector<FileEntry> table;
+  uint64_t offset =
+      align_up(sizeof(FileHeader) + m_entries.size() * sizeof(FileEntry));
+  for (auto &&[key, entry] : m_entries) {
+    FileEntry stored{};
+    stored.key = key;
+    stored.code_offset = offset;
+    stored.code_size = entry.code.size();
+    offset = align_up(offset + entry.code.size());
+    stored.relocs_offset = offset;
+    stored.num_relocs = entry.relocations.size();
+    offset = align_up(offset + stored.num_relocs * sizeof(CallRelocation));
+    auto relocs = reinterpret_cast<const uint8_t *>(entry.relocations.data());
+    stored.checksum =
+        get_checksum(relocs, stored.num_relocs * sizeof(CallRelocation),
+                     get_checksum(entry.code.data(), entry.code.size()));
+    table.push_back(stored);
+  }
+  FileHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = FORMAT_VERSION;
+  header.target = TARGET_TAG;
+  header.num_entries = table.size();
+  header.file_size = offset;
+  header.table_checksum =
+      get_checksum(reinterpret_cast<const uint8_t *>(table.data()),
+                   table.size() * sizeof(FileEntry));
+
+  auto tmp_path = m_path + ".tmp." + std::to_string(getpid());
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    throw_errno("open");
+  }
+  try {
+    static constexpr uint8_t PADDING[8] = {};
+    uint64_t written = sizeof(header) + table.size() * sizeof(FileEntry);
+    write_all(fd, &header, sizeof(header));
+    write_all(fd, table.data(), table.size() * sizeof(FileEntry));
+    auto pad = [fd, &written](uint64_t target) {
+      write_all(fd, PADDING, target - written);
+      written = target;
+    };
+    auto stored = table.begin();
+    for (auto &&[key, entry] : m_entries) {
+      pad(stored->code_offset);
+      write_all(fd, entry.code.data(), entry.code.size());
+      written += entry.code.size();
+      pad(stored->relocs_offset);
+      write_all(fd, entry.relocations.data(),
+                entry.relocations.size() * sizeof(CallRelocation));
+      written += entry.relocations.size() * sizeof(CallRelocation);
+      ++stored;
+    }
+    pad(offset);
+    if (::close(fd) != 0) {
+      fd = -1;
+      throw_errno("close");
+    }
+    fd = -1;
+    if (::rename(tmp_path.c_str(), m_path.c_str()) != 0) {
+      throw_errno("rename");
+    }
+  } catch (...) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    ::unlink(tmp_path.c_str());
+    throw;
+  }
+}
+
+uint64_t AotCache::get_key(ProgramGraph &graph, std::string_view pipeline) {
+  return HashBuilder()
+      .add(FORMAT_VERSION)
+      .add(X86Backend::NUM_REGS)
+      .add(pipeline)
+      .add(hash_graph(graph))
+      .get();
+}
+
+} // namespace koda
@@ -0,0 +1,211 @@
+#include <CodeGen/CodeCache.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace koda {
+
+namespace {
+
+size_t round_up(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+std::ostream &operator<<(std::ostream &os, const CodeCacheStats &stats) {
+  os << "code_cache.num_regions " << stats.num_regions << "\n";
+  os << "code_cache.reserved_bytes " << stats.reserved_bytes << "\n";
+  os << "code_cache.used_bytes " << stats.used_bytes << "\n";
+  os << "code_cache.num_live_chunks " << stats.num_live_chunks << "\n";
+  os << "code_cache.num_free_chunks " << stats.num_free_chunks << "\n";
+  os << "code_cache.largest_free_chunk " << stats.largest_free_chunk << "\n";
+  os << "code_cache.num_allocations " << stats.num_allocations << "\n";
+  os << "code_cache.num_evictions " << stats.num_evictions << "\n";
+  os << "code_cache.num_protection_flips " << stats.num_protection_flips
+     << "\n";
+  return os;
+}
+
+CodeCache::CodeCache(size_t region_size, bool use_huge_pages)
+    : m_region_size(round_up(std::max<size_t>(region_size, 1),
+                             static_cast<size_t>(sysconf(_SC_PAGESIZE)))),
+      m_use_huge_pages(use_huge_pages) {}
+
+CodeCache::~CodeCache() {
+  for (auto &&[base, region] : m_regions) {
+    munmap(base, region.size);
+  }
+}
+
+size_t CodeCache::get_size_class(size_t size) {
+  size_t size_class = 0;
+  for (size /= ALIGNMENT; size > 1 && size_class + 1 < NUM_SIZE_CLASSES;
+       size >>= 1) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+CodeCache::Region &CodeCache::get_region(const uint8_t *addr) {
+  auto region = m_regions.upper_bound(const_cast<uint8_t *>(addr));
+  assert(region != m_regions.begin() && "Address is out of cache");
+  return std::prev(region)->second;
+}
+
+CodeCache::Region &CodeCache::reserve_region(size_t size) {
+  auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size = round_up(std::max(size, m_region_size), page_size);
+  // Huge pages back only aligned ranges, so mapping is trimmed to alignment.
+  auto alignment = m_use_huge_pages ? m_region_size : page_size;
+  size = round_up(size, alignment);
+  auto mapped_size = size + alignment - page_size;
+  void *data = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    throw std::system_error(errno, std::generic_category(), "mmap");
+  }
+  auto mapped = static_cast<uint8_t *>(data);
+  auto base = reinterpret_cast<uint8_t *>(
+      round_up(reinterpret_cast<uintptr_t>(mapped), alignment));
+  if (base != mapped) {
+    munmap(mapped, base - mapped);
+  }
+  if (base + size != mapped + mapped_size) {
+    munmap(base + size, mapped + mapped_size - (base + size));
+  }
+#if defined(MADV_HUGEPAGE)
+  if (m_use_huge_pages) {
+    // Only advice, regular pages are used if it's not supported.
+    madvise(base, size, MADV_HUGEPAGE);
+  }
+#endif
+  ++m_stats.num_regions;
+  m_stats.reserved_bytes += size;
+  auto &&region = m_regions[base];
+  region = Region{base, size, true};
+  add_free_chunk(base, size);
+  return region;
+}
+
+void CodeCache::protect(Region &region, bool is_writable) {
+  auto prot = is_writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+  if (mprotect(region.base, region.size, prot) != 0) {
+    throw std::system_error(errno, std::generic_category(), "mprotect");
+  }
+  region.is_writable = is_writable;
+  ++m_stats.num_protection_flips;
+}
+
+void CodeCache::add_free_chunk(uint8_t *addr, size_t size) {
+  m_free.emplace(addr, size);
+  m_bins[get_size_class(size)].emplace(size, addr);
+}
+
+void CodeCache::remove_free_chunk(uint8_t *addr, size_t size) {
+  m_free.erase(addr);
+  m_bins[get_size_class(size)].erase({size, addr});
+}
+
+uint8_t *CodeCache::allocate(size_t size) {
+  size = round_up(std::max<size_t>(size, 1), ALIGNMENT);
+  std::optional<std::pair<size_t, uint8_t *>> best;
+  for (auto size_class = get_size_class(size);
+       size_class < NUM_SIZE_CLASSES && !best; ++size_class) {
+    auto &&bin = m_bins[size_class];
+    auto chunk = bin.lower_bound({size, nullptr});
+    if (chunk != bin.end()) {
+      best = *chunk;
+    }
+  }
+  if (!best) {
+    auto &&region = reserve_region(size);
+    best = {region.size, region.base};
+  }
+  auto [chunk_size, addr] = *best;
+  remove_free_chunk(addr, chunk_size);
+  if (chunk_size > size) {
+    add_free_chunk(addr + size, chunk_size - size);
+  }
+  auto &&region = get_region(addr);
+  if (!region.is_writable) {
+    protect(region, true);
+  }
+  m_chunks.emplace(addr, size);
+  ++m_stats.num_allocations;
+  ++m_stats.num_live_chunks;
+  m_stats.used_bytes += size;
+  return addr;
+}
+
+const void *CodeCache::add(const std::vector<uint8_t> &code) {
+  auto addr = allocate(code.size());
+  std::memcpy(addr, code.data(), code.size());
+  return addr;
+}
+
+void CodeCache::free(const void *code) {
+  auto chunk = m_chunks.find(static_cast<const uint8_t *>(code));
+  assert(chunk != m_chunks.end() && "Code isn't allocated in cache");
+  auto addr = const_cast<uint8_t *>(chunk->first);
+  auto size = chunk->second;
+  m_chunks.erase(chunk);
+  ++m_stats.num_evictions;
+  --m_stats.num_live_chunks;
+  m_stats.used_bytes -= size;
+
+  // Regions may be adjacent in address space, chunks never span them.
+  auto &&region = get_region(addr);
+  auto next = m_free.find(addr + size);
+  if (next != m_free.end() && addr + size < region.base + region.size) {
+    auto next_size = next->second;
+    remove_free_chunk(addr + size, next_size);
+    size += next_size;
+  }
+  auto prev = m_free.lower_bound(addr);
+  if (prev != m_free.begin()) {
+    --prev;
+    auto [prev_addr, prev_size] = *prev;
+    if (prev_addr >= region.base && prev_addr + prev_size == addr) {
+      remove_free_chunk(prev_addr, prev_size);
+      addr = prev_addr;
+      size += prev_size;
+    }
+  }
+  add_free_chunk(addr, size);
+}
+
+void CodeCache::make_executable() {
+  for (auto &&[base, region] : m_regions) {
+    if (region.is_writable) {
+      protect(region, false);
+    }
+  }
+}
+
+size_t CodeCache::get_chunk_size(const void *code) const {
+  auto chunk = m_chunks.find(static_cast<const uint8_t *>(code));
+  assert(chunk != m_chunks.end() && "Code isn't allocated in cache");
+  return chunk->second;
+}
+
+CodeCacheStats CodeCache::get_stats() const {
+  auto stats = m_stats;
+  stats.num_free_chunks = m_free.size();
+  for (auto &&bin = m_bins.rbegin(); bin != m_bins.rend(); ++bin) {
+    if (!bin->empty()) {
+      stats.largest_free_chunk = bin->rbegin()->first;
+      break;
+    }
+  }
+  return stats;
+}
+
+} // namespace koda
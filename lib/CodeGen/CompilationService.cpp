@@ -0,0 +1,148 @@
+#include <CodeGen/CompilationService.hpp>
+#include <CodeGen/X86Baseline.hpp>
+#include <Core/Compiler.h>
+#include <IR/IRCloner.hpp>
+#include <IR/Module.hpp>
+
+#include <algorithm>
+
+namespace koda {
+
+CompilationService::CompilationService(size_t num_threads, CodeTier tier)
+    : m_tier(tier) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t idx = 0; idx < num_threads; ++idx) {
+    m_workers.push_back(std::make_unique<Worker>());
+  }
+  for (size_t idx = 0; idx < num_threads; ++idx) {
+    m_workers[idx]->thread = std::thread([this, idx] { run_worker(idx); });
+  }
+}
+
+CompilationService::~CompilationService() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_is_stopping = true;
+  }
+  m_wake.notify_all();
+  for (auto &&worker : m_workers) {
+    worker->thread.join();
+  }
+}
+
+bool CompilationService::pop_task(size_t worker, size_t &task) {
+  auto &&self = *m_workers[worker];
+  std::lock_guard lock(self.mutex);
+  if (self.tasks.empty()) {
+    return false;
+  }
+  task = self.tasks.front();
+  self.tasks.pop_front();
+  return true;
+}
+
+// Victims are visited starting from the next worker, so thieves spread over
+// different ranges.
+bool CompilationService::steal_task(size_t worker, size_t &task) {
+  for (size_t offset = 1; offset < m_workers.size(); ++offset) {
+    auto &&victim = *m_workers[(worker + offset) % m_workers.size()];
+    std::lock_guard lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.back();
+      victim.tasks.pop_back();
+      ++m_num_steals;
+      return true;
+    }
+  }
+  return false;
+}
+
+void CompilationService::run_worker(size_t worker) {
+  Compiler comp(X86Backend::NUM_REGS);
+  if (m_tier == CodeTier::OPTIMIZING) {
+    comp.register_default_passes();
+  }
+  uint64_t generation = 0;
+  for (;;) {
+    {
+      std::unique_lock lock(m_mutex);
+      m_wake.wait(lock, [this, generation] {
+        return m_is_stopping || m_generation != generation;
+      });
+      if (m_is_stopping) {
+        return;
+      }
+      generation = m_generation;
+    }
+    size_t task = 0;
+    while (pop_task(worker, task) || steal_task(worker, task)) {
+      comp.reset();
+      m_task(comp, task);
+      if (--m_num_pending == 0) {
+        std::lock_guard lock(m_mutex);
+        m_done.notify_all();
+      }
+    }
+  }
+}
+
+void CompilationService::run_batch(
+    size_t num_tasks, std::function<void(Compiler &, size_t)> task) {
+  if (num_tasks == 0) {
+    return;
+  }
+  std::lock_guard batch_lock(m_batch_mutex);
+  m_task = std::move(task);
+  m_num_pending = num_tasks;
+  auto num_workers = m_workers.size();
+  for (size_t idx = 0; idx < num_workers; ++idx) {
+    auto &&worker = *m_workers[idx];
+    std::lock_guard lock(worker.mutex);
+    for (auto task_idx = idx * num_tasks / num_workers;
+         task_idx < (idx + 1) * num_tasks / num_workers; ++task_idx) {
+      worker.tasks.push_back(task_idx);
+    }
+  }
+  std::unique_lock lock(m_mutex);
+  ++m_generation;
+  m_wake.notify_all();
+  m_done.wait(lock, [this] { return m_num_pending == 0; });
+}
+
+std::vector<CompiledFunction>
+CompilationService::compile(const std::vector<ProgramGraph *> &graphs,
+                            const void *const *call_table) {
+  std::vector<CompiledFunction> results(graphs.size());
+  run_batch(graphs.size(), [this, &graphs, &results,
+                            call_table](Compiler &comp, size_t idx) {
+    auto &&result = results[idx];
+    try {
+      IRCloner(comp.graph()).clone_graph(*graphs[idx]);
+      if (m_tier == CodeTier::BASELINE) {
+        result.code = X86Baseline::emit(comp.graph(), call_table,
+                                        &result.relocations);
+      } else {
+        comp.run_all_passes();
+        result.code =
+            X86Backend::emit(comp, call_table, &result.relocations);
+      }
+    } catch (const std::exception &error) {
+      result = {{}, {}, error.what()};
+    }
+  });
+  return results;
+}
+
+std::vector<CompiledFunction>
+CompilationService::compile(const Module &module,
+                            const void *const *call_table) {
+  std::vector<ProgramGraph *> graphs;
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    graphs.push_back(&module.get_function(id));
+  }
+  return compile(graphs, call_table);
+}
+
+} // namespace koda
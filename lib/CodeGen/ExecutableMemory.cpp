@@ -0,0 +1,65 @@
+#include <CodeGen/ExecutableMemory.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace koda {
+
+ExecutableMemory::ExecutableMemory(size_t size) {
+  auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  m_size = (std::max<size_t>(size, 1) + page_size - 1) / page_size * page_size;
+  void *data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    m_size = 0;
+    throw std::system_error(errno, std::generic_category(), "mmap");
+  }
+  m_data = static_cast<uint8_t *>(data);
+}
+
+ExecutableMemory::ExecutableMemory(ExecutableMemory &&other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_is_sealed(std::exchange(other.m_is_sealed, false)) {}
+
+ExecutableMemory &ExecutableMemory::operator=(ExecutableMemory &&other) noexcept {
+  if (this != &other) {
+    release();
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+    m_is_sealed = std::exchange(other.m_is_sealed, false);
+  }
+  return *this;
+}
+
+void ExecutableMemory::release() {
+  if (m_data != nullptr) {
+    munmap(m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+  }
+}
+
+void ExecutableMemory::seal() {
+  assert(!m_is_sealed && "Memory is already sealed");
+  if (mprotect(m_data, m_size, PROT_READ | PROT_EXEC) != 0) {
+    throw std::system_error(errno, std::generic_category(), "mprotect");
+  }
+  m_is_sealed = true;
+}
+
+ExecutableMemory ExecutableMemory::from_code(const std::vector<uint8_t> &code) {
+  ExecutableMemory memory(code.size());
+  std::memcpy(memory.data(), code.data(), code.size());
+  memory.seal();
+  return memory;
+}
+
+} // namespace koda
@@ -0,0 +1,142 @@
+#include <CodeGen/AotCache.hpp>
+#include <CodeGen/Jit.hpp>
+#include <CodeGen/X86Backend.hpp>
+#include <CodeGen/X86Baseline.hpp>
+#include <Core/Compiler.h>
+#include <IR/IRCloner.hpp>
+#include <IR/Module.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+
+namespace koda {
+
+JitFunction jit_compile(Compiler &comp) {
+  return JitFunction(ExecutableMemory::from_code(X86Backend::emit(comp)));
+}
+
+JitFunction jit_compile_baseline(ProgramGraph &graph) {
+  return JitFunction(ExecutableMemory::from_code(X86Baseline::emit(graph)));
+}
+
+ArrayCallStub::ArrayCallStub(CodeCache &cache, const void *entry,
+                             size_t num_params)
+    : m_code(cache.add(X86Backend::emit_array_stub(entry, num_params))) {}
+
+JitModule::JitModule(const Module &module, AotCache *aot_cache,
+                     CodeTier tier)
+    : m_call_table(std::make_unique<const void *[]>(module.size())) {
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    auto &&func = module.get_function(id);
+    std::optional<AotCache::Entry> entry;
+    uint64_t key = 0;
+    if (aot_cache != nullptr) {
+      key = AotCache::get_key(
+          func, tier == CodeTier::BASELINE ? BASELINE_PIPELINE : PIPELINE);
+      entry = aot_cache->lookup(key);
+    }
+    // Callees are part of the key, foreign ones mean hash collision.
+    if (entry && std::any_of(entry->relocations.begin(),
+                             entry->relocations.end(),
+                             [&module](auto &&reloc) {
+                               return reloc.callee >= module.size();
+                             })) {
+      entry.reset();
+    }
+    if (!entry) {
+      entry.emplace();
+      Compiler comp(X86Backend::NUM_REGS);
+      IRCloner(comp.graph()).clone_graph(func);
+      entry->code = tier == CodeTier::BASELINE
+                        ? X86Baseline::emit(comp.graph(), m_call_table.get(),
+                                            &entry->relocations)
+                        : X86Backend::emit(comp, m_call_table.get(),
+                                           &entry->relocations);
+      if (aot_cache != nullptr) {
+        aot_cache->insert(key, *entry);
+      }
+    } else {
+      X86Backend::relocate(entry->code, entry->relocations,
+                           m_call_table.get());
+    }
+    auto &&code = entry->code;
+    m_functions.emplace_back(m_code_cache.add(code), code.size());
+    m_call_table[id] = m_functions.back().get_entry();
+  }
+  m_code_cache.make_executable();
+}
+
+LazyJitModule::LazyJitModule(const Module &module)
+    : m_module(module), m_call_table(std::make_unique<Entry[]>(module.size())),
+      m_tiers(module.size()) {
+  auto table = reinterpret_cast<const void *const *>(m_call_table.get());
+  auto stubs =
+      X86Backend::emit_lazy_stubs(table, module.size(), resolve, this);
+  auto code = static_cast<const uint8_t *>(m_stub_cache.add(stubs.code));
+  m_stub_cache.make_executable();
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    m_call_table[id].store(code + stubs.resolvers[id],
+                           std::memory_order_relaxed);
+    auto size = (id + 1 < module.size() ? stubs.entries[id + 1]
+                                        : stubs.resolvers[0]) -
+                stubs.entries[id];
+    m_functions.emplace_back(code + stubs.entries[id], size);
+  }
+}
+
+// Other thread may have compiled the function while this one was waiting
+// for the lock.
+const void *LazyJitModule::resolve(void *context, uint64_t id) noexcept {
+  auto &&self = *static_cast<LazyJitModule *>(context);
+  auto func_id = static_cast<funcid_t>(id);
+  std::lock_guard lock(self.m_mutex);
+  if (self.m_tiers[func_id]) {
+    return self.m_call_table[func_id].load(std::memory_order_relaxed);
+  }
+  try {
+    return self.compile(func_id, CodeTier::BASELINE);
+  } catch (const std::exception &error) {
+    std::fprintf(stderr, "kodjit: can't compile %s: %s\n",
+                 self.m_module.get_name(func_id).c_str(), error.what());
+    std::abort();
+  }
+}
+
+const void *LazyJitModule::compile(funcid_t id, CodeTier tier) {
+  auto table = reinterpret_cast<const void *const *>(m_call_table.get());
+  std::vector<uint8_t> code;
+  if (tier == CodeTier::BASELINE) {
+    code = X86Baseline::emit(m_module.get_function(id), table);
+  } else {
+    Compiler comp(X86Backend::NUM_REGS);
+    IRCloner(comp.graph()).clone_graph(m_module.get_function(id));
+    comp.register_default_passes();
+    comp.run_all_passes();
+    code = X86Backend::emit(comp, table);
+  }
+  auto &&memory = m_code.emplace_back(ExecutableMemory::from_code(code));
+  // Code is written before it's published.
+  m_call_table[id].store(memory.data(), std::memory_order_release);
+  m_tiers[id] = tier;
+  ++m_num_compiled;
+  return memory.data();
+}
+
+void LazyJitModule::tier_up(funcid_t id) {
+  std::lock_guard lock(m_mutex);
+  compile(id, CodeTier::OPTIMIZING);
+}
+
+std::optional<CodeTier> LazyJitModule::get_tier(funcid_t id) const {
+  std::lock_guard lock(m_mutex);
+  return m_tiers[id];
+}
+
+size_t LazyJitModule::get_num_compiled() const {
+  std::lock_guard lock(m_mutex);
+  return m_num_compiled;
+}
+
+} // namespace koda
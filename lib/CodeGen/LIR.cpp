@@ -0,0 +1,351 @@
+#include <CodeGen/LIR.hpp>
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace koda {
+
+namespace {
+
+const char *const REG_NAMES[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp",
+                                 "rsi", "rdi", "r8",  "r9",  "r10", "r11",
+                                 "r12", "r13", "r14", "r15"};
+
+const char *get_op_name(const LirInst &inst) {
+  switch (inst.opcode) {
+  case LIR_ALU:
+    switch (inst.op) {
+    case ALU_ADD:
+      return "add";
+    case ALU_OR:
+      return "or";
+    case ALU_AND:
+      return "and";
+    case ALU_SUB:
+      return "sub";
+    case ALU_XOR:
+      return "xor";
+    default:
+      return "cmp";
+    }
+  case LIR_SHIFT:
+    return inst.op == SHIFT_SHL ? "shl" : inst.op == SHIFT_SHR ? "shr" : "sar";
+  case LIR_UNARY:
+    return inst.op == UNARY_NOT ? "not" : "neg";
+  default:
+    return lir_opc_to_str(inst.opcode);
+  }
+}
+
+const char *get_cond_name(uint8_t cond) {
+  switch (cond) {
+  case COND_E:
+    return "e";
+  case COND_NE:
+    return "ne";
+  case COND_L:
+    return "l";
+  case COND_GE:
+    return "ge";
+  case COND_LE:
+    return "le";
+  default:
+    return "g";
+  }
+}
+
+} // namespace
+
+std::ostream &operator<<(std::ostream &os, const LirOperand &operand) {
+  switch (operand.kind) {
+  case LirOperand::VREG:
+    return os << "v" << operand.get_vreg();
+  case LirOperand::PREG:
+    return os << REG_NAMES[operand.get_preg()];
+  case LirOperand::SLOT:
+    return os << "[slot " << operand.get_slot() << "]";
+  case LirOperand::IMM:
+    return os << operand.get_imm();
+  default:
+    return os << "_";
+  }
+}
+
+const char *lir_opc_to_str(LirOpcode opcode) {
+  switch (opcode) {
+  case LIR_MOV:
+    return "mov";
+  case LIR_LEA:
+    return "lea";
+  case LIR_ALU:
+    return "alu";
+  case LIR_IMUL:
+    return "imul";
+  case LIR_SHIFT:
+    return "shift";
+  case LIR_UNARY:
+    return "unary";
+  case LIR_MULH:
+    return "mulh";
+  case LIR_DIV:
+    return "div";
+  case LIR_MOD:
+    return "mod";
+  case LIR_PARAM:
+    return "param";
+  case LIR_SELECT:
+    return "select";
+  case LIR_CALL:
+    return "call";
+  case LIR_BRANCH:
+    return "branch";
+  case LIR_JUMP:
+    return "jump";
+  case LIR_RET:
+    return "ret";
+  default:
+    return "unknown";
+  }
+}
+
+size_t LirFunction::get_num_insts() const {
+  size_t num_insts = 0;
+  for (auto &&bb : m_blocks) {
+    num_insts += bb.insts.size();
+  }
+  return num_insts;
+}
+
+// Liveness is solved by iterating over blocks until live sets stop
+// changing, intervals are hulls of positions where registers are live.
+std::vector<RegAlloc::Interval> LirFunction::get_live_intervals() const {
+  using LiveSet = std::vector<bool>;
+  std::unordered_map<bbid_t, size_t> block_idx;
+  for (size_t idx = 0; idx < m_blocks.size(); ++idx) {
+    block_idx[m_blocks[idx].id] = idx;
+  }
+  std::vector<LiveSet> gen(m_blocks.size(), LiveSet(m_num_vregs, false));
+  std::vector<LiveSet> kill(m_blocks.size(), LiveSet(m_num_vregs, false));
+  std::vector<LiveSet> live_in(m_blocks.size(), LiveSet(m_num_vregs, false));
+  std::vector<LiveSet> live_out(m_blocks.size(), LiveSet(m_num_vregs, false));
+  auto use = [&gen, &kill](size_t idx, const LirOperand &operand) {
+    if (operand.is_vreg() && !kill[idx][operand.get_vreg()]) {
+      gen[idx][operand.get_vreg()] = true;
+    }
+  };
+  auto def = [&kill](size_t idx, const LirOperand &operand) {
+    if (operand.is_vreg()) {
+      kill[idx][operand.get_vreg()] = true;
+    }
+  };
+  for (size_t idx = 0; idx < m_blocks.size(); ++idx) {
+    auto &&bb = m_blocks[idx];
+    for (auto &&phi : bb.phis) {
+      def(idx, phi);
+    }
+    for (auto &&inst : bb.insts) {
+      for (auto &&src : inst.srcs) {
+        use(idx, src);
+      }
+      def(idx, inst.dst);
+    }
+    for (auto &&edge : bb.edges) {
+      for (auto &&move : edge.moves) {
+        use(idx, move.src);
+      }
+    }
+  }
+  for (bool is_changed = true; is_changed;) {
+    is_changed = false;
+    for (size_t idx = m_blocks.size(); idx-- > 0;) {
+      auto &&out = live_out[idx];
+      for (auto &&edge : m_blocks[idx].edges) {
+        auto &&succ_in = live_in[block_idx.at(edge.succ)];
+        for (size_t vreg = 0; vreg < m_num_vregs; ++vreg) {
+          out[vreg] = out[vreg] || succ_in[vreg];
+        }
+        for (auto &&move : edge.moves) {
+          if (move.src.is_vreg()) {
+            out[move.src.get_vreg()] = true;
+          }
+        }
+      }
+      for (size_t vreg = 0; vreg < m_num_vregs; ++vreg) {
+        bool is_live = gen[idx][vreg] || (out[vreg] && !kill[idx][vreg]);
+        if (is_live && !live_in[idx][vreg]) {
+          live_in[idx][vreg] = true;
+          is_changed = true;
+        }
+      }
+    }
+  }
+
+  std::vector<size_t> begins(m_num_vregs, SIZE_MAX);
+  std::vector<size_t> ends(m_num_vregs, 0);
+  std::vector<bool> is_read(m_num_vregs, false);
+  auto extend = [&begins, &ends](const LirOperand &operand, size_t pos) {
+    if (operand.is_vreg()) {
+      begins[operand.get_vreg()] = std::min(begins[operand.get_vreg()], pos);
+      ends[operand.get_vreg()] = std::max(ends[operand.get_vreg()], pos);
+    }
+  };
+  size_t pos = 0;
+  for (size_t idx = 0; idx < m_blocks.size(); ++idx) {
+    auto &&bb = m_blocks[idx];
+    auto start = pos;
+    for (auto &&phi : bb.phis) {
+      extend(phi, start);
+    }
+    for (auto &&inst : bb.insts) {
+      pos += 2;
+      for (auto &&src : inst.srcs) {
+        extend(src, pos);
+        if (src.is_vreg()) {
+          is_read[src.get_vreg()] = true;
+        }
+      }
+      extend(inst.dst, pos);
+    }
+    pos += 2;
+    for (auto &&edge : bb.edges) {
+      for (auto &&move : edge.moves) {
+        extend(move.src, pos);
+        if (move.src.is_vreg()) {
+          is_read[move.src.get_vreg()] = true;
+        }
+      }
+    }
+    for (vreg_t vreg = 0; vreg < m_num_vregs; ++vreg) {
+      if (live_in[idx][vreg]) {
+        extend(LirOperand::make_vreg(vreg), start);
+      }
+      if (live_out[idx][vreg]) {
+        extend(LirOperand::make_vreg(vreg), pos);
+      }
+    }
+  }
+  std::vector<RegAlloc::Interval> intervals;
+  for (vreg_t vreg = 0; vreg < m_num_vregs; ++vreg) {
+    if (is_read[vreg] && begins[vreg] < ends[vreg]) {
+      intervals.push_back({vreg, begins[vreg], ends[vreg]});
+    }
+  }
+  return intervals;
+}
+
+void LirFunction::assign_locations(RegAlloc &regalloc, const X86Reg *regs,
+                                   size_t num_regs) {
+  size_t num_spills = 0;
+  size_t num_overflows = 0;
+  for (vreg_t vreg = 0; vreg < m_num_vregs; ++vreg) {
+    auto loc = regalloc.get_location(vreg);
+    if (!loc) {
+      continue;
+    }
+    auto idx = static_cast<size_t>(loc->location);
+    if (loc->is_stack) {
+      num_spills = std::max(num_spills, idx + 1);
+    } else if (idx >= num_regs) {
+      num_overflows = std::max(num_overflows, idx - num_regs + 1);
+    }
+  }
+  m_num_slots = num_spills + num_overflows;
+  std::vector<LirOperand> locations(m_num_vregs);
+  for (vreg_t vreg = 0; vreg < m_num_vregs; ++vreg) {
+    auto loc = regalloc.get_location(vreg);
+    if (!loc) {
+      continue;
+    }
+    auto idx = static_cast<size_t>(loc->location);
+    if (loc->is_stack) {
+      locations[vreg] = LirOperand::make_slot(idx);
+    } else if (idx < num_regs) {
+      locations[vreg] = LirOperand::make_preg(regs[idx]);
+    } else {
+      locations[vreg] = LirOperand::make_slot(num_spills + idx - num_regs);
+    }
+  }
+  auto assign = [&locations](LirOperand &operand) {
+    if (operand.is_vreg()) {
+      operand = locations[operand.get_vreg()];
+    }
+  };
+  for (auto &&bb : m_blocks) {
+    for (auto &&phi : bb.phis) {
+      assign(phi);
+    }
+    bb.phis.erase(std::remove_if(bb.phis.begin(), bb.phis.end(),
+                                 [](auto &&phi) { return phi.is_none(); }),
+                  bb.phis.end());
+    for (auto &&inst : bb.insts) {
+      assign(inst.dst);
+      for (auto &&src : inst.srcs) {
+        assign(src);
+      }
+    }
+    for (auto &&edge : bb.edges) {
+      for (auto &&move : edge.moves) {
+        assign(move.dst);
+        assign(move.src);
+      }
+      edge.moves.erase(std::remove_if(edge.moves.begin(), edge.moves.end(),
+                                      [](const LirMove &move) {
+                                        return move.dst.is_none() ||
+                                               move.dst == move.src;
+                                      }),
+                       edge.moves.end());
+    }
+  }
+}
+
+void LirFunction::dump(std::ostream &os) const {
+  for (auto &&bb : m_blocks) {
+    os << "bb" << bb.id << ":";
+    if (bb.id == m_entry) {
+      os << " # entry";
+    }
+    os << "\n";
+    if (!bb.phis.empty()) {
+      os << "  phi";
+      for (size_t idx = 0; idx < bb.phis.size(); ++idx) {
+        os << (idx == 0 ? " " : ", ") << bb.phis[idx];
+      }
+      os << "\n";
+    }
+    for (auto &&inst : bb.insts) {
+      os << "  ";
+      if (!inst.dst.is_none()) {
+        os << inst.dst << " = ";
+      }
+      os << get_op_name(inst);
+      if (inst.opcode == LIR_SELECT || inst.opcode == LIR_BRANCH) {
+        os << "." << get_cond_name(inst.op);
+      }
+      if (inst.opcode == LIR_PARAM || inst.opcode == LIR_CALL) {
+        os << " " << (inst.opcode == LIR_CALL ? "f" : "") << inst.index;
+      }
+      if (inst.opcode == LIR_LEA) {
+        os << " [" << inst.srcs[0];
+        if (inst.srcs.size() > 1) {
+          os << " + " << inst.srcs[1] << " * " << unsigned(inst.scale);
+        }
+        os << " + " << inst.disp << "]\n";
+        continue;
+      }
+      for (size_t idx = 0; idx < inst.srcs.size(); ++idx) {
+        os << (idx == 0 ? " " : ", ") << inst.srcs[idx];
+      }
+      os << "\n";
+    }
+    for (auto &&edge : bb.edges) {
+      os << "  -> bb" << edge.succ;
+      for (size_t idx = 0; idx < edge.moves.size(); ++idx) {
+        os << (idx == 0 ? " [" : ", ") << edge.moves[idx].dst << " = "
+           << edge.moves[idx].src;
+      }
+      os << (edge.moves.empty() ? "\n" : "]\n");
+    }
+  }
+}
+
+} // namespace koda
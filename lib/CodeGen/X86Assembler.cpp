@@ -0,0 +1,298 @@
+#include <CodeGen/X86Assembler.hpp>
+
+#include <cassert>
+#include <cstring>
+
+namespace koda {
+
+namespace {
+
+bool fits_int8(int64_t value) { return value >= INT8_MIN && value <= INT8_MAX; }
+
+bool fits_int32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+} // namespace
+
+void X86Assembler::emit_imm32(int32_t imm) {
+  for (int i = 0; i < 4; ++i) {
+    emit_byte(static_cast<uint8_t>(static_cast<uint32_t>(imm) >> (8 * i)));
+  }
+}
+
+void X86Assembler::emit_imm64(int64_t imm) {
+  for (int i = 0; i < 8; ++i) {
+    emit_byte(static_cast<uint8_t>(static_cast<uint64_t>(imm) >> (8 * i)));
+  }
+}
+
+void X86Assembler::emit_rex(bool is_wide, unsigned reg, unsigned base,
+                            unsigned index) {
+  uint8_t rex = 0x40 | (is_wide << 3) | ((reg >> 3) << 2) |
+                ((index >> 3) << 1) | (base >> 3);
+  if (rex != 0x40) {
+    emit_byte(rex);
+  }
+}
+
+void X86Assembler::emit_modrm(unsigned reg, X86Reg rm) {
+  emit_byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void X86Assembler::emit_modrm(unsigned reg, const X86Mem &mem) {
+  // Displacement is always encoded, so rbp and r13 need no special case.
+  bool is_short = fits_int8(mem.disp);
+  auto rm = mem.index != RSP ? static_cast<unsigned>(RSP) : mem.base & 7;
+  emit_byte((is_short ? 0x40 : 0x80) | ((reg & 7) << 3) | rm);
+  // Index and rsp or r12 as base require SIB byte
+  if (mem.index != RSP) {
+    assert((mem.scale == 1 || mem.scale == 2 || mem.scale == 4 ||
+            mem.scale == 8) &&
+           "Invalid scale");
+    uint8_t scale_bits = mem.scale == 8   ? 3
+                         : mem.scale == 4 ? 2
+                         : mem.scale == 2 ? 1
+                                          : 0;
+    emit_byte((scale_bits << 6) | ((mem.index & 7) << 3) | (mem.base & 7));
+  } else if ((mem.base & 7) == RSP) {
+    emit_byte(0x24);
+  }
+  if (is_short) {
+    emit_byte(static_cast<uint8_t>(mem.disp));
+  } else {
+    emit_imm32(mem.disp);
+  }
+}
+
+void X86Assembler::emit_rel32(Label label) {
+  m_fixups.emplace_back(m_code.size(), label);
+  emit_imm32(0);
+}
+
+X86Assembler::Label X86Assembler::make_label() {
+  m_labels.push_back(UNBOUND);
+  return m_labels.size() - 1;
+}
+
+void X86Assembler::bind(Label label) {
+  assert(m_labels[label] == UNBOUND && "Label is bound twice");
+  m_labels[label] = m_code.size();
+}
+
+std::vector<uint8_t> X86Assembler::finalize() {
+  for (auto &&[pos, label] : m_fixups) {
+    assert(m_labels[label] != UNBOUND && "Jump to unbound label");
+    auto rel = static_cast<int32_t>(m_labels[label] - (pos + 4));
+    std::memcpy(&m_code[pos], &rel, sizeof(rel));
+  }
+  m_fixups.clear();
+  return m_code;
+}
+
+void X86Assembler::mov(X86Reg dst, X86Reg src) {
+  emit_rex(true, src, dst);
+  emit_byte(0x89);
+  emit_modrm(src, dst);
+}
+
+void X86Assembler::mov(X86Reg dst, const X86Mem &src) {
+  emit_rex(true, dst, src);
+  emit_byte(0x8b);
+  emit_modrm(dst, src);
+}
+
+void X86Assembler::mov(const X86Mem &dst, X86Reg src) {
+  emit_rex(true, src, dst);
+  emit_byte(0x89);
+  emit_modrm(src, dst);
+}
+
+void X86Assembler::mov(X86Reg dst, int64_t imm) {
+  if (fits_int32(imm)) {
+    // Sign extended imm32
+    emit_rex(true, 0, dst);
+    emit_byte(0xc7);
+    emit_modrm(0, dst);
+    emit_imm32(static_cast<int32_t>(imm));
+    return;
+  }
+  mov_imm64(dst, imm);
+}
+
+void X86Assembler::mov(const X86Mem &dst, int32_t imm) {
+  emit_rex(true, 0, dst);
+  emit_byte(0xc7);
+  emit_modrm(0, dst);
+  emit_imm32(imm);
+}
+
+size_t X86Assembler::mov_imm64(X86Reg dst, int64_t imm) {
+  emit_rex(true, 0, dst);
+  emit_byte(0xb8 | (dst & 7));
+  auto offset = m_code.size();
+  emit_imm64(imm);
+  return offset;
+}
+
+void X86Assembler::lea(X86Reg dst, const X86Mem &src) {
+  emit_rex(true, dst, src);
+  emit_byte(0x8d);
+  emit_modrm(dst, src);
+}
+
+void X86Assembler::alu(X86AluOp op, X86Reg dst, X86Reg src) {
+  emit_rex(true, src, dst);
+  emit_byte(op);
+  emit_modrm(src, dst);
+}
+
+// "op r64, r/m64" form has direction bit set.
+void X86Assembler::alu(X86AluOp op, X86Reg dst, const X86Mem &src) {
+  emit_rex(true, dst, src);
+  emit_byte(op | 2);
+  emit_modrm(dst, src);
+}
+
+void X86Assembler::alu(X86AluOp op, X86Reg dst, int32_t imm) {
+  emit_rex(true, 0, dst);
+  if (fits_int8(imm)) {
+    emit_byte(0x83);
+    emit_modrm(op >> 3, dst);
+    emit_byte(static_cast<uint8_t>(imm));
+    return;
+  }
+  emit_byte(0x81);
+  emit_modrm(op >> 3, dst);
+  emit_imm32(imm);
+}
+
+void X86Assembler::imul(X86Reg dst, X86Reg src) {
+  emit_rex(true, dst, src);
+  emit_byte(0x0f);
+  emit_byte(0xaf);
+  emit_modrm(dst, src);
+}
+
+void X86Assembler::imul(X86Reg dst, const X86Mem &src) {
+  emit_rex(true, dst, src);
+  emit_byte(0x0f);
+  emit_byte(0xaf);
+  emit_modrm(dst, src);
+}
+
+void X86Assembler::imul(X86Reg dst, X86Reg src, int32_t imm) {
+  emit_rex(true, dst, src);
+  if (fits_int8(imm)) {
+    emit_byte(0x6b);
+    emit_modrm(dst, src);
+    emit_byte(static_cast<uint8_t>(imm));
+    return;
+  }
+  emit_byte(0x69);
+  emit_modrm(dst, src);
+  emit_imm32(imm);
+}
+
+void X86Assembler::unary(X86UnaryOp op, X86Reg reg) {
+  emit_rex(true, 0, reg);
+  emit_byte(0xf7);
+  emit_modrm(op, reg);
+}
+
+void X86Assembler::shift_cl(X86ShiftOp op, X86Reg reg) {
+  emit_rex(true, 0, reg);
+  emit_byte(0xd3);
+  emit_modrm(op, reg);
+}
+
+void X86Assembler::shift(X86ShiftOp op, X86Reg reg, uint8_t amount) {
+  emit_rex(true, 0, reg);
+  emit_byte(0xc1);
+  emit_modrm(op, reg);
+  emit_byte(amount & 63);
+}
+
+void X86Assembler::cqo() {
+  emit_byte(0x48);
+  emit_byte(0x99);
+}
+
+void X86Assembler::cmov(X86Cond cond, X86Reg dst, X86Reg src) {
+  emit_rex(true, dst, src);
+  emit_byte(0x0f);
+  emit_byte(0x40 | cond);
+  emit_modrm(dst, src);
+}
+
+void X86Assembler::cmov(X86Cond cond, X86Reg dst, const X86Mem &src) {
+  emit_rex(true, dst, src);
+  emit_byte(0x0f);
+  emit_byte(0x40 | cond);
+  emit_modrm(dst, src);
+}
+
+void X86Assembler::push(X86Reg reg) {
+  emit_rex(false, 0, reg);
+  emit_byte(0x50 | (reg & 7));
+}
+
+void X86Assembler::push(const X86Mem &mem) {
+  emit_rex(false, 0, mem);
+  emit_byte(0xff);
+  emit_modrm(6, mem);
+}
+
+void X86Assembler::push(int32_t imm) {
+  if (fits_int8(imm)) {
+    emit_byte(0x6a);
+    emit_byte(static_cast<uint8_t>(imm));
+    return;
+  }
+  emit_byte(0x68);
+  emit_imm32(imm);
+}
+
+void X86Assembler::pop(X86Reg reg) {
+  emit_rex(false, 0, reg);
+  emit_byte(0x58 | (reg & 7));
+}
+
+void X86Assembler::call(const X86Mem &target) {
+  emit_rex(false, 0, target);
+  emit_byte(0xff);
+  emit_modrm(2, target);
+}
+
+void X86Assembler::call(X86Reg target) {
+  emit_rex(false, 0, target);
+  emit_byte(0xff);
+  emit_modrm(2, target);
+}
+
+void X86Assembler::jmp(Label label) {
+  emit_byte(0xe9);
+  emit_rel32(label);
+}
+
+void X86Assembler::jmp(const X86Mem &target) {
+  emit_rex(false, 0, target);
+  emit_byte(0xff);
+  emit_modrm(4, target);
+}
+
+void X86Assembler::jmp(X86Reg target) {
+  emit_rex(false, 0, target);
+  emit_byte(0xff);
+  emit_modrm(4, target);
+}
+
+void X86Assembler::jcc(X86Cond cond, Label label) {
+  emit_byte(0x0f);
+  emit_byte(0x80 | cond);
+  emit_rel32(label);
+}
+
+void X86Assembler::ret() { emit_byte(0xc3); }
+
+} // namespace koda
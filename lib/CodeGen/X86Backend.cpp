@@ -0,0 +1,656 @@
+#include <CodeGen/X86Assembler.hpp>
+#include <CodeGen/X86Backend.hpp>
+#include <CodeGen/X86ISel.hpp>
+#include <Core/Compiler.h>
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+
+namespace koda {
+
+namespace {
+
+constexpr X86Reg ALLOCATABLE_REGS[] = {RBX, R12, R13, R14, R15,
+                                       RSI, RDI, R8,  R9,  R10};
+static_assert(std::size(ALLOCATABLE_REGS) == X86Backend::NUM_REGS);
+
+constexpr X86Reg ARG_REGS[] = {RDI, RSI, RDX, RCX, R8, R9};
+constexpr size_t NUM_ARG_REGS = std::size(ARG_REGS);
+
+constexpr int32_t SLOT_SIZE = 8;
+
+bool is_callee_saved(X86Reg reg) {
+  return reg == RBX || reg == R12 || reg == R13 || reg == R14 || reg == R15;
+}
+
+bool fits_int32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Frame layout below saved rbp:
+//   callee saved registers
+//   register parameters
+//   frame slots of LIR
+//   caller saved registers during calls
+class FunctionEmitter final {
+  LirFunction &m_func;
+
+  const void *const *m_call_table;
+
+  std::vector<CallRelocation> *m_relocations;
+
+  X86Assembler m_asm;
+
+  std::vector<X86Assembler::Label> m_labels;
+
+  std::vector<X86Reg> m_saved_regs;
+
+  std::vector<X86Reg> m_caller_saved_regs;
+
+  size_t m_spill_base = 0;
+
+  size_t m_call_save_base = 0;
+
+  size_t m_num_slots = 0;
+
+  int32_t get_slot_disp(size_t slot) const {
+    return -SLOT_SIZE * static_cast<int32_t>(m_saved_regs.size() + 1 + slot);
+  }
+
+  X86Mem get_mem(const LirOperand &operand) const {
+    return {RBP, get_slot_disp(m_spill_base + operand.get_slot())};
+  }
+
+  void load(X86Reg reg, const LirOperand &src);
+
+  // Values without location are not used.
+  void store(const LirOperand &dst, X86Reg reg);
+
+  void move(const LirOperand &dst, const LirOperand &src);
+
+  // Register holding operand, operand out of register is loaded into
+  // scratch.
+  X86Reg get_reg(const LirOperand &operand, X86Reg scratch) {
+    if (operand.is_preg()) {
+      return operand.get_preg();
+    }
+    load(scratch, operand);
+    return scratch;
+  }
+
+  // Result is computed in dst register unless it holds operand, which is
+  // read after dst is written.
+  static X86Reg get_work_reg(const LirOperand &dst,
+                             const LirOperand &late_src) {
+    return dst.is_preg() && dst != late_src ? dst.get_preg() : RAX;
+  }
+
+  void emit_parallel_moves(std::vector<LirMove> moves);
+
+  void emit_edge(const LirEdge &edge, const LirBlock *next);
+
+  void layout_frame();
+
+  void emit_prologue();
+
+  void emit_epilogue();
+
+  void emit_compare(const LirOperand &lhs, const LirOperand &rhs);
+
+  void emit_instruction(const LirInst &inst, const LirBlock &bb,
+                        const LirBlock *next);
+
+  void emit_alu(const LirInst &inst);
+
+  void emit_imul(const LirInst &inst);
+
+  void emit_shift(const LirInst &inst);
+
+  void emit_lea(const LirInst &inst);
+
+  void emit_select(const LirInst &inst);
+
+  void emit_cond_branch(const LirInst &inst, const LirBlock &bb,
+                        const LirBlock *next);
+
+  void emit_division(const LirInst &inst);
+
+  void emit_call(const LirInst &inst);
+
+public:
+  FunctionEmitter(LirFunction &func, size_t num_blocks,
+                  const void *const *call_table,
+                  std::vector<CallRelocation> *relocations)
+      : m_func(func), m_call_table(call_table), m_relocations(relocations) {
+    for (size_t idx = 0; idx < num_blocks; ++idx) {
+      m_labels.push_back(m_asm.make_label());
+    }
+  }
+
+  std::vector<uint8_t> run();
+};
+
+void FunctionEmitter::load(X86Reg reg, const LirOperand &src) {
+  switch (src.kind) {
+  case LirOperand::PREG:
+    if (src.get_preg() != reg) {
+      m_asm.mov(reg, src.get_preg());
+    }
+    break;
+  case LirOperand::SLOT:
+    m_asm.mov(reg, get_mem(src));
+    break;
+  case LirOperand::IMM:
+    m_asm.mov(reg, src.get_imm());
+    break;
+  default:
+    throw CodeGenError("Value used without location");
+  }
+}
+
+void FunctionEmitter::store(const LirOperand &dst, X86Reg reg) {
+  if (dst.is_preg()) {
+    if (dst.get_preg() != reg) {
+      m_asm.mov(dst.get_preg(), reg);
+    }
+  } else if (dst.is_slot()) {
+    m_asm.mov(get_mem(dst), reg);
+  }
+}
+
+void FunctionEmitter::move(const LirOperand &dst, const LirOperand &src) {
+  if (dst == src || dst.is_none()) {
+    return;
+  }
+  if (dst.is_preg()) {
+    load(dst.get_preg(), src);
+  } else if (src.is_imm() && fits_int32(src.get_imm())) {
+    m_asm.mov(get_mem(dst), static_cast<int32_t>(src.get_imm()));
+  } else {
+    store(dst, get_reg(src, RAX));
+  }
+}
+
+// Phis read their inputs simultaneously. Move is emitted when its
+// destination isn't read by other pending moves. If there is no such move,
+// remaining ones form cycles, which are broken by saving one destination
+// in r11.
+void FunctionEmitter::emit_parallel_moves(std::vector<LirMove> moves) {
+  while (!moves.empty()) {
+    auto ready = std::find_if(
+        moves.begin(), moves.end(), [&moves](const LirMove &move) {
+          return std::none_of(
+              moves.begin(), moves.end(),
+              [&move](const LirMove &other) { return other.src == move.dst; });
+        });
+    if (ready != moves.end()) {
+      move(ready->dst, ready->src);
+      moves.erase(ready);
+      continue;
+    }
+    auto saved = moves.front().dst;
+    auto temp = LirOperand::make_preg(R11);
+    move(temp, saved);
+    for (auto &&pending : moves) {
+      if (pending.src == saved) {
+        pending.src = temp;
+      }
+    }
+  }
+}
+
+void FunctionEmitter::emit_edge(const LirEdge &edge, const LirBlock *next) {
+  emit_parallel_moves(edge.moves);
+  if (next == nullptr || edge.succ != next->id) {
+    m_asm.jmp(m_labels[edge.succ]);
+  }
+}
+
+void FunctionEmitter::layout_frame() {
+  std::vector<bool> is_used(std::size(ALLOCATABLE_REGS), false);
+  bool has_calls = false;
+  auto mark = [&is_used](const LirOperand &operand) {
+    if (!operand.is_preg()) {
+      return;
+    }
+    auto reg = std::find(std::begin(ALLOCATABLE_REGS),
+                         std::end(ALLOCATABLE_REGS), operand.get_preg());
+    if (reg != std::end(ALLOCATABLE_REGS)) {
+      is_used[reg - std::begin(ALLOCATABLE_REGS)] = true;
+    }
+  };
+  for (auto &&bb : m_func) {
+    for (auto &&phi : bb.phis) {
+      mark(phi);
+    }
+    for (auto &&inst : bb.insts) {
+      has_calls |= inst.opcode == LIR_CALL;
+      mark(inst.dst);
+    }
+  }
+  for (size_t idx = 0; idx < is_used.size(); ++idx) {
+    if (!is_used[idx]) {
+      continue;
+    }
+    auto reg = ALLOCATABLE_REGS[idx];
+    if (is_callee_saved(reg)) {
+      m_saved_regs.push_back(reg);
+    } else if (has_calls) {
+      m_caller_saved_regs.push_back(reg);
+    }
+  }
+  m_spill_base = std::min(m_func.get_num_params(), NUM_ARG_REGS);
+  m_call_save_base = m_spill_base + m_func.get_num_slots();
+  m_num_slots = m_call_save_base + m_caller_saved_regs.size();
+  // Keep rsp 16 byte aligned for calls: return address and saved rbp take
+  // 16 bytes.
+  if ((m_saved_regs.size() + m_num_slots) % 2 != 0) {
+    ++m_num_slots;
+  }
+}
+
+void FunctionEmitter::emit_prologue() {
+  m_asm.push(RBP);
+  m_asm.mov(RBP, RSP);
+  for (auto &&reg : m_saved_regs) {
+    m_asm.push(reg);
+  }
+  if (m_num_slots != 0) {
+    m_asm.alu(ALU_SUB, RSP, static_cast<int32_t>(m_num_slots * SLOT_SIZE));
+  }
+  // Parameter registers are reused, so parameters are kept in frame.
+  for (size_t idx = 0; idx < m_spill_base; ++idx) {
+    m_asm.mov(X86Mem{RBP, get_slot_disp(idx)}, ARG_REGS[idx]);
+  }
+}
+
+void FunctionEmitter::emit_epilogue() {
+  m_asm.lea(RSP, X86Mem{RBP, -SLOT_SIZE *
+                                  static_cast<int32_t>(m_saved_regs.size())});
+  for (auto it = m_saved_regs.rbegin(); it != m_saved_regs.rend(); ++it) {
+    m_asm.pop(*it);
+  }
+  m_asm.pop(RBP);
+  m_asm.ret();
+}
+
+void FunctionEmitter::emit_compare(const LirOperand &lhs,
+                                   const LirOperand &rhs) {
+  auto reg = get_reg(lhs, RAX);
+  if (rhs.is_imm()) {
+    m_asm.alu(ALU_CMP, reg, static_cast<int32_t>(rhs.get_imm()));
+  } else if (rhs.is_slot()) {
+    m_asm.alu(ALU_CMP, reg, get_mem(rhs));
+  } else {
+    m_asm.alu(ALU_CMP, reg, get_reg(rhs, RCX));
+  }
+}
+
+void FunctionEmitter::emit_alu(const LirInst &inst) {
+  auto op = static_cast<X86AluOp>(inst.op);
+  auto lhs = inst.srcs[0];
+  auto rhs = inst.srcs[1];
+  if (op != ALU_SUB && rhs == inst.dst && lhs != rhs) {
+    std::swap(lhs, rhs);
+  }
+  auto work = get_work_reg(inst.dst, rhs);
+  load(work, lhs);
+  if (rhs.is_imm()) {
+    m_asm.alu(op, work, static_cast<int32_t>(rhs.get_imm()));
+  } else if (rhs.is_slot()) {
+    m_asm.alu(op, work, get_mem(rhs));
+  } else {
+    m_asm.alu(op, work, get_reg(rhs, RCX));
+  }
+  store(inst.dst, work);
+}
+
+void FunctionEmitter::emit_imul(const LirInst &inst) {
+  auto lhs = inst.srcs[0];
+  auto rhs = inst.srcs[1];
+  if (rhs.is_imm()) {
+    auto work = inst.dst.is_preg() ? inst.dst.get_preg() : RAX;
+    m_asm.imul(work, get_reg(lhs, RAX), static_cast<int32_t>(rhs.get_imm()));
+    store(inst.dst, work);
+    return;
+  }
+  if (rhs == inst.dst && lhs != rhs) {
+    std::swap(lhs, rhs);
+  }
+  auto work = get_work_reg(inst.dst, rhs);
+  load(work, lhs);
+  if (rhs.is_slot()) {
+    m_asm.imul(work, get_mem(rhs));
+  } else {
+    m_asm.imul(work, get_reg(rhs, RCX));
+  }
+  store(inst.dst, work);
+}
+
+// Hardware masks shift amount to 6 bits as IR does.
+void FunctionEmitter::emit_shift(const LirInst &inst) {
+  auto op = static_cast<X86ShiftOp>(inst.op);
+  auto &&amount = inst.srcs[1];
+  if (!amount.is_imm()) {
+    load(RCX, amount);
+  }
+  auto work = inst.dst.is_preg() ? inst.dst.get_preg() : RAX;
+  load(work, inst.srcs[0]);
+  if (amount.is_imm()) {
+    m_asm.shift(op, work, static_cast<uint8_t>(amount.get_imm()));
+  } else {
+    m_asm.shift_cl(op, work);
+  }
+  store(inst.dst, work);
+}
+
+void FunctionEmitter::emit_lea(const LirInst &inst) {
+  X86Mem addr{get_reg(inst.srcs[0], RAX), inst.disp};
+  if (inst.srcs.size() > 1) {
+    addr.index = get_reg(inst.srcs[1], RCX);
+    addr.scale = inst.scale;
+  }
+  auto work = inst.dst.is_preg() ? inst.dst.get_preg() : RAX;
+  m_asm.lea(work, addr);
+  store(inst.dst, work);
+}
+
+// Loads don't change flags of comparison.
+void FunctionEmitter::emit_select(const LirInst &inst) {
+  emit_compare(inst.srcs[0], inst.srcs[1]);
+  auto &&true_value = inst.srcs[2];
+  auto work = get_work_reg(inst.dst, true_value);
+  load(work, inst.srcs[3]);
+  auto cond = static_cast<X86Cond>(inst.op);
+  if (true_value.is_slot()) {
+    m_asm.cmov(cond, work, get_mem(true_value));
+  } else {
+    m_asm.cmov(cond, work, get_reg(true_value, RDX));
+  }
+  store(inst.dst, work);
+}
+
+void FunctionEmitter::emit_cond_branch(const LirInst &inst,
+                                       const LirBlock &bb,
+                                       const LirBlock *next) {
+  auto &&false_edge = bb.edges[0];
+  auto &&true_edge = bb.edges[1];
+  emit_compare(inst.srcs[0], inst.srcs[1]);
+  auto cond = static_cast<X86Cond>(inst.op);
+  if (true_edge.moves.empty() && next != nullptr &&
+      true_edge.succ == next->id && false_edge.moves.empty()) {
+    m_asm.jcc(invert_cond(cond), m_labels[false_edge.succ]);
+    return;
+  }
+  if (true_edge.moves.empty()) {
+    m_asm.jcc(cond, m_labels[true_edge.succ]);
+  } else {
+    // Moves of true edge are placed before false edge.
+    auto false_label = m_asm.make_label();
+    m_asm.jcc(invert_cond(cond), false_label);
+    emit_parallel_moves(true_edge.moves);
+    m_asm.jmp(m_labels[true_edge.succ]);
+    m_asm.bind(false_label);
+  }
+  emit_edge(false_edge, next);
+}
+
+// x86 idiv traps on INT64_MIN / -1, so division by -1 is negation.
+void FunctionEmitter::emit_division(const LirInst &inst) {
+  bool is_div = inst.opcode == LIR_DIV;
+  auto divide = m_asm.make_label();
+  auto done = m_asm.make_label();
+  load(RAX, inst.srcs[0]);
+  load(RCX, inst.srcs[1]);
+  m_asm.alu(ALU_CMP, RCX, -1);
+  m_asm.jcc(COND_NE, divide);
+  if (is_div) {
+    m_asm.unary(UNARY_NEG, RAX);
+  } else {
+    m_asm.alu(ALU_XOR, RAX, RAX);
+  }
+  m_asm.jmp(done);
+  m_asm.bind(divide);
+  m_asm.cqo();
+  m_asm.unary(UNARY_IDIV, RCX);
+  if (!is_div) {
+    m_asm.mov(RAX, RDX);
+  }
+  m_asm.bind(done);
+  store(inst.dst, RAX);
+}
+
+// Arguments are pushed from their locations and popped into argument
+// registers, so locations can't be overwritten before they are read.
+// Arguments beyond registers are left on stack.
+void FunctionEmitter::emit_call(const LirInst &inst) {
+  if (m_call_table == nullptr) {
+    throw CodeGenError("Calls require table of callees");
+  }
+  for (size_t idx = 0; idx < m_caller_saved_regs.size(); ++idx) {
+    m_asm.mov(X86Mem{RBP, get_slot_disp(m_call_save_base + idx)},
+              m_caller_saved_regs[idx]);
+  }
+  auto num_args = inst.srcs.size();
+  auto num_stack_args = num_args > NUM_ARG_REGS ? num_args - NUM_ARG_REGS : 0;
+  auto stack_size = static_cast<int32_t>(
+      (num_stack_args + num_stack_args % 2) * SLOT_SIZE);
+  if (num_stack_args % 2 != 0) {
+    m_asm.alu(ALU_SUB, RSP, SLOT_SIZE);
+  }
+  for (size_t idx = num_args; idx-- > 0;) {
+    auto &&arg = inst.srcs[idx];
+    if (arg.is_imm()) {
+      m_asm.push(static_cast<int32_t>(arg.get_imm()));
+    } else if (arg.is_slot()) {
+      m_asm.push(get_mem(arg));
+    } else {
+      m_asm.push(get_reg(arg, RAX));
+    }
+  }
+  for (size_t idx = 0; idx < std::min(num_args, NUM_ARG_REGS); ++idx) {
+    m_asm.pop(ARG_REGS[idx]);
+  }
+  auto offset = m_asm.mov_imm64(
+      RAX, reinterpret_cast<int64_t>(&m_call_table[inst.index]));
+  if (m_relocations != nullptr) {
+    m_relocations->push_back({static_cast<uint32_t>(offset), inst.index});
+  }
+  m_asm.call(X86Mem{RAX, 0});
+  if (stack_size != 0) {
+    m_asm.alu(ALU_ADD, RSP, stack_size);
+  }
+  for (size_t idx = 0; idx < m_caller_saved_regs.size(); ++idx) {
+    m_asm.mov(m_caller_saved_regs[idx],
+              X86Mem{RBP, get_slot_disp(m_call_save_base + idx)});
+  }
+  store(inst.dst, RAX);
+}
+
+void FunctionEmitter::emit_instruction(const LirInst &inst,
+                                       const LirBlock &bb,
+                                       const LirBlock *next) {
+  if (inst.is_pure() && inst.dst.is_none()) {
+    return;
+  }
+  switch (inst.opcode) {
+  case LIR_MOV:
+    move(inst.dst, inst.srcs[0]);
+    break;
+  case LIR_LEA:
+    emit_lea(inst);
+    break;
+  case LIR_ALU:
+    emit_alu(inst);
+    break;
+  case LIR_IMUL:
+    emit_imul(inst);
+    break;
+  case LIR_SHIFT:
+    emit_shift(inst);
+    break;
+  case LIR_UNARY: {
+    auto work = inst.dst.is_preg() ? inst.dst.get_preg() : RAX;
+    load(work, inst.srcs[0]);
+    m_asm.unary(static_cast<X86UnaryOp>(inst.op), work);
+    store(inst.dst, work);
+    break;
+  }
+  case LIR_MULH:
+    load(RAX, inst.srcs[0]);
+    load(RCX, inst.srcs[1]);
+    m_asm.unary(UNARY_IMUL_WIDE, RCX);
+    store(inst.dst, RDX);
+    break;
+  case LIR_DIV:
+  case LIR_MOD:
+    emit_division(inst);
+    break;
+  case LIR_PARAM: {
+    // Stack parameters are above return address and saved rbp.
+    auto idx = inst.index;
+    X86Mem src{RBP, idx < NUM_ARG_REGS
+                        ? get_slot_disp(idx)
+                        : static_cast<int32_t>(2 * SLOT_SIZE +
+                                               (idx - NUM_ARG_REGS) *
+                                                   SLOT_SIZE)};
+    auto work = inst.dst.is_preg() ? inst.dst.get_preg() : RAX;
+    m_asm.mov(work, src);
+    store(inst.dst, work);
+    break;
+  }
+  case LIR_SELECT:
+    emit_select(inst);
+    break;
+  case LIR_CALL:
+    emit_call(inst);
+    break;
+  case LIR_BRANCH:
+    emit_cond_branch(inst, bb, next);
+    break;
+  case LIR_JUMP:
+    emit_edge(bb.edges[0], next);
+    break;
+  case LIR_RET:
+    load(RAX, inst.srcs[0]);
+    emit_epilogue();
+    break;
+  default:
+    throw CodeGenError(std::string("Unsupported LIR instruction ") +
+                       lir_opc_to_str(inst.opcode));
+  }
+}
+
+std::vector<uint8_t> FunctionEmitter::run() {
+  layout_frame();
+  emit_prologue();
+  if (m_func.size() == 0 || m_func.begin()->id != m_func.get_entry()) {
+    m_asm.jmp(m_labels[m_func.get_entry()]);
+  }
+  for (auto bb = m_func.begin(); bb != m_func.end(); ++bb) {
+    auto next = std::next(bb) != m_func.end() ? &*std::next(bb) : nullptr;
+    m_asm.bind(m_labels[bb->id]);
+    for (auto &&inst : bb->insts) {
+      emit_instruction(inst, *bb, next);
+    }
+  }
+  return m_asm.finalize();
+}
+
+} // namespace
+
+LirFunction X86Backend::lower(Compiler &comp) {
+  auto func = X86ISel::select(comp);
+  RegAlloc regalloc;
+  regalloc.run(func.get_live_intervals(), func.get_num_vregs(),
+               comp.get_num_pregs());
+  func.assign_locations(regalloc, ALLOCATABLE_REGS, NUM_REGS);
+  return func;
+}
+
+std::vector<uint8_t>
+X86Backend::emit(Compiler &comp, const void *const *call_table,
+                 std::vector<CallRelocation> *relocations) {
+  auto func = lower(comp);
+  return FunctionEmitter(func, comp.graph().size(), call_table, relocations)
+      .run();
+}
+
+void X86Backend::relocate(std::vector<uint8_t> &code,
+                          const std::vector<CallRelocation> &relocations,
+                          const void *const *call_table) {
+  for (auto &&reloc : relocations) {
+    if (reloc.offset + sizeof(int64_t) > code.size()) {
+      throw CodeGenError("Relocation out of code");
+    }
+    auto addr = reinterpret_cast<int64_t>(&call_table[reloc.callee]);
+    std::memcpy(code.data() + reloc.offset, &addr, sizeof(addr));
+  }
+}
+
+std::vector<uint8_t> X86Backend::emit_array_stub(const void *entry,
+                                                 size_t num_params) {
+  X86Assembler masm;
+  masm.push(RBP);
+  masm.mov(RBP, RSP);
+  masm.mov(RAX, RDI);
+  auto num_stack_params =
+      num_params > NUM_ARG_REGS ? num_params - NUM_ARG_REGS : 0;
+  if (num_stack_params % 2 != 0) {
+    masm.alu(ALU_SUB, RSP, SLOT_SIZE);
+  }
+  for (size_t idx = num_params; idx-- > NUM_ARG_REGS;) {
+    masm.push(X86Mem{RAX, static_cast<int32_t>(idx * SLOT_SIZE)});
+  }
+  for (size_t idx = 0; idx < std::min(num_params, NUM_ARG_REGS); ++idx) {
+    masm.mov(ARG_REGS[idx], X86Mem{RAX, static_cast<int32_t>(idx * SLOT_SIZE)});
+  }
+  masm.mov(RAX, reinterpret_cast<int64_t>(entry));
+  masm.call(RAX);
+  masm.mov(RSP, RBP);
+  masm.pop(RBP);
+  masm.ret();
+  return masm.finalize();
+}
+
+// Resolver stubs pass id in r11 to the shared part, which keeps parameter
+// registers and stack parameters of the caller intact.
+LazyStubCode X86Backend::emit_lazy_stubs(const void *const *call_table,
+                                         size_t num_functions,
+                                         ResolveFn resolve, void *context) {
+  X86Assembler masm;
+  LazyStubCode stubs;
+  auto resolve_label = masm.make_label();
+  for (size_t id = 0; id < num_functions; ++id) {
+    stubs.entries.push_back(masm.size());
+    masm.mov_imm64(RAX, reinterpret_cast<int64_t>(&call_table[id]));
+    masm.jmp(X86Mem{RAX, 0});
+  }
+  for (size_t id = 0; id < num_functions; ++id) {
+    stubs.resolvers.push_back(masm.size());
+    masm.mov(R11, static_cast<int64_t>(id));
+    masm.jmp(resolve_label);
+  }
+  // Return address, saved rbp and six parameter registers keep rsp 16 byte
+  // aligned.
+  masm.bind(resolve_label);
+  masm.push(RBP);
+  masm.mov(RBP, RSP);
+  for (auto &&reg : ARG_REGS) {
+    masm.push(reg);
+  }
+  masm.mov(RDI, reinterpret_cast<int64_t>(context));
+  masm.mov(RSI, R11);
+  masm.mov(RAX, reinterpret_cast<int64_t>(resolve));
+  masm.call(RAX);
+  for (auto it = std::rbegin(ARG_REGS); it != std::rend(ARG_REGS); ++it) {
+    masm.pop(*it);
+  }
+  masm.pop(RBP);
+  masm.jmp(RAX);
+  stubs.code = masm.finalize();
+  return stubs;
+}
+
+} // namespace koda
@@ -0,0 +1,574 @@
+#include <CodeGen/X86Assembler.hpp>
+#include <CodeGen/X86Baseline.hpp>
+#include <CodeGen/X86ISel.hpp>
+#include <Core/Analysis.hpp>
+#include <IR/ProgramGraph.hpp>
+
+#include <algorithm>
+#include <array>
+#include <optional>
+
+namespace koda {
+
+namespace {
+
+// Caller saved registers which aren't needed by division, shifts and
+// returns. Parameter registers are free after prologue.
+constexpr X86Reg CACHE_REGS[] = {RSI, RDI, R8, R9, R10, R11};
+constexpr size_t NUM_CACHE_REGS = std::size(CACHE_REGS);
+
+constexpr X86Reg ARG_REGS[] = {RDI, RSI, RDX, RCX, R8, R9};
+constexpr size_t NUM_ARG_REGS = std::size(ARG_REGS);
+
+constexpr int32_t SLOT_SIZE = 8;
+constexpr int32_t NO_SLOT = -1;
+
+std::optional<int64_t> get_const(const Instruction &inst) {
+  if (inst.get_opcode() != INST_CONST) {
+    return std::nullopt;
+  }
+  return static_cast<const LoadConstant<int64_t> &>(inst).get_value();
+}
+
+// Constant which fits into sign extended imm32.
+std::optional<int32_t> get_imm32(const Instruction &inst) {
+  auto value = get_const(inst);
+  if (!value || *value < INT32_MIN || *value > INT32_MAX) {
+    return std::nullopt;
+  }
+  return static_cast<int32_t>(*value);
+}
+
+// Values held by cache registers. Registers returned while instruction is
+// encoded are locked, so its operands aren't evicted by each other.
+class RegCache final {
+  std::array<const Instruction *, NUM_CACHE_REGS> m_values{};
+
+  std::array<uint64_t, NUM_CACHE_REGS> m_last_use{};
+
+  uint64_t m_clock = 0;
+
+  unsigned m_locked = 0;
+
+  X86Reg use(size_t idx) {
+    m_last_use[idx] = ++m_clock;
+    m_locked |= 1u << idx;
+    return CACHE_REGS[idx];
+  }
+
+public:
+  std::optional<X86Reg> find(const Instruction &value) {
+    for (size_t idx = 0; idx < NUM_CACHE_REGS; ++idx) {
+      if (m_values[idx] == &value) {
+        return use(idx);
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Evicts least recently used unlocked register and binds it to value.
+  X86Reg take(const Instruction &value) {
+    size_t victim = NUM_CACHE_REGS;
+    for (size_t idx = 0; idx < NUM_CACHE_REGS; ++idx) {
+      if ((m_locked & (1u << idx)) == 0 &&
+          (victim == NUM_CACHE_REGS || m_last_use[idx] < m_last_use[victim])) {
+        victim = idx;
+      }
+    }
+    m_values[victim] = &value;
+    return use(victim);
+  }
+
+  void forget(const Instruction &value) {
+    std::replace(m_values.begin(), m_values.end(), &value,
+                 static_cast<const Instruction *>(nullptr));
+  }
+
+  void unlock() { m_locked = 0; }
+
+  void clear() {
+    m_values.fill(nullptr);
+    m_locked = 0;
+  }
+};
+
+// Frame layout below saved rbp:
+//   register parameters
+//   values
+//   copies of phis for parallel moves
+class BaselineEmitter final {
+  ProgramGraph &m_graph;
+
+  const void *const *m_call_table;
+
+  std::vector<CallRelocation> *m_relocations;
+
+  X86Assembler m_asm;
+
+  std::vector<X86Assembler::Label> m_labels;
+
+  std::vector<int32_t> m_slots;
+
+  std::vector<int32_t> m_phi_copies;
+
+  int32_t m_num_slots = 0;
+
+  RegCache m_cache;
+
+  static X86Mem get_mem(int32_t slot) { return {RBP, -SLOT_SIZE * (slot + 1)}; }
+
+  X86Mem get_mem(const Instruction &value) const {
+    return get_mem(m_slots[value.get_id()]);
+  }
+
+  int32_t create_slot() { return m_num_slots++; }
+
+  void layout_frame(const RPOAnalysis &rpo);
+
+  // Register holding value.
+  X86Reg use(const Instruction &value);
+
+  // Cache register for result of inst.
+  X86Reg def(const Instruction &inst) { return m_cache.take(inst); }
+
+  void store(const Instruction &inst, X86Reg reg) {
+    m_asm.mov(get_mem(inst), reg);
+    m_cache.unlock();
+  }
+
+  // Puts the value into memory without going through cache.
+  void store(const X86Mem &dst, const Instruction &value);
+
+  void emit_phi_moves(BasicBlock *bb, BasicBlock *succ);
+
+  void emit_edge(BasicBlock *bb, BasicBlock *succ, const BasicBlock *next) {
+    emit_phi_moves(bb, succ);
+    if (succ != next) {
+      m_asm.jmp(m_labels[succ->get_id()]);
+    }
+  }
+
+  // Returns condition of flags, operands may be swapped.
+  X86Cond emit_compare(CmpFlag flag, const Instruction &lhs,
+                       const Instruction &rhs);
+
+  void emit_instruction(Instruction &inst, const BasicBlock *next);
+
+  void emit_alu(X86AluOp op, Instruction &inst);
+
+  void emit_mul(Instruction &inst);
+
+  void emit_shift(X86ShiftOp op, Instruction &inst);
+
+  void emit_division(Instruction &inst);
+
+  void emit_select(SelectInstruction &inst);
+
+  void emit_cond_branch(ConditionalBranchInstruction &inst,
+                        const BasicBlock *next);
+
+  void emit_call(CallInstruction &inst);
+
+public:
+  BaselineEmitter(ProgramGraph &graph, const void *const *call_table,
+                  std::vector<CallRelocation> *relocations)
+      : m_graph(graph), m_call_table(call_table), m_relocations(relocations),
+        m_slots(graph.get_instr_count(), NO_SLOT),
+        m_phi_copies(graph.get_instr_count(), NO_SLOT) {
+    for (size_t idx = 0; idx < graph.size(); ++idx) {
+      m_labels.push_back(m_asm.make_label());
+    }
+  }
+
+  std::vector<uint8_t> run();
+};
+
+void BaselineEmitter::layout_frame(const RPOAnalysis &rpo) {
+  m_num_slots = static_cast<int32_t>(
+      std::min(m_graph.get_num_params(), NUM_ARG_REGS));
+  for (auto &&id : rpo) {
+    for (auto &&inst : *m_graph.get_bb(id)) {
+      auto type = inst.get_type();
+      if (type != INTEGER && type != NONE) {
+        throw CodeGenError("Only integer values are supported");
+      }
+      if (inst.is_phi()) {
+        m_slots[inst.get_id()] = create_slot();
+      } else if (type != NONE && inst.get_opcode() != INST_CONST &&
+                 inst.get_num_users() != 0) {
+        m_slots[inst.get_id()] = create_slot();
+      }
+    }
+  }
+  for (auto &&id : rpo) {
+    for (auto &&inst : *m_graph.get_bb(id)) {
+      if (inst.is_phi()) {
+        m_phi_copies[inst.get_id()] = create_slot();
+      }
+    }
+  }
+  // Keep rsp 16 byte aligned for calls.
+  m_num_slots += m_num_slots % 2;
+}
+
+X86Reg BaselineEmitter::use(const Instruction &value) {
+  if (auto reg = m_cache.find(value)) {
+    return *reg;
+  }
+  auto reg = m_cache.take(value);
+  if (auto imm = get_const(value)) {
+    m_asm.mov(reg, *imm);
+  } else {
+    m_asm.mov(reg, get_mem(value));
+  }
+  return reg;
+}
+
+void BaselineEmitter::store(const X86Mem &dst, const Instruction &value) {
+  if (auto imm = get_imm32(value)) {
+    m_asm.mov(dst, *imm);
+  } else {
+    m_asm.mov(dst, use(value));
+  }
+  m_cache.unlock();
+}
+
+// Phis of successor read their inputs simultaneously. If some input is a
+// phi of the same successor, inputs are copied to frame first.
+void BaselineEmitter::emit_phi_moves(BasicBlock *bb, BasicBlock *succ) {
+  std::vector<std::pair<PhiInstruction *, Instruction *>> moves;
+  for (auto &&inst : *succ) {
+    if (!inst.is_phi()) {
+      break;
+    }
+    auto &&phi = static_cast<PhiInstruction &>(inst);
+    moves.emplace_back(&phi, phi.get_value_for(bb));
+  }
+  bool is_cyclic = std::any_of(moves.begin(), moves.end(), [succ](auto &&move) {
+    return move.second->is_phi() && move.second->get_bb() == succ;
+  });
+  for (auto &&[phi, value] : moves) {
+    if (is_cyclic) {
+      store(get_mem(m_phi_copies[phi->get_id()]), *value);
+    } else if (phi != value) {
+      store(get_mem(*phi), *value);
+      m_cache.forget(*phi);
+    }
+  }
+  if (!is_cyclic) {
+    return;
+  }
+  for (auto &&[phi, value] : moves) {
+    m_asm.mov(RAX, get_mem(m_phi_copies[phi->get_id()]));
+    m_asm.mov(get_mem(*phi), RAX);
+    m_cache.forget(*phi);
+  }
+}
+
+X86Cond BaselineEmitter::emit_compare(CmpFlag flag, const Instruction &lhs,
+                                      const Instruction &rhs) {
+  if (get_imm32(lhs) && !get_imm32(rhs)) {
+    return emit_compare(swap_flag(flag), rhs, lhs);
+  }
+  auto reg = use(lhs);
+  if (auto imm = get_imm32(rhs)) {
+    m_asm.alu(ALU_CMP, reg, *imm);
+  } else {
+    m_asm.alu(ALU_CMP, reg, use(rhs));
+  }
+  m_cache.unlock();
+  return get_x86_cond(flag);
+}
+
+void BaselineEmitter::emit_alu(X86AluOp op, Instruction &inst) {
+  auto lhs = use(*inst.get_input(0));
+  auto imm = get_imm32(*inst.get_input(1));
+  auto rhs = imm ? lhs : use(*inst.get_input(1));
+  auto dst = def(inst);
+  m_asm.mov(dst, lhs);
+  if (imm) {
+    m_asm.alu(op, dst, *imm);
+  } else {
+    m_asm.alu(op, dst, rhs);
+  }
+  store(inst, dst);
+}
+
+void BaselineEmitter::emit_mul(Instruction &inst) {
+  auto lhs = use(*inst.get_input(0));
+  if (auto imm = get_imm32(*inst.get_input(1))) {
+    auto dst = def(inst);
+    m_asm.imul(dst, lhs, *imm);
+    store(inst, dst);
+    return;
+  }
+  auto rhs = use(*inst.get_input(1));
+  auto dst = def(inst);
+  m_asm.mov(dst, lhs);
+  m_asm.imul(dst, rhs);
+  store(inst, dst);
+}
+
+// Hardware masks shift amount to 6 bits as IR does.
+void BaselineEmitter::emit_shift(X86ShiftOp op, Instruction &inst) {
+  auto amount = get_const(*inst.get_input(1));
+  if (!amount) {
+    m_asm.mov(RCX, use(*inst.get_input(1)));
+  }
+  auto lhs = use(*inst.get_input(0));
+  auto dst = def(inst);
+  m_asm.mov(dst, lhs);
+  if (amount) {
+    m_asm.shift(op, dst, static_cast<uint8_t>(*amount));
+  } else {
+    m_asm.shift_cl(op, dst);
+  }
+  store(inst, dst);
+}
+
+// x86 idiv traps on INT64_MIN / -1, so division by -1 is negation.
+void BaselineEmitter::emit_division(Instruction &inst) {
+  bool is_div = inst.get_opcode() == INST_DIV;
+  auto divide = m_asm.make_label();
+  auto done = m_asm.make_label();
+  m_asm.mov(RAX, use(*inst.get_input(0)));
+  m_asm.mov(RCX, use(*inst.get_input(1)));
+  m_asm.alu(ALU_CMP, RCX, -1);
+  m_asm.jcc(COND_NE, divide);
+  if (is_div) {
+    m_asm.unary(UNARY_NEG, RAX);
+  } else {
+    m_asm.alu(ALU_XOR, RAX, RAX);
+  }
+  m_asm.jmp(done);
+  m_asm.bind(divide);
+  m_asm.cqo();
+  m_asm.unary(UNARY_IDIV, RCX);
+  if (!is_div) {
+    m_asm.mov(RAX, RDX);
+  }
+  m_asm.bind(done);
+  store(inst, RAX);
+}
+
+// Moves don't change flags, so comparison is the last.
+void BaselineEmitter::emit_select(SelectInstruction &inst) {
+  auto true_value = use(*inst.get_true_value());
+  auto false_value = use(*inst.get_false_value());
+  auto dst = def(inst);
+  m_asm.mov(dst, false_value);
+  auto cond = emit_compare(inst.get_flag(), *inst.get_lhs(), *inst.get_rhs());
+  m_asm.cmov(cond, dst, true_value);
+  store(inst, dst);
+}
+
+void BaselineEmitter::emit_cond_branch(ConditionalBranchInstruction &inst,
+                                       const BasicBlock *next) {
+  auto cond = emit_compare(inst.get_flag(), *inst.get_input(0),
+                           *inst.get_input(1));
+  auto bb = inst.get_bb();
+  auto false_succ = bb->get_false_successor();
+  auto true_succ = bb->get_true_successor();
+  auto has_phis = [](const BasicBlock *succ) {
+    return !succ->empty() && succ->front().is_phi();
+  };
+  if (!has_phis(true_succ) && !has_phis(false_succ) && true_succ == next) {
+    m_asm.jcc(invert_cond(cond), m_labels[false_succ->get_id()]);
+    return;
+  }
+  if (!has_phis(true_succ)) {
+    m_asm.jcc(cond, m_labels[true_succ->get_id()]);
+  } else {
+    // Moves of true edge are placed before false edge, which starts with
+    // registers of the branch.
+    auto false_label = m_asm.make_label();
+    m_asm.jcc(invert_cond(cond), false_label);
+    auto cache = m_cache;
+    emit_edge(bb, true_succ, nullptr);
+    m_asm.bind(false_label);
+    m_cache = cache;
+  }
+  emit_edge(bb, false_succ, next);
+}
+
+// Arguments are pushed and popped into argument registers, the ones beyond
+// registers are left on stack.
+void BaselineEmitter::emit_call(CallInstruction &inst) {
+  if (m_call_table == nullptr) {
+    throw CodeGenError("Calls require table of callees");
+  }
+  auto num_args = inst.get_num_inputs();
+  auto num_stack_args = num_args > NUM_ARG_REGS ? num_args - NUM_ARG_REGS : 0;
+  auto stack_size = static_cast<int32_t>(
+      (num_stack_args + num_stack_args % 2) * SLOT_SIZE);
+  if (num_stack_args % 2 != 0) {
+    m_asm.alu(ALU_SUB, RSP, SLOT_SIZE);
+  }
+  for (size_t idx = num_args; idx-- > 0;) {
+    auto &&arg = *inst.get_input(idx);
+    if (auto imm = get_imm32(arg)) {
+      m_asm.push(*imm);
+    } else if (auto reg = m_cache.find(arg)) {
+      m_asm.push(*reg);
+    } else if (auto value = get_const(arg)) {
+      m_asm.mov(RAX, *value);
+      m_asm.push(RAX);
+    } else {
+      m_asm.push(get_mem(arg));
+    }
+  }
+  for (size_t idx = 0; idx < std::min(num_args, NUM_ARG_REGS); ++idx) {
+    m_asm.pop(ARG_REGS[idx]);
+  }
+  auto callee = static_cast<uint32_t>(inst.get_callee());
+  auto offset = m_asm.mov_imm64(
+      RAX, reinterpret_cast<int64_t>(&m_call_table[callee]));
+  if (m_relocations != nullptr) {
+    m_relocations->push_back({static_cast<uint32_t>(offset), callee});
+  }
+  m_asm.call(X86Mem{RAX, 0});
+  if (stack_size != 0) {
+    m_asm.alu(ALU_ADD, RSP, stack_size);
+  }
+  m_cache.clear();
+  if (m_slots[inst.get_id()] != NO_SLOT) {
+    store(inst, RAX);
+  }
+}
+
+void BaselineEmitter::emit_instruction(Instruction &inst,
+                                       const BasicBlock *next) {
+  auto opcode = inst.get_opcode();
+  if (!inst.is_terminator() && opcode != INST_CALL &&
+      m_slots[inst.get_id()] == NO_SLOT) {
+    return;
+  }
+  switch (opcode) {
+  case INST_PHI:
+    break;
+  case INST_PARAM: {
+    // Stack parameters are above return address and saved rbp.
+    auto idx = static_cast<LoadParam &>(inst).get_index();
+    auto dst = def(inst);
+    m_asm.mov(dst, idx < NUM_ARG_REGS
+                       ? get_mem(static_cast<int32_t>(idx))
+                       : X86Mem{RBP, static_cast<int32_t>(
+                                         (2 + idx - NUM_ARG_REGS) * SLOT_SIZE)});
+    store(inst, dst);
+    break;
+  }
+  case INST_ADD:
+    emit_alu(ALU_ADD, inst);
+    break;
+  case INST_SUB:
+    emit_alu(ALU_SUB, inst);
+    break;
+  case INST_AND:
+    emit_alu(ALU_AND, inst);
+    break;
+  case INST_OR:
+    emit_alu(ALU_OR, inst);
+    break;
+  case INST_XOR:
+    emit_alu(ALU_XOR, inst);
+    break;
+  case INST_MUL:
+    emit_mul(inst);
+    break;
+  case INST_SHL:
+    emit_shift(SHIFT_SHL, inst);
+    break;
+  case INST_SHR:
+    emit_shift(SHIFT_SHR, inst);
+    break;
+  case INST_ASHR:
+    emit_shift(SHIFT_SAR, inst);
+    break;
+  case INST_NOT: {
+    auto src = use(*inst.get_input(0));
+    auto dst = def(inst);
+    m_asm.mov(dst, src);
+    m_asm.unary(UNARY_NOT, dst);
+    store(inst, dst);
+    break;
+  }
+  case INST_MULH:
+    m_asm.mov(RAX, use(*inst.get_input(0)));
+    m_asm.mov(RCX, use(*inst.get_input(1)));
+    m_asm.unary(UNARY_IMUL_WIDE, RCX);
+    store(inst, RDX);
+    break;
+  case INST_DIV:
+  case INST_MOD:
+    emit_division(inst);
+    break;
+  case INST_SELECT:
+    emit_select(static_cast<SelectInstruction &>(inst));
+    break;
+  case INST_CALL:
+    emit_call(static_cast<CallInstruction &>(inst));
+    break;
+  case INST_BRANCH:
+    emit_edge(inst.get_bb(), inst.get_bb()->get_uncond_successor(), next);
+    break;
+  case INST_COND_BR:
+    emit_cond_branch(static_cast<ConditionalBranchInstruction &>(inst), next);
+    break;
+  case INST_RET:
+    if (inst.get_num_inputs() != 0) {
+      m_asm.mov(RAX, use(*inst.get_input(0)));
+      m_cache.unlock();
+    }
+    m_asm.mov(RSP, RBP);
+    m_asm.pop(RBP);
+    m_asm.ret();
+    break;
+  default:
+    throw CodeGenError(std::string("Unsupported instruction ") +
+                       inst_opc_to_str(opcode));
+  }
+}
+
+std::vector<uint8_t> BaselineEmitter::run() {
+  RPOAnalysis rpo;
+  rpo.run(m_graph);
+  layout_frame(rpo);
+  m_asm.push(RBP);
+  m_asm.mov(RBP, RSP);
+  if (m_num_slots != 0) {
+    m_asm.alu(ALU_SUB, RSP, m_num_slots * SLOT_SIZE);
+  }
+  auto num_reg_params = std::min(m_graph.get_num_params(), NUM_ARG_REGS);
+  for (size_t idx = 0; idx < num_reg_params; ++idx) {
+    m_asm.mov(get_mem(static_cast<int32_t>(idx)), ARG_REGS[idx]);
+  }
+  for (auto it = rpo.begin(); it != rpo.end(); ++it) {
+    auto bb = m_graph.get_bb(*it);
+    auto next =
+        std::next(it) != rpo.end() ? m_graph.get_bb(*std::next(it)) : nullptr;
+    m_asm.bind(m_labels[bb->get_id()]);
+    m_cache.clear();
+    for (auto &&inst : *bb) {
+      emit_instruction(inst, next);
+    }
+    // Block without terminator falls to its successor.
+    if ((bb->empty() || !bb->back().is_terminator()) &&
+        bb->get_num_successors() == 1) {
+      emit_edge(bb, bb->get_uncond_successor(), next);
+    }
+  }
+  return m_asm.finalize();
+}
+
+} // namespace
+
+std::vector<uint8_t>
+X86Baseline::emit(ProgramGraph &graph, const void *const *call_table,
+                  std::vector<CallRelocation> *relocations) {
+  if (graph.get_entry() == nullptr) {
+    throw CodeGenError("Function has no entry");
+  }
+  return BaselineEmitter(graph, call_table, relocations).run();
+}
+
+} // namespace koda
@@ -0,0 +1,659 @@
+#include <CodeGen/X86Backend.hpp>
+#include <CodeGen/X86ISel.hpp>
+#include <Core/Compiler.h>
+#include <IR/ProgramGraph.hpp>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <optional>
+
+namespace koda {
+
+namespace {
+
+enum Nonterm : uint8_t {
+  NT_REG,
+  // Constant fitting into sign extended imm32.
+  NT_IMM,
+  // reg * scale
+  NT_INDEX,
+  // reg + reg * scale
+  NT_BASE_INDEX,
+  // reg + [reg * scale] + disp
+  NT_ADDR,
+  // Terminator
+  NT_STMT,
+  NUM_NONTERMS
+};
+
+// Reduced subtree. NT_REG value and NT_IMM immediate are kept in base.
+struct Value {
+  LirOperand base{};
+  LirOperand index{};
+  uint8_t scale = 1;
+  int32_t disp = 0;
+};
+
+class Selector;
+struct Rule;
+
+using Action = Value (*)(Selector &sel, const Rule &rule, Instruction &inst,
+                         const Value *kids, LirOperand dst);
+
+constexpr size_t MAX_KIDS = 2;
+
+// Node of opcode with inputs derived to kids is derived to lhs. Chain rules
+// have INST_INVALID opcode and derive lhs from nonterminal kids[0] of the
+// same node. Action emits code of rule, dst is the register of NT_REG.
+struct Rule {
+  Nonterm lhs;
+  InstOpcode opcode;
+  std::array<Nonterm, MAX_KIDS> kids;
+  uint8_t num_kids;
+  uint8_t cost;
+  LirOpcode lir_opcode;
+  uint8_t op;
+  bool (*cond)(const Instruction &inst);
+  Action action;
+};
+
+using cost_t = uint32_t;
+constexpr cost_t INF_COST = std::numeric_limits<cost_t>::max();
+
+// The cheapest rules deriving node to every nonterminal.
+struct Label {
+  std::array<cost_t, NUM_NONTERMS> costs;
+  std::array<const Rule *, NUM_NONTERMS> rules;
+};
+
+bool fits_imm32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+std::optional<int64_t> get_const(const Instruction &inst) {
+  if (inst.get_opcode() != INST_CONST) {
+    return std::nullopt;
+  }
+  return static_cast<const LoadConstant<int64_t> &>(inst).get_value();
+}
+
+int64_t get_input_const(const Instruction &inst, size_t idx) {
+  return *get_const(*inst.get_input(idx));
+}
+
+bool is_imm32(const Instruction &inst) { return fits_imm32(*get_const(inst)); }
+
+bool is_zero_lhs(const Instruction &inst) {
+  return get_const(*inst.get_input(0)) == 0;
+}
+
+bool is_negatable_rhs(const Instruction &inst) {
+  auto value = get_const(*inst.get_input(1));
+  return value && fits_imm32(-*value);
+}
+
+bool is_scale_shift(const Instruction &inst) {
+  auto value = get_const(*inst.get_input(1));
+  return value && *value >= 0 && *value <= 3;
+}
+
+bool is_scale(std::optional<int64_t> value) {
+  return value == 1 || value == 2 || value == 4 || value == 8;
+}
+
+bool is_scale_rhs(const Instruction &inst) {
+  return is_scale(get_const(*inst.get_input(1)));
+}
+
+bool is_scale_lhs(const Instruction &inst) {
+  return is_scale(get_const(*inst.get_input(0)));
+}
+
+// x * 3 == x + x * 2
+bool is_scale_plus_one_rhs(const Instruction &inst) {
+  auto value = get_const(*inst.get_input(1));
+  return value && is_scale(*value - 1) && *value != 2;
+}
+
+bool is_pow2_rhs(const Instruction &inst) {
+  auto value = get_const(*inst.get_input(1));
+  return value && *value > 0 && (*value & (*value - 1)) == 0;
+}
+
+class Selector final {
+  Compiler &m_comp;
+
+  LirFunction m_func;
+
+  LirBlock *m_block = nullptr;
+
+  std::vector<vreg_t> m_vregs;
+
+  std::vector<bool> m_is_inline;
+
+  std::vector<Label> m_labels;
+
+  std::vector<bool> m_is_labeled;
+
+  // Label of values computed outside of tree.
+  Label m_leaf;
+
+  static bool is_foldable(const Instruction &inst);
+
+  static void close(Label &label);
+
+  const Label &get_kid_label(Instruction &kid) {
+    return m_is_inline[kid.get_id()] ? label(kid) : m_leaf;
+  }
+
+  const Label &label(Instruction &inst);
+
+  Value reduce(Instruction &inst, const Label &label, Nonterm nt,
+               LirOperand dst);
+
+  // Register or immediate, whichever is cheaper.
+  LirOperand reduce_operand(Instruction &inst);
+
+  LirOperand reduce_reg(Instruction &inst) {
+    return reduce(inst, get_kid_label(inst), NT_REG, {}).base;
+  }
+
+  void select_root(Instruction &inst);
+
+  void add_edge(BasicBlock *bb, BasicBlock *succ);
+
+public:
+  explicit Selector(Compiler &comp);
+
+  LirOperand get_vreg(const Instruction &inst) {
+    auto &&vreg = m_vregs[inst.get_id()];
+    if (vreg == std::numeric_limits<vreg_t>::max()) {
+      vreg = m_func.create_vreg();
+    }
+    return LirOperand::make_vreg(vreg);
+  }
+
+  LirOperand create_vreg() { return LirOperand::make_vreg(m_func.create_vreg()); }
+
+  void emit(LirInst inst) { m_block->insts.push_back(std::move(inst)); }
+
+  LirFunction run();
+};
+
+Value act_mov_const(Selector &sel, const Rule &, Instruction &inst,
+                    const Value *, LirOperand dst) {
+  sel.emit({LIR_MOV, 0, 1, 0, 0, dst, {LirOperand::make_imm(*get_const(inst))}});
+  return {dst};
+}
+
+Value act_imm(Selector &, const Rule &, Instruction &inst, const Value *,
+              LirOperand) {
+  return {LirOperand::make_imm(*get_const(inst))};
+}
+
+Value act_param(Selector &sel, const Rule &, Instruction &inst, const Value *,
+                LirOperand dst) {
+  auto index = static_cast<LoadParam &>(inst).get_index();
+  sel.emit({LIR_PARAM, 0, 1, 0, static_cast<uint32_t>(index), dst, {}});
+  return {dst};
+}
+
+Value act_unary(Selector &sel, const Rule &rule, Instruction &,
+                const Value *kids, LirOperand dst) {
+  sel.emit({rule.lir_opcode, rule.op, 1, 0, 0, dst, {kids[0].base}});
+  return {dst};
+}
+
+Value act_binary(Selector &sel, const Rule &rule, Instruction &,
+                 const Value *kids, LirOperand dst) {
+  sel.emit(
+      {rule.lir_opcode, rule.op, 1, 0, 0, dst, {kids[0].base, kids[1].base}});
+  return {dst};
+}
+
+// Commutative operation with immediate on the left.
+Value act_binary_rev(Selector &sel, const Rule &rule, Instruction &,
+                     const Value *kids, LirOperand dst) {
+  sel.emit(
+      {rule.lir_opcode, rule.op, 1, 0, 0, dst, {kids[1].base, kids[0].base}});
+  return {dst};
+}
+
+// 0 - x
+Value act_neg(Selector &sel, const Rule &, Instruction &, const Value *kids,
+              LirOperand dst) {
+  sel.emit({LIR_UNARY, UNARY_NEG, 1, 0, 0, dst, {kids[1].base}});
+  return {dst};
+}
+
+// x * 2^k
+Value act_mul_pow2(Selector &sel, const Rule &, Instruction &inst,
+                   const Value *kids, LirOperand dst) {
+  auto value = static_cast<uint64_t>(get_input_const(inst, 1));
+  int64_t amount = 0;
+  while ((value >>= 1) != 0) {
+    ++amount;
+  }
+  sel.emit({LIR_SHIFT,
+            SHIFT_SHL,
+            1,
+            0,
+            0,
+            dst,
+            {kids[0].base, LirOperand::make_imm(amount)}});
+  return {dst};
+}
+
+Value act_scale_shift(Selector &, const Rule &, Instruction &inst,
+                      const Value *kids, LirOperand) {
+  return {{}, kids[0].base,
+          static_cast<uint8_t>(1 << get_input_const(inst, 1))};
+}
+
+Value act_scale_mul(Selector &, const Rule &, Instruction &inst,
+                    const Value *kids, LirOperand) {
+  return {{}, kids[0].base, static_cast<uint8_t>(get_input_const(inst, 1))};
+}
+
+Value act_scale_mul_rev(Selector &, const Rule &, Instruction &inst,
+                        const Value *kids, LirOperand) {
+  return {{}, kids[1].base, static_cast<uint8_t>(get_input_const(inst, 0))};
+}
+
+Value act_scale_plus_one(Selector &, const Rule &, Instruction &inst,
+                         const Value *kids, LirOperand) {
+  return {kids[0].base, kids[0].base,
+          static_cast<uint8_t>(get_input_const(inst, 1) - 1)};
+}
+
+Value act_base_index(Selector &, const Rule &, Instruction &,
+                     const Value *kids, LirOperand) {
+  return {kids[0].base, kids[1].index, kids[1].scale};
+}
+
+Value act_base_index_rev(Selector &, const Rule &, Instruction &,
+                         const Value *kids, LirOperand) {
+  return {kids[1].base, kids[0].index, kids[0].scale};
+}
+
+Value act_add_disp(Selector &, const Rule &, Instruction &, const Value *kids,
+                   LirOperand) {
+  auto value = kids[0];
+  value.disp = static_cast<int32_t>(kids[1].base.get_imm());
+  return value;
+}
+
+Value act_add_disp_rev(Selector &, const Rule &, Instruction &,
+                       const Value *kids, LirOperand) {
+  auto value = kids[1];
+  value.disp = static_cast<int32_t>(kids[0].base.get_imm());
+  return value;
+}
+
+Value act_sub_disp(Selector &, const Rule &, Instruction &, const Value *kids,
+                   LirOperand) {
+  auto value = kids[0];
+  value.disp = static_cast<int32_t>(-kids[1].base.get_imm());
+  return value;
+}
+
+Value act_lea(Selector &sel, const Rule &, Instruction &, const Value *kids,
+              LirOperand dst) {
+  auto &&addr = kids[0];
+  LirInst lea{LIR_LEA, 0, addr.scale, addr.disp, 0, dst, {addr.base}};
+  if (!addr.index.is_none()) {
+    lea.srcs.push_back(addr.index);
+  }
+  sel.emit(std::move(lea));
+  return {dst};
+}
+
+Value act_reg_index(Selector &, const Rule &, Instruction &,
+                    const Value *kids, LirOperand) {
+  return {{}, kids[0].base, 1};
+}
+
+Value act_forward(Selector &, const Rule &, Instruction &, const Value *kids,
+                  LirOperand) {
+  return kids[0];
+}
+
+Value act_branch(Selector &sel, const Rule &, Instruction &inst,
+                 const Value *kids, LirOperand) {
+  auto flag = static_cast<ConditionalBranchInstruction &>(inst).get_flag();
+  sel.emit({LIR_BRANCH,
+            get_x86_cond(flag),
+            1,
+            0,
+            0,
+            {},
+            {kids[0].base, kids[1].base}});
+  return {};
+}
+
+// Immediate on the left, so operands are swapped.
+Value act_branch_rev(Selector &sel, const Rule &, Instruction &inst,
+                     const Value *kids, LirOperand) {
+  auto flag = static_cast<ConditionalBranchInstruction &>(inst).get_flag();
+  sel.emit({LIR_BRANCH,
+            get_x86_cond(swap_flag(flag)),
+            1,
+            0,
+            0,
+            {},
+            {kids[1].base, kids[0].base}});
+  return {};
+}
+
+Value act_ret(Selector &sel, const Rule &, Instruction &, const Value *kids,
+              LirOperand) {
+  sel.emit({LIR_RET, 0, 1, 0, 0, {}, {kids[0].base}});
+  return {};
+}
+
+#define RULE(lhs, opc, kid0, kid1, num_kids, cost, lir_opc, op, cond, action)  \
+  Rule {                                                                       \
+    NT_##lhs, INST_##opc, {NT_##kid0, NT_##kid1}, num_kids, cost,              \
+        LIR_##lir_opc, op, cond, action                                        \
+  }
+#define BINARY(opc, cost, lir_opc, op)                                         \
+  RULE(REG, opc, REG, REG, 2, cost, lir_opc, op, nullptr, act_binary),         \
+      RULE(REG, opc, REG, IMM, 2, cost, lir_opc, op, nullptr, act_binary)
+#define COMMUTATIVE(opc, cost, lir_opc, op)                                    \
+  BINARY(opc, cost, lir_opc, op),                                              \
+      RULE(REG, opc, IMM, REG, 2, cost, lir_opc, op, nullptr, act_binary_rev)
+#define CHAIN(lhs, rhs, cost, lir_opc, action)                                 \
+  RULE(lhs, INVALID, rhs, STMT, 1, cost, lir_opc, 0, nullptr, action)
+
+// Costs are numbers of x86 instructions, multiplication counts as two and
+// division as four for their latency. Of rules with equal costs the first
+// one is chosen.
+const Rule RULES[] = {
+    RULE(REG, CONST, STMT, STMT, 0, 1, MOV, 0, nullptr, act_mov_const),
+    RULE(IMM, CONST, STMT, STMT, 0, 0, MOV, 0, is_imm32, act_imm),
+    RULE(REG, PARAM, STMT, STMT, 0, 1, PARAM, 0, nullptr, act_param),
+    COMMUTATIVE(ADD, 1, ALU, ALU_ADD),
+    BINARY(SUB, 1, ALU, ALU_SUB),
+    RULE(REG, SUB, IMM, REG, 2, 1, UNARY, UNARY_NEG, is_zero_lhs, act_neg),
+    COMMUTATIVE(AND, 1, ALU, ALU_AND),
+    COMMUTATIVE(OR, 1, ALU, ALU_OR),
+    COMMUTATIVE(XOR, 1, ALU, ALU_XOR),
+    RULE(REG, MUL, REG, IMM, 2, 1, SHIFT, SHIFT_SHL, is_pow2_rhs,
+         act_mul_pow2),
+    COMMUTATIVE(MUL, 2, IMUL, 0),
+    BINARY(SHL, 1, SHIFT, SHIFT_SHL),
+    BINARY(SHR, 1, SHIFT, SHIFT_SHR),
+    BINARY(ASHR, 1, SHIFT, SHIFT_SAR),
+    RULE(REG, NOT, REG, STMT, 1, 1, UNARY, UNARY_NOT, nullptr, act_unary),
+    RULE(REG, MULH, REG, REG, 2, 2, MULH, 0, nullptr, act_binary),
+    RULE(REG, DIV, REG, REG, 2, 4, DIV, 0, nullptr, act_binary),
+    RULE(REG, MOD, REG, REG, 2, 4, MOD, 0, nullptr, act_binary),
+    // Address arithmetic for lea.
+    RULE(INDEX, SHL, REG, IMM, 2, 0, LEA, 0, is_scale_shift, act_scale_shift),
+    RULE(INDEX, MUL, REG, IMM, 2, 0, LEA, 0, is_scale_rhs, act_scale_mul),
+    RULE(INDEX, MUL, IMM, REG, 2, 0, LEA, 0, is_scale_lhs, act_scale_mul_rev),
+    RULE(BASE_INDEX, MUL, REG, IMM, 2, 0, LEA, 0, is_scale_plus_one_rhs,
+         act_scale_plus_one),
+    RULE(BASE_INDEX, ADD, REG, INDEX, 2, 0, LEA, 0, nullptr, act_base_index),
+    RULE(BASE_INDEX, ADD, INDEX, REG, 2, 0, LEA, 0, nullptr,
+         act_base_index_rev),
+    RULE(ADDR, ADD, REG, IMM, 2, 0, LEA, 0, nullptr, act_add_disp),
+    RULE(ADDR, ADD, BASE_INDEX, IMM, 2, 0, LEA, 0, nullptr, act_add_disp),
+    RULE(ADDR, ADD, IMM, BASE_INDEX, 2, 0, LEA, 0, nullptr, act_add_disp_rev),
+    RULE(ADDR, SUB, REG, IMM, 2, 0, LEA, 0, is_negatable_rhs, act_sub_disp),
+    RULE(ADDR, SUB, BASE_INDEX, IMM, 2, 0, LEA, 0, is_negatable_rhs,
+         act_sub_disp),
+    // Terminators
+    RULE(STMT, COND_BR, REG, REG, 2, 1, BRANCH, 0, nullptr, act_branch),
+    RULE(STMT, COND_BR, REG, IMM, 2, 1, BRANCH, 0, nullptr, act_branch),
+    RULE(STMT, COND_BR, IMM, REG, 2, 1, BRANCH, 0, nullptr, act_branch_rev),
+    RULE(STMT, RET, REG, STMT, 1, 1, RET, 0, nullptr, act_ret),
+    RULE(STMT, RET, IMM, STMT, 1, 1, RET, 0, nullptr, act_ret),
+};
+
+const Rule CHAIN_RULES[] = {
+    CHAIN(INDEX, REG, 0, LEA, act_reg_index),
+    CHAIN(ADDR, BASE_INDEX, 0, LEA, act_forward),
+    CHAIN(REG, ADDR, 1, LEA, act_lea),
+};
+
+#undef CHAIN
+#undef COMMUTATIVE
+#undef BINARY
+#undef RULE
+
+Selector::Selector(Compiler &comp)
+    : m_comp(comp), m_func(comp.graph().get_num_params()),
+      m_vregs(comp.graph().get_instr_count(),
+              std::numeric_limits<vreg_t>::max()),
+      m_is_inline(comp.graph().get_instr_count(), false),
+      m_labels(comp.graph().get_instr_count()),
+      m_is_labeled(comp.graph().get_instr_count(), false) {
+  m_leaf.costs.fill(INF_COST);
+  m_leaf.rules.fill(nullptr);
+  m_leaf.costs[NT_REG] = 0;
+  close(m_leaf);
+}
+
+// Values used once by instruction of the same block are computed right
+// before their user, so their code may be merged into user's patterns.
+bool Selector::is_foldable(const Instruction &inst) {
+  switch (inst.get_opcode()) {
+  case INST_CONST:
+    return true;
+  case INST_ADD:
+  case INST_SUB:
+  case INST_MUL:
+  case INST_AND:
+  case INST_OR:
+  case INST_XOR:
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR:
+  case INST_NOT:
+    break;
+  default:
+    return false;
+  }
+  if (inst.get_num_users() != 1) {
+    return false;
+  }
+  auto user = *inst.users_begin();
+  return !user->is_phi() && user->get_bb() == inst.get_bb() &&
+         std::count(user->inputs_begin(), user->inputs_end(), &inst) == 1;
+}
+
+void Selector::close(Label &label) {
+  for (bool is_changed = true; is_changed;) {
+    is_changed = false;
+    for (auto &&rule : CHAIN_RULES) {
+      auto cost = label.costs[rule.kids[0]];
+      if (cost != INF_COST && cost + rule.cost < label.costs[rule.lhs]) {
+        label.costs[rule.lhs] = cost + rule.cost;
+        label.rules[rule.lhs] = &rule;
+        is_changed = true;
+      }
+    }
+  }
+}
+
+const Label &Selector::label(Instruction &inst) {
+  auto id = inst.get_id();
+  if (m_is_labeled[id]) {
+    return m_labels[id];
+  }
+  Label label;
+  label.costs.fill(INF_COST);
+  label.rules.fill(nullptr);
+  for (auto &&rule : RULES) {
+    if (rule.opcode != inst.get_opcode() ||
+        rule.num_kids != inst.get_num_inputs() ||
+        (rule.cond != nullptr && !rule.cond(inst))) {
+      continue;
+    }
+    cost_t cost = rule.cost;
+    for (size_t idx = 0; idx < rule.num_kids && cost != INF_COST; ++idx) {
+      auto kid_cost = get_kid_label(*inst.get_input(idx)).costs[rule.kids[idx]];
+      cost = kid_cost == INF_COST ? INF_COST : cost + kid_cost;
+    }
+    if (cost < label.costs[rule.lhs]) {
+      label.costs[rule.lhs] = cost;
+      label.rules[rule.lhs] = &rule;
+    }
+  }
+  close(label);
+  m_labels[id] = label;
+  m_is_labeled[id] = true;
+  return m_labels[id];
+}
+
+Value Selector::reduce(Instruction &inst, const Label &label, Nonterm nt,
+                       LirOperand dst) {
+  if (label.costs[nt] == INF_COST) {
+    throw CodeGenError(std::string("Unsupported instruction ") +
+                       inst_opc_to_str(inst.get_opcode()));
+  }
+  auto rule = label.rules[nt];
+  if (rule == nullptr) {
+    return {get_vreg(inst)};
+  }
+  if (rule->lhs == NT_REG && dst.is_none()) {
+    dst = create_vreg();
+  }
+  std::array<Value, MAX_KIDS> kids;
+  if (rule->opcode == INST_INVALID) {
+    kids[0] = reduce(inst, label, rule->kids[0], {});
+  } else {
+    for (size_t idx = 0; idx < rule->num_kids; ++idx) {
+      auto &&kid = *inst.get_input(idx);
+      kids[idx] = reduce(kid, get_kid_label(kid), rule->kids[idx], {});
+    }
+  }
+  return rule->action(*this, *rule, inst, kids.data(), dst);
+}
+
+LirOperand Selector::reduce_operand(Instruction &inst) {
+  auto &&label = get_kid_label(inst);
+  auto nt = label.costs[NT_IMM] < label.costs[NT_REG] ? NT_IMM : NT_REG;
+  return reduce(inst, label, nt, {}).base;
+}
+
+void Selector::select_root(Instruction &inst) {
+  switch (inst.get_opcode()) {
+  case INST_BRANCH:
+    emit({LIR_JUMP, 0, 1, 0, 0, {}, {}});
+    return;
+  case INST_COND_BR:
+  case INST_RET:
+    reduce(inst, label(inst), NT_STMT, {});
+    return;
+  case INST_CALL: {
+    auto &&call = static_cast<CallInstruction &>(inst);
+    LirInst lir{LIR_CALL, 0, 1, 0, static_cast<uint32_t>(call.get_callee()),
+                {},       {}};
+    if (call.get_num_users() != 0) {
+      lir.dst = get_vreg(call);
+    }
+    for (size_t idx = 0; idx < call.get_num_inputs(); ++idx) {
+      lir.srcs.push_back(reduce_operand(*call.get_input(idx)));
+    }
+    emit(std::move(lir));
+    return;
+  }
+  default:
+    break;
+  }
+  if (inst.get_num_users() == 0) {
+    return;
+  }
+  if (inst.get_opcode() == INST_SELECT) {
+    // cmov needs the true value in register or memory.
+    auto &&select = static_cast<SelectInstruction &>(inst);
+    LirInst lir{LIR_SELECT, get_x86_cond(select.get_flag()), 1, 0, 0,
+                get_vreg(select), {}};
+    lir.srcs.push_back(reduce_reg(*select.get_lhs()));
+    lir.srcs.push_back(reduce_operand(*select.get_rhs()));
+    lir.srcs.push_back(reduce_reg(*select.get_true_value()));
+    lir.srcs.push_back(reduce_operand(*select.get_false_value()));
+    emit(std::move(lir));
+    return;
+  }
+  reduce(inst, label(inst), NT_REG, get_vreg(inst));
+}
+
+void Selector::add_edge(BasicBlock *bb, BasicBlock *succ) {
+  LirEdge edge{succ->get_id(), {}};
+  for (auto &&inst : *succ) {
+    if (!inst.is_phi()) {
+      break;
+    }
+    auto &&value = *static_cast<PhiInstruction &>(inst).get_value_for(bb);
+    auto src = value.get_opcode() == INST_CONST
+                   ? LirOperand::make_imm(*get_const(value))
+                   : get_vreg(value);
+    edge.moves.push_back({get_vreg(inst), src});
+  }
+  m_block->edges.push_back(std::move(edge));
+}
+
+LirFunction Selector::run() {
+  auto &&graph = m_comp.graph();
+  auto &&linear_order = m_comp.get_or_create<LinearOrder>(m_comp);
+  for (auto &&bb : linear_order) {
+    for (auto &&inst : *bb) {
+      auto type = inst.get_type();
+      if (type != INTEGER && type != NONE) {
+        throw CodeGenError("Only integer values are supported");
+      }
+      m_is_inline[inst.get_id()] = is_foldable(inst);
+    }
+  }
+  m_func.set_entry(graph.get_entry()->get_id());
+  for (auto &&bb : linear_order) {
+    m_block = &m_func.create_block(bb->get_id());
+    for (auto &&inst : *bb) {
+      if (inst.is_phi()) {
+        m_block->phis.push_back(get_vreg(inst));
+      } else if (!m_is_inline[inst.get_id()]) {
+        select_root(inst);
+      }
+    }
+    if (!bb->empty() && bb->back().get_opcode() == INST_COND_BR) {
+      add_edge(bb, bb->get_false_successor());
+      add_edge(bb, bb->get_true_successor());
+    } else if (bb->get_num_successors() == 1) {
+      // Block without terminator falls to its successor.
+      if (bb->empty() || !bb->back().is_terminator()) {
+        emit({LIR_JUMP, 0, 1, 0, 0, {}, {}});
+      }
+      add_edge(bb, bb->get_uncond_successor());
+    }
+  }
+  return std::move(m_func);
+}
+
+} // namespace
+
+X86Cond get_x86_cond(CmpFlag flag) {
+  switch (flag) {
+  case CMP_EQ:
+    return COND_E;
+  case CMP_NE:
+    return COND_NE;
+  case CMP_L:
+    return COND_L;
+  case CMP_LE:
+    return COND_LE;
+  case CMP_G:
+    return COND_G;
+  case CMP_GE:
+    return COND_GE;
+  default:
+    throw CodeGenError("Invalid comparison flag");
+  }
+}
+
+LirFunction X86ISel::select(Compiler &comp) { return Selector(comp).run(); }
+
+} // namespace koda
@@ -2,6 +2,7 @@
 
 #include "Core/Compiler.h"
 #include "DataStructures/Graph.hpp"
+#include "IR/Arithmetic.hpp"
 #include "IR/ProgramGraph.hpp"
 
 namespace koda {
@@ -10,6 +11,20 @@ LoopInfo::loop_id_t LoopInfo::get_id() const {
   return m_header ? m_header->get_loop_id() : INVALID_LOOP_ID;
 }
 
+void LoopInfo::add_block(BasicBlock *bb) {
+  size_t id = bb->get_id();
+  if (id >= m_block_set.size()) {
+    m_block_set.resize(id + 1, false);
+  }
+  m_block_set[id] = true;
+  m_blocks.push_back(bb);
+}
+
+bool LoopInfo::contains(const BasicBlock *bb) const {
+  size_t id = bb->get_id();
+  return id < m_block_set.size() && m_block_set[id];
+}
+
 void RPOAnalysis::run(Compiler &comp) {
   run(comp.graph());
 }
@@ -55,6 +70,12 @@ void LoopTreeAnalysis::run(ProgramGraph &graph,
                            DomsTreeAnalysis::DomsTree &dom_tree) {
   assert(graph.get_entry() != nullptr && "Entry block must be specified");
 
+  // Loop ids are stored in blocks, so drop results of previous run.
+  m_loop_tree.clear();
+  for (auto &&bb : graph) {
+    bb.set_loop_id(LoopInfo::NIL_LOOP_ID);
+  }
+
   // Collect backedges
   std::vector<bool> marked(graph.size(), false);
   std::vector<std::pair<BasicBlock *, BasicBlock *>> backedges;
@@ -118,16 +139,15 @@ void LoopTreeAnalysis::run(ProgramGraph &graph,
             }
             return true;
           });
-      // Put blocks inside loop in DFS order
-      visit_dfs_conditional(graph, header,
-                            [&loop_blocks, &loop](BasicBlock *bb) {
-                              if (loop_blocks.find(bb) == loop_blocks.end()) {
-                                return false;
-                              }
-                              loop.add_block(bb);
-                              return true;
-                            });
     }
+    // Put blocks inside loop in DFS order
+    visit_dfs_conditional(graph, header, [&loop_blocks, &loop](BasicBlock *bb) {
+      if (loop_blocks.find(bb) == loop_blocks.end()) {
+        return false;
+      }
+      loop.add_block(bb);
+      return true;
+    });
   }
 
   // Build tree
@@ -152,8 +172,203 @@ const LoopInfo &LoopTreeAnalysis::get_loop(const BasicBlock &bb) const {
   return m_loop_tree.get(bb.get_loop_id());
 }
 
+size_t LoopTreeAnalysis::get_depth(const BasicBlock &bb) const {
+  size_t depth = 0;
+  for (auto loop_id = bb.get_loop_id(); m_loop_tree.contains(loop_id) &&
+                                        loop_id != LoopInfo::NIL_LOOP_ID;
+       loop_id = m_loop_tree.get_parent(loop_id)) {
+    ++depth;
+  }
+  return depth;
+}
+
+namespace {
+
+std::optional<int64_t> get_int_const(const Instruction *inst) {
+  if (inst->get_opcode() != INST_CONST || inst->get_type() != INTEGER) {
+    return std::nullopt;
+  }
+  return static_cast<const LoadConstant<int64_t> *>(inst)->get_value();
+}
+
+// Represents values computed inside the loop as affine functions of
+// given header phis.
+class AffineBuilder final {
+  const LoopInfo &m_loop;
+
+  std::unordered_set<const Instruction *> m_bases;
+
+  std::unordered_map<const Instruction *, std::optional<InductionVariable>>
+      m_cache;
+
+  std::optional<InductionVariable> combine(const Instruction &inst) {
+    auto lhs = inst.get_input(BinaryOpInstructionBase::LHS);
+    auto rhs = inst.get_input(BinaryOpInstructionBase::RHS);
+    auto lhs_iv = get(lhs);
+    auto rhs_iv = get(rhs);
+    auto lhs_const = get_int_const(lhs);
+    auto rhs_const = get_int_const(rhs);
+    std::optional<InductionVariable> res;
+    switch (inst.get_opcode()) {
+    case INST_ADD:
+      if (lhs_iv && rhs_const) {
+        res = {lhs_iv->base, lhs_iv->scale,
+               wrap_add(lhs_iv->offset, *rhs_const)};
+      } else if (lhs_const && rhs_iv) {
+        res = {rhs_iv->base, rhs_iv->scale,
+               wrap_add(*lhs_const, rhs_iv->offset)};
+      } else if (lhs_iv && rhs_iv && lhs_iv->base == rhs_iv->base) {
+        res = {lhs_iv->base, wrap_add(lhs_iv->scale, rhs_iv->scale),
+               wrap_add(lhs_iv->offset, rhs_iv->offset)};
+      }
+      break;
+    case INST_SUB:
+      if (lhs_iv && rhs_const) {
+        res = {lhs_iv->base, lhs_iv->scale,
+               wrap_sub(lhs_iv->offset, *rhs_const)};
+      } else if (lhs_const && rhs_iv) {
+        res = {rhs_iv->base, wrap_sub(0, rhs_iv->scale),
+               wrap_sub(*lhs_const, rhs_iv->offset)};
+      } else if (lhs_iv && rhs_iv && lhs_iv->base == rhs_iv->base) {
+        res = {lhs_iv->base, wrap_sub(lhs_iv->scale, rhs_iv->scale),
+               wrap_sub(lhs_iv->offset, rhs_iv->offset)};
+      }
+      break;
+    case INST_MUL:
+      if (lhs_iv && rhs_const) {
+        res = {lhs_iv->base, wrap_mul(lhs_iv->scale, *rhs_const),
+               wrap_mul(lhs_iv->offset, *rhs_const)};
+      } else if (lhs_const && rhs_iv) {
+        res = {rhs_iv->base, wrap_mul(*lhs_const, rhs_iv->scale),
+               wrap_mul(*lhs_const, rhs_iv->offset)};
+      }
+      break;
+    case INST_SHL:
+      if (lhs_iv && rhs_const && *rhs_const >= 0 && *rhs_const < 64) {
+        int64_t factor = static_cast<int64_t>(1ull << *rhs_const);
+        res = {lhs_iv->base, wrap_mul(lhs_iv->scale, factor),
+               wrap_mul(lhs_iv->offset, factor)};
+      }
+      break;
+    default:
+      break;
+    }
+    // Zero scale means value doesn't depend on iteration.
+    if (res && res->scale == 0) {
+      return std::nullopt;
+    }
+    return res;
+  }
+
+public:
+  AffineBuilder(const LoopInfo &loop) : m_loop(loop) {}
+
+  void add_base(const PhiInstruction *phi) { m_bases.insert(phi); }
+
+  std::optional<InductionVariable> get(Instruction *inst) {
+    if (m_bases.find(inst) != m_bases.end()) {
+      return InductionVariable{static_cast<PhiInstruction *>(inst), 1, 0};
+    }
+    if (inst->is_phi() || inst->get_num_inputs() != 2 ||
+        !m_loop.contains(inst->get_bb())) {
+      return std::nullopt;
+    }
+    auto cached = m_cache.find(inst);
+    if (cached != m_cache.end()) {
+      return cached->second;
+    }
+    auto res = combine(*inst);
+    m_cache[inst] = res;
+    return res;
+  }
+};
+
+} // namespace
+
+void InductionVariableAnalysis::run(Compiler &comp) {
+  m_ivs.clear();
+  m_basic_ivs.clear();
+  m_loop_ivs.clear();
+  auto &&loops = comp.get_or_create<LoopTreeAnalysis>(comp);
+  for (auto &&loop_it : loops.get()) {
+    if (loop_it.first == LoopInfo::NIL_LOOP_ID) {
+      continue;
+    }
+    analyze_loop(loop_it.second.value());
+  }
+}
+
+void InductionVariableAnalysis::analyze_loop(const LoopInfo &loop) {
+  BasicBlock *header = loop.get_header();
+  if (header == nullptr || !loop.is_reducible()) {
+    return;
+  }
+  auto &&loop_ivs = m_loop_ivs[loop.get_id()];
+  AffineBuilder affine(loop);
+  for (auto &&inst : *header) {
+    if (!inst.is_phi()) {
+      break;
+    }
+    auto &&phi = static_cast<PhiInstruction &>(inst);
+    // All backedges must bring the same value
+    Instruction *update = nullptr;
+    bool is_single_update = true;
+    for (size_t i = 0, num = phi.get_num_inputs(); i < num; ++i) {
+      auto &&[bb, value] = phi.get_option(i);
+      if (!loop.contains(bb)) {
+        continue;
+      }
+      is_single_update = is_single_update && (!update || update == value);
+      update = value;
+    }
+    if (!update || !is_single_update) {
+      continue;
+    }
+    AffineBuilder single_phi(loop);
+    single_phi.add_base(&phi);
+    auto iv = single_phi.get(update);
+    // Phi with zero step doesn't change between iterations
+    if (!iv || iv->base != &phi || iv->scale != 1 || iv->offset == 0) {
+      continue;
+    }
+    m_basic_ivs[phi.get_id()] = {&phi, update, iv->offset, loop.get_id()};
+    loop_ivs.push_back(&phi);
+    affine.add_base(&phi);
+  }
+  if (loop_ivs.empty()) {
+    return;
+  }
+  for (auto &&bb : loop) {
+    for (auto &&inst : *bb) {
+      auto iv = affine.get(&inst);
+      if (iv) {
+        m_ivs[inst.get_id()] = *iv;
+      }
+    }
+  }
+}
+
+const InductionVariable *
+InductionVariableAnalysis::get(const Instruction &inst) const {
+  auto iv = m_ivs.find(inst.get_id());
+  return iv == m_ivs.end() ? nullptr : &iv->second;
+}
+
+const BasicInductionVariable *
+InductionVariableAnalysis::get_basic(const Instruction &phi) const {
+  auto iv = m_basic_ivs.find(phi.get_id());
+  return iv == m_basic_ivs.end() ? nullptr : &iv->second;
+}
+
+const std::vector<PhiInstruction *> &
+InductionVariableAnalysis::get_basic_ivs(loop_id_t loop) const {
+  auto ivs = m_loop_ivs.find(loop);
+  return ivs == m_loop_ivs.end() ? m_no_ivs : ivs->second;
+}
+
 void LinearOrder::linearize_graph(Compiler &comp) {
   ProgramGraph &graph = comp.graph();
+  m_linear_order.clear();
   const auto &loops = comp.get_or_create<LoopTreeAnalysis>(comp);
   const auto &rpo = comp.get_or_create<RPOAnalysis>(graph);
   std::vector<bool> visited(graph.size(), false);
@@ -191,7 +406,185 @@ void LinearOrder::linearize_loop(const BasicBlock &header,
   }
 }
 
-void LinearOrder::run(Compiler &comp) { linearize_graph(comp); }
+namespace {
+
+// Pettis-Hansen layout of loop nest. Each reducible loop is laid out
+// separately: its nodes are its own blocks and headers of immediately
+// nested loops, which stand for the whole nested loops. Loop header is the
+// first node, so loops stay contiguous and start with header.
+class ProfileLayout {
+  using loop_id_t = LoopInfo::loop_id_t;
+
+  ProgramGraph &m_graph;
+
+  const LoopTreeAnalysis &m_loops;
+
+  const ProfileInfo &m_profile;
+
+  std::vector<BasicBlock *> m_rpo;
+
+  std::vector<BasicBlock *> &m_order;
+
+  // Irreducible loops are not laid out separately.
+  loop_id_t get_region(loop_id_t loop) const {
+    auto &&tree = m_loops.get();
+    while (loop != LoopInfo::NIL_LOOP_ID && !tree.get(loop).is_reducible()) {
+      loop = tree.get_parent(loop);
+    }
+    return loop;
+  }
+
+  bool contains(loop_id_t region, const BasicBlock *bb) const {
+    return region == LoopInfo::NIL_LOOP_ID ||
+           m_loops.get().get(region).contains(bb);
+  }
+
+  // Node of region which contains bb.
+  BasicBlock *get_node(loop_id_t region, BasicBlock *bb) const {
+    auto &&tree = m_loops.get();
+    auto node = bb;
+    for (auto loop = get_region(bb->get_loop_id()); loop != region;
+         loop = get_region(tree.get_parent(loop))) {
+      node = tree.get(loop).get_header();
+    }
+    return node;
+  }
+
+public:
+  ProfileLayout(ProgramGraph &graph, const RPOAnalysis &rpo,
+                const LoopTreeAnalysis &loops, const ProfileInfo &profile,
+                std::vector<BasicBlock *> &order)
+      : m_graph(graph), m_loops(loops), m_profile(profile), m_order(order) {
+    for (auto &&bbid : rpo) {
+      m_rpo.push_back(m_graph.get_bb(bbid));
+    }
+  }
+
+  void layout(loop_id_t region, BasicBlock *head);
+};
+
+void ProfileLayout::layout(loop_id_t region, BasicBlock *head) {
+  // Nodes in RPO, so head is the first one.
+  std::vector<BasicBlock *> nodes;
+  std::unordered_map<BasicBlock *, size_t> node_idx;
+  for (auto &&bb : m_rpo) {
+    if (contains(region, bb) && get_node(region, bb) == bb) {
+      node_idx[bb] = nodes.size();
+      nodes.push_back(bb);
+    }
+  }
+  assert(nodes.front() == head && "Region must start with its head");
+
+  struct Edge {
+    uint64_t count;
+    size_t from;
+    size_t to;
+  };
+  std::vector<Edge> edges;
+  // Number of entries into node from other nodes of region.
+  std::vector<uint64_t> freq(nodes.size(), 0);
+  for (auto &&bb : m_rpo) {
+    if (!contains(region, bb)) {
+      continue;
+    }
+    auto from = node_idx[get_node(region, bb)];
+    for (size_t succ_idx = 0; succ_idx < bb->get_num_successors();
+         ++succ_idx) {
+      auto succ = *std::next(bb->succ_begin(), succ_idx);
+      if (!contains(region, succ)) {
+        continue;
+      }
+      auto to = node_idx[get_node(region, succ)];
+      auto count = m_profile.get_edge_count(*bb, succ_idx);
+      // Edges inside nested loops and back edges don't form chains.
+      if (from == to || to == 0) {
+        continue;
+      }
+      freq[to] += count;
+      if (count != 0) {
+        edges.push_back({count, from, to});
+      }
+    }
+  }
+  std::stable_sort(edges.begin(), edges.end(),
+                   [](const Edge &lhs, const Edge &rhs) {
+                     return lhs.count > rhs.count;
+                   });
+
+  // Merge chains along the hottest edges: tail of one chain falls through
+  // into head of another one.
+  std::vector<std::vector<size_t>> chains(nodes.size());
+  std::vector<size_t> chain_of(nodes.size());
+  for (size_t idx = 0; idx < nodes.size(); ++idx) {
+    chains[idx].push_back(idx);
+    chain_of[idx] = idx;
+  }
+  for (auto &&edge : edges) {
+    auto from_chain = chain_of[edge.from];
+    auto to_chain = chain_of[edge.to];
+    if (from_chain == to_chain || chains[from_chain].back() != edge.from ||
+        chains[to_chain].front() != edge.to) {
+      continue;
+    }
+    for (auto &&node : chains[to_chain]) {
+      chain_of[node] = from_chain;
+      chains[from_chain].push_back(node);
+    }
+    chains[to_chain].clear();
+  }
+
+  // Chain of head goes first, then hot chains by frequency and cold ones in
+  // RPO.
+  auto get_freq = [&chains, &freq](size_t chain) {
+    uint64_t res = 0;
+    for (auto &&node : chains[chain]) {
+      res = std::max(res, freq[node]);
+    }
+    return res;
+  };
+  std::vector<size_t> order;
+  for (size_t chain = 1; chain < chains.size(); ++chain) {
+    if (!chains[chain].empty()) {
+      order.push_back(chain);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&get_freq](size_t lhs, size_t rhs) {
+                     return get_freq(lhs) > get_freq(rhs);
+                   });
+  order.insert(order.begin(), 0);
+
+  for (auto &&chain : order) {
+    for (auto &&node : chains[chain]) {
+      auto bb = nodes[node];
+      if (bb != head && bb->is_loop_header() &&
+          m_loops.get_loop(*bb).is_reducible()) {
+        layout(bb->get_loop_id(), bb);
+      } else {
+        m_order.push_back(bb);
+      }
+    }
+  }
+}
+
+} // namespace
+
+void LinearOrder::linearize_with_profile(Compiler &comp) {
+  m_linear_order.clear();
+  auto &&graph = comp.graph();
+  ProfileLayout layout(graph, comp.get_or_create<RPOAnalysis>(graph),
+                       comp.get_or_create<LoopTreeAnalysis>(comp),
+                       comp.profile(), m_linear_order);
+  layout.layout(LoopInfo::NIL_LOOP_ID, graph.get_entry());
+}
+
+void LinearOrder::run(Compiler &comp) {
+  if (comp.profile().empty()) {
+    linearize_graph(comp);
+  } else {
+    linearize_with_profile(comp);
+  }
+}
 
 void Liveness::run(Compiler &compiler) {
   using LiveSet = std::unordered_set<instid_t>;
@@ -204,7 +597,8 @@ void Liveness::run(Compiler &compiler) {
   std::vector<size_t> live_numbers(inst_count);
   RangeMap bb_live_nums(bb_count);
   BBLiveSetMap live_set_map(bb_count);
-  m_live_ranges.resize(inst_count, {0, 0});
+  // Empty hull, so that pieces may be added in any order.
+  m_live_ranges.assign(inst_count, {SIZE_MAX, 0});
 
   auto set_live_num = [&live_numbers](instid_t iid, size_t num) {
     live_numbers[iid] = num;
@@ -238,10 +632,15 @@ void Liveness::run(Compiler &compiler) {
     live_num += 2;
     bb_range.second = live_num;
   }
-  // Calculate live ranges
-  for (auto &&bb_it = linear_order.rbegin(), end_bb = linear_order.rend();
+  // Calculate live ranges. Blocks are visited in reverse RPO, so successors
+  // are visited before predecessors except for loop back edges, which are
+  // handled by extending liveness over the whole loop. Ranges are hulls of
+  // per block pieces, so blocks may be placed in any order as long as loops
+  // are contiguous.
+  auto &&rpo = compiler.get_or_create<RPOAnalysis>(compiler);
+  for (auto &&bb_it = rpo.blocks().rbegin(), end_bb = rpo.blocks().rend();
        bb_it != end_bb; ++bb_it) {
-    auto &&bb = *bb_it;
+    auto &&bb = compiler.graph().get_bb(*bb_it);
     // Calculate initial live set for block
     auto &&live_set = get_live_set(bb);
     for (auto &&succ = bb->succ_begin(), end_succ = bb->succ_end();
@@ -262,10 +661,12 @@ void Liveness::run(Compiler &compiler) {
         }
       }
     }
-    // Append block live range to all entries in live set
+    // Pieces of live ranges in this block. Values live out of block are
+    // live in the whole block.
     auto &&bb_range = get_bb_live_range(bb);
+    std::unordered_map<instid_t, LiveRange> pieces;
     for (instid_t iid : live_set) {
-      extend_liverange(iid, bb_range);
+      pieces[iid] = bb_range;
     }
     // Shorten live ranges
     for (auto &&inst_it = bb->rbegin(), end_it = bb->rend(); inst_it != end_it;
@@ -273,7 +674,9 @@ void Liveness::run(Compiler &compiler) {
       auto &&inst = *inst_it;
       size_t inst_live_num = get_live_num(inst.get_id());
       if (inst.get_num_users() != 0) {
-        m_live_ranges[inst.get_id()].first = inst_live_num;
+        auto piece = pieces.emplace(inst.get_id(),
+                                    LiveRange{inst_live_num, inst_live_num});
+        piece.first->second.first = inst_live_num;
         live_set.erase(inst.get_id());
       }
       if (inst.is_phi()) {
@@ -283,9 +686,15 @@ void Liveness::run(Compiler &compiler) {
            input != end_input; ++input) {
         instid_t input_id = (*input)->get_id();
         live_set.insert(input_id);
-        extend_liverange(input_id, {bb_range.first, inst_live_num});
+        auto piece = pieces.emplace(input_id,
+                                    LiveRange{bb_range.first, inst_live_num});
+        piece.first->second.second =
+            std::max(piece.first->second.second, inst_live_num);
       }
     }
+    for (auto &&[iid, piece] : pieces) {
+      extend_liverange(iid, piece);
+    }
     // Extend liveness in loops
     if (bb->is_loop_header()) {
       auto &&loop = loop_analysis.get_loop(*bb);
@@ -298,16 +707,22 @@ void Liveness::run(Compiler &compiler) {
       }
     }
   }
+  // Values which are never live
+  for (auto &&range : m_live_ranges) {
+    if (range.first > range.second) {
+      range = {0, 0};
+    }
+  }
 }
 
-void RegAlloc::reset(Compiler &compiler) {
+void RegAlloc::reset(size_t num_values, size_t num_regs) {
   m_slot_num = 0;
   m_slotmap.clear();
   m_active.clear();
-  m_regnum = compiler.get_num_pregs();
+  m_regnum = num_regs;
 
   m_regmap.clear();
-  m_regmap.resize(compiler.graph().get_instr_count(), INVALID_REG);
+  m_regmap.resize(num_values, INVALID_REG);
 
   m_free_pool.clear();
   for (locid_t reg = m_regnum - 1; reg >= 0; reg--) {
@@ -316,11 +731,30 @@ void RegAlloc::reset(Compiler &compiler) {
 }
 
 void RegAlloc::run(Compiler &compiler) {
-  reset(compiler);
   auto &&liveness = compiler.get_or_create<Liveness>(compiler);
+  std::vector<Interval> intervals;
+  for (auto &&bb : compiler.graph()) {
+    for (auto &&inst : bb) {
+      instid_t id = inst.get_id();
+      auto &&range = liveness.get_live_range(id);
+      if (range.first != range.second)
+        intervals.push_back({id, range.first, range.second});
+    }
+  }
+  run(intervals, compiler.graph().get_instr_count(),
+      compiler.get_num_pregs());
+}
+
+void RegAlloc::run(const std::vector<Interval> &intervals, size_t num_values,
+                   size_t num_regs) {
+  reset(num_values, num_regs);
+  allocate(intervals);
+}
+
+void RegAlloc::allocate(const std::vector<Interval> &unordered) {
   auto cmp_ascending_start = [](const Interval &lhs, const Interval &rhs) {
     if (lhs.begin == rhs.begin) {
-      if (lhs.end == rhs.begin) {
+      if (lhs.end == rhs.end) {
         return lhs.inst < rhs.inst;
       }
       return lhs.end < rhs.end;
@@ -328,16 +762,7 @@ void RegAlloc::run(Compiler &compiler) {
     return lhs.begin < rhs.begin;
   };
   std::set<Interval, decltype(cmp_ascending_start)> intervals(
-      cmp_ascending_start);
-
-  for (auto &&bb : compiler.graph()) {
-    for (auto &&inst : bb) {
-      instid_t id = inst.get_id();
-      auto &&range = liveness.get_live_range(id);
-      if (range.first != range.second)
-        intervals.insert({id, range.first, range.second});
-    }
-  }
+      unordered.begin(), unordered.end(), cmp_ascending_start);
 
   for (auto &&inter : intervals) {
     expire_old_intervals(inter);
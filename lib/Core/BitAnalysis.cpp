@@ -0,0 +1,238 @@
+#include "Core/Analysis.hpp"
+
+#include "Core/Compiler.h"
+#include "IR/ProgramGraph.hpp"
+
+#include <deque>
+
+namespace koda {
+
+namespace {
+
+// Instructions of reachable blocks in RPO.
+std::vector<Instruction *> get_instructions(Compiler &comp) {
+  auto &&graph = comp.graph();
+  std::vector<Instruction *> insts;
+  for (auto &&bbid : comp.get_or_create<RPOAnalysis>(comp)) {
+    for (auto &&inst : *graph.get_bb(bbid)) {
+      insts.push_back(&inst);
+    }
+  }
+  return insts;
+}
+
+// Lower bits up to the highest demanded one. Carries of add, sub and mul go
+// only from lower bits to higher ones.
+uint64_t fill_low_bits(uint64_t demanded) {
+  return demanded == 0 ? 0 : low_bits_mask(64 - __builtin_clzll(demanded));
+}
+
+} // namespace
+
+KnownBits KnownBitsAnalysis::get(const Instruction &inst) const {
+  if (inst.get_type() != INTEGER) {
+    return {};
+  }
+  if (inst.get_opcode() == INST_CONST) {
+    return KnownBits::constant(
+        static_cast<const LoadConstant<int64_t> &>(inst).get_value());
+  }
+  if (inst.get_id() >= m_bits.size()) {
+    return {};
+  }
+  return m_bits[inst.get_id()];
+}
+
+KnownBits KnownBitsAnalysis::compute(const Instruction &inst) const {
+  if (inst.get_type() != INTEGER) {
+    return {};
+  }
+  auto input = [this, &inst](size_t idx) { return get(*inst.get_input(idx)); };
+  switch (inst.get_opcode()) {
+  case INST_CONST:
+    return get(inst);
+  case INST_PHI: {
+    // Options which are not computed yet don't restrict the result.
+    KnownBits res{~uint64_t(0), ~uint64_t(0)};
+    for (auto it = inst.inputs_begin(); it != inst.inputs_end(); ++it) {
+      auto id = (*it)->get_id();
+      if ((*it)->get_opcode() == INST_CONST ||
+          (id < m_is_computed.size() && m_is_computed[id])) {
+        res = meet(res, get(**it));
+      }
+    }
+    return res;
+  }
+  case INST_AND:
+    return known_and(input(0), input(1));
+  case INST_OR:
+    return known_or(input(0), input(1));
+  case INST_XOR:
+    return known_xor(input(0), input(1));
+  case INST_NOT:
+    return known_not(input(0));
+  case INST_SELECT:
+    return meet(input(SelectInstruction::TRUE_VALUE),
+                input(SelectInstruction::FALSE_VALUE));
+  case INST_ADD:
+    return known_add(input(0), input(1));
+  case INST_SUB:
+    return known_sub(input(0), input(1));
+  case INST_MUL:
+    return known_mul(input(0), input(1));
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR: {
+    auto shift = input(1);
+    if (!shift.is_constant()) {
+      return {};
+    }
+    auto amount = static_cast<unsigned>(shift.get_constant());
+    auto value = input(0);
+    if (inst.get_opcode() == INST_SHL) {
+      return known_shl(value, amount);
+    }
+    return inst.get_opcode() == INST_SHR ? known_shr(value, amount)
+                                         : known_ashr(value, amount);
+  }
+  default:
+    return {};
+  }
+}
+
+void KnownBitsAnalysis::run(Compiler &comp) {
+  auto &&graph = comp.graph();
+  auto count = graph.get_instr_count();
+  m_bits.assign(count, KnownBits{});
+  m_is_computed.assign(count, false);
+
+  std::deque<Instruction *> worklist;
+  std::vector<bool> queued(count, false);
+  auto enqueue = [&worklist, &queued](Instruction *inst) {
+    if (!queued[inst->get_id()]) {
+      queued[inst->get_id()] = true;
+      worklist.push_back(inst);
+    }
+  };
+  auto insts = get_instructions(comp);
+  std::for_each(insts.begin(), insts.end(), enqueue);
+  while (!worklist.empty()) {
+    auto inst = worklist.front();
+    worklist.pop_front();
+    auto id = inst->get_id();
+    queued[id] = false;
+    auto next = compute(*inst);
+    // Known bits only decrease, so loops converge.
+    if (m_is_computed[id]) {
+      next = meet(next, m_bits[id]);
+      if (next == m_bits[id]) {
+        continue;
+      }
+    }
+    m_bits[id] = next;
+    m_is_computed[id] = true;
+    std::for_each(inst->users_begin(), inst->users_end(), enqueue);
+  }
+}
+
+uint64_t DemandedBitsAnalysis::get(const Instruction &inst) const {
+  if (inst.get_type() != INTEGER || inst.get_id() >= m_demanded.size()) {
+    return ~uint64_t(0);
+  }
+  return m_demanded[inst.get_id()];
+}
+
+uint64_t DemandedBitsAnalysis::get_demanded_by(const Instruction &user,
+                                               size_t input_idx,
+                                               uint64_t demanded,
+                                               const KnownBitsAnalysis &known) {
+  if (user.has_side_effects() || user.is_terminator()) {
+    return ~uint64_t(0);
+  }
+  if (demanded == 0) {
+    return 0;
+  }
+  auto other = [&user, &known, input_idx]() {
+    return known.get(*user.get_input(1 - input_idx));
+  };
+  switch (user.get_opcode()) {
+  case INST_PHI:
+  case INST_XOR:
+  case INST_NOT:
+    return demanded;
+  case INST_SELECT:
+    // All bits of compared values matter.
+    return input_idx >= SelectInstruction::TRUE_VALUE ? demanded
+                                                      : ~uint64_t(0);
+  case INST_AND:
+    // Bits which are zero in the other operand are not read.
+    return demanded & ~other().zeros;
+  case INST_OR:
+    return demanded & ~other().ones;
+  case INST_ADD:
+  case INST_SUB:
+  case INST_MUL:
+    return fill_low_bits(demanded);
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR: {
+    // Only 6 lower bits of shift amount are used.
+    if (input_idx == 1) {
+      return 63;
+    }
+    auto shift = known.get(*user.get_input(1));
+    if (!shift.is_constant()) {
+      return ~uint64_t(0);
+    }
+    auto amount = static_cast<unsigned>(shift.get_constant()) & 63;
+    if (user.get_opcode() == INST_SHL) {
+      return demanded >> amount;
+    }
+    uint64_t res = demanded << amount;
+    // Upper bits of ashr are copies of sign bit
+    uint64_t sign_copies = ~(~uint64_t(0) >> amount);
+    if (user.get_opcode() == INST_ASHR && (demanded & sign_copies) != 0) {
+      res |= uint64_t(1) << 63;
+    }
+    return res;
+  }
+  default:
+    return ~uint64_t(0);
+  }
+}
+
+void DemandedBitsAnalysis::run(Compiler &comp) {
+  auto &&graph = comp.graph();
+  auto &&known = comp.get_or_create<KnownBitsAnalysis>(comp);
+  auto count = graph.get_instr_count();
+  m_demanded.assign(count, 0);
+
+  std::deque<Instruction *> worklist;
+  std::vector<bool> queued(count, false);
+  auto enqueue = [&worklist, &queued](Instruction *inst) {
+    if (!queued[inst->get_id()]) {
+      queued[inst->get_id()] = true;
+      worklist.push_back(inst);
+    }
+  };
+  auto insts = get_instructions(comp);
+  std::for_each(insts.rbegin(), insts.rend(), enqueue);
+  while (!worklist.empty()) {
+    auto inst = worklist.front();
+    worklist.pop_front();
+    queued[inst->get_id()] = false;
+    auto demanded = m_demanded[inst->get_id()];
+    for (size_t idx = 0; idx < inst->get_num_inputs(); ++idx) {
+      auto input = inst->get_input(idx);
+      auto &&input_demanded = m_demanded[input->get_id()];
+      auto next = input_demanded |
+                  get_demanded_by(*inst, idx, demanded, known);
+      if (next != input_demanded) {
+        input_demanded = next;
+        enqueue(input);
+      }
+    }
+  }
+}
+
+} // namespace koda
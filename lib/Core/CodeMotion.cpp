@@ -0,0 +1,333 @@
+#include <Core/Analysis.hpp>
+#include <Core/Compiler.h>
+#include <Core/Passes.hpp>
+#include <IR/IRBuilder.hpp>
+#include <IR/ProgramGraph.hpp>
+
+namespace koda {
+
+namespace {
+
+// Immediate dominators and dominator tree depths indexed by block id.
+struct DomDepths {
+  std::vector<BasicBlock *> idom;
+  std::vector<size_t> depth;
+
+  size_t get_depth(const BasicBlock *bb) const { return depth[bb->get_id()]; }
+
+  BasicBlock *get_idom(const BasicBlock *bb) const {
+    return idom[bb->get_id()];
+  }
+
+  // Nearest common dominator. nullptr is the neutral element.
+  BasicBlock *get_lca(BasicBlock *lhs, BasicBlock *rhs) const {
+    if (lhs == nullptr) {
+      return rhs;
+    }
+    while (get_depth(lhs) > get_depth(rhs)) {
+      lhs = get_idom(lhs);
+    }
+    while (get_depth(rhs) > get_depth(lhs)) {
+      rhs = get_idom(rhs);
+    }
+    while (lhs != rhs) {
+      lhs = get_idom(lhs);
+      rhs = get_idom(rhs);
+    }
+    return lhs;
+  }
+};
+
+} // namespace
+
+bool GlobalCodeMotion::is_pinned(const Instruction &inst) {
+  switch (inst.get_opcode()) {
+  case INST_PHI:
+  case INST_PARAM:
+    return true;
+  case INST_DIV:
+  case INST_MOD: {
+    // Division may trap, so it is hoisted only if divisor is non-zero
+    // constant.
+    auto divisor = inst.get_input(1);
+    return divisor->get_opcode() != INST_CONST ||
+           divisor->get_type() != INTEGER ||
+           static_cast<const LoadConstant<int64_t> *>(divisor)->get_value() ==
+               0;
+  }
+  default:
+    return inst.is_terminator() || inst.has_side_effects();
+  }
+}
+
+void GlobalCodeMotion::run(Compiler &comp) {
+  auto &&graph = comp.graph();
+  auto &&doms = comp.get_or_create<DomsTreeAnalysis>(graph).get();
+  auto &&loops = comp.get_or_create<LoopTreeAnalysis>(comp);
+
+  DomDepths dom_depths{std::vector<BasicBlock *>(graph.size(), nullptr),
+                       std::vector<size_t>(graph.size(), 0)};
+  std::vector<bool> is_reachable(graph.size(), false);
+  std::vector<Instruction *> insts;
+  // Dominators precede dominated blocks in RPO, so definitions precede all
+  // their non-phi users.
+  for (auto &&bbid : comp.get_or_create<RPOAnalysis>(comp)) {
+    auto bb = graph.get_bb(bbid);
+    is_reachable[bbid] = true;
+    if (bb != graph.get_entry()) {
+      auto idom = doms.get_parent(bb);
+      dom_depths.idom[bbid] = idom;
+      dom_depths.depth[bbid] = dom_depths.get_depth(idom) + 1;
+    }
+    for (auto &&inst : *bb) {
+      insts.push_back(&inst);
+    }
+  }
+
+  auto count = graph.get_instr_count();
+  std::vector<BasicBlock *> blocks(count, nullptr);
+  std::vector<bool> is_movable(count, false);
+  for (auto &&inst : insts) {
+    blocks[inst->get_id()] = inst->get_bb();
+    is_movable[inst->get_id()] =
+        !is_pinned(*inst) &&
+        std::all_of(inst->users_begin(), inst->users_end(),
+                    [&is_reachable](const Instruction *user) {
+                      return is_reachable[user->get_bb()->get_id()];
+                    });
+  }
+
+  // Schedule early: the deepest dominator among blocks of inputs.
+  std::vector<BasicBlock *> early(count, nullptr);
+  for (auto &&inst : insts) {
+    auto id = inst->get_id();
+    if (!is_movable[id]) {
+      continue;
+    }
+    auto bb = graph.get_entry();
+    for (auto it = inst->inputs_begin(); it != inst->inputs_end(); ++it) {
+      auto input_bb = blocks[(*it)->get_id()];
+      if (dom_depths.get_depth(input_bb) > dom_depths.get_depth(bb)) {
+        bb = input_bb;
+      }
+    }
+    early[id] = bb;
+    blocks[id] = bb;
+  }
+
+  // Schedule late: users are placed before their inputs, so the common
+  // dominator of uses is final. Then pick the block with the smallest loop
+  // depth on dominator path from late to early, preferring the latest one.
+  bool is_changed = false;
+  for (auto it = insts.rbegin(); it != insts.rend(); ++it) {
+    auto inst = *it;
+    auto id = inst->get_id();
+    if (!is_movable[id]) {
+      continue;
+    }
+    BasicBlock *late = nullptr;
+    for (auto uit = inst->users_begin(); uit != inst->users_end(); ++uit) {
+      auto user = *uit;
+      if (!user->is_phi()) {
+        late = dom_depths.get_lca(late, blocks[user->get_id()]);
+        continue;
+      }
+      // Value flowing into phi is used at the end of predecessor.
+      auto phi = static_cast<PhiInstruction *>(user);
+      for (size_t idx = 0; idx < phi->get_num_options(); ++idx) {
+        auto [pred, value] = phi->get_option(idx);
+        if (value == inst && is_reachable[pred->get_id()]) {
+          late = dom_depths.get_lca(late, pred);
+        }
+      }
+    }
+    if (late == nullptr) {
+      blocks[id] = inst->get_bb();
+      continue;
+    }
+    auto best = late;
+    for (auto bb = late; bb != early[id];) {
+      bb = dom_depths.get_idom(bb);
+      assert(bb && "Early block must dominate late one");
+      if (loops.get_depth(*bb) < loops.get_depth(*best)) {
+        best = bb;
+      }
+    }
+    blocks[id] = best;
+    is_changed |= best != inst->get_bb();
+  }
+  if (!is_changed) {
+    return;
+  }
+
+  // Rebuild blocks in RPO instruction order: it keeps definitions before
+  // uses and doesn't reorder pinned instructions.
+  std::vector<Instruction *> terminators;
+  for (auto &&inst : insts) {
+    if (!inst->is_phi()) {
+      inst->get_bb()->remove_instruction(inst);
+    }
+  }
+  for (auto &&inst : insts) {
+    if (inst->is_terminator()) {
+      terminators.push_back(inst);
+    } else if (!inst->is_phi()) {
+      blocks[inst->get_id()]->add_instruction(inst);
+    }
+  }
+  for (auto &&term : terminators) {
+    blocks[term->get_id()]->add_instruction(term);
+  }
+  comp.invalidate_analyses();
+}
+
+namespace {
+
+// Block of if-then-else side which branches to merge block.
+BasicBlock *get_side_merge(BasicBlock *side, const BasicBlock *head) {
+  if (side == head || side->get_num_predecessors() != 1 ||
+      side->get_num_successors() != 1) {
+    return nullptr;
+  }
+  return side->get_uncond_successor();
+}
+
+// Number of side instructions or nullopt if some of them can't be executed
+// speculatively.
+std::optional<size_t> get_speculation_cost(BasicBlock &side) {
+  size_t cost = 0;
+  for (auto &&inst : side) {
+    if (inst.is_terminator()) {
+      continue;
+    }
+    if (GlobalCodeMotion::is_pinned(inst)) {
+      return std::nullopt;
+    }
+    ++cost;
+  }
+  return cost;
+}
+
+} // namespace
+
+bool IfConversion::try_convert(IRBuilder &builder, BasicBlock *head) const {
+  if (head->empty() || head->back().get_opcode() != INST_COND_BR) {
+    return false;
+  }
+  auto &&branch = static_cast<ConditionalBranchInstruction &>(head->back());
+  if (branch.get_lhs()->get_type() != INTEGER) {
+    return false;
+  }
+  auto false_bb = branch.get_false_block();
+  auto true_bb = branch.get_true_block();
+  if (false_bb == true_bb) {
+    return false;
+  }
+  // In triangle one of successors is merge block itself.
+  BasicBlock *merge = nullptr;
+  std::vector<BasicBlock *> sides;
+  auto false_merge = get_side_merge(false_bb, head);
+  auto true_merge = get_side_merge(true_bb, head);
+  if (false_merge != nullptr && false_merge == true_merge) {
+    merge = false_merge;
+    sides = {false_bb, true_bb};
+  } else if (true_merge == false_bb) {
+    merge = false_bb;
+    sides = {true_bb};
+  } else if (false_merge == true_bb) {
+    merge = true_bb;
+    sides = {false_bb};
+  } else {
+    return false;
+  }
+  if (merge == head) {
+    return false;
+  }
+
+  size_t cost = 0;
+  for (auto &&side : sides) {
+    if (!side->empty() && side->front().is_phi()) {
+      return false;
+    }
+    auto side_cost = get_speculation_cost(*side);
+    if (!side_cost) {
+      return false;
+    }
+    cost += *side_cost;
+  }
+  // Values which come to merge from false and true paths.
+  auto false_pred = false_bb == merge ? head : false_bb;
+  auto true_pred = true_bb == merge ? head : true_bb;
+  std::vector<PhiInstruction *> phis;
+  for (auto &&inst : *merge) {
+    if (!inst.is_phi()) {
+      break;
+    }
+    auto phi = static_cast<PhiInstruction *>(&inst);
+    phis.push_back(phi);
+    cost += phi->get_value_for(false_pred) != phi->get_value_for(true_pred);
+  }
+  if (cost > m_max_cost) {
+    return false;
+  }
+
+  for (auto &&side : sides) {
+    std::vector<Instruction *> insts;
+    for (auto &&inst : *side) {
+      if (!inst.is_terminator()) {
+        insts.push_back(&inst);
+      }
+    }
+    for (auto &&inst : insts) {
+      side->remove_instruction(inst);
+      builder.insert_before_terminator(inst, head);
+    }
+  }
+  for (auto &&phi : phis) {
+    auto false_value = phi->get_value_for(false_pred);
+    auto true_value = phi->get_value_for(true_pred);
+    Instruction *value = true_value;
+    if (false_value != true_value) {
+      value = builder.make_select(branch.get_flag(), branch.get_lhs(),
+                                  branch.get_rhs(), true_value, false_value);
+      builder.insert_before_terminator(value, head);
+    }
+    auto idx = phi->get_option_idx(head);
+    if (idx < phi->get_num_options()) {
+      phi->set_option(idx, head, value);
+    } else {
+      phi->add_option(head, value);
+    }
+  }
+  // Sides become unreachable, their phi options are removed with them.
+  builder.replace_with_branch(head, merge);
+  builder.rm_unreachable_blocks();
+  if (merge->get_num_predecessors() == 1) {
+    for (auto &&phi : phis) {
+      IRBuilder::move_users(phi, phi->get_value_for(head));
+      IRBuilder::rm_instruction(phi);
+    }
+  }
+  return true;
+}
+
+void IfConversion::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
+  IRBuilder builder(graph);
+  bool is_converted = false;
+  do {
+    is_converted = false;
+    auto &&rpo = compiler.get_or_create<RPOAnalysis>(compiler);
+    std::vector<bbid_t> blocks(rpo.begin(), rpo.end());
+    // Inner diamonds are converted first, so outer ones may become small
+    // enough in the same sweep. Removed blocks are left empty.
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+      is_converted |= try_convert(builder, graph.get_bb(*it));
+    }
+    if (is_converted) {
+      compiler.invalidate_analyses();
+    }
+  } while (is_converted);
+}
+
+} // namespace koda
@@ -1,4 +1,65 @@
 #include <Core/Compiler.h>
 #include <DataStructures/Graph.hpp>
 
-namespace koda {} // namespace koda
\ No newline at end of file
+namespace koda {
+
+namespace {
+
+template <typename Pass> std::unique_ptr<PassI> make_pass() {
+  return std::make_unique<Pass>();
+}
+
+constexpr std::pair<std::string_view, std::unique_ptr<PassI> (*)()>
+    PASS_FACTORIES[] = {
+        {"const-fold", make_pass<ConstantFolding>},
+        {"peephole", make_pass<Peephole>},
+        {"reassociate", make_pass<Reassociation>},
+        {"redundant-phi", make_pass<RedundantPhiElimination>},
+        {"range-simplify", make_pass<RangeSimplification>},
+        {"bit-simplify", make_pass<BitSimplification>},
+        {"loop-rotate", make_pass<LoopRotation>},
+        {"loop-strength-reduce", make_pass<LoopStrengthReduction>},
+        {"loop-unroll", make_pass<LoopUnroll>},
+        {"gcm", make_pass<GlobalCodeMotion>},
+        {"if-convert", make_pass<IfConversion>},
+        {"rm-unused", make_pass<RmUnused>},
+};
+
+} // namespace
+
+std::unique_ptr<PassI> create_pass(std::string_view name) {
+  for (auto &&[pass_name, factory] : PASS_FACTORIES) {
+    if (pass_name == name) {
+      return factory();
+    }
+  }
+  return nullptr;
+}
+
+const std::vector<std::string_view> &get_pass_names() {
+  static const std::vector<std::string_view> names = [] {
+    std::vector<std::string_view> names;
+    for (auto &&[name, factory] : PASS_FACTORIES) {
+      names.push_back(name);
+    }
+    return names;
+  }();
+  return names;
+}
+
+const std::vector<std::string_view> &get_default_pipeline() {
+  static const std::vector<std::string_view> pipeline = {
+      "const-fold", "peephole", "reassociate", "redundant-phi",
+      "range-simplify", "bit-simplify", "loop-rotate", "loop-strength-reduce",
+      "loop-unroll", "const-fold", "peephole", "gcm", "if-convert",
+      "rm-unused"};
+  return pipeline;
+}
+
+void Compiler::register_default_passes() {
+  for (auto &&name : get_default_pipeline()) {
+    m_passes.push_back(create_pass(name));
+  }
+}
+
+} // namespace koda
@@ -0,0 +1,219 @@
+#include <Core/Inliner.hpp>
+#include <DataStructures/Graph.hpp>
+#include <IR/IRBuilder.hpp>
+#include <IR/IRCloner.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace koda {
+
+namespace {
+
+std::vector<BasicBlock *> get_reachable_blocks(ProgramGraph &graph) {
+  std::vector<BasicBlock *> blocks;
+  visit_dfs(graph, graph.get_entry(),
+            [&blocks](BasicBlock *bb) { blocks.push_back(bb); });
+  return blocks;
+}
+
+std::vector<CallInstruction *> get_calls(ProgramGraph &graph) {
+  std::vector<CallInstruction *> calls;
+  for (auto &&bb : graph) {
+    for (auto &&inst : bb) {
+      if (inst.get_opcode() == INST_CALL) {
+        calls.push_back(static_cast<CallInstruction *>(&inst));
+      }
+    }
+  }
+  return calls;
+}
+
+// Tarjan's algorithm. Components are completed in reverse topological
+// order, i.e. callees first.
+class CallGraphSCC {
+  static constexpr size_t UNVISITED = std::numeric_limits<size_t>::max();
+
+  const Module &m_module;
+
+  std::vector<std::vector<funcid_t>> m_callees;
+
+  std::vector<size_t> m_index;
+
+  std::vector<size_t> m_lowlink;
+
+  std::vector<bool> m_on_stack;
+
+  std::vector<funcid_t> m_stack;
+
+  size_t m_counter = 0;
+
+  std::vector<std::vector<funcid_t>> m_sccs;
+
+  void visit(funcid_t func) {
+    m_index[func] = m_lowlink[func] = m_counter++;
+    m_stack.push_back(func);
+    m_on_stack[func] = true;
+    for (auto &&callee : m_callees[func]) {
+      if (m_index[callee] == UNVISITED) {
+        visit(callee);
+        m_lowlink[func] = std::min(m_lowlink[func], m_lowlink[callee]);
+      } else if (m_on_stack[callee]) {
+        m_lowlink[func] = std::min(m_lowlink[func], m_index[callee]);
+      }
+    }
+    if (m_lowlink[func] != m_index[func]) {
+      return;
+    }
+    auto &&scc = m_sccs.emplace_back();
+    funcid_t member = 0;
+    do {
+      member = m_stack.back();
+      m_stack.pop_back();
+      m_on_stack[member] = false;
+      scc.push_back(member);
+    } while (member != func);
+  }
+
+public:
+  CallGraphSCC(const Module &module)
+      : m_module(module), m_callees(module.size()),
+        m_index(module.size(), UNVISITED), m_lowlink(module.size(), 0),
+        m_on_stack(module.size(), false) {}
+
+  std::vector<std::vector<funcid_t>> run() {
+    for (funcid_t func = 0; func < m_module.size(); ++func) {
+      for (auto &&call : get_calls(m_module.get_function(func))) {
+        m_callees[func].push_back(call->get_callee());
+      }
+    }
+    for (funcid_t func = 0; func < m_module.size(); ++func) {
+      if (m_index[func] == UNVISITED) {
+        visit(func);
+      }
+    }
+    return std::move(m_sccs);
+  }
+};
+
+} // namespace
+
+std::vector<std::vector<funcid_t>>
+Inliner::get_call_sccs(const Module &module) {
+  return CallGraphSCC(module).run();
+}
+
+size_t Inliner::get_inline_cost(ProgramGraph &function) {
+  size_t cost = 0;
+  for (auto &&bb : function) {
+    for (auto &&inst : bb) {
+      // Parameters are replaced with arguments, returns with branches
+      if (inst.get_opcode() != INST_PARAM && inst.get_opcode() != INST_RET) {
+        ++cost;
+      }
+    }
+  }
+  return cost;
+}
+
+bool Inliner::can_inline(ProgramGraph &callee) {
+  auto entry = callee.get_entry();
+  if (entry == nullptr || entry->get_num_predecessors() != 0) {
+    return false;
+  }
+  auto blocks = get_reachable_blocks(callee);
+  return std::any_of(blocks.begin(), blocks.end(), [](BasicBlock *bb) {
+    return !bb->empty() && bb->back().get_opcode() == INST_RET;
+  });
+}
+
+Instruction *Inliner::inline_call(ProgramGraph &caller, CallInstruction *call,
+                                  ProgramGraph &callee) {
+  IRBuilder builder(caller);
+  IRCloner cloner(caller);
+  auto blocks = get_reachable_blocks(callee);
+  for (auto &&bb : blocks) {
+    for (auto &&inst : *bb) {
+      if (inst.get_opcode() != INST_PARAM) {
+        continue;
+      }
+      size_t idx = static_cast<LoadParam &>(inst).get_index();
+      if (idx >= call->get_num_inputs() ||
+          call->get_input(idx)->get_type() != inst.get_type()) {
+        throw IRInvalidArgument("Call arguments don't match callee params");
+      }
+      cloner.map_value(&inst, call->get_input(idx));
+    }
+  }
+  auto copies = cloner.clone_blocks(blocks);
+  auto call_bb = call->get_bb();
+  auto cont_bb = builder.split_block(call);
+  std::vector<std::pair<BasicBlock *, Instruction *>> returns;
+  for (auto &&bb : copies) {
+    if (bb->empty() || bb->back().get_opcode() != INST_RET) {
+      continue;
+    }
+    auto ret = static_cast<ReturnInstruction *>(&bb->back());
+    auto value = ret->get_input();
+    if (value->get_type() != call->get_type()) {
+      throw IRInvalidArgument("Call type doesn't match callee return");
+    }
+    builder.rm_instruction(ret);
+    builder.set_insert_point(bb);
+    builder.create_branch(cont_bb);
+    returns.emplace_back(bb, value);
+  }
+  Instruction *result = nullptr;
+  if (returns.size() == 1) {
+    result = returns.front().second;
+  } else {
+    auto phi = builder.make_phi(call->get_type());
+    builder.insert_phi(phi, cont_bb);
+    for (auto &&[bb, value] : returns) {
+      phi->add_option(bb, value);
+    }
+    result = phi;
+  }
+  builder.move_users(call, result);
+  builder.rm_instruction(call);
+  builder.set_insert_point(call_bb);
+  builder.create_branch(cloner.get_block(callee.get_entry()));
+  return result;
+}
+
+bool Inliner::run(Module &module) {
+  auto sccs = get_call_sccs(module);
+  std::vector<size_t> scc_of(module.size());
+  for (size_t scc_idx = 0; scc_idx < sccs.size(); ++scc_idx) {
+    for (auto &&func : sccs[scc_idx]) {
+      scc_of[func] = scc_idx;
+    }
+  }
+  bool changed = false;
+  for (auto &&scc : sccs) {
+    for (auto &&func : scc) {
+      auto &&caller = module.get_function(func);
+      size_t caller_size = get_inline_cost(caller);
+      // Calls appearing in copied bodies are either recursive or were
+      // rejected in callee, so they are not revisited.
+      for (auto &&call : get_calls(caller)) {
+        funcid_t callee_id = call->get_callee();
+        if (scc_of[callee_id] == scc_of[func]) {
+          continue;
+        }
+        auto &&callee = module.get_function(callee_id);
+        size_t cost = get_inline_cost(callee);
+        if (cost > m_callee_threshold ||
+            caller_size + cost > m_caller_budget || !can_inline(callee)) {
+          continue;
+        }
+        inline_call(caller, call, callee);
+        caller_size += cost;
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+} // namespace koda
@@ -0,0 +1,608 @@
+#include <Core/Analysis.hpp>
+#include <Core/Compiler.h>
+#include <Core/Passes.hpp>
+#include <IR/Arithmetic.hpp>
+#include <IR/BasicBlock.hpp>
+#include <IR/IRBuilder.hpp>
+#include <IR/IRCloner.hpp>
+
+#include <limits>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace koda {
+
+namespace {
+
+bool is_int_const(const Instruction *inst) {
+  return inst->get_opcode() == INST_CONST && inst->get_type() == INTEGER;
+}
+
+int64_t get_int_const(const Instruction *inst) {
+  assert(is_int_const(inst) && "Integer constant expected");
+  return static_cast<const LoadConstant<int64_t> *>(inst)->get_value();
+}
+
+// Emit scale * value + offset at the end of block.
+Instruction *emit_affine(IRBuilder &builder, BasicBlock *bb,
+                         Instruction *value, int64_t scale, int64_t offset) {
+  if (is_int_const(value)) {
+    auto folded = builder.make_int_constant(
+        wrap_add(wrap_mul(scale, get_int_const(value)), offset));
+    builder.insert_before_terminator(folded, bb);
+    return folded;
+  }
+  auto scale_const = builder.make_int_constant(scale);
+  builder.insert_before_terminator(scale_const, bb);
+  Instruction *result = builder.make_imul(value, scale_const);
+  builder.insert_before_terminator(result, bb);
+  if (offset != 0) {
+    auto offset_const = builder.make_int_constant(offset);
+    builder.insert_before_terminator(offset_const, bb);
+    result = builder.make_iadd(result, offset_const);
+    builder.insert_before_terminator(result, bb);
+  }
+  return result;
+}
+
+bool is_same_value(const Instruction *lhs, const Instruction *rhs) {
+  if (lhs == rhs) {
+    return true;
+  }
+  return is_int_const(lhs) && is_int_const(rhs) &&
+         get_int_const(lhs) == get_int_const(rhs);
+}
+
+// Loop which is exited only by the test in its header:
+//   preheader -> header -> body_entry -> ... -> latch -> header
+//                      \-> exit
+struct LoopShape {
+  BasicBlock *preheader = nullptr;
+  BasicBlock *header = nullptr;
+  BasicBlock *body_entry = nullptr;
+  BasicBlock *latch = nullptr;
+  BasicBlock *exit = nullptr;
+  // Header goes first
+  std::vector<BasicBlock *> blocks;
+};
+
+std::optional<LoopShape> get_loop_shape(const LoopInfo &loop) {
+  LoopShape shape;
+  shape.header = loop.get_header();
+  auto &&latches = loop.get_latches();
+  if (!loop.is_reducible() || latches.size() != 1) {
+    return std::nullopt;
+  }
+  shape.latch = latches.front();
+  auto header = shape.header;
+  if (header->empty() || header->back().get_opcode() != INST_COND_BR ||
+      header->get_num_predecessors() != 2) {
+    return std::nullopt;
+  }
+  shape.body_entry = header->get_true_successor();
+  shape.exit = header->get_false_successor();
+  if (!loop.contains(shape.body_entry)) {
+    std::swap(shape.body_entry, shape.exit);
+  }
+  if (!loop.contains(shape.body_entry) || loop.contains(shape.exit) ||
+      shape.body_entry == header) {
+    return std::nullopt;
+  }
+  for (auto pred = header->pred_begin(); pred != header->pred_end(); ++pred) {
+    if (*pred != shape.latch) {
+      shape.preheader = *pred;
+    }
+  }
+  if (shape.preheader == nullptr || loop.contains(shape.preheader)) {
+    return std::nullopt;
+  }
+  shape.blocks.push_back(header);
+  for (auto &&bb : loop) {
+    if (bb == header) {
+      continue;
+    }
+    // Single exit from header
+    bool has_side_exit = std::any_of(
+        bb->succ_begin(), bb->succ_end(),
+        [&loop](BasicBlock *succ) { return !loop.contains(succ); });
+    if (has_side_exit) {
+      return std::nullopt;
+    }
+    shape.blocks.push_back(bb);
+  }
+  return shape;
+}
+
+template <typename Visitor>
+void for_each_phi(BasicBlock *bb, Visitor &&visitor) {
+  for (auto &&inst : *bb) {
+    if (!inst.is_phi()) {
+      break;
+    }
+    visitor(static_cast<PhiInstruction *>(&inst));
+  }
+}
+
+// Copy one iteration of the loop before it. Copied iteration is known to
+// execute, so its exit test is dropped. Copy's latch becomes new preheader.
+void peel_iteration(IRBuilder &builder, ProgramGraph &graph,
+                    LoopShape &shape) {
+  IRCloner cloner(graph);
+  for_each_phi(shape.header, [&shape, &cloner](PhiInstruction *phi) {
+    cloner.map_value(phi, phi->get_value_for(shape.preheader));
+  });
+  cloner.clone_blocks(shape.blocks);
+  auto header_copy = cloner.get_block(shape.header);
+  auto latch_copy = cloner.get_block(shape.latch);
+  builder.replace_with_branch(header_copy, cloner.get_block(shape.body_entry));
+  latch_copy->replace_successor(header_copy, shape.header);
+  shape.preheader->replace_successor(shape.header, header_copy);
+  for_each_phi(shape.header, [&shape, &cloner,
+                               latch_copy](PhiInstruction *phi) {
+    auto value = cloner.get_value(phi->get_value_for(shape.latch));
+    phi->set_option(phi->get_option_idx(shape.preheader), latch_copy, value);
+  });
+  shape.preheader = latch_copy;
+}
+
+// Put factor - 1 copies of the loop body between latch and header. Tests of
+// the copies are dropped, so trip count must be multiple of factor.
+void replicate_body(IRBuilder &builder, ProgramGraph &graph,
+                    const LoopShape &shape, size_t factor) {
+  std::unordered_map<PhiInstruction *, Instruction *> carried;
+  for_each_phi(shape.header, [&shape, &carried](PhiInstruction *phi) {
+    carried[phi] = phi->get_value_for(shape.latch);
+  });
+  // Edges are rewired after all copies are made, so every copy of the latch
+  // is cloned with backedge to the original header.
+  std::vector<std::pair<BasicBlock *, BasicBlock *>> copies;
+  for (size_t copy_idx = 1; copy_idx < factor; ++copy_idx) {
+    IRCloner cloner(graph);
+    for (auto &&[phi, value] : carried) {
+      cloner.map_value(phi, value);
+    }
+    cloner.clone_blocks(shape.blocks);
+    auto header_copy = cloner.get_block(shape.header);
+    builder.replace_with_branch(header_copy,
+                                cloner.get_block(shape.body_entry));
+    copies.emplace_back(header_copy, cloner.get_block(shape.latch));
+    for (auto &&[phi, value] : carried) {
+      value = cloner.get_value(phi->get_value_for(shape.latch));
+    }
+  }
+  BasicBlock *prev_latch = shape.latch;
+  for (auto &&[header_copy, latch_copy] : copies) {
+    prev_latch->replace_successor(shape.header, header_copy);
+    latch_copy->replace_successor(header_copy, shape.header);
+    prev_latch = latch_copy;
+  }
+  for (auto &&[phi, value] : carried) {
+    phi->set_option(phi->get_option_idx(shape.latch), prev_latch, value);
+  }
+}
+
+// Redirect all uses of from in user to to.
+void replace_input(Instruction *user, Instruction *from, Instruction *to) {
+  for (size_t idx = 0, num = user->get_num_inputs(); idx < num; ++idx) {
+    if (user->get_input(idx) == from) {
+      user->set_input(idx, to);
+      from->rm_user(user);
+      to->add_user(user);
+    }
+  }
+}
+
+// Copy header test into guard before the loop, so the old header is
+// executed only after the body and becomes the latch:
+//   guard -> preheader -> body_entry -> ... -> latch -> header -> body_entry
+//        \-> exit                                           \-> exit
+// Values of header reach body and exit through new phis, which merge copies
+// from guard with originals from header.
+void rotate_loop(IRBuilder &builder, ProgramGraph &graph, const LoopInfo &loop,
+                 const LoopShape &shape) {
+  auto header = shape.header;
+  IRCloner cloner(graph);
+  std::vector<PhiInstruction *> header_phis;
+  for_each_phi(header, [&shape, &cloner, &header_phis](PhiInstruction *phi) {
+    cloner.map_value(phi, phi->get_value_for(shape.preheader));
+    header_phis.push_back(phi);
+  });
+  auto guard = cloner.clone_blocks({header}).front();
+  shape.preheader->replace_successor(header, guard);
+  auto preheader = graph.create_basic_block();
+  guard->replace_successor(shape.body_entry, preheader);
+  builder.set_insert_point(preheader);
+  builder.create_branch(shape.body_entry);
+
+  // Phis which already take values from header get copies from new edges.
+  std::unordered_set<Instruction *> edge_phis;
+  auto add_edge_option = [&](BasicBlock *bb, BasicBlock *pred) {
+    for_each_phi(bb, [&](PhiInstruction *phi) {
+      phi->add_option(pred, cloner.get_value(phi->get_value_for(header)));
+      edge_phis.insert(phi);
+    });
+  };
+  add_edge_option(shape.body_entry, preheader);
+  add_edge_option(shape.exit, guard);
+  for (auto &&phi : header_phis) {
+    phi->remove_option(phi->get_option_idx(shape.preheader));
+  }
+
+  auto make_merge_phi = [&](Instruction *value, BasicBlock *bb,
+                            BasicBlock *pred) {
+    auto phi = builder.make_phi(value->get_type());
+    builder.insert_phi(phi, bb);
+    phi->add_option(pred, cloner.get_value(value));
+    phi->add_option(header, value);
+    edge_phis.insert(phi);
+    return phi;
+  };
+  std::unordered_map<Instruction *, PhiInstruction *> body_phis;
+  auto get_body_phi = [&](Instruction *value) {
+    auto &&phi = body_phis[value];
+    if (phi == nullptr) {
+      phi = make_merge_phi(value, shape.body_entry, preheader);
+    }
+    return phi;
+  };
+  for (auto &&inst : *header) {
+    if (inst.is_terminator()) {
+      continue;
+    }
+    std::vector<Instruction *> users(inst.users_begin(), inst.users_end());
+    std::sort(users.begin(), users.end());
+    users.erase(std::unique(users.begin(), users.end()), users.end());
+    PhiInstruction *exit_phi = nullptr;
+    for (auto &&user : users) {
+      auto bb = user->get_bb();
+      if (bb == header || edge_phis.count(user) != 0) {
+        continue;
+      }
+      if (loop.contains(bb)) {
+        replace_input(user, &inst, get_body_phi(&inst));
+        continue;
+      }
+      if (exit_phi == nullptr) {
+        exit_phi = make_merge_phi(&inst, shape.exit, guard);
+      }
+      replace_input(user, &inst, exit_phi);
+    }
+  }
+
+  // Header is entered only from latch now, so its phis hold values from the
+  // previous iteration. Values computed by header on previous iteration are
+  // seen by body through its phis.
+  std::vector<Instruction *> replacements;
+  for (auto &&phi : header_phis) {
+    auto value = phi->get_value_for(shape.latch);
+    replacements.push_back(value->get_bb() == header ? get_body_phi(value)
+                                                     : value);
+  }
+  for (size_t idx = 0; idx < header_phis.size(); ++idx) {
+    IRBuilder::move_users(header_phis[idx], replacements[idx]);
+    IRBuilder::rm_instruction(header_phis[idx]);
+  }
+}
+
+size_t get_loop_size(const LoopShape &shape) {
+  size_t size = 0;
+  for (auto &&bb : shape.blocks) {
+    size += bb->size();
+  }
+  return size;
+}
+
+} // namespace
+
+void LoopStrengthReduction::run(Compiler &compiler) {
+  auto &&loops = compiler.get_or_create<LoopTreeAnalysis>(compiler);
+  auto &&ivs = compiler.get_or_create<InductionVariableAnalysis>(compiler);
+  IRBuilder builder(compiler.graph());
+  bool changed = false;
+  for (auto &&loop_it : loops.get()) {
+    const LoopInfo &loop = loop_it.second.value();
+    if (loop_it.first == LoopInfo::NIL_LOOP_ID || !loop.is_reducible() ||
+        ivs.get_basic_ivs(loop.get_id()).empty()) {
+      continue;
+    }
+    // Collect multiplications first, since rewriting changes blocks.
+    std::vector<Instruction *> muls;
+    for (auto &&bb : loop) {
+      for (auto &&inst : *bb) {
+        if (inst.get_opcode() != INST_MUL) {
+          continue;
+        }
+        auto iv = ivs.get(inst);
+        if (iv && iv->base->get_bb() == loop.get_header()) {
+          muls.push_back(&inst);
+        }
+      }
+    }
+    // Multiplications giving the same function of IV share recurrence.
+    std::map<std::tuple<instid_t, int64_t, int64_t>, Instruction *> reduced;
+    for (auto &&mul : muls) {
+      auto iv = ivs.get(*mul);
+      Instruction *replacement = iv->base;
+      if (!iv->is_basic()) {
+        auto key = std::make_tuple(iv->base->get_id(), iv->scale, iv->offset);
+        auto recurrence = reduced.find(key);
+        if (recurrence == reduced.end()) {
+          auto &&basic = *ivs.get_basic(*iv->base);
+          replacement =
+              create_recurrence(builder, loop, basic, iv->scale, iv->offset);
+          reduced[key] = replacement;
+        } else {
+          replacement = recurrence->second;
+        }
+      }
+      builder.move_users(mul, replacement);
+      builder.rm_instruction(mul);
+      changed = true;
+    }
+    changed |= merge_duplicate_ivs(builder, loop, ivs);
+    changed |= remove_dead_ivs(builder, loop, ivs);
+  }
+  if (changed) {
+    compiler.invalidate_analyses();
+  }
+}
+
+PhiInstruction *LoopStrengthReduction::create_recurrence(
+    IRBuilder &builder, const LoopInfo &loop,
+    const BasicInductionVariable &basic, int64_t scale, int64_t offset) {
+  auto phi = builder.make_phi(INTEGER);
+  builder.insert_phi(phi, loop.get_header());
+  // Recurrence is updated right after basic IV, so both of them are
+  // available on backedges.
+  auto step = builder.make_int_constant(wrap_mul(scale, basic.step));
+  builder.insert_after(step, basic.update);
+  auto next = builder.make_iadd(phi, step);
+  builder.insert_after(next, step);
+  for (size_t i = 0, num = basic.phi->get_num_inputs(); i < num; ++i) {
+    auto &&[bb, init] = basic.phi->get_option(i);
+    if (loop.contains(bb)) {
+      phi->add_option(bb, next);
+    } else {
+      phi->add_option(bb, emit_affine(builder, bb, init, scale, offset));
+    }
+  }
+  return phi;
+}
+
+bool LoopStrengthReduction::merge_duplicate_ivs(
+    IRBuilder &builder, const LoopInfo &loop,
+    const InductionVariableAnalysis &ivs) {
+  auto same_init = [&loop](PhiInstruction *lhs, PhiInstruction *rhs) {
+    if (lhs->get_num_inputs() != rhs->get_num_inputs()) {
+      return false;
+    }
+    for (size_t i = 0, num = lhs->get_num_inputs(); i < num; ++i) {
+      auto &&[bb, init] = lhs->get_option(i);
+      if (loop.contains(bb)) {
+        continue;
+      }
+      auto other_init = rhs->get_value_for(bb);
+      if (!other_init || !is_same_value(init, other_init)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  bool changed = false;
+  auto &&basics = ivs.get_basic_ivs(loop.get_id());
+  for (size_t i = 0; i < basics.size(); ++i) {
+    auto &&keep = *ivs.get_basic(*basics[i]);
+    if (keep.phi->get_bb() == nullptr) {
+      continue;
+    }
+    for (size_t j = i + 1; j < basics.size(); ++j) {
+      auto &&dup = *ivs.get_basic(*basics[j]);
+      if (dup.phi->get_bb() == nullptr || dup.step != keep.step ||
+          !same_init(keep.phi, dup.phi)) {
+        continue;
+      }
+      // Both phis hold the same value on every iteration. Duplicate update
+      // stays in place, since its users may precede the kept update.
+      builder.move_users(dup.phi, keep.phi);
+      builder.rm_instruction(dup.phi);
+      if (dup.update->get_num_users() == 0) {
+        builder.rm_instruction(dup.update);
+      }
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool LoopStrengthReduction::remove_dead_ivs(
+    IRBuilder &builder, const LoopInfo &loop,
+    const InductionVariableAnalysis &ivs) {
+  bool changed = false;
+  for (auto &&phi : ivs.get_basic_ivs(loop.get_id())) {
+    if (phi->get_bb() == nullptr) {
+      continue;
+    }
+    auto update = ivs.get_basic(*phi)->update;
+    auto is_only_user = [](Instruction *inst, Instruction *user) {
+      return std::all_of(inst->users_begin(), inst->users_end(),
+                         [user](Instruction *use) { return use == user; });
+    };
+    // phi and its update only feed each other
+    if (update->get_bb() == nullptr || !is_only_user(phi, update) ||
+        !is_only_user(update, phi)) {
+      continue;
+    }
+    builder.rm_instruction(phi);
+    builder.rm_instruction(update);
+    changed = true;
+  }
+  return changed;
+}
+
+void LoopRotation::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
+  IRBuilder builder(graph);
+  // Guard and preheader belong to the parent loop, so loop tree is rebuilt
+  // after each rotation. Rotated loop exits from latch, so it isn't rotated
+  // again.
+  for (bool is_rotated = true; is_rotated;) {
+    is_rotated = false;
+    auto &&loops = compiler.get_or_create<LoopTreeAnalysis>(compiler);
+    for (auto &&loop_it : loops.get()) {
+      const LoopInfo &loop = loop_it.second.value();
+      if (loop_it.first == LoopInfo::NIL_LOOP_ID) {
+        continue;
+      }
+      auto shape = get_loop_shape(loop);
+      if (!shape || shape->header->size() > m_max_header_size ||
+          shape->body_entry->get_num_predecessors() != 1 ||
+          shape->exit->get_num_predecessors() != 1) {
+        continue;
+      }
+      rotate_loop(builder, graph, loop, *shape);
+      compiler.invalidate_analyses();
+      is_rotated = true;
+      break;
+    }
+  }
+}
+
+std::optional<uint64_t>
+LoopUnroll::get_trip_count(const LoopInfo &loop,
+                           const InductionVariableAnalysis &ivs) {
+  using int128 = __int128;
+  auto shape = get_loop_shape(loop);
+  if (!shape) {
+    return std::nullopt;
+  }
+  auto &&cond =
+      static_cast<const ConditionalBranchInstruction &>(shape->header->back());
+  CmpFlag flag = cond.get_flag();
+  Instruction *iv_inst = cond.get_lhs();
+  Instruction *bound_inst = cond.get_rhs();
+  if (!ivs.get(*iv_inst)) {
+    std::swap(iv_inst, bound_inst);
+    flag = swap_flag(flag);
+  }
+  auto iv = ivs.get(*iv_inst);
+  if (!iv || !is_int_const(bound_inst)) {
+    return std::nullopt;
+  }
+  auto basic = ivs.get_basic(*iv->base);
+  if (!basic || basic->loop != loop.get_id()) {
+    return std::nullopt;
+  }
+  auto init_inst = iv->base->get_value_for(shape->preheader);
+  if (!init_inst || !is_int_const(init_inst)) {
+    return std::nullopt;
+  }
+  // Normalize condition to stay in loop while it is true
+  if (cond.get_true_block() != shape->body_entry) {
+    flag = invert_flag(flag);
+  }
+  // Value on k-th test is start + k * step
+  int128 init = get_int_const(init_inst);
+  int128 start = iv->scale * init + iv->offset;
+  int128 step = static_cast<int128>(iv->scale) * basic->step;
+  int128 bound = get_int_const(bound_inst);
+  if (flag == CMP_G || flag == CMP_GE) {
+    start = -start;
+    step = -step;
+    bound = -bound;
+    flag = swap_flag(flag);
+  }
+  if (flag == CMP_LE) {
+    bound += 1;
+    flag = CMP_L;
+  }
+  int128 dist = bound - start;
+  int128 trips = 0;
+  switch (flag) {
+  case CMP_L:
+    if (dist > 0) {
+      if (step <= 0) {
+        return std::nullopt;
+      }
+      trips = (dist + step - 1) / step;
+    }
+    break;
+  case CMP_NE:
+    if (step == 0 || dist % step != 0 || dist / step < 0) {
+      return std::nullopt;
+    }
+    trips = dist / step;
+    break;
+  case CMP_EQ:
+    trips = dist == 0 ? 1 : 0;
+    break;
+  default:
+    return std::nullopt;
+  }
+  // Machine arithmetic wraps, so values on all iterations must fit into
+  // int64_t for closed form to be correct. Values are monotone, so it's
+  // enough to check the last one.
+  auto fits = [](int128 val) {
+    return val >= std::numeric_limits<int64_t>::min() &&
+           val <= std::numeric_limits<int64_t>::max();
+  };
+  int128 last_phi = init + trips * basic->step;
+  int128 last_iv = iv->scale * last_phi + iv->offset;
+  if (!fits(last_phi) || !fits(last_iv) || !fits(start + trips * step)) {
+    return std::nullopt;
+  }
+  return static_cast<uint64_t>(trips);
+}
+
+void LoopUnroll::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
+  auto &&loops = compiler.get_or_create<LoopTreeAnalysis>(compiler);
+  auto &&ivs = compiler.get_or_create<InductionVariableAnalysis>(compiler);
+  IRBuilder builder(graph);
+  bool changed = false;
+  auto &&loop_tree = loops.get();
+  for (auto &&loop_it : loop_tree) {
+    auto loop_id = loop_it.first;
+    const LoopInfo &loop = loop_it.second.value();
+    bool is_innermost =
+        loop_tree.children_begin(loop_id) == loop_tree.children_end(loop_id);
+    if (loop_id == LoopInfo::NIL_LOOP_ID || !is_innermost) {
+      continue;
+    }
+    auto shape = get_loop_shape(loop);
+    auto trips = get_trip_count(loop, ivs);
+    if (!shape || !trips || *trips == 0) {
+      continue;
+    }
+    size_t size = get_loop_size(*shape);
+    if (*trips <= m_max_full_trips && *trips * size <= m_size_budget) {
+      for (uint64_t i = 0; i < *trips; ++i) {
+        peel_iteration(builder, graph, *shape);
+      }
+      // Last test always exits
+      builder.replace_with_branch(shape->header, shape->exit);
+      changed = true;
+      continue;
+    }
+    if (m_factor < 2 || *trips < m_factor) {
+      continue;
+    }
+    uint64_t remainder = *trips % m_factor;
+    if ((m_factor - 1 + remainder) * size > m_size_budget) {
+      continue;
+    }
+    for (uint64_t i = 0; i < remainder; ++i) {
+      peel_iteration(builder, graph, *shape);
+    }
+    replicate_body(builder, graph, *shape, m_factor);
+    changed = true;
+  }
+  if (changed) {
+    builder.rm_unreachable_blocks();
+    compiler.invalidate_analyses();
+  }
+}
+
+} // namespace koda
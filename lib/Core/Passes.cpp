@@ -2,8 +2,16 @@
 #include <Core/Compiler.h>
 #include <Core/Passes.hpp>
 #include <DataStructures/Graph.hpp>
+#include <IR/Arithmetic.hpp>
 #include <IR/BasicBlock.hpp>
 #include <IR/IRBuilder.hpp>
+#include <IR/PatternMatch.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace koda {
 
@@ -24,316 +32,849 @@ void RmUnused::run(Compiler &compiler) {
   }
 }
 
-ConstantFolding::ConstantFolding() {
-  auto get_inputs = [](const Instruction &inst) {
-    assert(inst.get_num_inputs() == 2 && "Binary operation expected");
-    const auto &binop = reinterpret_cast<const BinaryOpInstructionBase &>(inst);
-    ConstInst *lhs = reinterpret_cast<ConstInst *>(binop.get_lhs());
-    assert(lhs->get_opcode() == INST_CONST && "Can't fold non const value");
-    ConstInst *rhs = reinterpret_cast<ConstInst *>(binop.get_rhs());
-    assert(rhs->get_opcode() == INST_CONST && "Can't fold non const value");
-    return std::make_pair(lhs, rhs);
-  };
+namespace {
 
-  m_evaluators[INST_ADD] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_ADD);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    int64_t result = lhs->get_value() + rhs->get_value();
-    return result;
-  };
-  m_evaluators[INST_SUB] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_SUB);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    int64_t result = lhs->get_value() - rhs->get_value();
-    return result;
-  };
-  m_evaluators[INST_MUL] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_MUL);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    int64_t result = lhs->get_value() * rhs->get_value();
-    return result;
-  };
-  m_evaluators[INST_DIV] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_DIV);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    int64_t result = lhs->get_value() / rhs->get_value();
-    return result;
-  };
-  m_evaluators[INST_SHL] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_SHL);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    uint64_t result = static_cast<uint64_t>(lhs->get_value())
-                      << static_cast<uint64_t>(rhs->get_value());
-    return result;
-  };
-  m_evaluators[INST_SHR] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_SHR);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    uint64_t result = static_cast<uint64_t>(lhs->get_value()) >>
-                      static_cast<uint64_t>(rhs->get_value());
-    return result;
-  };
-  m_evaluators[INST_AND] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_AND);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    uint64_t result = static_cast<uint64_t>(lhs->get_value()) &
-                      static_cast<uint64_t>(rhs->get_value());
-    return result;
-  };
-  m_evaluators[INST_OR] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_OR);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    uint64_t result = static_cast<uint64_t>(lhs->get_value()) |
-                      static_cast<uint64_t>(rhs->get_value());
-    return result;
-  };
-  m_evaluators[INST_XOR] = [&get_inputs](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_XOR);
-    auto &&[lhs, rhs] = get_inputs(inst);
-    uint64_t result = static_cast<uint64_t>(lhs->get_value()) ^
-                      static_cast<uint64_t>(rhs->get_value());
-    return result;
-  };
-  m_evaluators[INST_NOT] = [](const Instruction &inst) {
-    assert(inst.get_opcode() == INST_NOT);
-    ConstInst *val = reinterpret_cast<ConstInst *>(inst.get_input(0));
-    assert(val->get_opcode() == INST_CONST && "Can't fold non const value");
-    return ~static_cast<uint64_t>(val->get_value());
-  };
-}
+// Evaluates instruction on constant inputs. Unary instructions ignore rhs.
+// Returns false if result is undefined.
+using FoldFn = bool (*)(int64_t lhs, int64_t rhs, int64_t &result);
+
+template <InstOpcode Opcode> constexpr FoldFn k_fold_fn = nullptr;
+
+#define FOLD_DEF(name, expr)                                                   \
+  template <>                                                                  \
+  constexpr FoldFn k_fold_fn<INST_##name> =                                    \
+      [](int64_t lhs, int64_t rhs, int64_t &result) {                          \
+        result = (expr);                                                       \
+        return true;                                                           \
+      };
+
+FOLD_DEF(ADD, wrap_add(lhs, rhs))
+FOLD_DEF(SUB, wrap_sub(lhs, rhs))
+FOLD_DEF(MUL, wrap_mul(lhs, rhs))
+FOLD_DEF(MULH, eval_mulh(lhs, rhs))
+FOLD_DEF(SHL, eval_shl(lhs, rhs))
+FOLD_DEF(SHR, eval_shr(lhs, rhs))
+FOLD_DEF(ASHR, eval_ashr(lhs, rhs))
+FOLD_DEF(AND, lhs & rhs)
+FOLD_DEF(OR, lhs | rhs)
+FOLD_DEF(XOR, lhs ^ rhs)
+#undef FOLD_DEF
+
+template <>
+constexpr FoldFn k_fold_fn<INST_NOT> = [](int64_t value, int64_t,
+                                          int64_t &result) {
+  result = ~value;
+  return true;
+};
+
+template <>
+constexpr FoldFn k_fold_fn<INST_DIV> = [](int64_t lhs, int64_t rhs,
+                                          int64_t &result) {
+  if (rhs == 0) {
+    return false;
+  }
+  result = eval_div(lhs, rhs);
+  return true;
+};
+
+template <>
+constexpr FoldFn k_fold_fn<INST_MOD> = [](int64_t lhs, int64_t rhs,
+                                          int64_t &result) {
+  if (rhs == 0) {
+    return false;
+  }
+  result = eval_mod(lhs, rhs);
+  return true;
+};
+
+constexpr std::array<FoldFn, INST_NUM_OPCODES> k_fold_table = {
+#define INAME_DEF(name, dummy) k_fold_fn<INST_##name>,
+#include <IR/IRInstEnum.def>
+#undef INAME_DEF
+};
+
+} // namespace
 
 void ConstantFolding::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
   auto &&rpo = compiler.get_or_create<RPOAnalysis>(compiler);
-  IRBuilder builder(compiler.graph());
+  IRBuilder builder(graph);
+  std::deque<Instruction *> worklist;
   for (auto &&bbid : rpo) {
-    auto &&bb = *compiler.graph().get_bb(bbid);
-    if (bb.empty()) {
+    for (auto &&inst : *graph.get_bb(bbid)) {
+      worklist.push_back(&inst);
+    }
+  }
+  bool changed = false;
+  bool is_cfg_changed = false;
+  while (!worklist.empty()) {
+    auto inst = worklist.front();
+    worklist.pop_front();
+    // Already folded
+    if (inst->get_bb() == nullptr) {
       continue;
     }
-    Instruction *inst = &*bb.begin();
-    while (inst->has_next()) {
-      if (!is_computable(*inst) || !has_const_input(*inst)) {
-        inst = inst->get_next();
-        continue;
-      }
-      auto result = fold(*inst);
-      auto folded_inst = builder.make_int_constant(result);
-      inst = builder.replace(inst, folded_inst);
+    if (inst->get_opcode() == INST_COND_BR) {
+      is_cfg_changed |= fold_branch(
+          builder, static_cast<ConditionalBranchInstruction &>(*inst));
+      continue;
     }
+    int64_t result = 0;
+    if (!fold(*inst, result)) {
+      continue;
+    }
+    std::copy(inst->users_begin(), inst->users_end(),
+              std::back_inserter(worklist));
+    builder.replace(inst, builder.make_int_constant(result));
+    changed = true;
   }
-}
-
-bool ConstantFolding::is_computable(const Instruction &inst) {
-  if (inst.get_type() != INTEGER) {
-    return false;
+  if (is_cfg_changed) {
+    builder.rm_unreachable_blocks();
   }
-  bool is_computable = false;
-  switch (inst.get_opcode()) {
-  case INST_ADD:
-  case INST_SUB:
-  case INST_MUL:
-  case INST_DIV:
-  case INST_SHL:
-  case INST_SHR:
-  case INST_AND:
-  case INST_OR:
-  case INST_XOR:
-  case INST_NOT:
-    is_computable = true;
-    break;
-  default:
-    is_computable = false;
+  if (changed || is_cfg_changed) {
+    compiler.invalidate_analyses();
   }
-  return is_computable;
 }
 
 bool ConstantFolding::has_const_input(const Instruction &inst) {
   return std::all_of(inst.inputs_begin(), inst.inputs_end(),
                      [](const Instruction *input) {
-                       return input->get_opcode() == INST_CONST;
+                       return pattern::is_int_const(input);
                      });
 }
 
-int64_t ConstantFolding::fold(const Instruction &act) {
-  auto &&eval = m_evaluators[act.get_opcode()];
-  auto folded = eval(act);
-  return folded;
+bool ConstantFolding::fold(const Instruction &inst, int64_t &result) {
+  auto fold_fn = k_fold_table[inst.get_opcode()];
+  if (fold_fn == nullptr || inst.get_type() != INTEGER ||
+      !has_const_input(inst)) {
+    return false;
+  }
+  auto num_inputs = inst.get_num_inputs();
+  int64_t lhs = num_inputs > 0 ? pattern::get_int_const(inst.get_input(0)) : 0;
+  int64_t rhs = num_inputs > 1 ? pattern::get_int_const(inst.get_input(1)) : 0;
+  return fold_fn(lhs, rhs, result);
+}
+
+bool ConstantFolding::fold_branch(IRBuilder &builder,
+                                  ConditionalBranchInstruction &branch) {
+  if (!has_const_input(branch)) {
+    return false;
+  }
+  auto lhs = pattern::get_int_const(branch.get_lhs());
+  auto rhs = pattern::get_int_const(branch.get_rhs());
+  auto target = eval_cmp(branch.get_flag(), lhs, rhs)
+                    ? branch.get_true_block()
+                    : branch.get_false_block();
+  builder.replace_with_branch(branch.get_bb(), target);
+  return true;
+}
+
+namespace {
+
+using namespace pattern;
+
+Instruction *insert_int_constant(IRBuilder &builder, Instruction *point,
+                                 int64_t value) {
+  auto constant = builder.make_int_constant(value);
+  builder.insert_before(constant, point);
+  return constant;
+}
+
+// x & x -> x
+Instruction *rewrite_and_self(IRBuilder &, Instruction *inst) {
+  Instruction *x = nullptr;
+  return match(inst, m_And(m_Value(x), m_Same(x))) ? x : nullptr;
+}
+
+// x & 0 -> 0
+Instruction *rewrite_and_zero(IRBuilder &, Instruction *inst) {
+  Instruction *zero = nullptr;
+  return match(inst, m_And(m_Value(), m_Bind(zero, m_Const(0)))) ? zero
+                                                                 : nullptr;
+}
+
+// x & 0xFFFF... -> x
+Instruction *rewrite_and_ones(IRBuilder &, Instruction *inst) {
+  Instruction *x = nullptr;
+  return match(inst, m_And(m_Value(x), m_Const(-1))) ? x : nullptr;
+}
+
+// sub a, a -> 0
+Instruction *rewrite_sub_self(IRBuilder &builder, Instruction *inst) {
+  Instruction *x = nullptr;
+  if (!match(inst, m_Sub(m_Value(x), m_Same(x)))) {
+    return nullptr;
+  }
+  return insert_int_constant(builder, inst, 0);
+}
+
+// sub a, 0 -> a
+Instruction *rewrite_sub_zero(IRBuilder &, Instruction *inst) {
+  Instruction *x = nullptr;
+  return match(inst, m_Sub(m_Value(x), m_Const(0))) ? x : nullptr;
+}
+
+// v1 = shr v0, x
+// v2 = shr v1, y -> v2 = shr v0, (x + y)
+Instruction *rewrite_shr_shr(IRBuilder &builder, Instruction *inst) {
+  Instruction *x = nullptr;
+  int64_t first = 0;
+  int64_t second = 0;
+  if (!match(inst, m_Shr(m_Shr(m_Value(x), m_AnyConst(first)),
+                         m_AnyConst(second)))) {
+    return nullptr;
+  }
+  // Shift amount is taken modulo 64, all bits are shifted out by the sum of
+  // 64 or more.
+  uint64_t total = (first & 63) + (second & 63);
+  if (total >= 64) {
+    return insert_int_constant(builder, inst, 0);
+  }
+  auto shift = insert_int_constant(builder, inst, total);
+  auto result = builder.make_shr(x, shift);
+  builder.insert_before(result, inst);
+  return result;
+}
+
+// Quotient of signed division by constant, rounded toward zero. Emitted
+// instructions are inserted before point.
+Instruction *emit_div_by_const(IRBuilder &builder, Instruction *point,
+                               Instruction *x, int64_t divisor) {
+  assert(divisor != 0 && "Division by zero can't be lowered");
+  auto emit = [&builder, point](Instruction *inst) {
+    builder.insert_before(inst, point);
+    return inst;
+  };
+  auto constant = [&builder, point](int64_t value) {
+    return insert_int_constant(builder, point, value);
+  };
+  if (divisor == 1) {
+    return x;
+  }
+  if (divisor == -1) {
+    return emit(builder.make_isub(constant(0), x));
+  }
+  uint64_t abs_div = divisor < 0 ? -static_cast<uint64_t>(divisor) : divisor;
+  Instruction *quot = nullptr;
+  if ((abs_div & (abs_div - 1)) == 0) {
+    // Shift rounds toward -inf, so negative dividend is biased by
+    // 2^k - 1 first:
+    //   x / 2^k == ashr(x + shr(ashr(x, 63), 64 - k), k)
+    int64_t power = __builtin_ctzll(abs_div);
+    auto sign = emit(builder.make_ashr(x, constant(63)));
+    auto bias = emit(builder.make_shr(sign, constant(64 - power)));
+    auto biased = emit(builder.make_iadd(x, bias));
+    quot = emit(builder.make_ashr(biased, constant(power)));
+    if (divisor < 0) {
+      quot = emit(builder.make_isub(constant(0), quot));
+    }
+    return quot;
+  }
+  auto magic = get_signed_magic(divisor);
+  quot = emit(builder.make_mulh(x, constant(magic.multiplier)));
+  if (divisor > 0 && magic.multiplier < 0) {
+    quot = emit(builder.make_iadd(quot, x));
+  } else if (divisor < 0 && magic.multiplier > 0) {
+    quot = emit(builder.make_isub(quot, x));
+  }
+  if (magic.shift > 0) {
+    quot = emit(builder.make_ashr(quot, constant(magic.shift)));
+  }
+  // Round toward zero: add 1 to negative quotient
+  auto sign_bit = emit(builder.make_shr(quot, constant(63)));
+  return emit(builder.make_iadd(quot, sign_bit));
+}
+
+// div x, c -> mulh/shift sequence
+Instruction *rewrite_div_const(IRBuilder &builder, Instruction *inst) {
+  Instruction *x = nullptr;
+  int64_t divisor = 0;
+  if (!match(inst, m_Div(m_Value(x), m_AnyConst(divisor))) || divisor == 0) {
+    return nullptr;
+  }
+  return emit_div_by_const(builder, inst, x, divisor);
+}
+
+// mod x, c -> x - (x / c) * c
+Instruction *rewrite_mod_const(IRBuilder &builder, Instruction *inst) {
+  Instruction *x = nullptr;
+  int64_t divisor = 0;
+  if (!match(inst, m_Mod(m_Value(x), m_AnyConst(divisor))) || divisor == 0) {
+    return nullptr;
+  }
+  if (divisor == 1 || divisor == -1) {
+    return insert_int_constant(builder, inst, 0);
+  }
+  auto quot = emit_div_by_const(builder, inst, x, divisor);
+  auto div_const = insert_int_constant(builder, inst, divisor);
+  auto prod = builder.make_imul(quot, div_const);
+  builder.insert_before(prod, inst);
+  auto rem = builder.make_isub(x, prod);
+  builder.insert_before(rem, inst);
+  return rem;
+}
+
+} // namespace
+
+Peephole::Peephole() {
+  add_rule(INST_AND, rewrite_and_self);
+  add_rule(INST_AND, rewrite_and_zero);
+  add_rule(INST_AND, rewrite_and_ones);
+  add_rule(INST_SUB, rewrite_sub_self);
+  add_rule(INST_SUB, rewrite_sub_zero);
+  add_rule(INST_SHR, rewrite_shr_shr);
+  add_rule(INST_DIV, rewrite_div_const);
+  add_rule(INST_MOD, rewrite_mod_const);
 }
 
 void Peephole::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
   auto &&rpo = compiler.get_or_create<RPOAnalysis>(compiler);
-  IRBuilder builder(compiler.graph());
+  IRBuilder builder(graph);
+  std::deque<Instruction *> worklist;
+  std::vector<bool> queued;
+  auto enqueue = [&worklist, &queued, &graph](Instruction *inst) {
+    if (queued.size() <= inst->get_id()) {
+      queued.resize(graph.get_instr_count(), false);
+    }
+    if (!queued[inst->get_id()]) {
+      queued[inst->get_id()] = true;
+      worklist.push_back(inst);
+    }
+  };
   for (auto &&bbid : rpo) {
-    auto &&bb = *compiler.graph().get_bb(bbid);
-    if (bb.empty()) {
+    for (auto &&inst : *graph.get_bb(bbid)) {
+      enqueue(&inst);
+    }
+  }
+  bool changed = false;
+  while (!worklist.empty()) {
+    auto inst = worklist.front();
+    worklist.pop_front();
+    queued[inst->get_id()] = false;
+    // Instruction was removed by earlier rewrite
+    if (inst->get_bb() == nullptr) {
       continue;
     }
-    for (auto inst = bb.begin(); inst != bb.end();) {
-      auto maybe_next = peephole_and(builder, &*inst);
-      if (maybe_next) {
-        // After peephole iterator on removed instruction will be invalidated.
-        inst = BasicBlock::iterator(maybe_next.value());
-        // Restart all checks for next instruction
-        continue;
-      }
-      maybe_next = peephole_sub(builder, &*inst);
-      if (maybe_next) {
-        inst = BasicBlock::iterator(maybe_next.value());
+    for (auto &&rule : m_rules[inst->get_opcode()]) {
+      auto replacement = rule(builder, inst);
+      if (replacement == nullptr) {
         continue;
       }
-      maybe_next = peephole_shr(builder, &*inst);
-      if (maybe_next) {
-        inst = BasicBlock::iterator(maybe_next.value());
-        continue;
-      }
-      maybe_next = peephole_div(builder, &*inst);
-      if (maybe_next) {
-        inst = BasicBlock::iterator(maybe_next.value());
-        continue;
-      }
-      // If no peephole applied go to next instruction
-      ++inst;
+      std::vector<Instruction *> users(inst->users_begin(), inst->users_end());
+      builder.move_users(inst, replacement);
+      builder.rm_instruction(inst);
+      enqueue(replacement);
+      std::for_each(users.begin(), users.end(), enqueue);
+      changed = true;
+      break;
     }
   }
+  if (changed) {
+    compiler.invalidate_analyses();
+  }
 }
 
-std::optional<Instruction *> Peephole::peephole_and(IRBuilder &builder,
-                                                    Instruction *inst) {
-  auto apply_peephole = [&builder](BitOperation *and_inst,
-                                   Instruction *replacement) {
-    builder.move_users(and_inst, replacement);
-    auto next = builder.rm_instruction(and_inst);
-    return next;
-  };
-  if (inst->get_opcode() != INST_AND) {
-    return std::nullopt;
+void RangeSimplification::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
+  auto &&ranges = compiler.get_or_create<RangeAnalysis>(compiler);
+  auto &&rpo = compiler.get_or_create<RPOAnalysis>(compiler);
+  IRBuilder builder(graph);
+  std::vector<Instruction *> insts;
+  std::vector<BasicBlock *> blocks;
+  for (auto &&bbid : rpo) {
+    auto bb = graph.get_bb(bbid);
+    blocks.push_back(bb);
+    for (auto &&inst : *bb) {
+      insts.push_back(&inst);
+    }
   }
-  auto lhs = inst->get_input(BinaryOpInstructionBase::LHS);
-  auto rhs = inst->get_input(BinaryOpInstructionBase::RHS);
-  if (lhs->get_id() == rhs->get_id()) {
-    // x & x -> x
-    return apply_peephole(reinterpret_cast<BitOperation *>(inst), lhs);
+  // Rewrites keep values the same, so results of analysis stay valid until
+  // branches are changed.
+  bool changed = false;
+  for (auto &&inst : insts) {
+    if (inst->get_type() != INTEGER || inst->is_phi() ||
+        inst->has_side_effects() || inst->get_opcode() == INST_CONST) {
+      continue;
+    }
+    auto range = ranges.get_range(*inst);
+    if (!range.is_empty() && range.is_constant()) {
+      builder.replace(inst, builder.make_int_constant(range.min));
+      changed = true;
+      continue;
+    }
+    Instruction *x = nullptr;
+    int64_t divisor = 0;
+    if (!match(inst, m_Div(m_Value(x), m_AnyConst(divisor))) &&
+        !match(inst, m_Mod(m_Value(x), m_AnyConst(divisor)))) {
+      continue;
+    }
+    if (divisor <= 0 || (divisor & (divisor - 1)) != 0 ||
+        !ranges.get_range_at(*x, *inst->get_bb()).is_non_negative()) {
+      continue;
+    }
+    // Non-negative dividend needs no rounding bias:
+    //   x / 2^k == shr(x, k), x % 2^k == and(x, 2^k - 1)
+    Instruction *lowered = nullptr;
+    if (inst->get_opcode() == INST_DIV) {
+      auto shift = insert_int_constant(builder, inst,
+                                       __builtin_ctzll(divisor));
+      lowered = builder.make_shr(x, shift);
+    } else {
+      auto mask = insert_int_constant(builder, inst, divisor - 1);
+      lowered = builder.make_and(x, mask);
+    }
+    builder.replace(inst, lowered);
+    changed = true;
   }
-  if (lhs->get_opcode() != INST_CONST && rhs->get_opcode() != INST_CONST) {
-    return std::nullopt;
+  bool is_cfg_changed = false;
+  for (auto &&bb : blocks) {
+    if (bb->empty() || bb->back().get_opcode() != INST_COND_BR) {
+      continue;
+    }
+    auto &&branch = static_cast<ConditionalBranchInstruction &>(bb->back());
+    auto outcome = ranges.get_branch_outcome(branch);
+    if (outcome) {
+      auto target =
+          *outcome ? branch.get_true_block() : branch.get_false_block();
+      builder.replace_with_branch(bb, target);
+      is_cfg_changed = true;
+    }
   }
-  auto &&[var_input, const_input] = std::make_pair(lhs, rhs);
-  if (const_input->get_opcode() != INST_CONST) {
-    std::swap(const_input, var_input);
+  if (is_cfg_changed) {
+    builder.rm_unreachable_blocks();
   }
-  if (is_const_eq(const_input, 0)) {
-    // x & 0 -> 0
-    return apply_peephole(reinterpret_cast<BitOperation *>(inst), const_input);
-  } else if (is_const_eq(const_input, static_cast<int64_t>(~0ul))) {
-    // x & 0xFFFF... -> x
-    return apply_peephole(reinterpret_cast<BitOperation *>(inst), var_input);
+  if (changed || is_cfg_changed) {
+    compiler.invalidate_analyses();
   }
-  return inst;
 }
 
-std::optional<Instruction *> Peephole::peephole_sub(IRBuilder &builder,
-                                                    Instruction *inst) {
-  if (inst->get_opcode() != INST_SUB) {
-    return std::nullopt;
+namespace {
+
+using namespace pattern;
+
+Instruction *simplify_known_bits(IRBuilder &builder, Instruction *inst,
+                                 const KnownBitsAnalysis &known) {
+  auto bits = known.get(*inst);
+  if (bits.is_constant()) {
+    return insert_int_constant(builder, inst, bits.get_constant());
+  }
+  Instruction *lhs = nullptr;
+  Instruction *rhs = nullptr;
+  if (match(inst, m_And(m_Value(lhs), m_Value(rhs)))) {
+    // x & y -> x if y is one in all bits which may be one in x
+    auto lhs_bits = known.get(*lhs);
+    auto rhs_bits = known.get(*rhs);
+    if ((lhs_bits.get_possible_ones() & ~rhs_bits.ones) == 0) {
+      return lhs;
+    }
+    if ((rhs_bits.get_possible_ones() & ~lhs_bits.ones) == 0) {
+      return rhs;
+    }
+    return nullptr;
+  }
+  if (match(inst, m_Or(m_Value(lhs), m_Value(rhs)))) {
+    // x | y -> x if y may be one only where x is one
+    auto lhs_bits = known.get(*lhs);
+    auto rhs_bits = known.get(*rhs);
+    if ((rhs_bits.get_possible_ones() & ~lhs_bits.ones) == 0) {
+      return lhs;
+    }
+    if ((lhs_bits.get_possible_ones() & ~rhs_bits.ones) == 0) {
+      return rhs;
+    }
+    // x | y -> x + y if x and y have no common bits
+    if ((lhs_bits.get_possible_ones() & rhs_bits.get_possible_ones()) == 0) {
+      auto add = builder.make_iadd(lhs, rhs);
+      builder.insert_before(add, inst);
+      return add;
+    }
+    return nullptr;
+  }
+  Instruction *x = nullptr;
+  int64_t inner = 0;
+  int64_t outer = 0;
+  // shl(shr(x, c), c) -> x if c lower bits of x are zero
+  if (match(inst, m_Shl(m_Shr(m_Value(x), m_AnyConst(inner)),
+                        m_AnyConst(outer))) &&
+      (inner & 63) == (outer & 63)) {
+    auto mask = low_bits_mask(outer & 63);
+    return (known.get(*x).zeros & mask) == mask ? x : nullptr;
+  }
+  // shr(shl(x, c), c) -> x if c upper bits of x are zero
+  if (match(inst, m_Shr(m_Shl(m_Value(x), m_AnyConst(inner)),
+                        m_AnyConst(outer))) &&
+      (inner & 63) == (outer & 63)) {
+    auto mask = ~(~uint64_t(0) >> (outer & 63));
+    return (known.get(*x).zeros & mask) == mask ? x : nullptr;
   }
-  auto sub = reinterpret_cast<ArithmeticInstruction *>(inst);
-  if (sub->get_lhs()->get_id() == sub->get_rhs()->get_id()) {
-    // sub a, a -> 0
-    auto zero = builder.make_int_constant(0);
-    auto next = builder.replace(sub, zero);
-    return next;
-  } else if (is_const_eq(sub->get_rhs(), 0)) {
-    // sub a, 0 -> a
-    builder.move_users(sub, sub->get_lhs());
-    auto next = builder.rm_instruction(sub);
-    return next;
-  }
-  return std::nullopt;
+  return nullptr;
 }
 
-std::optional<Instruction *> Peephole::peephole_shr(IRBuilder &builder,
-                                                    Instruction *inst) {
-  if (inst->get_opcode() != INST_SHR) {
-    return std::nullopt;
+Instruction *simplify_demanded_bits(IRBuilder &builder, Instruction *inst,
+                                    const DemandedBitsAnalysis &demanded) {
+  auto bits = demanded.get(*inst);
+  if (bits == 0) {
+    return inst->get_num_users() == 0 ? nullptr
+                                      : insert_int_constant(builder, inst, 0);
   }
-  auto shift = dynamic_cast<BitShift *>(inst);
-  if (!is_const(shift->get_rhs())) {
-    return std::nullopt;
+  // Operations with constant which change only bits nobody reads
+  Instruction *x = nullptr;
+  int64_t mask = 0;
+  if (match(inst, m_And(m_Value(x), m_AnyConst(mask)))) {
+    return (bits & ~mask) == 0 ? x : nullptr;
   }
-  auto user_shift_it = std::find_if(
-      shift->users_begin(), shift->users_end(),
-      [inst](const Instruction *user) {
-        if (user->get_opcode() == INST_SHR) {
-          auto user_shift = dynamic_cast<const BitShift *>(user);
-          return user_shift->get_lhs()->get_id() == inst->get_id() &&
-                 is_const(user_shift->get_rhs());
-        }
-        return false;
-      });
-  if (user_shift_it == shift->users_end()) {
-    return std::nullopt;
+  if (match(inst, m_Or(m_Value(x), m_AnyConst(mask))) ||
+      match(inst, m_Xor(m_Value(x), m_AnyConst(mask)))) {
+    return (bits & mask) == 0 ? x : nullptr;
   }
-  // v1 = shr v0, x
-  // v2 = shr v1, y -> v2 = shr v0, (x+y)
-  auto user_shift = dynamic_cast<BitShift *>(*user_shift_it);
-  uint64_t first = get_const_value(shift->get_rhs());
-  uint64_t second = get_const_value(user_shift->get_rhs());
-  uint64_t result = (first + second) % (sizeof(uint64_t) * 8);
-  auto result_const = builder.make_int_constant(result);
-  auto result_shift = builder.make_shr(shift->get_lhs(), result_const);
-  builder.replace(user_shift, result_shift);
-  builder.insert_before(result_const, result_shift);
-  return inst;
+  return nullptr;
 }
 
-std::optional<Instruction *> Peephole::peephole_div(IRBuilder &builder,
-                                                    Instruction *inst) {
-  if (inst->get_opcode() != INST_DIV) {
-    return std::nullopt;
+} // namespace
+
+void BitSimplification::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
+  IRBuilder builder(graph);
+  // Rewrites keep values of all demanded bits, so results of analysis stay
+  // valid during single sweep.
+  auto sweep = [&compiler, &graph](auto &&simplify) {
+    std::vector<Instruction *> insts;
+    for (auto &&bbid : compiler.get_or_create<RPOAnalysis>(compiler)) {
+      for (auto &&inst : *graph.get_bb(bbid)) {
+        insts.push_back(&inst);
+      }
+    }
+    bool changed = false;
+    for (auto &&inst : insts) {
+      if (inst->get_type() != INTEGER || inst->is_phi() ||
+          inst->has_side_effects() || inst->get_opcode() == INST_CONST) {
+        continue;
+      }
+      auto replacement = simplify(inst);
+      if (replacement != nullptr) {
+        IRBuilder::move_users(inst, replacement);
+        IRBuilder::rm_instruction(inst);
+        changed = true;
+      }
+    }
+    if (changed) {
+      compiler.invalidate_analyses();
+    }
+  };
+  auto &&known = compiler.get_or_create<KnownBitsAnalysis>(compiler);
+  sweep([&builder, &known](Instruction *inst) {
+    return simplify_known_bits(builder, inst, known);
+  });
+  auto &&demanded = compiler.get_or_create<DemandedBitsAnalysis>(compiler);
+  sweep([&builder, &demanded](Instruction *inst) {
+    return simplify_demanded_bits(builder, inst, demanded);
+  });
+}
+
+bool Reassociation::is_associative(InstOpcode opcode) {
+  switch (opcode) {
+  case INST_ADD:
+  case INST_MUL:
+  case INST_AND:
+  case INST_OR:
+  case INST_XOR:
+    return true;
+  default:
+    return false;
   }
-  auto div_inst = dynamic_cast<ArithmeticInstruction *>(inst);
-  if (div_inst->get_rhs()->get_opcode() != INST_CONST) {
-    return std::nullopt;
+}
+
+namespace {
+
+int64_t eval_associative(InstOpcode opcode, int64_t lhs, int64_t rhs) {
+  switch (opcode) {
+  case INST_ADD:
+    return wrap_add(lhs, rhs);
+  case INST_MUL:
+    return wrap_mul(lhs, rhs);
+  case INST_AND:
+    return lhs & rhs;
+  case INST_OR:
+    return lhs | rhs;
+  default:
+    return lhs ^ rhs;
   }
-  auto denominator = get_const_value(div_inst->get_rhs());
-  if (denominator < 0 || (denominator & 1)) {
-    return std::nullopt;
+}
+
+int64_t get_identity(InstOpcode opcode) {
+  switch (opcode) {
+  case INST_MUL:
+    return 1;
+  case INST_AND:
+    return -1;
+  default:
+    return 0;
   }
-  auto is_pow2 = [](uint64_t num) {
-    return num != 0 && (num ^ ((~num + 1) & num)) == 0;
-  };
-  if (!is_pow2(static_cast<uint64_t>(denominator))) {
+}
+
+// Value x such that x op y == x for any y.
+std::optional<int64_t> get_absorbing(InstOpcode opcode) {
+  switch (opcode) {
+  case INST_MUL:
+  case INST_AND:
+    return 0;
+  case INST_OR:
+    return -1;
+  default:
     return std::nullopt;
   }
-  size_t power = 0;
-  while (denominator > 1) {
-    power++;
-    denominator = denominator >> 1;
+}
+
+Instruction *make_associative(IRBuilder &builder, InstOpcode opcode,
+                              Instruction *lhs, Instruction *rhs) {
+  switch (opcode) {
+  case INST_ADD:
+    return builder.make_iadd(lhs, rhs);
+  case INST_MUL:
+    return builder.make_imul(lhs, rhs);
+  default:
+    return builder.make_bit_op(opcode, lhs, rhs);
   }
-  auto shift_val = builder.make_int_constant(power);
-  builder.insert_before(shift_val, div_inst);
-  auto shr_inst = builder.make_shr(div_inst->get_lhs(), shift_val);
-  return builder.replace(div_inst, shr_inst);
 }
 
-bool Peephole::is_const_eq(Instruction *inst, int64_t value) {
-  if (inst->get_opcode() != INST_CONST || inst->get_type() != INTEGER) {
+// Operation of bb which is computed only for its single user from the same
+// tree.
+bool is_tree_node(const Instruction &inst, InstOpcode opcode,
+                  const BasicBlock *bb) {
+  if (inst.get_opcode() != opcode || inst.get_bb() != bb ||
+      inst.get_num_users() != 1) {
     return false;
   }
-  auto inst_value =
-      reinterpret_cast<LoadConstant<int64_t> *>(inst)->get_value();
-  return inst_value == value;
+  auto &&user = **inst.users_begin();
+  return user.get_opcode() == opcode && user.get_bb() == bb;
 }
 
-int64_t Peephole::get_const_value(Instruction *const_inst) {
-  assert(const_inst->get_opcode() == INST_CONST &&
-         const_inst->get_type() == INTEGER &&
-         "Only integer const value can be extracted in compile time");
-  return reinterpret_cast<LoadConstant<int64_t> *>(const_inst)->get_value();
+// Collects nodes of tree in preorder and its leaves from left to right.
+void collect_tree(Instruction *node, InstOpcode opcode,
+                  std::vector<Instruction *> &nodes,
+                  std::vector<Instruction *> &leaves) {
+  nodes.push_back(node);
+  for (auto it = node->inputs_begin(); it != node->inputs_end(); ++it) {
+    if (is_tree_node(**it, opcode, node->get_bb())) {
+      collect_tree(*it, opcode, nodes, leaves);
+    } else {
+      leaves.push_back(*it);
+    }
+  }
 }
 
-bool Peephole::is_const(Instruction *inst) {
-  return inst->get_opcode() == INST_CONST;
+} // namespace
+
+void Reassociation::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
+  auto &&loops = compiler.get_or_create<LoopTreeAnalysis>(compiler);
+  IRBuilder builder(graph);
+  // Rank is (loop depth, position of definition in RPO)
+  std::vector<std::pair<size_t, size_t>> ranks(graph.get_instr_count());
+  std::vector<Instruction *> insts;
+  for (auto &&bbid : compiler.get_or_create<RPOAnalysis>(compiler)) {
+    auto &&bb = *graph.get_bb(bbid);
+    auto depth = loops.get_depth(bb);
+    for (auto &&inst : bb) {
+      ranks[inst.get_id()] = {depth, insts.size()};
+      insts.push_back(&inst);
+    }
+  }
+  auto rank_less = [&ranks](Instruction *lhs, Instruction *rhs) {
+    return ranks[lhs->get_id()] < ranks[rhs->get_id()];
+  };
+
+  bool changed = false;
+  for (auto &&root : insts) {
+    auto opcode = root->get_opcode();
+    auto bb = root->get_bb();
+    if (!is_associative(opcode) || root->get_type() != INTEGER ||
+        is_tree_node(*root, opcode, bb)) {
+      continue;
+    }
+    std::vector<Instruction *> nodes;
+    std::vector<Instruction *> leaves;
+    collect_tree(root, opcode, nodes, leaves);
+    if (nodes.size() < 2) {
+      continue;
+    }
+
+    auto constant = get_identity(opcode);
+    size_t num_constants = 0;
+    std::vector<Instruction *> operands;
+    for (auto &&leaf : leaves) {
+      if (pattern::is_int_const(leaf)) {
+        constant =
+            eval_associative(opcode, constant, pattern::get_int_const(leaf));
+        ++num_constants;
+      } else {
+        operands.push_back(leaf);
+      }
+    }
+    bool is_sorted = std::is_sorted(operands.begin(), operands.end(),
+                                    rank_less) &&
+                     (num_constants == 0 ||
+                      (num_constants == 1 && pattern::is_int_const(leaves[0])));
+    if (is_sorted && num_constants < 2) {
+      continue;
+    }
+    std::stable_sort(operands.begin(), operands.end(), rank_less);
+
+    Instruction *replacement = nullptr;
+    if (get_absorbing(opcode) == constant || operands.empty()) {
+      replacement = insert_int_constant(builder, root, constant);
+    } else {
+      replacement = operands.front();
+      if (constant != get_identity(opcode)) {
+        auto const_inst = insert_int_constant(builder, root, constant);
+        replacement =
+            make_associative(builder, opcode, const_inst, replacement);
+        builder.insert_before(replacement, root);
+      }
+      for (auto it = std::next(operands.begin()); it != operands.end(); ++it) {
+        replacement = make_associative(builder, opcode, replacement, *it);
+        builder.insert_before(replacement, root);
+      }
+    }
+    IRBuilder::move_users(root, replacement);
+    // Nodes are ordered from root, so each one is unused when removed.
+    std::for_each(nodes.begin(), nodes.end(), IRBuilder::rm_instruction);
+    changed = true;
+  }
+  if (changed) {
+    compiler.invalidate_analyses();
+  }
+}
+
+namespace {
+
+// Tarjan's algorithm on graph of phis and their operands which are in the
+// same set. SCCs are produced operands first.
+class PhiSCCBuilder {
+  struct Node {
+    size_t index = 0;
+    size_t low_link = 0;
+    bool is_on_stack = false;
+  };
+
+  std::unordered_map<Instruction *, Node> m_nodes;
+
+  std::vector<Instruction *> m_stack;
+
+  std::vector<std::vector<Instruction *>> m_sccs;
+
+  size_t m_index = 0;
+
+  void visit(Instruction *phi) {
+    auto &&node = m_nodes[phi];
+    node.index = node.low_link = ++m_index;
+    node.is_on_stack = true;
+    m_stack.push_back(phi);
+    for (auto it = phi->inputs_begin(); it != phi->inputs_end(); ++it) {
+      auto operand = m_nodes.find(*it);
+      if (operand == m_nodes.end()) {
+        continue;
+      }
+      if (operand->second.index == 0) {
+        visit(*it);
+        node.low_link = std::min(node.low_link, operand->second.low_link);
+      } else if (operand->second.is_on_stack) {
+        node.low_link = std::min(node.low_link, operand->second.index);
+      }
+    }
+    if (node.low_link != node.index) {
+      return;
+    }
+    auto &&scc = m_sccs.emplace_back();
+    Instruction *member = nullptr;
+    do {
+      member = m_stack.back();
+      m_stack.pop_back();
+      m_nodes[member].is_on_stack = false;
+      scc.push_back(member);
+    } while (member != phi);
+  }
+
+public:
+  std::vector<std::vector<Instruction *>>
+  build(const std::vector<Instruction *> &phis) {
+    for (auto &&phi : phis) {
+      m_nodes[phi];
+    }
+    for (auto &&phi : phis) {
+      if (m_nodes[phi].index == 0) {
+        visit(phi);
+      }
+    }
+    return std::move(m_sccs);
+  }
+};
+
+} // namespace
+
+bool RedundantPhiElimination::remove_redundant_phis(
+    const std::vector<Instruction *> &phis) {
+  bool changed = false;
+  for (auto &&scc : PhiSCCBuilder().build(phis)) {
+    std::unordered_set<Instruction *> members(scc.begin(), scc.end());
+    std::vector<Instruction *> inner;
+    Instruction *outer_value = nullptr;
+    bool has_many_values = false;
+    for (auto &&phi : scc) {
+      bool is_inner = true;
+      for (auto it = phi->inputs_begin(); it != phi->inputs_end(); ++it) {
+        if (members.count(*it) != 0) {
+          continue;
+        }
+        is_inner = false;
+        if (outer_value != nullptr && outer_value != *it) {
+          has_many_values = true;
+        }
+        outer_value = *it;
+      }
+      if (is_inner) {
+        inner.push_back(phi);
+      }
+    }
+    if (outer_value == nullptr) {
+      continue;
+    }
+    if (!has_many_values) {
+      // The whole SCC forwards single value.
+      for (auto &&phi : scc) {
+        IRBuilder::move_users(phi, outer_value);
+      }
+      std::for_each(scc.begin(), scc.end(), IRBuilder::rm_instruction);
+      changed = true;
+    } else if (!inner.empty()) {
+      // Phis with all operands inside SCC may still form redundant SCC.
+      changed |= remove_redundant_phis(inner);
+    }
+  }
+  return changed;
+}
+
+void RedundantPhiElimination::run(Compiler &compiler) {
+  auto &&graph = compiler.graph();
+  bool changed = false;
+  bool is_removed = false;
+  do {
+    std::vector<Instruction *> phis;
+    for (auto &&bbid : compiler.get_or_create<RPOAnalysis>(compiler)) {
+      for (auto &&inst : *graph.get_bb(bbid)) {
+        if (!inst.is_phi()) {
+          break;
+        }
+        phis.push_back(&inst);
+      }
+    }
+    is_removed = remove_redundant_phis(phis);
+    changed |= is_removed;
+  } while (is_removed);
+  if (changed) {
+    compiler.invalidate_analyses();
+  }
 }
 
 } // namespace koda
\ No newline at end of file
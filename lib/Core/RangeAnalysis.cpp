@@ -0,0 +1,370 @@
+#include "Core/Analysis.hpp"
+
+#include "Core/Compiler.h"
+#include "IR/Arithmetic.hpp"
+#include "IR/ProgramGraph.hpp"
+
+#include <deque>
+#include <initializer_list>
+
+namespace koda {
+
+namespace {
+
+using wide_t = __int128;
+
+// Number of updates after which value is widened even outside of loop
+// header, so irreducible cycles converge too.
+constexpr size_t k_max_updates = 8;
+
+constexpr size_t k_narrowing_sweeps = 2;
+
+ValueRange make_range(wide_t min, wide_t max) {
+  if (min < ValueRange::k_min || max > ValueRange::k_max) {
+    return ValueRange::full();
+  }
+  return {static_cast<int64_t>(min), static_cast<int64_t>(max)};
+}
+
+ValueRange make_range(std::initializer_list<wide_t> bounds) {
+  return make_range(std::min(bounds), std::max(bounds));
+}
+
+// All ones up to the highest set bit of non-negative value.
+int64_t fill_ones(int64_t value) {
+  uint64_t res = static_cast<uint64_t>(value);
+  for (unsigned shift = 1; shift < 64; shift *= 2) {
+    res |= res >> shift;
+  }
+  return static_cast<int64_t>(res);
+}
+
+ValueRange eval_div_range(const ValueRange &lhs, const ValueRange &rhs) {
+  if (rhs.contains(0)) {
+    return ValueRange::full();
+  }
+  // Divisor has the same sign in whole range, so quotient is monotonic in
+  // both operands.
+  wide_t lmin = lhs.min, lmax = lhs.max, rmin = rhs.min, rmax = rhs.max;
+  return make_range({lmin / rmin, lmin / rmax, lmax / rmin, lmax / rmax});
+}
+
+ValueRange eval_mod_range(const ValueRange &lhs, const ValueRange &rhs) {
+  if (rhs.contains(0)) {
+    return ValueRange::full();
+  }
+  // |x % y| < |y| and remainder has sign of dividend.
+  wide_t bound = std::max(-static_cast<wide_t>(rhs.min),
+                          static_cast<wide_t>(rhs.max)) -
+                 1;
+  wide_t min = lhs.min >= 0 ? 0 : std::max<wide_t>(lhs.min, -bound);
+  wide_t max = lhs.max <= 0 ? 0 : std::min<wide_t>(lhs.max, bound);
+  return make_range(min, max);
+}
+
+ValueRange eval_shift_range(InstOpcode opcode, const ValueRange &value,
+                            const ValueRange &shift) {
+  if (!shift.is_constant()) {
+    // Result is between value and 0.
+    if (opcode == INST_ASHR ||
+        (opcode == INST_SHR && value.is_non_negative())) {
+      return {std::min<int64_t>(value.min, 0),
+              std::max<int64_t>(value.max, 0)};
+    }
+    return ValueRange::full();
+  }
+  unsigned amount = shift.min & 63;
+  switch (opcode) {
+  case INST_SHL:
+    return make_range(value.min * (wide_t(1) << amount),
+                      value.max * (wide_t(1) << amount));
+  case INST_ASHR:
+    return {eval_ashr(value.min, amount), eval_ashr(value.max, amount)};
+  case INST_SHR:
+    if (amount == 0) {
+      return value;
+    }
+    // Logical shift is monotonic on values with the same sign.
+    if (value.min >= 0 || value.max < 0) {
+      return {eval_shr(value.min, amount), eval_shr(value.max, amount)};
+    }
+    return {0, eval_shr(-1, amount)};
+  default:
+    return ValueRange::full();
+  }
+}
+
+ValueRange eval_bitwise_range(InstOpcode opcode, const ValueRange &lhs,
+                              const ValueRange &rhs) {
+  switch (opcode) {
+  case INST_AND:
+    // Result of and with non-negative value is in [0, value].
+    if (lhs.is_non_negative() && rhs.is_non_negative()) {
+      return {0, std::min(lhs.max, rhs.max)};
+    }
+    if (lhs.is_non_negative() || rhs.is_non_negative()) {
+      return {0, lhs.is_non_negative() ? lhs.max : rhs.max};
+    }
+    return ValueRange::full();
+  case INST_OR:
+  case INST_XOR:
+    if (lhs.is_non_negative() && rhs.is_non_negative()) {
+      int64_t min = opcode == INST_OR ? std::max(lhs.min, rhs.min) : 0;
+      return {min, fill_ones(std::max(lhs.max, rhs.max))};
+    }
+    return ValueRange::full();
+  default:
+    return ValueRange::full();
+  }
+}
+
+ValueRange eval_binary_range(InstOpcode opcode, const ValueRange &lhs,
+                             const ValueRange &rhs) {
+  wide_t lmin = lhs.min, lmax = lhs.max, rmin = rhs.min, rmax = rhs.max;
+  switch (opcode) {
+  case INST_ADD:
+    return make_range(lmin + rmin, lmax + rmax);
+  case INST_SUB:
+    return make_range(lmin - rmax, lmax - rmin);
+  case INST_MUL:
+    return make_range({lmin * rmin, lmin * rmax, lmax * rmin, lmax * rmax});
+  case INST_MULH:
+    return make_range({(lmin * rmin) >> 64, (lmin * rmax) >> 64,
+                       (lmax * rmin) >> 64, (lmax * rmax) >> 64});
+  case INST_DIV:
+    return eval_div_range(lhs, rhs);
+  case INST_MOD:
+    return eval_mod_range(lhs, rhs);
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR:
+    return eval_shift_range(opcode, lhs, rhs);
+  default:
+    return eval_bitwise_range(opcode, lhs, rhs);
+  }
+}
+
+// Bounds of prev which grew in next are moved to the limits.
+ValueRange widen(const ValueRange &prev, const ValueRange &next) {
+  if (prev.is_empty()) {
+    return next;
+  }
+  if (next.is_empty()) {
+    return prev;
+  }
+  return {next.min < prev.min ? ValueRange::k_min : prev.min,
+          next.max > prev.max ? ValueRange::k_max : prev.max};
+}
+
+} // namespace
+
+ValueRange RangeAnalysis::get_range(const Instruction &inst) const {
+  if (inst.get_opcode() == INST_CONST && inst.get_type() == INTEGER) {
+    return ValueRange::constant(
+        static_cast<const LoadConstant<int64_t> &>(inst).get_value());
+  }
+  if (inst.get_type() != INTEGER || inst.get_id() >= m_ranges.size()) {
+    return ValueRange::full();
+  }
+  return m_ranges[inst.get_id()];
+}
+
+ValueRange RangeAnalysis::apply_guard(const Guard &guard,
+                                      const Instruction &inst,
+                                      const ValueRange &range) const {
+  auto &&branch = *guard.branch;
+  auto flag = guard.is_true_edge ? branch.get_flag()
+                                 : invert_flag(branch.get_flag());
+  if (branch.get_lhs() == branch.get_rhs()) {
+    return range;
+  }
+  if (branch.get_lhs() == &inst) {
+    return narrow(range, flag, get_range(*branch.get_rhs()));
+  }
+  if (branch.get_rhs() == &inst) {
+    return narrow(range, swap_flag(flag), get_range(*branch.get_lhs()));
+  }
+  return range;
+}
+
+ValueRange RangeAnalysis::get_range_at(const Instruction &inst,
+                                       const BasicBlock &bb) const {
+  auto range = get_range(inst);
+  auto def_bb = inst.get_bb();
+  auto curr = const_cast<BasicBlock *>(&bb);
+  // Conditions above definition can't refer to the value.
+  while (curr != def_bb && m_doms->contains(curr)) {
+    auto id = static_cast<size_t>(curr->get_id());
+    if (id < m_guards.size() && m_guards[id].branch != nullptr) {
+      range = apply_guard(m_guards[id], inst, range);
+    }
+    curr = m_doms->get_parent(curr);
+  }
+  return range;
+}
+
+ValueRange RangeAnalysis::get_range_on_edge(const Instruction &inst,
+                                            BasicBlock *pred,
+                                            const BasicBlock &succ) const {
+  auto range = get_range_at(inst, *pred);
+  if (pred->empty() || pred->back().get_opcode() != INST_COND_BR) {
+    return range;
+  }
+  auto &&branch = static_cast<const ConditionalBranchInstruction &>(
+      pred->back());
+  if (branch.get_true_block() == branch.get_false_block()) {
+    return range;
+  }
+  return apply_guard({&branch, branch.get_true_block() == &succ}, inst,
+                     range);
+}
+
+ValueRange RangeAnalysis::compute(const Instruction &inst) const {
+  if (inst.get_type() != INTEGER) {
+    return ValueRange::full();
+  }
+  auto &&bb = *inst.get_bb();
+  switch (inst.get_opcode()) {
+  case INST_CONST:
+    return get_range(inst);
+  case INST_PHI: {
+    auto &&phi = static_cast<const PhiInstruction &>(inst);
+    auto range = ValueRange::empty();
+    for (size_t idx = 0; idx < phi.get_num_options(); ++idx) {
+      auto &&[pred, value] = phi.get_option(idx);
+      range = join(range, get_range_on_edge(*value, pred, bb));
+    }
+    return range;
+  }
+  case INST_NOT: {
+    auto value = get_range_at(*inst.get_input(0), bb);
+    return value.is_empty() ? value : ValueRange{~value.max, ~value.min};
+  }
+  case INST_ADD:
+  case INST_SUB:
+  case INST_MUL:
+  case INST_MULH:
+  case INST_DIV:
+  case INST_MOD:
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR:
+  case INST_AND:
+  case INST_OR:
+  case INST_XOR: {
+    auto lhs = get_range_at(*inst.get_input(0), bb);
+    auto rhs = get_range_at(*inst.get_input(1), bb);
+    if (lhs.is_empty() || rhs.is_empty()) {
+      return ValueRange::empty();
+    }
+    return eval_binary_range(inst.get_opcode(), lhs, rhs);
+  }
+  case INST_SELECT: {
+    // Each value is narrowed by condition under which it is chosen.
+    auto &&select = static_cast<const SelectInstruction &>(inst);
+    auto lhs = get_range_at(*select.get_lhs(), bb);
+    auto rhs = get_range_at(*select.get_rhs(), bb);
+    auto get_chosen = [&select, &lhs, &rhs, &bb, this](const Instruction *value,
+                                                      CmpFlag flag) {
+      auto range = get_range_at(*value, bb);
+      if (value == select.get_lhs()) {
+        return narrow(range, flag, rhs);
+      }
+      if (value == select.get_rhs()) {
+        return narrow(range, swap_flag(flag), lhs);
+      }
+      return range;
+    };
+    return join(get_chosen(select.get_true_value(), select.get_flag()),
+                get_chosen(select.get_false_value(),
+                           invert_flag(select.get_flag())));
+  }
+  default:
+    return ValueRange::full();
+  }
+}
+
+void RangeAnalysis::run(Compiler &comp) {
+  auto &&graph = comp.graph();
+  auto &&rpo = comp.get_or_create<RPOAnalysis>(comp);
+  m_doms = &comp.get_or_create<DomsTreeAnalysis>(graph).get();
+  // Marks loop headers
+  comp.get_or_create<LoopTreeAnalysis>(comp);
+
+  m_guards.assign(graph.size(), Guard{});
+  m_ranges.assign(graph.get_instr_count(), ValueRange::empty());
+  std::vector<size_t> num_updates(graph.get_instr_count(), 0);
+  std::vector<Instruction *> order;
+  for (auto &&bbid : rpo) {
+    auto bb = graph.get_bb(bbid);
+    for (auto &&inst : *bb) {
+      order.push_back(&inst);
+    }
+    if (bb->get_num_predecessors() != 1) {
+      continue;
+    }
+    auto pred = *bb->pred_begin();
+    if (pred->empty() || pred->back().get_opcode() != INST_COND_BR) {
+      continue;
+    }
+    auto &&branch =
+        static_cast<const ConditionalBranchInstruction &>(pred->back());
+    if (branch.get_true_block() != branch.get_false_block()) {
+      m_guards[bbid] = {&branch, branch.get_true_block() == bb};
+    }
+  }
+
+  std::deque<Instruction *> worklist;
+  std::vector<bool> queued(graph.get_instr_count(), false);
+  auto enqueue = [&worklist, &queued](Instruction *inst) {
+    if (!queued[inst->get_id()]) {
+      queued[inst->get_id()] = true;
+      worklist.push_back(inst);
+    }
+  };
+  std::for_each(order.begin(), order.end(), enqueue);
+  while (!worklist.empty()) {
+    auto inst = worklist.front();
+    worklist.pop_front();
+    queued[inst->get_id()] = false;
+    auto &&prev = m_ranges[inst->get_id()];
+    auto next = join(prev, compute(*inst));
+    if (next == prev) {
+      continue;
+    }
+    bool is_widened = inst->is_phi() && inst->get_bb()->is_loop_header();
+    if (is_widened || ++num_updates[inst->get_id()] > k_max_updates) {
+      next = widen(prev, next);
+    }
+    prev = next;
+    for (auto it = inst->users_begin(); it != inst->users_end(); ++it) {
+      auto user = *it;
+      enqueue(user);
+      if (user->get_opcode() != INST_COND_BR) {
+        continue;
+      }
+      // Ranges narrowed by branch depend on both of its operands.
+      for (auto &&operand : {user->get_input(0), user->get_input(1)}) {
+        std::for_each(operand->users_begin(), operand->users_end(), enqueue);
+      }
+    }
+  }
+
+  // Widening overshoots loop bounds, so recompute ranges from widened
+  // fixed point. Any result of transfer functions is still correct.
+  for (size_t sweep = 0; sweep < k_narrowing_sweeps; ++sweep) {
+    for (auto &&inst : order) {
+      auto &&range = m_ranges[inst->get_id()];
+      range = intersect(range, compute(*inst));
+    }
+  }
+}
+
+std::optional<bool> RangeAnalysis::get_branch_outcome(
+    const ConditionalBranchInstruction &branch) const {
+  auto &&bb = *branch.get_bb();
+  return compare(branch.get_flag(), get_range_at(*branch.get_lhs(), bb),
+                 get_range_at(*branch.get_rhs(), bb));
+}
+
+} // namespace koda
@@ -11,4 +11,27 @@ void BasicBlock::set_cond_successors(BasicBlock *false_bb, BasicBlock *true_bb)
 
 bool BasicBlock::has_successor() const { return !m_successors.empty(); }
 
+void BasicBlock::remove_predecessor(BasicBlock *pred) {
+  auto pos = std::find(m_predecessors.begin(), m_predecessors.end(), pred);
+  assert(pos != m_predecessors.end() && "Not a predecessor");
+  m_predecessors.erase(pos);
+}
+
+void BasicBlock::replace_successor(BasicBlock *old_succ, BasicBlock *new_succ) {
+  for (auto &&succ : m_successors) {
+    if (succ == old_succ) {
+      succ = new_succ;
+      old_succ->remove_predecessor(this);
+      new_succ->add_predecessor(this);
+    }
+  }
+}
+
+void BasicBlock::clear_successors() {
+  for (auto &&succ : m_successors) {
+    succ->remove_predecessor(this);
+  }
+  m_successors.clear();
+}
+
 } // namespace koda
\ No newline at end of file
@@ -0,0 +1,604 @@
+#include <DataStructures/Graph.hpp>
+#include <IR/BinaryIR.hpp>
+#include <IR/IRBuilder.hpp>
+#include <IR/Module.hpp>
+#include <IR/ProgramGraph.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace koda {
+
+namespace {
+
+constexpr uint8_t GRAPH_MAGIC[4] = {'K', 'I', 'R', 'G'};
+constexpr uint8_t MODULE_MAGIC[4] = {'K', 'I', 'R', 'M'};
+constexpr uint64_t FORMAT_VERSION = 1;
+
+// Longest LEB128 encoding of 64-bit value.
+constexpr size_t MAX_VARINT_SIZE = 10;
+
+uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+class BinaryWriter final {
+  std::vector<uint8_t> &m_out;
+
+public:
+  explicit BinaryWriter(std::vector<uint8_t> &out) : m_out(out) {}
+
+  void write(uint64_t value) {
+    while (value >= 0x80) {
+      m_out.push_back(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    m_out.push_back(static_cast<uint8_t>(value));
+  }
+
+  void write_signed(int64_t value) { write(zigzag(value)); }
+
+  void write_bytes(const void *data, size_t size) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    m_out.insert(m_out.end(), bytes, bytes + size);
+  }
+};
+
+class GraphWriter final {
+  ProgramGraph &m_graph;
+
+  BinaryWriter m_writer;
+
+  std::unordered_map<const BasicBlock *, uint64_t> m_block_numbers;
+
+  std::unordered_map<const Instruction *, uint64_t> m_value_numbers;
+
+  void write_operand(uint64_t user, const Instruction *input) {
+    auto number = m_value_numbers.find(input);
+    if (number == m_value_numbers.end() || number->second >= user) {
+      throw IRInvalidArgument("Value is used before its definition");
+    }
+    m_writer.write(user - number->second);
+  }
+
+  void write_instruction(const Instruction &inst, uint64_t number);
+
+public:
+  GraphWriter(ProgramGraph &graph, std::vector<uint8_t> &out)
+      : m_graph(graph), m_writer(out) {}
+
+  void run();
+};
+
+void GraphWriter::write_instruction(const Instruction &inst, uint64_t number) {
+  auto opc = inst.get_opcode();
+  m_writer.write(opc);
+  switch (opc) {
+  case INST_CONST:
+    if (inst.get_type() != INTEGER) {
+      throw IRInvalidArgument("Can't write non-integer constant");
+    }
+    m_writer.write_signed(
+        static_cast<const LoadConstant<int64_t> &>(inst).get_value());
+    return;
+  case INST_PARAM:
+    m_writer.write(static_cast<const LoadParam &>(inst).get_index());
+    return;
+  case INST_PHI: {
+    auto &&phi = static_cast<const PhiInstruction &>(inst);
+    m_writer.write(phi.get_type());
+    size_t num_options = 0;
+    for (size_t idx = 0; idx < phi.get_num_options(); ++idx) {
+      num_options += m_block_numbers.count(phi.get_incoming_block(idx));
+    }
+    m_writer.write(num_options);
+    for (size_t idx = 0; idx < phi.get_num_options(); ++idx) {
+      auto &&[bb, value] = phi.get_option(idx);
+      auto bb_number = m_block_numbers.find(bb);
+      if (bb_number == m_block_numbers.end()) {
+        continue;
+      }
+      auto value_number = m_value_numbers.find(value);
+      if (value_number == m_value_numbers.end()) {
+        throw IRInvalidArgument("Phi input is not defined");
+      }
+      m_writer.write(bb_number->second);
+      m_writer.write_signed(static_cast<int64_t>(number - value_number->second));
+    }
+    return;
+  }
+  case INST_ADD:
+  case INST_SUB:
+  case INST_MUL:
+  case INST_DIV:
+  case INST_MOD:
+  case INST_MULH:
+    m_writer.write(inst.get_type());
+    break;
+  case INST_COND_BR:
+    m_writer.write(
+        static_cast<const ConditionalBranchInstruction &>(inst).get_flag());
+    break;
+  case INST_SELECT:
+    m_writer.write(static_cast<const SelectInstruction &>(inst).get_flag());
+    break;
+  case INST_CALL:
+    m_writer.write(inst.get_type());
+    m_writer.write(static_cast<const CallInstruction &>(inst).get_callee());
+    m_writer.write(inst.get_num_inputs());
+    break;
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR:
+  case INST_AND:
+  case INST_OR:
+  case INST_XOR:
+  case INST_NOT:
+  case INST_RET:
+  case INST_BRANCH:
+    break;
+  default:
+    throw IRInvalidArgument("Can't write instruction");
+  }
+  for (auto input = inst.inputs_begin(); input != inst.inputs_end(); ++input) {
+    write_operand(number, *input);
+  }
+}
+
+void GraphWriter::run() {
+  std::vector<BasicBlock *> blocks;
+  if (m_graph.get_entry() != nullptr) {
+    visit_rpo(m_graph, m_graph.get_entry(), [this, &blocks](BasicBlock *bb) {
+      m_block_numbers.emplace(bb, blocks.size());
+      blocks.push_back(bb);
+    });
+  }
+  for (auto &&bb : blocks) {
+    for (auto &&inst : *bb) {
+      m_value_numbers.emplace(&inst, m_value_numbers.size());
+    }
+  }
+
+  m_writer.write(m_graph.get_num_params());
+  for (size_t idx = 0; idx < m_graph.get_num_params(); ++idx) {
+    m_writer.write(m_graph.get_param(idx).get_type());
+  }
+  m_writer.write(blocks.size());
+  m_writer.write(m_value_numbers.size());
+  uint64_t number = 0;
+  for (auto &&bb : blocks) {
+    m_writer.write(bb->size());
+    m_writer.write(bb->get_num_successors());
+    for (auto succ = bb->succ_begin(); succ != bb->succ_end(); ++succ) {
+      m_writer.write(m_block_numbers.at(*succ));
+    }
+    for (auto &&inst : *bb) {
+      write_instruction(inst, number++);
+    }
+  }
+}
+
+class BinaryReader final {
+  const uint8_t *m_begin;
+
+  const uint8_t *m_pos;
+
+  const uint8_t *m_end;
+
+public:
+  BinaryReader(const uint8_t *data, size_t size)
+      : m_begin(data), m_pos(data), m_end(data + size) {}
+
+  [[noreturn]] void fail(const char *msg) const {
+    throw IRFormatError(std::string("Malformed binary IR: ") + msg +
+                        " at offset " + std::to_string(m_pos - m_begin));
+  }
+
+  size_t get_remaining() const { return static_cast<size_t>(m_end - m_pos); }
+
+  uint64_t read() {
+    uint64_t value = 0;
+    for (size_t idx = 0; idx < MAX_VARINT_SIZE; ++idx) {
+      if (m_pos == m_end) {
+        fail("unexpected end");
+      }
+      auto byte = *m_pos++;
+      value |= static_cast<uint64_t>(byte & 0x7f) << (7 * idx);
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    fail("too long varint");
+  }
+
+  int64_t read_signed() { return unzigzag(read()); }
+
+  // Number of items taking at least item_size bytes each, so invalid
+  // counts can't cause huge allocations.
+  size_t read_count(size_t item_size) {
+    auto count = read();
+    if (count > get_remaining() / item_size) {
+      fail("count exceeds buffer");
+    }
+    return static_cast<size_t>(count);
+  }
+
+  const uint8_t *read_bytes(size_t size) {
+    if (size > get_remaining()) {
+      fail("unexpected end");
+    }
+    auto bytes = m_pos;
+    m_pos += size;
+    return bytes;
+  }
+
+  void read_header(const uint8_t (&magic)[4]) {
+    if (std::memcmp(read_bytes(sizeof(magic)), magic, sizeof(magic)) != 0) {
+      fail("invalid magic");
+    }
+    if (read() != FORMAT_VERSION) {
+      fail("unsupported version");
+    }
+  }
+
+  void expect_end() const {
+    if (m_pos != m_end) {
+      fail("trailing bytes");
+    }
+  }
+};
+
+class GraphReader final {
+  BinaryReader &m_reader;
+
+  ProgramGraph &m_graph;
+
+  // Number of module functions, callees aren't checked if unknown.
+  size_t m_num_functions;
+
+  std::vector<BasicBlock *> m_blocks;
+
+  std::vector<Instruction *> m_values;
+
+  struct PhiOption {
+    PhiInstruction *phi;
+    uint64_t block;
+    int64_t distance;
+    size_t user;
+  };
+
+  std::vector<PhiOption> m_phi_options;
+
+  OperandType read_type() {
+    auto type = m_reader.read();
+    if (type == TYPE_INVALID || type > LABEL) {
+      m_reader.fail("invalid type");
+    }
+    return static_cast<OperandType>(type);
+  }
+
+  CmpFlag read_flag() {
+    auto flag = m_reader.read();
+    if (flag < CMP_EQ || flag > CMP_GE) {
+      m_reader.fail("invalid comparison flag");
+    }
+    return static_cast<CmpFlag>(flag);
+  }
+
+  BasicBlock *read_block() {
+    auto number = m_reader.read();
+    if (number >= m_blocks.size()) {
+      m_reader.fail("invalid block");
+    }
+    return m_blocks[number];
+  }
+
+  Instruction *read_operand() {
+    auto distance = m_reader.read();
+    if (distance == 0 || distance > m_values.size()) {
+      m_reader.fail("invalid operand");
+    }
+    return m_values[m_values.size() - distance];
+  }
+
+  Instruction *read_operand(OperandType type) {
+    auto operand = read_operand();
+    if (operand->get_type() != type) {
+      m_reader.fail("invalid operand type");
+    }
+    return operand;
+  }
+
+  Instruction *read_instruction();
+
+public:
+  GraphReader(BinaryReader &reader, ProgramGraph &graph, size_t num_functions)
+      : m_reader(reader), m_graph(graph), m_num_functions(num_functions) {}
+
+  void run();
+};
+
+Instruction *GraphReader::read_instruction() {
+  auto opc = m_reader.read();
+  switch (opc) {
+  case INST_CONST:
+    return m_graph.create_instruction<LoadConstant<int64_t>>(
+        INTEGER, m_reader.read_signed());
+  case INST_PARAM: {
+    auto idx = m_reader.read();
+    if (idx >= m_graph.get_num_params()) {
+      m_reader.fail("invalid parameter index");
+    }
+    return m_graph.create_instruction<LoadParam>(
+        m_graph.get_param(idx).get_type(), idx);
+  }
+  case INST_PHI: {
+    auto phi = m_graph.create_instruction<PhiInstruction>(read_type());
+    auto num_options = m_reader.read_count(2);
+    for (size_t idx = 0; idx < num_options; ++idx) {
+      auto block = m_reader.read();
+      m_phi_options.push_back(
+          {phi, block, m_reader.read_signed(), m_values.size()});
+    }
+    return phi;
+  }
+  case INST_ADD:
+  case INST_SUB:
+  case INST_MUL:
+  case INST_DIV:
+  case INST_MOD:
+  case INST_MULH: {
+    auto type = read_type();
+    auto lhs = read_operand(type);
+    auto rhs = read_operand(type);
+    return m_graph.create_instruction<ArithmeticInstruction>(
+        static_cast<InstOpcode>(opc), type, lhs, rhs);
+  }
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR: {
+    auto lhs = read_operand(INTEGER);
+    auto rhs = read_operand(INTEGER);
+    return m_graph.create_instruction<BitShift>(static_cast<InstOpcode>(opc),
+                                                lhs, rhs);
+  }
+  case INST_AND:
+  case INST_OR:
+  case INST_XOR: {
+    auto lhs = read_operand(INTEGER);
+    auto rhs = read_operand(INTEGER);
+    return m_graph.create_instruction<BitOperation>(
+        static_cast<InstOpcode>(opc), lhs, rhs);
+  }
+  case INST_NOT:
+    return m_graph.create_instruction<BitNot>(read_operand(INTEGER));
+  case INST_RET:
+    return m_graph.create_instruction<ReturnInstruction>(read_operand());
+  case INST_BRANCH:
+    return m_graph.create_instruction<BranchInstruction>();
+  case INST_COND_BR: {
+    auto flag = read_flag();
+    auto lhs = read_operand();
+    auto rhs = read_operand();
+    return m_graph.create_instruction<ConditionalBranchInstruction>(flag, lhs,
+                                                                    rhs);
+  }
+  case INST_SELECT: {
+    auto flag = read_flag();
+    auto lhs = read_operand();
+    auto rhs = read_operand();
+    auto true_value = read_operand();
+    auto false_value = read_operand(true_value->get_type());
+    return m_graph.create_instruction<SelectInstruction>(
+        flag, lhs, rhs, true_value, false_value);
+  }
+  case INST_CALL: {
+    auto type = read_type();
+    auto callee = m_reader.read();
+    if (callee >= m_num_functions) {
+      m_reader.fail("invalid callee");
+    }
+    std::vector<Instruction *> args(m_reader.read_count(1));
+    for (auto &&arg : args) {
+      arg = read_operand();
+    }
+    return m_graph.create_instruction<CallInstruction>(callee, type, args);
+  }
+  default:
+    m_reader.fail("invalid opcode");
+  }
+}
+
+void GraphReader::run() {
+  if (m_graph.size() != 0 || m_graph.get_num_params() != 0) {
+    throw IRInvalidArgument("Binary IR is read into empty graph");
+  }
+  auto num_params = m_reader.read_count(1);
+  for (size_t idx = 0; idx < num_params; ++idx) {
+    m_graph.create_param(read_type());
+  }
+  // Each block has at least counts of instructions and successors.
+  auto num_blocks = m_reader.read_count(2);
+  auto num_values = m_reader.read_count(1);
+  m_graph.reserve(num_blocks, num_values);
+  m_blocks.reserve(num_blocks);
+  m_values.reserve(num_values);
+  for (size_t idx = 0; idx < num_blocks; ++idx) {
+    m_blocks.push_back(m_graph.create_basic_block());
+  }
+  if (!m_blocks.empty()) {
+    m_graph.set_entry(m_blocks.front());
+  }
+
+  for (auto &&bb : m_blocks) {
+    auto size = m_reader.read_count(1);
+    auto num_successors = m_reader.read();
+    if (num_successors == 1) {
+      bb->set_uncond_successor(read_block());
+    } else if (num_successors == 2) {
+      auto false_bb = read_block();
+      bb->set_cond_successors(false_bb, read_block());
+    } else if (num_successors != 0) {
+      m_reader.fail("invalid number of successors");
+    }
+    for (size_t idx = 0; idx < size; ++idx) {
+      if (m_values.size() == num_values) {
+        m_reader.fail("too many instructions");
+      }
+      auto inst = read_instruction();
+      if (!inst->is_phi()) {
+        for (auto input = inst->inputs_begin(); input != inst->inputs_end();
+             ++input) {
+          (*input)->add_user(inst);
+        }
+      }
+      bb->add_instruction(inst);
+      m_values.push_back(inst);
+    }
+  }
+  if (m_values.size() != num_values) {
+    m_reader.fail("missing instructions");
+  }
+
+  for (auto &&option : m_phi_options) {
+    auto value_number = static_cast<int64_t>(option.user) - option.distance;
+    if (option.block >= m_blocks.size() || value_number < 0 ||
+        static_cast<uint64_t>(value_number) >= m_values.size()) {
+      m_reader.fail("invalid phi option");
+    }
+    auto value = m_values[value_number];
+    if (value->get_type() != option.phi->get_type()) {
+      m_reader.fail("invalid phi input type");
+    }
+    option.phi->add_option(m_blocks[option.block], value);
+  }
+}
+
+void read_module(BinaryReader &reader, Module &module) {
+  if (module.size() != 0) {
+    throw IRInvalidArgument("Binary IR is read into empty module");
+  }
+  reader.read_header(MODULE_MAGIC);
+  auto num_functions = reader.read_count(2);
+  for (size_t idx = 0; idx < num_functions; ++idx) {
+    auto name_size = reader.read_count(1);
+    auto name = reinterpret_cast<const char *>(reader.read_bytes(name_size));
+    module.create_function(std::string(name, name_size));
+  }
+  for (funcid_t id = 0; id < num_functions; ++id) {
+    auto size = reader.read_count(1);
+    BinaryReader graph_reader(reader.read_bytes(size), size);
+    GraphReader(graph_reader, module.get_function(id), num_functions).run();
+    graph_reader.expect_end();
+  }
+  reader.expect_end();
+}
+
+// Read-only mapping of the whole file.
+class MappedFile final {
+  const uint8_t *m_data = nullptr;
+
+  size_t m_size = 0;
+
+public:
+  explicit MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "open");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      auto error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "fstat");
+    }
+    m_size = static_cast<size_t>(info.st_size);
+    if (m_size == 0) {
+      ::close(fd);
+      return;
+    }
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    auto error = errno;
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      throw std::system_error(error, std::generic_category(), "mmap");
+    }
+    m_data = static_cast<const uint8_t *>(data);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (m_data != nullptr) {
+      munmap(const_cast<uint8_t *>(m_data), m_size);
+    }
+  }
+
+  const uint8_t *data() const { return m_data; }
+
+  size_t size() const { return m_size; }
+};
+
+} // namespace
+
+std::vector<uint8_t> write_binary_ir(ProgramGraph &graph) {
+  std::vector<uint8_t> out;
+  BinaryWriter writer(out);
+  writer.write_bytes(GRAPH_MAGIC, sizeof(GRAPH_MAGIC));
+  writer.write(FORMAT_VERSION);
+  GraphWriter(graph, out).run();
+  return out;
+}
+
+std::vector<uint8_t> write_binary_module(const Module &module) {
+  std::vector<uint8_t> out;
+  BinaryWriter writer(out);
+  writer.write_bytes(MODULE_MAGIC, sizeof(MODULE_MAGIC));
+  writer.write(FORMAT_VERSION);
+  writer.write(module.size());
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    auto &&name = module.get_name(id);
+    writer.write(name.size());
+    writer.write_bytes(name.data(), name.size());
+  }
+  std::vector<uint8_t> graph;
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    graph.clear();
+    GraphWriter(module.get_function(id), graph).run();
+    writer.write(graph.size());
+    writer.write_bytes(graph.data(), graph.size());
+  }
+  return out;
+}
+
+void read_binary_ir(const uint8_t *data, size_t size, ProgramGraph &graph) {
+  BinaryReader reader(data, size);
+  reader.read_header(GRAPH_MAGIC);
+  GraphReader(reader, graph, SIZE_MAX).run();
+  reader.expect_end();
+}
+
+void read_binary_module(const uint8_t *data, size_t size, Module &module) {
+  BinaryReader reader(data, size);
+  read_module(reader, module);
+}
+
+void read_binary_module_file(const std::string &path, Module &module) {
+  MappedFile file(path);
+  read_binary_module(file.data(), file.size(), module);
+}
+
+} // namespace koda
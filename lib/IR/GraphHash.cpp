@@ -0,0 +1,116 @@
+#include <DataStructures/Graph.hpp>
+#include <IR/GraphHash.hpp>
+#include <IR/IRBuilder.hpp>
+#include <IR/ProgramGraph.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+namespace koda {
+
+namespace {
+
+// splitmix64 finalizer
+uint64_t mix(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111eb;
+  value ^= value >> 31;
+  return value;
+}
+
+} // namespace
+
+HashBuilder &HashBuilder::add(uint64_t value) {
+  m_hash = mix(m_hash ^ mix(value));
+  return *this;
+}
+
+HashBuilder &HashBuilder::add(std::string_view str) {
+  add(str.size());
+  for (auto &&chr : str) {
+    add(static_cast<uint64_t>(static_cast<unsigned char>(chr)));
+  }
+  return *this;
+}
+
+uint64_t hash_graph(ProgramGraph &graph) {
+  HashBuilder hash;
+  hash.add(graph.get_num_params());
+  for (size_t idx = 0; idx < graph.get_num_params(); ++idx) {
+    hash.add(graph.get_param(idx).get_type());
+  }
+  if (graph.get_entry() == nullptr) {
+    return hash.get();
+  }
+
+  std::vector<BasicBlock *> blocks;
+  std::unordered_map<const BasicBlock *, uint64_t> block_numbers;
+  visit_dfs(graph, graph.get_entry(), [&blocks, &block_numbers](auto *bb) {
+    block_numbers.emplace(bb, blocks.size());
+    blocks.push_back(bb);
+  });
+  std::unordered_map<const Instruction *, uint64_t> value_numbers;
+  for (auto &&bb : blocks) {
+    for (auto &&inst : *bb) {
+      value_numbers.emplace(&inst, value_numbers.size());
+    }
+  }
+  // Values out of reachable blocks are all the same for the hash.
+  auto get_number = [](auto &&numbers, auto *key) -> uint64_t {
+    auto number = numbers.find(key);
+    return number == numbers.end() ? UINT64_MAX : number->second;
+  };
+
+  for (auto &&bb : blocks) {
+    hash.add(bb->size()).add(bb->get_num_successors());
+    for (auto succ = bb->succ_begin(); succ != bb->succ_end(); ++succ) {
+      hash.add(get_number(block_numbers, *succ));
+    }
+    for (auto &&inst : *bb) {
+      hash.add(inst.get_opcode()).add(inst.get_type());
+      switch (inst.get_opcode()) {
+      case INST_CONST:
+        if (inst.get_type() != INTEGER) {
+          throw IRInvalidArgument("Can't hash non-integer constant");
+        }
+        hash.add(static_cast<uint64_t>(
+            static_cast<const LoadConstant<int64_t> &>(inst).get_value()));
+        break;
+      case INST_PARAM:
+        hash.add(static_cast<const LoadParam &>(inst).get_index());
+        break;
+      case INST_COND_BR:
+        hash.add(static_cast<const ConditionalBranchInstruction &>(inst)
+                     .get_flag());
+        break;
+      case INST_SELECT:
+        hash.add(static_cast<const SelectInstruction &>(inst).get_flag());
+        break;
+      case INST_CALL:
+        hash.add(static_cast<const CallInstruction &>(inst).get_callee());
+        break;
+      default:
+        break;
+      }
+      hash.add(inst.get_num_inputs());
+      if (inst.is_phi()) {
+        auto &&phi = static_cast<const PhiInstruction &>(inst);
+        for (size_t idx = 0; idx < phi.get_num_options(); ++idx) {
+          auto &&[pred, value] = phi.get_option(idx);
+          hash.add(get_number(block_numbers, pred))
+              .add(get_number(value_numbers, value));
+        }
+        continue;
+      }
+      for (auto input = inst.inputs_begin(); input != inst.inputs_end();
+           ++input) {
+        hash.add(get_number(value_numbers, *input));
+      }
+    }
+  }
+  return hash.get();
+}
+
+} // namespace koda
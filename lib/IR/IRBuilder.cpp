@@ -35,6 +35,26 @@ void IRBuilder::insert_before(Instruction *inst, Instruction *point) {
   bb->insert_inst_before(inst, point);
 }
 
+void IRBuilder::insert_before_terminator(Instruction *inst, BasicBlock *bb) {
+  if (!bb->empty() && bb->back().is_terminator()) {
+    bb->insert_inst_before(inst, &bb->back());
+  } else {
+    bb->add_instruction(inst);
+  }
+}
+
+void IRBuilder::insert_phi(PhiInstruction *phi, BasicBlock *bb) {
+  auto point = bb->begin();
+  while (point != bb->end() && point->is_phi()) {
+    ++point;
+  }
+  if (point == bb->end()) {
+    bb->add_instruction(phi);
+  } else {
+    bb->insert_inst_before(phi, &*point);
+  }
+}
+
 void IRBuilder::move_users(Instruction *from, Instruction *to) {
   std::for_each(from->users_begin(), from->users_end(),
                 [from, to](Instruction *use) {
@@ -46,8 +66,13 @@ void IRBuilder::move_users(Instruction *from, Instruction *to) {
 
 Instruction *IRBuilder::rm_instruction(Instruction *inst) {
   auto &&bb = inst->get_bb();
+  // Inputs may be already detached when dead cycle of instructions is removed
   std::for_each(inst->inputs_begin(), inst->inputs_end(),
-                [inst](Instruction *input) { input->rm_user(inst); });
+                [inst](Instruction *input) {
+                  if (input) {
+                    input->rm_user(inst);
+                  }
+                });
   std::for_each(
       inst->users_begin(), inst->users_end(),
       [inst](Instruction *user) { user->switch_input(inst, nullptr); });
@@ -63,6 +88,48 @@ Instruction *IRBuilder::replace(Instruction *old_inst, Instruction *new_inst) {
   return bb->remove_instruction(old_inst);
 }
 
+void IRBuilder::rm_phi_options(BasicBlock *bb, BasicBlock *pred) {
+  for (auto &&inst : *bb) {
+    if (!inst.is_phi()) {
+      break;
+    }
+    auto &&phi = static_cast<PhiInstruction &>(inst);
+    size_t idx = phi.get_option_idx(pred);
+    if (idx < phi.get_num_options()) {
+      phi.remove_option(idx);
+    }
+  }
+}
+
+SelectInstruction *IRBuilder::make_select(CmpFlag cmp_flag, Instruction *lhs,
+                                          Instruction *rhs,
+                                          Instruction *true_value,
+                                          Instruction *false_value) {
+  if (lhs->get_type() != OperandType::INTEGER ||
+      rhs->get_type() != OperandType::INTEGER) {
+    throw IROperandError(IROperandError::make_error_str(
+        {lhs, rhs}, {OperandType::INTEGER, OperandType::INTEGER}));
+  }
+  if (true_value->get_type() != false_value->get_type()) {
+    throw IROperandError(IROperandError::make_error_str(
+        {true_value, false_value},
+        {true_value->get_type(), true_value->get_type()}));
+  }
+  auto inst = m_graph->create_instruction<SelectInstruction>(
+      cmp_flag, lhs, rhs, true_value, false_value);
+  add_user_to(inst, {lhs, rhs, true_value, false_value});
+  return inst;
+}
+
+SelectInstruction *IRBuilder::create_select(CmpFlag cmp_flag, Instruction *lhs,
+                                            Instruction *rhs,
+                                            Instruction *true_value,
+                                            Instruction *false_value) {
+  auto inst = make_select(cmp_flag, lhs, rhs, true_value, false_value);
+  add_instruction(inst);
+  return inst;
+}
+
 LoadParam *IRBuilder::create_param_load(size_t param_idx) {
   if (param_idx >= m_graph->get_num_params()) {
     throw IRInvalidArgument("Invalid parameter index");
@@ -94,12 +161,54 @@ BranchInstruction *IRBuilder::create_branch(BasicBlock *target) {
   auto curr_bb = get_insert_point();
   if (!curr_bb->has_successor()) {
     curr_bb->set_uncond_successor(target);
-    target->add_predecessor(curr_bb);
   }
 
   return br_inst;
 }
 
+BranchInstruction *IRBuilder::replace_with_branch(BasicBlock *bb,
+                                                  BasicBlock *target) {
+  if (!bb->empty() && bb->back().is_terminator()) {
+    rm_instruction(&bb->back());
+  }
+  bool is_target_kept = false;
+  std::vector<BasicBlock *> succs(bb->succ_begin(), bb->succ_end());
+  for (auto &&succ : succs) {
+    if (succ == target && !is_target_kept) {
+      is_target_kept = true;
+      continue;
+    }
+    rm_phi_options(succ, bb);
+  }
+  bb->clear_successors();
+  auto br_inst = m_graph->create_instruction<BranchInstruction>();
+  bb->add_instruction(br_inst);
+  bb->set_uncond_successor(target);
+  return br_inst;
+}
+
+bool IRBuilder::rm_unreachable_blocks() {
+  std::vector<bool> reachable(m_graph->size(), false);
+  visit_dfs(*m_graph, m_graph->get_entry(),
+            [&reachable](BasicBlock *bb) { reachable[bb->get_id()] = true; });
+  bool changed = false;
+  for (auto &&bb : *m_graph) {
+    if (reachable[bb.get_id()] || (bb.empty() && !bb.has_successor())) {
+      continue;
+    }
+    std::vector<BasicBlock *> succs(bb.succ_begin(), bb.succ_end());
+    for (auto &&succ : succs) {
+      rm_phi_options(succ, &bb);
+    }
+    bb.clear_successors();
+    while (!bb.empty()) {
+      rm_instruction(&bb.front());
+    }
+    changed = true;
+  }
+  return changed;
+}
+
 ConditionalBranchInstruction *
 IRBuilder::create_conditional_branch(CmpFlag cmp_flag, BasicBlock *false_block,
                                      BasicBlock *true_block, Instruction *lhs,
@@ -122,19 +231,21 @@ IRBuilder::create_conditional_branch(CmpFlag cmp_flag, BasicBlock *false_block,
   //
   if (!curr_bb->has_successor()) {
     curr_bb->set_cond_successors(false_block, true_block);
-    false_block->add_predecessor(curr_bb);
-    true_block->add_predecessor(curr_bb);
   }
 
   return inst;
 }
 
 PhiInstruction *IRBuilder::create_phi(OperandType type) {
-  auto phi = m_graph->create_instruction<PhiInstruction>(type);
+  auto phi = make_phi(type);
   add_instruction(phi);
   return phi;
 }
 
+PhiInstruction *IRBuilder::make_phi(OperandType type) {
+  return m_graph->create_instruction<PhiInstruction>(type);
+}
+
 BitShift *IRBuilder::make_shr(Instruction *lhs, Instruction *rhs) {
   if (lhs->get_type() != INTEGER || rhs->get_type() != INTEGER) {
     auto &&errmsg =
@@ -160,4 +271,47 @@ ReturnInstruction *IRBuilder::create_ret(Instruction *val) {
   return ret;
 }
 
+CallInstruction *
+IRBuilder::create_call(funcid_t callee, OperandType type,
+                       const std::vector<Instruction *> &args) {
+  auto call = m_graph->create_instruction<CallInstruction>(callee, type, args);
+  add_instruction(call);
+  add_user_to(call, args);
+  return call;
+}
+
+BasicBlock *IRBuilder::split_block(Instruction *point) {
+  auto bb = point->get_bb();
+  auto tail = m_graph->create_basic_block();
+  while (point->has_next()) {
+    auto inst = point->get_next();
+    bb->remove_instruction(inst);
+    tail->add_instruction(inst);
+  }
+  std::vector<BasicBlock *> succs(bb->succ_begin(), bb->succ_end());
+  bb->clear_successors();
+  if (succs.size() == 1) {
+    tail->set_uncond_successor(succs[0]);
+  } else if (succs.size() == 2) {
+    tail->set_cond_successors(succs[0], succs[1]);
+  }
+  std::sort(succs.begin(), succs.end());
+  succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+  for (auto &&succ : succs) {
+    for (auto &&inst : *succ) {
+      if (!inst.is_phi()) {
+        break;
+      }
+      auto &&phi = static_cast<PhiInstruction &>(inst);
+      for (size_t i = 0, num = phi.get_num_options(); i < num; ++i) {
+        auto &&[incoming, value] = phi.get_option(i);
+        if (incoming == bb) {
+          phi.set_option(i, tail, value);
+        }
+      }
+    }
+  }
+  return tail;
+}
+
 }; // namespace koda
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include <IR/IRBuilder.hpp>
+#include <IR/IRCloner.hpp>
+
+namespace koda {
+
+Instruction *IRCloner::clone_instruction(const Instruction &inst) {
+  Instruction *lhs = nullptr;
+  Instruction *rhs = nullptr;
+  if (inst.get_num_inputs() == 2 && !inst.is_phi()) {
+    lhs = inst.get_input(BinaryOpInstructionBase::LHS);
+    rhs = inst.get_input(BinaryOpInstructionBase::RHS);
+  }
+  InstOpcode opc = inst.get_opcode();
+  switch (opc) {
+  case INST_ADD:
+  case INST_SUB:
+  case INST_MUL:
+  case INST_DIV:
+  case INST_MOD:
+  case INST_MULH:
+    return m_graph->create_instruction<ArithmeticInstruction>(
+        opc, inst.get_type(), lhs, rhs);
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR:
+    return m_graph->create_instruction<BitShift>(opc, lhs, rhs);
+  case INST_AND:
+  case INST_OR:
+  case INST_XOR:
+    return m_graph->create_instruction<BitOperation>(opc, lhs, rhs);
+  case INST_NOT:
+    return m_graph->create_instruction<BitNot>(inst.get_input(0));
+  case INST_BRANCH:
+    return m_graph->create_instruction<BranchInstruction>();
+  case INST_SELECT: {
+    auto &&select = static_cast<const SelectInstruction &>(inst);
+    return m_graph->create_instruction<SelectInstruction>(
+        select.get_flag(), select.get_lhs(), select.get_rhs(),
+        select.get_true_value(), select.get_false_value());
+  }
+  case INST_COND_BR: {
+    auto &&cond_br = static_cast<const ConditionalBranchInstruction &>(inst);
+    return m_graph->create_instruction<ConditionalBranchInstruction>(
+        cond_br.get_flag(), lhs, rhs);
+  }
+  case INST_PHI:
+    return m_graph->create_instruction<PhiInstruction>(inst.get_type());
+  case INST_PARAM: {
+    auto &&param = static_cast<const LoadParam &>(inst);
+    return m_graph->create_instruction<LoadParam>(param.get_type(),
+                                                  param.get_index());
+  }
+  case INST_CONST:
+    // Builder creates only integer constants
+    if (inst.get_type() == INTEGER) {
+      auto &&constant = static_cast<const LoadConstant<int64_t> &>(inst);
+      return m_graph->create_instruction<LoadConstant<int64_t>>(
+          constant.get_type(), constant.get_value());
+    }
+    throw IRInvalidArgument("Can't clone non-integer constant");
+  case INST_RET:
+    return m_graph->create_instruction<ReturnInstruction>(inst.get_input(0));
+  case INST_CALL: {
+    auto &&call = static_cast<const CallInstruction &>(inst);
+    std::vector<Instruction *> args(call.inputs_begin(), call.inputs_end());
+    return m_graph->create_instruction<CallInstruction>(
+        call.get_callee(), call.get_type(), args);
+  }
+  default:
+    throw IRInvalidArgument("Can't clone instruction");
+  }
+}
+
+void IRCloner::remap_operands(const Instruction &orig, Instruction &copy) {
+  if (orig.is_phi()) {
+    auto &&orig_phi = static_cast<const PhiInstruction &>(orig);
+    auto &&copy_phi = static_cast<PhiInstruction &>(copy);
+    for (size_t i = 0, num = orig_phi.get_num_options(); i < num; ++i) {
+      auto &&[bb, value] = orig_phi.get_option(i);
+      copy_phi.add_option(get_block(bb), get_value(value));
+    }
+    return;
+  }
+  for (size_t i = 0, num = orig.get_num_inputs(); i < num; ++i) {
+    auto input = get_value(orig.get_input(i));
+    copy.set_input(i, input);
+    input->add_user(&copy);
+  }
+}
+
+std::vector<BasicBlock *>
+IRCloner::clone_blocks(const std::vector<BasicBlock *> &bbs) {
+  std::vector<BasicBlock *> copies;
+  for (auto &&bb : bbs) {
+    auto copy = m_graph->create_basic_block();
+    map_block(bb, copy);
+    copies.push_back(copy);
+  }
+  // Copy instructions first, since operands may be defined later in the list
+  std::vector<std::pair<const Instruction *, Instruction *>> cloned;
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    for (auto &&inst : *bbs[i]) {
+      if (m_values.find(&inst) != m_values.end()) {
+        continue;
+      }
+      auto copy = clone_instruction(inst);
+      map_value(&inst, copy);
+      copies[i]->add_instruction(copy);
+      cloned.emplace_back(&inst, copy);
+    }
+  }
+  for (auto &&[orig, copy] : cloned) {
+    remap_operands(*orig, *copy);
+  }
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    auto &&bb = bbs[i];
+    if (bb->get_num_successors() == 1) {
+      copies[i]->set_uncond_successor(get_block(bb->get_uncond_successor()));
+    } else if (bb->get_num_successors() == 2) {
+      copies[i]->set_cond_successors(get_block(bb->get_false_successor()),
+                                     get_block(bb->get_true_successor()));
+    }
+  }
+  return copies;
+}
+
+void IRCloner::clone_graph(ProgramGraph &src) {
+  for (size_t idx = 0; idx < src.get_num_params(); ++idx) {
+    m_graph->create_param(src.get_param(idx).get_type());
+  }
+  std::vector<BasicBlock *> bbs;
+  for (auto &&bb : src) {
+    bbs.push_back(&bb);
+  }
+  clone_blocks(bbs);
+  m_graph->set_entry(get_block(src.get_entry()));
+}
+
+} // namespace koda
@@ -0,0 +1,614 @@
+#include <IR/IRBuilder.hpp>
+#include <IR/IRParser.hpp>
+#include <IR/Module.hpp>
+
+#include <charconv>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace koda {
+
+namespace {
+
+enum class TokenKind { WORD, NUMBER, PUNCT, NEWLINE, END };
+
+struct Token {
+  TokenKind kind = TokenKind::END;
+  std::string_view text;
+  size_t line = 1;
+  size_t column = 1;
+};
+
+bool is_word_start(char chr) {
+  return (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') ||
+         chr == '_';
+}
+
+bool is_digit(char chr) { return chr >= '0' && chr <= '9'; }
+
+bool is_word_char(char chr) {
+  return is_word_start(chr) || is_digit(chr) || chr == '.';
+}
+
+// Splits text into tokens on demand, the current token is always ready.
+class Lexer final {
+  std::string_view m_text;
+
+  size_t m_pos = 0;
+
+  size_t m_line = 1;
+
+  size_t m_line_start = 0;
+
+  Token m_token;
+
+  void advance();
+
+public:
+  explicit Lexer(std::string_view text) : m_text(text) { advance(); }
+
+  const Token &peek() const { return m_token; }
+
+  Token next() {
+    auto token = m_token;
+    advance();
+    return token;
+  }
+};
+
+void Lexer::advance() {
+  while (m_pos < m_text.size()) {
+    auto chr = m_text[m_pos];
+    if (chr == ' ' || chr == '\t' || chr == '\r') {
+      ++m_pos;
+    } else if (chr == '#') {
+      while (m_pos < m_text.size() && m_text[m_pos] != '\n') {
+        ++m_pos;
+      }
+    } else {
+      break;
+    }
+  }
+  m_token.line = m_line;
+  m_token.column = m_pos - m_line_start + 1;
+  auto start = m_pos;
+  if (m_pos == m_text.size()) {
+    m_token.kind = TokenKind::END;
+  } else if (m_text[m_pos] == '\n') {
+    m_token.kind = TokenKind::NEWLINE;
+    ++m_pos;
+    ++m_line;
+    m_line_start = m_pos;
+  } else if (is_word_start(m_text[m_pos])) {
+    m_token.kind = TokenKind::WORD;
+    while (m_pos < m_text.size() && is_word_char(m_text[m_pos])) {
+      ++m_pos;
+    }
+  } else if (is_digit(m_text[m_pos]) ||
+             (m_text[m_pos] == '-' && m_pos + 1 < m_text.size() &&
+              is_digit(m_text[m_pos + 1]))) {
+    m_token.kind = TokenKind::NUMBER;
+    ++m_pos;
+    while (m_pos < m_text.size() && is_digit(m_text[m_pos])) {
+      ++m_pos;
+    }
+  } else {
+    m_token.kind = TokenKind::PUNCT;
+    m_pos += m_text.compare(m_pos, 2, "->") == 0 ? 2 : 1;
+  }
+  m_token.text = m_text.substr(start, m_pos - start);
+}
+
+[[noreturn]] void fail(const Token &token, const std::string &msg) {
+  throw IRParseError(std::to_string(token.line) + ":" +
+                     std::to_string(token.column) + ": " + msg);
+}
+
+std::optional<uint64_t> parse_number(std::string_view text) {
+  uint64_t value = 0;
+  auto end = text.data() + text.size();
+  auto [ptr, ec] = std::from_chars(text.data(), end, value);
+  if (text.empty() || ec != std::errc() || ptr != end) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+std::optional<OperandType> find_type(std::string_view name) {
+  for (auto type : {NONE, BOOLEAN, BYTE, INTEGER, FLOAT, STRING, LABEL}) {
+    if (name == operand_type_to_str(type)) {
+      return type;
+    }
+  }
+  return std::nullopt;
+}
+
+Instruction *create_binary_op(IRBuilder &builder, InstOpcode opcode,
+                              Instruction *lhs, Instruction *rhs) {
+  switch (opcode) {
+  case INST_ADD:
+    return builder.create_iadd(lhs, rhs);
+  case INST_SUB:
+    return builder.create_isub(lhs, rhs);
+  case INST_MUL:
+    return builder.create_imul(lhs, rhs);
+  case INST_DIV:
+    return builder.create_idiv(lhs, rhs);
+  case INST_MOD:
+    return builder.create_mod(lhs, rhs);
+  case INST_MULH:
+    return builder.create_mulh(lhs, rhs);
+  case INST_SHL:
+    return builder.create_shl(lhs, rhs);
+  case INST_SHR:
+    return builder.create_shr(lhs, rhs);
+  case INST_ASHR:
+    return builder.create_ashr(lhs, rhs);
+  case INST_AND:
+    return builder.create_and(lhs, rhs);
+  case INST_OR:
+    return builder.create_or(lhs, rhs);
+  default:
+    return builder.create_xor(lhs, rhs);
+  }
+}
+
+class FunctionParser final {
+  Lexer &m_lexer;
+
+  ProgramGraph &m_graph;
+
+  IRBuilder m_builder;
+
+  // Calls to check when all functions are known.
+  std::vector<std::pair<Token, funcid_t>> &m_calls;
+
+  struct BlockRef {
+    BasicBlock *bb;
+    bool is_defined;
+    Token first_use;
+  };
+
+  std::map<uint64_t, BlockRef> m_blocks;
+
+  std::unordered_map<uint64_t, Instruction *> m_values;
+
+  // Values used before definition. Their users refer to placeholders of
+  // expected type until definition is parsed.
+  struct ForwardValue {
+    std::unique_ptr<Instruction> placeholder;
+    bool is_typed;
+    Token first_use;
+  };
+
+  std::map<uint64_t, ForwardValue> m_forward_values;
+
+  BasicBlock *m_current = nullptr;
+
+  // Limit of block numbers, so their gaps are bounded by text size.
+  uint64_t m_max_block_id;
+
+  Token expect(TokenKind kind, const char *what) {
+    if (m_lexer.peek().kind != kind) {
+      fail(m_lexer.peek(), std::string("expected ") + what);
+    }
+    return m_lexer.next();
+  }
+
+  void expect_punct(std::string_view punct) {
+    if (m_lexer.peek().kind != TokenKind::PUNCT ||
+        m_lexer.peek().text != punct) {
+      fail(m_lexer.peek(), "expected '" + std::string(punct) + "'");
+    }
+    m_lexer.next();
+  }
+
+  void expect_word(std::string_view word) {
+    if (m_lexer.peek().kind != TokenKind::WORD ||
+        m_lexer.peek().text != word) {
+      fail(m_lexer.peek(), "expected '" + std::string(word) + "'");
+    }
+    m_lexer.next();
+  }
+
+  void expect_line_end() {
+    if (m_lexer.peek().kind != TokenKind::END) {
+      expect(TokenKind::NEWLINE, "end of line");
+    }
+  }
+
+  // Number of name like "bb3".
+  uint64_t parse_ref(std::string_view prefix, const char *what) {
+    auto token = expect(TokenKind::WORD, what);
+    auto text = token.text;
+    std::optional<uint64_t> number;
+    if (text.substr(0, prefix.size()) == prefix) {
+      number = parse_number(text.substr(prefix.size()));
+    }
+    if (!number) {
+      fail(token, std::string("expected ") + what);
+    }
+    return *number;
+  }
+
+  OperandType parse_type() {
+    auto token = expect(TokenKind::WORD, "type");
+    auto type = find_type(token.text);
+    if (!type) {
+      fail(token, "unknown type '" + std::string(token.text) + "'");
+    }
+    return *type;
+  }
+
+  CmpFlag parse_flag() {
+    auto token = expect(TokenKind::WORD, "comparison flag");
+    for (auto flag : {CMP_EQ, CMP_NE, CMP_L, CMP_LE, CMP_G, CMP_GE}) {
+      if (token.text == flag_to_str(flag)) {
+        return flag;
+      }
+    }
+    fail(token, "unknown comparison flag '" + std::string(token.text) + "'");
+  }
+
+  // Blocks keep their numbers, missing ones are left empty.
+  BasicBlock *get_block(const Token &token, uint64_t id) {
+    if (id > m_max_block_id) {
+      fail(token, "block number is too large");
+    }
+    auto [ref, inserted] =
+        m_blocks.try_emplace(id, BlockRef{nullptr, false, token});
+    if (inserted) {
+      while (m_graph.size() <= id) {
+        m_graph.create_basic_block();
+      }
+      ref->second.bb = m_graph.get_bb(static_cast<bbid_t>(id));
+    }
+    return ref->second.bb;
+  }
+
+  BasicBlock *parse_block() {
+    auto token = m_lexer.peek();
+    return get_block(token, parse_ref("bb", "block"));
+  }
+
+  // Value of given type, TYPE_INVALID accepts any type.
+  Instruction *parse_value(OperandType type = TYPE_INVALID);
+
+  // Operand printed with its type, e.g. "int i3".
+  Instruction *parse_typed_value() { return parse_value(parse_type()); }
+
+  void define(const Token &token, uint64_t id, Instruction *inst);
+
+  Instruction *parse_instruction(const Token &opcode_token, InstOpcode opcode);
+
+  void parse_block_label();
+
+  void parse_fallthrough();
+
+public:
+  FunctionParser(Lexer &lexer, ProgramGraph &graph,
+                 std::vector<std::pair<Token, funcid_t>> &calls,
+                 uint64_t max_block_id)
+      : m_lexer(lexer), m_graph(graph), m_builder(graph), m_calls(calls),
+        m_max_block_id(max_block_id) {}
+
+  void run();
+};
+
+Instruction *FunctionParser::parse_value(OperandType type) {
+  auto token = m_lexer.peek();
+  auto id = parse_ref("i", "value");
+  if (auto value = m_values.find(id); value != m_values.end()) {
+    if (type != TYPE_INVALID && value->second->get_type() != type) {
+      fail(token, "type mismatch of " + std::string(token.text));
+    }
+    return value->second;
+  }
+  auto [forward, inserted] = m_forward_values.try_emplace(id);
+  if (inserted) {
+    auto placeholder_type = type == TYPE_INVALID ? INTEGER : type;
+    forward->second = {std::make_unique<LoadConstant<int64_t>>(
+                           0, placeholder_type, 0),
+                       type != TYPE_INVALID, token};
+  } else if (type != TYPE_INVALID) {
+    if (forward->second.placeholder->get_type() != type) {
+      fail(token, "type mismatch of " + std::string(token.text));
+    }
+    forward->second.is_typed = true;
+  }
+  return forward->second.placeholder.get();
+}
+
+void FunctionParser::define(const Token &token, uint64_t id,
+                            Instruction *inst) {
+  if (!m_values.emplace(id, inst).second) {
+    fail(token, "redefinition of " + std::string(token.text));
+  }
+  auto forward = m_forward_values.find(id);
+  if (forward == m_forward_values.end()) {
+    return;
+  }
+  auto &&placeholder = forward->second.placeholder;
+  if (forward->second.is_typed && placeholder->get_type() != inst->get_type()) {
+    fail(forward->second.first_use,
+         "type mismatch of " + std::string(token.text));
+  }
+  IRBuilder::move_users(placeholder.get(), inst);
+  m_forward_values.erase(forward);
+}
+
+Instruction *FunctionParser::parse_instruction(const Token &opcode_token,
+                                               InstOpcode opcode) {
+  switch (opcode) {
+  case INST_ADD:
+  case INST_SUB:
+  case INST_MUL:
+  case INST_DIV:
+  case INST_MOD:
+  case INST_MULH:
+  case INST_SHL:
+  case INST_SHR:
+  case INST_ASHR:
+  case INST_AND:
+  case INST_OR:
+  case INST_XOR: {
+    auto type = parse_type();
+    auto lhs = parse_typed_value();
+    auto rhs = parse_typed_value();
+    auto inst = create_binary_op(m_builder, opcode, lhs, rhs);
+    if (inst->get_type() != type) {
+      fail(opcode_token, "invalid result type");
+    }
+    return inst;
+  }
+  case INST_NOT:
+  case INST_RET: {
+    auto type = parse_type();
+    auto input = parse_typed_value();
+    Instruction *inst = nullptr;
+    if (opcode == INST_NOT) {
+      inst = m_builder.create_not(input);
+    } else {
+      inst = m_builder.create_ret(input);
+    }
+    if (inst->get_type() != type) {
+      fail(opcode_token, "invalid result type");
+    }
+    return inst;
+  }
+  case INST_PARAM: {
+    // Type and index are printed together, e.g. "int0".
+    auto token = expect(TokenKind::WORD, "parameter");
+    for (auto type : {NONE, BOOLEAN, BYTE, INTEGER, FLOAT, STRING, LABEL}) {
+      std::string_view name = operand_type_to_str(type);
+      if (token.text.substr(0, name.size()) != name) {
+        continue;
+      }
+      auto idx = parse_number(token.text.substr(name.size()));
+      if (!idx) {
+        continue;
+      }
+      auto inst = m_builder.create_param_load(*idx);
+      if (inst->get_type() != type) {
+        fail(token, "parameter type mismatch");
+      }
+      return inst;
+    }
+    fail(token, "expected parameter");
+  }
+  case INST_CONST: {
+    if (parse_type() != INTEGER) {
+      fail(opcode_token, "only integer constants are supported");
+    }
+    auto token = expect(TokenKind::NUMBER, "integer");
+    int64_t value = 0;
+    auto end = token.text.data() + token.text.size();
+    auto [ptr, ec] = std::from_chars(token.text.data(), end, value);
+    if (ec != std::errc() || ptr != end) {
+      fail(token, "integer out of range");
+    }
+    return m_builder.create_int_constant(value);
+  }
+  case INST_BRANCH:
+    return m_builder.create_branch(parse_block());
+  case INST_COND_BR: {
+    auto flag = parse_flag();
+    auto lhs = parse_value(INTEGER);
+    expect_punct(",");
+    auto rhs = parse_value(INTEGER);
+    expect_word("F");
+    expect_punct(":");
+    auto false_bb = parse_block();
+    expect_word("T");
+    expect_punct(":");
+    auto true_bb = parse_block();
+    return m_builder.create_conditional_branch(flag, false_bb, true_bb, lhs,
+                                               rhs);
+  }
+  case INST_SELECT: {
+    auto type = parse_type();
+    auto flag = parse_flag();
+    auto lhs = parse_value(INTEGER);
+    expect_punct(",");
+    auto rhs = parse_value(INTEGER);
+    expect_punct("?");
+    auto true_value = parse_value(type);
+    expect_punct(":");
+    auto false_value = parse_value(type);
+    return m_builder.create_select(flag, lhs, rhs, true_value, false_value);
+  }
+  case INST_PHI: {
+    auto phi = m_builder.create_phi(parse_type());
+    while (m_lexer.peek().kind == TokenKind::PUNCT &&
+           m_lexer.peek().text == "[") {
+      m_lexer.next();
+      expect(TokenKind::NUMBER, "option index");
+      expect_punct(":");
+      auto bb = parse_block();
+      phi->add_option(bb, parse_value(phi->get_type()));
+      expect_punct("]");
+      expect_punct(";");
+    }
+    return phi;
+  }
+  case INST_CALL: {
+    auto type = parse_type();
+    auto token = m_lexer.peek();
+    auto callee = parse_ref("f", "callee");
+    m_calls.emplace_back(token, callee);
+    std::vector<Instruction *> args;
+    while (m_lexer.peek().kind == TokenKind::WORD) {
+      args.push_back(parse_value());
+    }
+    return m_builder.create_call(callee, type, args);
+  }
+  default:
+    fail(opcode_token, "unsupported instruction");
+  }
+}
+
+void FunctionParser::parse_block_label() {
+  auto token = m_lexer.peek();
+  auto id = parse_ref("bb", "block");
+  auto bb = get_block(token, id);
+  auto &&ref = m_blocks.at(id);
+  if (ref.is_defined) {
+    fail(token, "redefinition of " + std::string(token.text));
+  }
+  ref.is_defined = true;
+  if (m_graph.get_entry() == nullptr) {
+    m_graph.set_entry(bb);
+  }
+  m_current = bb;
+  m_builder.set_insert_point(bb);
+  expect_punct(":");
+  expect_line_end();
+}
+
+void FunctionParser::parse_fallthrough() {
+  auto token = m_lexer.next();
+  if (m_current == nullptr || m_current->has_successor()) {
+    fail(token, "unexpected successors");
+  }
+  auto succ = parse_block();
+  if (m_lexer.peek().kind == TokenKind::PUNCT && m_lexer.peek().text == ",") {
+    m_lexer.next();
+    m_current->set_cond_successors(succ, parse_block());
+  } else {
+    m_current->set_uncond_successor(succ);
+  }
+  expect_line_end();
+}
+
+void FunctionParser::run() {
+  expect_punct("(");
+  if (m_lexer.peek().text != ")") {
+    m_graph.create_param(parse_type());
+    while (m_lexer.peek().text == ",") {
+      m_lexer.next();
+      m_graph.create_param(parse_type());
+    }
+  }
+  expect_punct(")");
+  expect_punct("{");
+  expect_line_end();
+
+  static const auto opcodes = [] {
+    std::unordered_map<std::string_view, InstOpcode> opcodes;
+    for (unsigned opc = INST_INVALID + 1; opc < INST_NUM_OPCODES; ++opc) {
+      auto opcode = static_cast<InstOpcode>(opc);
+      opcodes.emplace(inst_opc_to_str(opcode), opcode);
+    }
+    return opcodes;
+  }();
+
+  while (true) {
+    auto &&token = m_lexer.peek();
+    if (token.kind == TokenKind::NEWLINE) {
+      m_lexer.next();
+      continue;
+    }
+    if (token.kind == TokenKind::END) {
+      fail(token, "expected '}'");
+    }
+    if (token.kind == TokenKind::PUNCT && token.text == "}") {
+      m_lexer.next();
+      break;
+    }
+    if (token.kind == TokenKind::PUNCT && token.text == "->") {
+      parse_fallthrough();
+      continue;
+    }
+    if (token.kind == TokenKind::WORD && token.text.substr(0, 2) == "bb") {
+      parse_block_label();
+      continue;
+    }
+    auto value_token = token;
+    auto id = parse_ref("i", "instruction");
+    if (m_current == nullptr) {
+      fail(value_token, "instruction outside of block");
+    }
+    expect_punct(":");
+    auto opcode_token = expect(TokenKind::WORD, "opcode");
+    auto opcode = opcodes.find(opcode_token.text);
+    if (opcode == opcodes.end()) {
+      fail(opcode_token,
+           "unknown opcode '" + std::string(opcode_token.text) + "'");
+    }
+    Instruction *inst = nullptr;
+    try {
+      inst = parse_instruction(opcode_token, opcode->second);
+    } catch (const IROperandError &error) {
+      fail(opcode_token, error.what());
+    } catch (const IRInvalidArgument &error) {
+      fail(opcode_token, error.what());
+    }
+    define(value_token, id, inst);
+    expect_line_end();
+  }
+
+  for (auto &&[id, ref] : m_blocks) {
+    if (!ref.is_defined) {
+      fail(ref.first_use, "undefined block bb" + std::to_string(id));
+    }
+  }
+  if (!m_forward_values.empty()) {
+    auto &&[id, forward] = *m_forward_values.begin();
+    fail(forward.first_use, "undefined value i" + std::to_string(id));
+  }
+}
+
+} // namespace
+
+void parse_module(std::string_view text, Module &module) {
+  Lexer lexer(text);
+  std::vector<std::pair<Token, funcid_t>> calls;
+  while (true) {
+    auto token = lexer.next();
+    if (token.kind == TokenKind::NEWLINE) {
+      continue;
+    }
+    if (token.kind == TokenKind::END) {
+      break;
+    }
+    if (token.kind != TokenKind::WORD || token.text != "func") {
+      fail(token, "expected 'func'");
+    }
+    auto name = lexer.next();
+    if (name.kind != TokenKind::WORD) {
+      fail(name, "expected function name");
+    }
+    auto id = module.create_function(std::string(name.text));
+    FunctionParser(lexer, module.get_function(id), calls, text.size())
+        .run();
+  }
+  for (auto &&[token, callee] : calls) {
+    if (callee >= module.size()) {
+      fail(token, "unknown function " + std::string(token.text));
+    }
+  }
+}
+
+} // namespace koda
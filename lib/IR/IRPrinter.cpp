@@ -2,6 +2,7 @@
 #include "IR/BasicBlock.hpp"
 #include "IR/ProgramGraph.hpp"
 #include <IR/IRPrinter.hpp>
+#include <IR/Module.hpp>
 
 #include <algorithm>
 
@@ -35,4 +36,48 @@ void IRPrinter::print_block(const BasicBlock &bb) {
   }
 }
 
+void IRPrinter::print_function(ProgramGraph &graph, const std::string &name) {
+  m_out_stream << "func " << name << "(";
+  for (size_t idx = 0; idx < graph.get_num_params(); ++idx) {
+    m_out_stream << (idx == 0 ? "" : ", ")
+                 << operand_type_to_str(graph.get_param(idx).get_type());
+  }
+  m_out_stream << ") {\n";
+  auto print = [this](BasicBlock &bb) {
+    m_out_stream << "bb" << bb.get_id() << ":\n";
+    for (auto &&inst : bb) {
+      m_out_stream << "  ";
+      inst.dump(m_out_stream);
+      m_out_stream << "\n";
+    }
+    if ((bb.empty() || !bb.back().is_terminator()) && bb.has_successor()) {
+      m_out_stream << "  ->";
+      for (auto succ = bb.succ_begin(); succ != bb.succ_end(); ++succ) {
+        m_out_stream << (succ == bb.succ_begin() ? " bb" : ", bb")
+                     << (*succ)->get_id();
+      }
+      m_out_stream << "\n";
+    }
+  };
+  auto entry = graph.get_entry();
+  if (entry != nullptr) {
+    print(*entry);
+  }
+  for (auto &&bb : graph) {
+    if (&bb != entry) {
+      print(bb);
+    }
+  }
+  m_out_stream << "}\n";
+}
+
+void IRPrinter::print_module(const Module &module) {
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    if (id != 0) {
+      m_out_stream << "\n";
+    }
+    print_function(module.get_function(id), module.get_name(id));
+  }
+}
+
 } // namespace koda
\ No newline at end of file
@@ -31,6 +31,29 @@ void PhiInstruction::add_option(BasicBlock *incoming_bb, Instruction *value) {
   m_inputs.push_back(value);
 }
 
+void PhiInstruction::set_option(size_t idx, BasicBlock *incoming_bb,
+                                Instruction *value) {
+  assert(idx < get_num_options() && "Invalid option index");
+  if (value->get_type() != m_type) {
+    throw IROperandError("Invalid phi operand type");
+  }
+  if (m_inputs[idx]) {
+    m_inputs[idx]->rm_user(this);
+  }
+  value->add_user(this);
+  m_incoming_blocks[idx] = incoming_bb;
+  m_inputs[idx] = value;
+}
+
+void PhiInstruction::remove_option(size_t idx) {
+  assert(idx < get_num_options() && "Invalid option index");
+  if (m_inputs[idx]) {
+    m_inputs[idx]->rm_user(this);
+  }
+  m_incoming_blocks.erase(std::next(m_incoming_blocks.begin(), idx));
+  m_inputs.erase(std::next(m_inputs.begin(), idx));
+}
+
 BasicBlock *BranchInstruction::get_target() const {
   return m_bblock->get_uncond_successor();
 }
@@ -54,6 +77,19 @@ void ConditionalBranchInstruction::dump_(std::ostream &os) const {
      << get_true_block()->get_id();
 }
 
+void SelectInstruction::dump_(std::ostream &os) const {
+  os << operand_type_to_str(get_type()) << " " << flag_to_str(m_flag) << " i"
+     << get_lhs()->get_id() << ", i" << get_rhs()->get_id() << " ? i"
+     << get_true_value()->get_id() << " : i" << get_false_value()->get_id();
+}
+
+void CallInstruction::dump_(std::ostream &os) const {
+  os << operand_type_to_str(get_type()) << " f" << m_callee;
+  for (auto &&arg : m_inputs) {
+    os << " i" << arg->get_id();
+  }
+}
+
 void PhiInstruction::dump_(std::ostream &os) const {
   os << operand_type_to_str(get_type());
   for (size_t i = 0; i < m_incoming_blocks.size(); ++i) {
@@ -0,0 +1,22 @@
+#include <IR/Module.hpp>
+
+#include <algorithm>
+
+namespace koda {
+
+funcid_t Module::create_function(const std::string &name) {
+  funcid_t id = m_functions.size();
+  m_functions.push_back(std::make_unique<ProgramGraph>());
+  m_names.push_back(name);
+  return id;
+}
+
+std::optional<funcid_t> Module::find_function(const std::string &name) const {
+  auto pos = std::find(m_names.begin(), m_names.end(), name);
+  if (pos == m_names.end()) {
+    return std::nullopt;
+  }
+  return std::distance(m_names.begin(), pos);
+}
+
+} // namespace koda
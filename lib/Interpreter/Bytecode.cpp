@@ -0,0 +1,304 @@
+#include <Core/Analysis.hpp>
+#include <IR/ProgramGraph.hpp>
+#include <Interpreter/Interpreter.hpp>
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+
+namespace koda {
+
+namespace {
+
+struct SlotMove {
+  uint32_t dst;
+  uint32_t src;
+};
+
+class BytecodeLowering final {
+  ProgramGraph &m_graph;
+
+  std::vector<uint32_t> &m_code;
+
+  std::vector<int64_t> &m_frame;
+
+  std::vector<bbid_t> &m_loop_headers;
+
+  DomsTreeAnalysis m_doms;
+
+  LoopTreeAnalysis m_loops;
+
+  // Numbers of counted loops by their header.
+  std::unordered_map<bbid_t, uint32_t> m_loop_numbers;
+
+  // Slot used to break cycles of phi moves.
+  uint32_t m_temp_slot;
+
+  // Start offsets of blocks, -1 if block isn't lowered yet.
+  std::vector<int64_t> m_block_offsets;
+
+  // Positions of jump targets and their blocks.
+  std::vector<std::pair<size_t, const BasicBlock *>> m_fixups;
+
+  static uint32_t get_slot(const Instruction *inst) {
+    return static_cast<uint32_t>(inst->get_id());
+  }
+
+  void emit(std::initializer_list<uint32_t> words) {
+    m_code.insert(m_code.end(), words);
+  }
+
+  void emit_target(const BasicBlock *bb) {
+    m_fixups.emplace_back(m_code.size(), bb);
+    m_code.push_back(0);
+  }
+
+  std::vector<SlotMove> get_phi_moves(BasicBlock *pred, BasicBlock *succ);
+
+  // Counting instruction of backedge, std::nullopt for other edges.
+  std::optional<std::pair<BytecodeOp, uint32_t>>
+  get_backedge_counter(BasicBlock *pred, BasicBlock *succ);
+
+  void emit_moves(std::vector<SlotMove> moves);
+
+  void emit_edge(BasicBlock *pred, BasicBlock *succ, const BasicBlock *next);
+
+  void lower_instruction(Instruction &inst, const BasicBlock *next);
+
+public:
+  BytecodeLowering(ProgramGraph &graph, std::vector<uint32_t> &code,
+                   std::vector<int64_t> &frame,
+                   std::vector<bbid_t> &loop_headers)
+      : m_graph(graph), m_code(code), m_frame(frame),
+        m_loop_headers(loop_headers),
+        m_temp_slot(static_cast<uint32_t>(graph.get_instr_count())),
+        m_block_offsets(graph.size(), -1) {}
+
+  void run();
+};
+
+std::vector<SlotMove> BytecodeLowering::get_phi_moves(BasicBlock *pred,
+                                                      BasicBlock *succ) {
+  std::vector<SlotMove> moves;
+  for (auto &&inst : *succ) {
+    if (!inst.is_phi()) {
+      break;
+    }
+    auto &&phi = static_cast<PhiInstruction &>(inst);
+    auto src = get_slot(phi.get_value_for(pred));
+    if (src != get_slot(&phi)) {
+      moves.push_back({get_slot(&phi), src});
+    }
+  }
+  return moves;
+}
+
+// Outermost loop is entered only through its header, so all values used in
+// the loop are in the frame on its backedge. That doesn't hold for inner
+// loops, values computed between outer and inner headers would be lost.
+std::optional<std::pair<BytecodeOp, uint32_t>>
+BytecodeLowering::get_backedge_counter(BasicBlock *pred, BasicBlock *succ) {
+  if (!succ->is_loop_header()) {
+    return std::nullopt;
+  }
+  auto &&tree = m_loops.get();
+  auto &&loop = tree.get(succ->get_id());
+  if (!loop.is_reducible() || !loop.contains(pred)) {
+    return std::nullopt;
+  }
+  auto outermost = succ->get_id();
+  while (tree.get_parent(outermost) != LoopInfo::NIL_LOOP_ID) {
+    outermost = tree.get_parent(outermost);
+  }
+  if (!tree.get(outermost).is_reducible()) {
+    return std::nullopt;
+  }
+  auto [number, inserted] = m_loop_numbers.emplace(
+      outermost, static_cast<uint32_t>(m_loop_headers.size()));
+  if (inserted) {
+    m_loop_headers.push_back(outermost);
+  }
+  auto op = outermost == succ->get_id() ? BC_LOOP : BC_COUNT;
+  return std::make_pair(op, number->second);
+}
+
+// Phis read their inputs simultaneously, so move is emitted when its
+// destination isn't read by other pending moves. Cycles are broken with
+// temporary slot.
+void BytecodeLowering::emit_moves(std::vector<SlotMove> moves) {
+  while (!moves.empty()) {
+    auto ready = std::find_if(
+        moves.begin(), moves.end(), [&moves](const SlotMove &move) {
+          return std::none_of(
+              moves.begin(), moves.end(),
+              [&move](const SlotMove &other) { return other.src == move.dst; });
+        });
+    if (ready != moves.end()) {
+      emit({BC_MOV, ready->dst, ready->src});
+      moves.erase(ready);
+      continue;
+    }
+    auto saved = moves.front().dst;
+    emit({BC_MOV, m_temp_slot, saved});
+    for (auto &&pending : moves) {
+      if (pending.src == saved) {
+        pending.src = m_temp_slot;
+      }
+    }
+  }
+}
+
+void BytecodeLowering::emit_edge(BasicBlock *pred, BasicBlock *succ,
+                                 const BasicBlock *next) {
+  emit_moves(get_phi_moves(pred, succ));
+  if (auto counter = get_backedge_counter(pred, succ)) {
+    emit({counter->first, counter->second});
+  }
+  if (succ != next) {
+    emit({BC_JMP});
+    emit_target(succ);
+  }
+}
+
+void BytecodeLowering::lower_instruction(Instruction &inst,
+                                         const BasicBlock *next) {
+  auto type = inst.get_type();
+  if (type != INTEGER && type != NONE) {
+    throw InterpreterError("Only integer values are supported");
+  }
+  auto dst = get_slot(&inst);
+  auto input = [&inst](size_t idx) { return get_slot(inst.get_input(idx)); };
+  switch (inst.get_opcode()) {
+  case INST_CONST:
+    m_frame[dst] = static_cast<LoadConstant<int64_t> &>(inst).get_value();
+    break;
+  case INST_PARAM:
+    emit({BC_PARAM, dst,
+          static_cast<uint32_t>(static_cast<LoadParam &>(inst).get_index())});
+    break;
+  case INST_ADD:
+    emit({BC_ADD, dst, input(0), input(1)});
+    break;
+  case INST_SUB:
+    emit({BC_SUB, dst, input(0), input(1)});
+    break;
+  case INST_MUL:
+    emit({BC_MUL, dst, input(0), input(1)});
+    break;
+  case INST_DIV:
+    emit({BC_DIV, dst, input(0), input(1)});
+    break;
+  case INST_MOD:
+    emit({BC_MOD, dst, input(0), input(1)});
+    break;
+  case INST_MULH:
+    emit({BC_MULH, dst, input(0), input(1)});
+    break;
+  case INST_SHL:
+    emit({BC_SHL, dst, input(0), input(1)});
+    break;
+  case INST_SHR:
+    emit({BC_SHR, dst, input(0), input(1)});
+    break;
+  case INST_ASHR:
+    emit({BC_ASHR, dst, input(0), input(1)});
+    break;
+  case INST_AND:
+    emit({BC_AND, dst, input(0), input(1)});
+    break;
+  case INST_OR:
+    emit({BC_OR, dst, input(0), input(1)});
+    break;
+  case INST_XOR:
+    emit({BC_XOR, dst, input(0), input(1)});
+    break;
+  case INST_NOT:
+    emit({BC_NOT, dst, input(0)});
+    break;
+  case INST_SELECT: {
+    auto &&select = static_cast<SelectInstruction &>(inst);
+    emit({BC_SEL_EQ + (select.get_flag() - CMP_EQ), dst,
+          get_slot(select.get_lhs()), get_slot(select.get_rhs()),
+          get_slot(select.get_true_value()),
+          get_slot(select.get_false_value())});
+    break;
+  }
+  case INST_BRANCH:
+    emit_edge(inst.get_bb(), inst.get_bb()->get_uncond_successor(), next);
+    break;
+  case INST_COND_BR: {
+    auto &&branch = static_cast<ConditionalBranchInstruction &>(inst);
+    auto bb = inst.get_bb();
+    auto true_bb = bb->get_true_successor();
+    auto true_moves = get_phi_moves(bb, true_bb);
+    emit({BC_J_EQ + (branch.get_flag() - CMP_EQ), input(0), input(1)});
+    if (true_moves.empty() && !get_backedge_counter(bb, true_bb)) {
+      emit_target(true_bb);
+      emit_edge(bb, bb->get_false_successor(), next);
+      break;
+    }
+    // Moves and counter of true edge follow the false edge.
+    auto true_edge = m_code.size();
+    m_code.push_back(0);
+    emit_edge(bb, bb->get_false_successor(), nullptr);
+    m_code[true_edge] = static_cast<uint32_t>(m_code.size());
+    emit_edge(bb, true_bb, next);
+    break;
+  }
+  case INST_RET:
+    emit({BC_RET, input(0)});
+    break;
+  case INST_CALL: {
+    auto &&call = static_cast<CallInstruction &>(inst);
+    emit({BC_CALL, dst, static_cast<uint32_t>(call.get_callee()),
+          static_cast<uint32_t>(call.get_num_inputs())});
+    for (size_t idx = 0; idx < call.get_num_inputs(); ++idx) {
+      m_code.push_back(input(idx));
+    }
+    break;
+  }
+  default:
+    throw InterpreterError(std::string("Unsupported instruction ") +
+                           inst_opc_to_str(inst.get_opcode()));
+  }
+}
+
+void BytecodeLowering::run() {
+  m_doms.run(m_graph);
+  m_loops.run(m_graph, m_doms.get());
+  RPOAnalysis rpo;
+  rpo.run(m_graph);
+  std::vector<BasicBlock *> blocks;
+  for (auto &&bbid : rpo) {
+    blocks.push_back(m_graph.get_bb(bbid));
+  }
+  for (size_t idx = 0; idx < blocks.size(); ++idx) {
+    auto bb = blocks[idx];
+    auto next = idx + 1 < blocks.size() ? blocks[idx + 1] : nullptr;
+    m_block_offsets[bb->get_id()] = static_cast<int64_t>(m_code.size());
+    for (auto &&inst : *bb) {
+      if (!inst.is_phi()) {
+        lower_instruction(inst, next);
+      }
+    }
+    // Block without terminator falls to its successor.
+    if ((bb->empty() || !bb->back().is_terminator()) &&
+        bb->get_num_successors() == 1) {
+      emit_edge(bb, bb->get_uncond_successor(), next);
+    }
+  }
+  for (auto &&[pos, bb] : m_fixups) {
+    m_code[pos] = static_cast<uint32_t>(m_block_offsets[bb->get_id()]);
+  }
+}
+
+} // namespace
+
+BytecodeFunction::BytecodeFunction(ProgramGraph &graph)
+    : m_initial_frame(graph.get_instr_count() + 1, 0),
+      m_num_params(graph.get_num_params()) {
+  BytecodeLowering(graph, m_code, m_initial_frame, m_loop_headers).run();
+  m_profile.backedges.resize(m_loop_headers.size());
+}
+
+} // namespace koda
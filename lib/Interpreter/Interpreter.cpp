@@ -0,0 +1,238 @@
+#include <IR/Arithmetic.hpp>
+#include <IR/Module.hpp>
+#include <Interpreter/Interpreter.hpp>
+
+#include <algorithm>
+
+namespace koda {
+
+Interpreter::Interpreter(Dispatch dispatch, size_t stack_size)
+    : m_stack(stack_size), m_dispatch(dispatch) {}
+
+Interpreter::Interpreter(const Module &module, Dispatch dispatch,
+                         size_t stack_size)
+    : m_module(&module), m_functions(module.size()), m_stack(stack_size),
+      m_dispatch(dispatch) {}
+
+const BytecodeFunction &Interpreter::get_function(funcid_t id) {
+  if (m_module == nullptr) {
+    throw InterpreterError("Calls require module");
+  }
+  auto &&func = m_functions[id];
+  if (!func) {
+    func = std::make_unique<BytecodeFunction>(m_module->get_function(id));
+  }
+  return *func;
+}
+
+int64_t Interpreter::run(const BytecodeFunction &func,
+                         const std::vector<int64_t> &args) {
+  return enter(func, NO_FUNCTION, args);
+}
+
+int64_t Interpreter::run(funcid_t id, const std::vector<int64_t> &args) {
+  return enter(get_function(id), id, args);
+}
+
+int64_t Interpreter::enter(const BytecodeFunction &func, funcid_t id,
+                           const std::vector<int64_t> &args) {
+  if (args.size() != func.get_num_params()) {
+    throw InterpreterError("Wrong number of arguments");
+  }
+  if (args.size() > m_stack.size()) {
+    throw InterpreterError("Interpreter stack overflow");
+  }
+  // Arguments are copied, so frames are never outside of the stack.
+  std::copy(args.begin(), args.end(), m_stack.begin());
+  return invoke(func, id, m_stack.data() + args.size(), m_stack.data());
+}
+
+int64_t Interpreter::invoke(const BytecodeFunction &func, funcid_t id,
+                            int64_t *frame, const int64_t *args) {
+  auto &&calls = func.get_profile().calls;
+  if (++calls >= m_call_threshold && m_hooks != nullptr &&
+      id != NO_FUNCTION) {
+    int64_t result = 0;
+    if (m_hooks->on_hot_call(id, args, result)) {
+      return result;
+    }
+    calls = 0;
+  }
+  auto &&initial = func.get_initial_frame();
+  if (frame + initial.size() > m_stack.data() + m_stack.size()) {
+    throw InterpreterError("Interpreter stack overflow");
+  }
+  std::copy(initial.begin(), initial.end(), frame);
+#if defined(__GNUC__)
+  if (m_dispatch == Dispatch::THREADED) {
+    return execute<Dispatch::THREADED>(func, id, frame, args);
+  }
+#endif
+  return execute<Dispatch::SWITCH>(func, id, frame, args);
+}
+
+// Handlers are shared by both dispatch modes. Threaded dispatch jumps from
+// the end of each handler right to the next one, so every handler has its
+// own indirect branch, which predicts better than a single switch.
+template <Interpreter::Dispatch D>
+int64_t Interpreter::execute(const BytecodeFunction &func, funcid_t id,
+                             int64_t *frame, const int64_t *args) {
+  const uint32_t *code = func.get_code().data();
+  const uint32_t *ip = code;
+  uint64_t *backedges = func.get_profile().backedges.data();
+
+#if defined(__GNUC__)
+  static const void *const handlers[] = {
+#define BC_OP_DEF(name) &&op_##name,
+#include "Interpreter/BytecodeOps.def"
+#undef BC_OP_DEF
+  };
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    if constexpr (D == Dispatch::THREADED) {                                   \
+      goto *handlers[*ip];                                                     \
+    } else {                                                                   \
+      goto dispatch;                                                           \
+    }                                                                          \
+  } while (false)
+#else
+#define DISPATCH() goto dispatch
+#endif
+
+#define BINARY_OP(name, expr)                                                  \
+  op_##name : {                                                                \
+    int64_t lhs = frame[ip[2]];                                                \
+    int64_t rhs = frame[ip[3]];                                                \
+    frame[ip[1]] = (expr);                                                     \
+    ip += 4;                                                                   \
+    DISPATCH();                                                                \
+  }
+
+#define DIVISION_OP(name, eval)                                                \
+  op_##name : {                                                                \
+    int64_t rhs = frame[ip[3]];                                                \
+    if (rhs == 0) {                                                            \
+      throw InterpreterError("Division by zero");                              \
+    }                                                                          \
+    frame[ip[1]] = eval(frame[ip[2]], rhs);                                    \
+    ip += 4;                                                                   \
+    DISPATCH();                                                                \
+  }
+
+#define SELECT_OP(name, cmp)                                                   \
+  op_##name : {                                                                \
+    frame[ip[1]] = frame[ip[2]] cmp frame[ip[3]] ? frame[ip[4]]                \
+                                                 : frame[ip[5]];               \
+    ip += 6;                                                                   \
+    DISPATCH();                                                                \
+  }
+
+#define JUMP_OP(name, cmp)                                                     \
+  op_##name : {                                                                \
+    ip = frame[ip[1]] cmp frame[ip[2]] ? code + ip[3] : ip + 4;                \
+    DISPATCH();                                                                \
+  }
+
+  // The first handler is chosen by switch in both modes.
+  goto dispatch;
+dispatch:
+  switch (static_cast<BytecodeOp>(*ip)) {
+#define BC_OP_DEF(name)                                                        \
+  case BC_##name:                                                              \
+    goto op_##name;
+#include "Interpreter/BytecodeOps.def"
+#undef BC_OP_DEF
+  default:
+    throw InterpreterError("Invalid bytecode");
+  }
+
+op_MOV : {
+  frame[ip[1]] = frame[ip[2]];
+  ip += 3;
+  DISPATCH();
+}
+op_PARAM : {
+  frame[ip[1]] = args[ip[2]];
+  ip += 3;
+  DISPATCH();
+}
+  BINARY_OP(ADD, wrap_add(lhs, rhs))
+  BINARY_OP(SUB, wrap_sub(lhs, rhs))
+  BINARY_OP(MUL, wrap_mul(lhs, rhs))
+  DIVISION_OP(DIV, eval_div)
+  DIVISION_OP(MOD, eval_mod)
+  BINARY_OP(MULH, eval_mulh(lhs, rhs))
+  BINARY_OP(SHL, eval_shl(lhs, rhs))
+  BINARY_OP(SHR, eval_shr(lhs, rhs))
+  BINARY_OP(ASHR, eval_ashr(lhs, rhs))
+  BINARY_OP(AND, lhs & rhs)
+  BINARY_OP(OR, lhs | rhs)
+  BINARY_OP(XOR, lhs ^ rhs)
+op_NOT : {
+  frame[ip[1]] = ~frame[ip[2]];
+  ip += 3;
+  DISPATCH();
+}
+  SELECT_OP(SEL_EQ, ==)
+  SELECT_OP(SEL_NE, !=)
+  SELECT_OP(SEL_L, <)
+  SELECT_OP(SEL_LE, <=)
+  SELECT_OP(SEL_G, >)
+  SELECT_OP(SEL_GE, >=)
+op_JMP : {
+  ip = code + ip[1];
+  DISPATCH();
+}
+  JUMP_OP(J_EQ, ==)
+  JUMP_OP(J_NE, !=)
+  JUMP_OP(J_L, <)
+  JUMP_OP(J_LE, <=)
+  JUMP_OP(J_G, >)
+  JUMP_OP(J_GE, >=)
+op_COUNT : {
+  ++backedges[ip[1]];
+  ip += 2;
+  DISPATCH();
+}
+op_LOOP : {
+  auto &&count = backedges[ip[1]];
+  if (++count >= m_backedge_threshold && m_hooks != nullptr &&
+      id != NO_FUNCTION) {
+    int64_t result = 0;
+    if (m_hooks->on_hot_loop(id, func.get_loop_headers()[ip[1]], frame,
+                             result)) {
+      return result;
+    }
+    count = 0;
+  }
+  ip += 2;
+  DISPATCH();
+}
+op_RET:
+  return frame[ip[1]];
+op_CALL : {
+  auto &&callee = get_function(ip[2]);
+  auto num_args = ip[3];
+  // Arguments are placed right after caller frame, callee frame follows
+  // them.
+  int64_t *callee_args = frame + func.get_num_slots();
+  if (callee_args + num_args > m_stack.data() + m_stack.size()) {
+    throw InterpreterError("Interpreter stack overflow");
+  }
+  for (uint32_t idx = 0; idx < num_args; ++idx) {
+    callee_args[idx] = frame[ip[4 + idx]];
+  }
+  frame[ip[1]] =
+      invoke(callee, ip[2], callee_args + num_args, callee_args);
+  ip += 4 + num_args;
+  DISPATCH();
+}
+
+#undef JUMP_OP
+#undef SELECT_OP
+#undef DIVISION_OP
+#undef BINARY_OP
+#undef DISPATCH
+}
+
+} // namespace koda
@@ -0,0 +1,237 @@
+#include <CodeGen/X86Backend.hpp>
+#include <Core/Compiler.h>
+#include <DataStructures/Graph.hpp>
+#include <IR/IRBuilder.hpp>
+#include <IR/IRCloner.hpp>
+#include <IR/Module.hpp>
+#include <Runtime/TieredRuntime.hpp>
+
+#include <algorithm>
+
+namespace koda {
+
+namespace {
+
+std::vector<funcid_t> get_callees(ProgramGraph &graph) {
+  std::vector<funcid_t> callees;
+  for (auto &&bb : graph) {
+    for (auto &&inst : bb) {
+      if (inst.get_opcode() == INST_CALL) {
+        callees.push_back(static_cast<CallInstruction &>(inst).get_callee());
+      }
+    }
+  }
+  return callees;
+}
+
+// Phi use is located in the incoming block of the value.
+bool is_used_in(Instruction &inst, const std::vector<bool> &blocks) {
+  return std::any_of(
+      inst.users_begin(), inst.users_end(), [&inst, &blocks](auto &&user) {
+        if (!user->is_phi()) {
+          return static_cast<bool>(blocks[user->get_bb()->get_id()]);
+        }
+        auto &&phi = static_cast<PhiInstruction &>(*user);
+        for (size_t idx = 0; idx < phi.get_num_options(); ++idx) {
+          auto &&[bb, value] = phi.get_option(idx);
+          if (value == &inst && blocks[bb->get_id()]) {
+            return true;
+          }
+        }
+        return false;
+      });
+}
+
+std::vector<uint8_t> compile_graph(Compiler &comp,
+                                   const void *const *call_table) {
+  comp.register_default_passes();
+  comp.run_all_passes();
+  return X86Backend::emit(comp, call_table);
+}
+
+} // namespace
+
+TieredRuntime::TieredRuntime(const Module &module, uint64_t call_threshold,
+                             uint64_t backedge_threshold)
+    : m_module(module), m_interpreter(module),
+      m_call_table(std::make_unique<const void *[]>(module.size())),
+      m_tiers(module.size(), Tier::INTERPRETED), m_stubs(module.size()) {
+  m_interpreter.set_tiering(this, call_threshold, backedge_threshold);
+}
+
+int64_t TieredRuntime::run(funcid_t id, const std::vector<int64_t> &args) {
+  return m_interpreter.run(id, args);
+}
+
+bool TieredRuntime::compile(const std::vector<funcid_t> &roots) {
+  std::vector<funcid_t> pending;
+  std::vector<bool> visited(m_module.size(), false);
+  std::vector<funcid_t> worklist(roots);
+  while (!worklist.empty()) {
+    auto id = worklist.back();
+    worklist.pop_back();
+    if (visited[id] || m_tiers[id] == Tier::OPTIMIZED) {
+      continue;
+    }
+    if (m_tiers[id] == Tier::FAILED) {
+      return false;
+    }
+    visited[id] = true;
+    pending.push_back(id);
+    auto callees = get_callees(m_module.get_function(id));
+    worklist.insert(worklist.end(), callees.begin(), callees.end());
+  }
+  // Code is installed only when all functions are compiled, so native code
+  // never calls function without code.
+  std::vector<std::vector<uint8_t>> functions;
+  for (auto &&id : pending) {
+    try {
+      Compiler comp(X86Backend::NUM_REGS);
+      IRCloner(comp.graph()).clone_graph(m_module.get_function(id));
+      functions.push_back(compile_graph(comp, m_call_table.get()));
+    } catch (const CodeGenError &) {
+      m_tiers[id] = Tier::FAILED;
+      return false;
+    } catch (const IRInvalidArgument &) {
+      m_tiers[id] = Tier::FAILED;
+      return false;
+    }
+  }
+  for (size_t idx = 0; idx < pending.size(); ++idx) {
+    auto id = pending[idx];
+    m_call_table[id] = m_code_cache.add(functions[idx]);
+    m_stubs[id].emplace(m_code_cache, m_call_table[id],
+                        m_module.get_function(id).get_num_params());
+    m_tiers[id] = Tier::OPTIMIZED;
+  }
+  m_code_cache.make_executable();
+  return true;
+}
+
+std::optional<TieredRuntime::OsrCode>
+TieredRuntime::compile_osr(funcid_t id, bbid_t header) {
+  auto &&func = m_module.get_function(id);
+  if (!compile(get_callees(func))) {
+    return std::nullopt;
+  }
+  try {
+    Compiler comp(X86Backend::NUM_REGS);
+    auto slots = build_osr_graph(func, header, comp.graph());
+    if (!slots) {
+      return std::nullopt;
+    }
+    auto entry = m_code_cache.add(compile_graph(comp, m_call_table.get()));
+    ArrayCallStub stub(m_code_cache, entry, slots->size());
+    OsrCode osr{std::move(*slots), stub};
+    m_code_cache.make_executable();
+    return osr;
+  } catch (const CodeGenError &) {
+    return std::nullopt;
+  } catch (const IRInvalidArgument &) {
+    return std::nullopt;
+  }
+}
+
+bool TieredRuntime::on_hot_call(funcid_t id, const int64_t *args,
+                                int64_t &result) {
+  if (!compile({id})) {
+    return false;
+  }
+  result = (*m_stubs[id])(args);
+  return true;
+}
+
+bool TieredRuntime::on_hot_loop(funcid_t id, bbid_t header,
+                                const int64_t *frame, int64_t &result) {
+  auto [osr, inserted] = m_osr_code.try_emplace(std::make_pair(id, header));
+  if (inserted) {
+    osr->second = compile_osr(id, header);
+  }
+  if (!osr->second) {
+    return false;
+  }
+  std::vector<int64_t> values;
+  for (auto &&slot : osr->second->slots) {
+    values.push_back(frame[slot]);
+  }
+  ++m_num_osr_entries;
+  result = osr->second->stub(values.data());
+  return true;
+}
+
+// Values defined before the loop don't change after the transfer, so their
+// uses are replaced with parameters. That is correct only if the loop is
+// not reachable from itself through its dominators, which is the case for
+// outermost loops.
+std::optional<std::vector<instid_t>>
+TieredRuntime::build_osr_graph(ProgramGraph &func, bbid_t header,
+                               ProgramGraph &osr) {
+  auto header_bb = func.get_bb(header);
+  if (header_bb == func.get_entry()) {
+    return std::nullopt;
+  }
+  DomsTreeAnalysis doms;
+  doms.run(func);
+  std::vector<bool> reachable(func.size(), false);
+  visit_dfs(func, header_bb,
+            [&reachable](BasicBlock *bb) { reachable[bb->get_id()] = true; });
+
+  std::vector<Instruction *> live_values;
+  for (auto &&bb : func) {
+    bool is_dominator = &bb != header_bb &&
+                        doms.get().is_dominator_of(&bb, header_bb);
+    if (!reachable[bb.get_id()]) {
+      for (auto &&inst : bb) {
+        if (is_dominator && is_used_in(inst, reachable)) {
+          live_values.push_back(&inst);
+        }
+      }
+      continue;
+    }
+    if (is_dominator) {
+      return std::nullopt;
+    }
+    if (std::any_of(bb.begin(), bb.end(), [](auto &&inst) {
+          return inst.get_opcode() == INST_PARAM;
+        })) {
+      return std::nullopt;
+    }
+  }
+
+  IRCloner cloner(osr);
+  cloner.clone_graph(func);
+  while (osr.get_num_params() != 0) {
+    osr.pop_back_param();
+  }
+  IRBuilder builder(osr);
+  auto entry = osr.create_basic_block();
+  builder.set_insert_point(entry);
+  std::vector<instid_t> slots;
+  auto load_slot = [&osr, &builder, &slots](Instruction &inst) {
+    slots.push_back(inst.get_id());
+    return builder.create_param_load(osr.create_param(inst.get_type()));
+  };
+  for (auto &&inst : *header_bb) {
+    if (!inst.is_phi()) {
+      break;
+    }
+    auto &&phi = static_cast<PhiInstruction &>(*cloner.get_value(&inst));
+    phi.add_option(entry, load_slot(inst));
+  }
+  for (auto &&inst : live_values) {
+    Instruction *value = nullptr;
+    if (inst->get_opcode() == INST_CONST && inst->get_type() == INTEGER) {
+      value = builder.create_int_constant(
+          static_cast<LoadConstant<int64_t> &>(*inst).get_value());
+    } else {
+      value = load_slot(*inst);
+    }
+    IRBuilder::move_users(cloner.get_value(inst), value);
+  }
+  builder.create_branch(cloner.get_block(header_bb));
+  builder.set_entry_point(entry);
+  builder.rm_unreachable_blocks();
+  return slots;
+}
+
+} // namespace koda
@@ -1,9 +1,33 @@
 #include <gtest/gtest.h>
 
+#include "CodeGen/AotCache.hpp"
+#include "CodeGen/CodeCache.hpp"
+#include "CodeGen/CompilationService.hpp"
+#include "CodeGen/Jit.hpp"
+#include "CodeGen/X86Assembler.hpp"
+#include "CodeGen/X86Backend.hpp"
+#include "CodeGen/X86Baseline.hpp"
+#include "CodeGen/X86ISel.hpp"
 #include "Core/Compiler.h"
+#include "Core/Inliner.hpp"
+#include "IR/Arithmetic.hpp"
+#include "IR/BinaryIR.hpp"
+#include "IR/IRCloner.hpp"
+#include "IR/GraphHash.hpp"
 #include "IR/IRBuilder.hpp"
+#include "IR/IRParser.hpp"
 #include "IR/IRPrinter.hpp"
+#include "IR/Module.hpp"
+#include "IR/PatternMatch.hpp"
+#include "Interpreter/Interpreter.hpp"
+#include "Runtime/TieredRuntime.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <set>
+#include <thread>
+#include <sstream>
 #include <vector>
 
 namespace koda {
@@ -37,6 +61,123 @@ void dump_loops(Compiler &comp, std::string filename) {
   dot_log.close();
 }
 
+// Reference semantics of IR. Used to check that passes preserve behaviour.
+// Calls are resolved in module.
+int64_t evaluate(ProgramGraph &graph, const std::vector<int64_t> &args,
+                 const Module *module = nullptr) {
+  std::vector<int64_t> values(graph.get_instr_count(), 0);
+  auto value = [&values](Instruction *inst) { return values[inst->get_id()]; };
+  BasicBlock *prev = nullptr;
+  BasicBlock *bb = graph.get_entry();
+  while (true) {
+    // Phis read their inputs simultaneously on block entry
+    std::vector<std::pair<instid_t, int64_t>> phi_values;
+    for (auto &&inst : *bb) {
+      if (!inst.is_phi()) {
+        break;
+      }
+      auto &&phi = static_cast<PhiInstruction &>(inst);
+      phi_values.emplace_back(phi.get_id(), value(phi.get_value_for(prev)));
+    }
+    for (auto &&[id, phi_value] : phi_values) {
+      values[id] = phi_value;
+    }
+    BasicBlock *next = nullptr;
+    for (auto &&inst : *bb) {
+      if (inst.is_phi()) {
+        continue;
+      }
+      int64_t lhs = inst.get_num_inputs() > 0 ? value(inst.get_input(0)) : 0;
+      int64_t rhs = inst.get_num_inputs() > 1 ? value(inst.get_input(1)) : 0;
+      int64_t &res = values[inst.get_id()];
+      switch (inst.get_opcode()) {
+      case INST_CONST:
+        res = static_cast<LoadConstant<int64_t> &>(inst).get_value();
+        break;
+      case INST_PARAM:
+        res = args[static_cast<LoadParam &>(inst).get_index()];
+        break;
+      case INST_ADD:
+        res = wrap_add(lhs, rhs);
+        break;
+      case INST_SUB:
+        res = wrap_sub(lhs, rhs);
+        break;
+      case INST_MUL:
+        res = wrap_mul(lhs, rhs);
+        break;
+      case INST_DIV:
+        res = eval_div(lhs, rhs);
+        break;
+      case INST_MOD:
+        res = eval_mod(lhs, rhs);
+        break;
+      case INST_MULH:
+        res = eval_mulh(lhs, rhs);
+        break;
+      case INST_SHL:
+        res = eval_shl(lhs, rhs);
+        break;
+      case INST_SHR:
+        res = eval_shr(lhs, rhs);
+        break;
+      case INST_ASHR:
+        res = eval_ashr(lhs, rhs);
+        break;
+      case INST_AND:
+        res = lhs & rhs;
+        break;
+      case INST_OR:
+        res = lhs | rhs;
+        break;
+      case INST_XOR:
+        res = lhs ^ rhs;
+        break;
+      case INST_NOT:
+        res = ~lhs;
+        break;
+      case INST_BRANCH:
+        next = bb->get_uncond_successor();
+        break;
+      case INST_SELECT: {
+        auto &&select = static_cast<SelectInstruction &>(inst);
+        res = eval_cmp(select.get_flag(), lhs, rhs)
+                  ? value(select.get_true_value())
+                  : value(select.get_false_value());
+        break;
+      }
+      case INST_COND_BR: {
+        auto &&cond_br = static_cast<ConditionalBranchInstruction &>(inst);
+        auto flag = cond_br.get_flag();
+        next = eval_cmp(flag, lhs, rhs) ? bb->get_true_successor()
+                                        : bb->get_false_successor();
+        break;
+      }
+      case INST_RET:
+        return lhs;
+      case INST_CALL: {
+        auto &&call = static_cast<CallInstruction &>(inst);
+        std::vector<int64_t> call_args;
+        std::transform(call.inputs_begin(), call.inputs_end(),
+                       std::back_inserter(call_args), value);
+        res = evaluate(module->get_function(call.get_callee()), call_args,
+                       module);
+        break;
+      }
+      default:
+        ADD_FAILURE() << "Unexpected instruction";
+        return 0;
+      }
+    }
+    // Block without terminator falls to its successor.
+    if (next == nullptr && bb->get_num_successors() == 1) {
+      next = bb->get_uncond_successor();
+    }
+    prev = bb;
+    bb = next;
+  }
+}
+
 void connect(BasicBlock *from, BasicBlock *to, IRBuilder &builder) {
   builder.set_insert_point(from);
   builder.create_branch(to);
@@ -105,6 +246,134 @@ TEST(CoreTest, linear_order_test) {
   dump_loops(comp, "LinearOrderTestLoops");
 }
 
+// Every value is live from its definition to all of its uses.
+void check_live_ranges(Compiler &comp) {
+  auto &&graph = comp.graph();
+  auto &&linear_order = comp.get_or_create<LinearOrder>(comp);
+  auto &&liveness = comp.get_or_create<Liveness>(comp);
+  std::vector<size_t> nums(graph.get_instr_count(), 0);
+  std::vector<size_t> bb_ends(graph.size(), 0);
+  size_t num = 0;
+  for (auto &&bb : linear_order) {
+    auto start = num;
+    for (auto &&inst : *bb) {
+      if (!inst.is_phi()) {
+        num += 2;
+      }
+      nums[inst.get_id()] = inst.is_phi() ? start : num;
+    }
+    num += 2;
+    bb_ends[bb->get_id()] = num;
+  }
+  for (auto &&bb : graph) {
+    for (auto &&inst : bb) {
+      auto range = liveness.get_live_range(inst.get_id());
+      for (auto it = inst.users_begin(); it != inst.users_end(); ++it) {
+        EXPECT_LE(range.first, nums[inst.get_id()]);
+        if (!(*it)->is_phi()) {
+          EXPECT_GE(range.second, nums[(*it)->get_id()]);
+          continue;
+        }
+        auto phi = static_cast<PhiInstruction *>(*it);
+        for (size_t idx = 0; idx < phi->get_num_options(); ++idx) {
+          auto [pred, value] = phi->get_option(idx);
+          if (value == &inst) {
+            EXPECT_GE(range.second, bb_ends[pred->get_id()]);
+          }
+        }
+      }
+    }
+  }
+}
+
+void check_linear_order(Compiler &comp, const std::vector<int> &ref) {
+  auto &&linear_order = comp.get_or_create<LinearOrder>(comp);
+  std::vector<int> order;
+  for (auto &&bb : linear_order) {
+    order.push_back(bb->get_id());
+  }
+  ASSERT_EQ(order, ref);
+}
+
+TEST(CoreTest, linear_order_edge_profile) {
+  Compiler comp;
+  auto &&graph = comp.graph();
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  MKBB(4);
+  MKBB(5);
+  MKBB(6);
+  MKBB(7);
+  builder.set_entry_point(bb0);
+  // bb1 and bb5 are cold, bb3 is header of loop {3, 4, 5, 7}
+  builder.set_insert_point(bb0);
+  auto value = builder.create_int_constant(5);
+  COND(0, 1, 2);
+  builder.set_insert_point(bb1);
+  builder.create_iadd(value, value);
+  EDGE(1, 3);
+  EDGE(2, 3);
+  COND(3, 6, 4);
+  COND(4, 5, 7);
+  builder.set_insert_point(bb5);
+  builder.create_imul(value, value);
+  EDGE(5, 7);
+  EDGE(7, 3);
+  builder.set_insert_point(bb6);
+  builder.create_ret(value);
+
+  auto &&profile = comp.profile();
+  profile.set_edge_count(*bb0, 0, 10);
+  profile.set_edge_count(*bb0, 1, 990);
+  profile.set_edge_count(*bb1, 0, 10);
+  profile.set_edge_count(*bb2, 0, 990);
+  profile.set_edge_count(*bb3, 0, 1000);
+  profile.set_edge_count(*bb3, 1, 10000);
+  profile.set_edge_count(*bb4, 0, 0);
+  profile.set_edge_count(*bb4, 1, 10000);
+  profile.set_edge_count(*bb5, 0, 0);
+  profile.set_edge_count(*bb7, 0, 10000);
+
+  dump_graph(graph, "LinearOrderEdgeProfileTest");
+  // Hot successors are fallthroughs, cold blocks go after hot ones of the
+  // same loop.
+  check_linear_order(comp, {0, 2, 3, 4, 7, 5, 6, 1});
+  check_live_ranges(comp);
+
+  // Without profile blocks are laid out in RPO.
+  profile.clear();
+  comp.invalidate_analyses();
+  check_linear_order(comp, {0, 1, 2, 3, 4, 7, 5, 6});
+  check_live_ranges(comp);
+}
+
+TEST(CoreTest, linear_order_block_profile) {
+  Compiler comp;
+  auto &&graph = comp.graph();
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  COND(0, 1, 2);
+  EDGE(1, 3);
+  EDGE(2, 3);
+  builder.set_insert_point(bb3);
+  builder.create_ret(builder.create_int_constant(0));
+
+  auto &&profile = comp.profile();
+  profile.set_block_count(*bb0, 101);
+  profile.set_block_count(*bb1, 100);
+  profile.set_block_count(*bb2, 1);
+  profile.set_block_count(*bb3, 101);
+  check_linear_order(comp, {0, 1, 3, 2});
+  check_live_ranges(comp);
+}
+
 TEST(CoreTest, liveness_test) {
   Compiler comp;
   auto &&graph = comp.graph();
@@ -322,6 +591,7 @@ TEST(CoreTest, cross_bb_fold) {
   comp.register_pass<ConstantFolding>();
   comp.register_pass<RmUnused>();
   auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
   IRBuilder builder(graph);
   MKBB(0);
   MKBB(1);
@@ -332,14 +602,15 @@ TEST(CoreTest, cross_bb_fold) {
   // rhs = 13
   // add_res = lhs + rhs
   // cmp_const = 25
-  // if (add_res == 25) { goto bb2 } else { goto bb1 }
+  // if (add_res == a0) { goto bb2 } else { goto bb1 }
   builder.set_insert_point(bb0);
+  auto arg = builder.create_param_load(0);
   auto lhs = builder.create_int_constant(10);
   auto rhs = builder.create_int_constant(13);
   auto add_res = builder.create_iadd(lhs, rhs);
   auto cmp_const = builder.create_int_constant(25);
   auto branch =
-      builder.create_conditional_branch(CMP_EQ, bb1, bb2, add_res, cmp_const);
+      builder.create_conditional_branch(CMP_EQ, bb1, bb2, add_res, arg);
   // bb1:
   // ret lhs
   builder.set_insert_point(bb1);
@@ -366,12 +637,117 @@ TEST(CoreTest, cross_bb_fold) {
   ASSERT_EQ(dynamic_cast<LoadConstant<int64_t> *>(folded_ret)->get_value(), -2);
 }
 
+TEST(CoreTest, mod_fold_chain) {
+  Compiler comp;
+  comp.register_pass<ConstantFolding>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  // ret ~(((7 + 5) * 3) % 5)
+  auto add = builder.create_iadd(builder.create_int_constant(7),
+                                 builder.create_int_constant(5));
+  auto mul = builder.create_imul(add, builder.create_int_constant(3));
+  auto mod = builder.create_mod(mul, builder.create_int_constant(5));
+  auto ret = builder.create_ret(builder.create_not(mod));
+  dump_graph(graph, "FoldModChainTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "FoldModChainTest1");
+  ASSERT_EQ(bb0->size(), 2);
+  auto folded = ret->get_input();
+  ASSERT_EQ(folded->get_opcode(), INST_CONST);
+  ASSERT_EQ(dynamic_cast<LoadConstant<int64_t> *>(folded)->get_value(),
+            ~(36 % 5));
+}
+
+TEST(CoreTest, div_by_zero_fold) {
+  Compiler comp;
+  comp.register_pass<ConstantFolding>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto zero = builder.create_int_constant(0);
+  auto five = builder.create_int_constant(5);
+  auto min = builder.create_int_constant(std::numeric_limits<int64_t>::min());
+  auto minus_one = builder.create_int_constant(-1);
+  auto div_zero = builder.create_idiv(five, zero);
+  auto mod_zero = builder.create_mod(five, zero);
+  auto div_overflow = builder.create_idiv(min, minus_one);
+  auto mod_overflow = builder.create_mod(min, minus_one);
+  auto sum = builder.create_iadd(div_zero, mod_zero);
+  sum = builder.create_iadd(sum, div_overflow);
+  auto ret = builder.create_ret(builder.create_iadd(sum, mod_overflow));
+  comp.run_all_passes();
+  dump_graph(graph, "FoldDivByZeroTest");
+  ASSERT_EQ(div_zero->get_bb(), bb0);
+  ASSERT_EQ(mod_zero->get_bb(), bb0);
+  ASSERT_EQ(div_overflow->get_bb(), nullptr);
+  ASSERT_EQ(mod_overflow->get_bb(), nullptr);
+  ASSERT_EQ(ret->get_input()->get_opcode(), INST_ADD);
+}
+
+TEST(CoreTest, cond_br_fold) {
+  Compiler comp;
+  comp.register_pass<ConstantFolding>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // bb0:
+  // if (2 + 1 < 5) { goto bb2 } else { goto bb1 }
+  builder.set_insert_point(bb0);
+  auto sum = builder.create_iadd(builder.create_int_constant(2),
+                                 builder.create_int_constant(1));
+  builder.create_conditional_branch(CMP_L, bb1, bb2, sum,
+                                    builder.create_int_constant(5));
+  builder.set_insert_point(bb1);
+  auto false_val = builder.create_int_constant(10);
+  builder.create_branch(bb3);
+  builder.set_insert_point(bb2);
+  auto true_val = builder.create_int_constant(20);
+  builder.create_branch(bb3);
+  // bb3:
+  // ret phi [bb1: 10, bb2: 20]
+  builder.set_insert_point(bb3);
+  auto phi = builder.create_phi(INTEGER);
+  phi->add_option(bb1, false_val);
+  phi->add_option(bb2, true_val);
+  builder.create_ret(phi);
+
+  dump_graph(graph, "FoldCondBrTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "FoldCondBrTest1");
+
+  ASSERT_EQ(bb0->back().get_opcode(), INST_BRANCH);
+  ASSERT_EQ(bb0->get_uncond_successor(), bb2);
+  ASSERT_TRUE(bb1->empty());
+  ASSERT_EQ(bb3->get_num_predecessors(), 1);
+  ASSERT_EQ(phi->get_num_inputs(), 1);
+  ASSERT_EQ(phi->get_input(0), true_val);
+  ASSERT_EQ(evaluate(graph, {}), 20);
+}
+
 auto has_inst(BasicBlock &bb, InstOpcode opc) {
   return std::any_of(bb.begin(), bb.end(), [opc](const Instruction &inst) {
     return inst.get_opcode() == opc;
   });
 };
 
+size_t count_insts(BasicBlock &bb, InstOpcode opc) {
+  return std::count_if(bb.begin(), bb.end(), [opc](const Instruction &inst) {
+    return inst.get_opcode() == opc;
+  });
+}
+
 TEST(CoreTest, peephole_and) {
   Compiler comp;
   comp.register_pass<Peephole>();
@@ -459,8 +835,8 @@ TEST(CoreTest, peephole_shr) {
   ASSERT_EQ(result_const, first_const + second_const);
 }
 
-TEST(CoreTest, peephole_div_shr) {
-  Compiler comp;
+// Lower ret (x op divisor) with Peephole.
+void build_div_by_const(Compiler &comp, InstOpcode opcode, int64_t divisor) {
   comp.register_pass<Peephole>();
   comp.register_pass<RmUnused>();
   auto &&graph = comp.graph();
@@ -470,23 +846,2698 @@ TEST(CoreTest, peephole_div_shr) {
   builder.set_entry_point(bb0);
   builder.set_insert_point(bb0);
   auto var = builder.create_param_load(0);
+  auto divisor_const = builder.create_int_constant(divisor);
+  auto res = opcode == INST_DIV ? builder.create_idiv(var, divisor_const)
+                                : builder.create_mod(var, divisor_const);
+  builder.create_ret(res);
+  comp.run_all_passes();
+}
+
+TEST(CoreTest, peephole_div_pow2) {
+  Compiler comp;
   size_t power = 7;
-  auto div_res =
-      builder.create_idiv(var, builder.create_int_constant(1 << power));
-  auto ret_inst = builder.create_ret(div_res);
-  dump_graph(graph, "PeepDivShrTest0");
+  build_div_by_const(comp, INST_DIV, 1 << power);
+  dump_graph(comp.graph(), "PeepDivPow2Test");
+  auto &&bb = *comp.graph().get_entry();
+  ASSERT_FALSE(has_inst(bb, INST_DIV));
+  ASSERT_FALSE(has_inst(bb, INST_MULH));
+  ASSERT_TRUE(has_inst(bb, INST_ASHR));
+  for (int64_t x : {0, 1, 127, 128, 129, -1, -127, -128, -129, -1000}) {
+    ASSERT_EQ(evaluate(comp.graph(), {x}), x / 128);
+  }
+}
+
+TEST(CoreTest, peephole_div_mod_const) {
+  // Values from Hacker's Delight, table 10-2
+  static_assert(get_signed_magic(3).multiplier == 0x5555555555555556);
+  static_assert(get_signed_magic(3).shift == 0);
+  static_assert(get_signed_magic(7).multiplier == 0x4924924924924925);
+  static_assert(get_signed_magic(7).shift == 1);
+  static_assert(get_signed_magic(-7).multiplier == -0x4924924924924925);
+  std::vector<int64_t> divisors;
+  for (int64_t d = -257; d <= 257; ++d) {
+    if (d != 0) {
+      divisors.push_back(d);
+    }
+  }
+  for (unsigned k = 9; k < 63; ++k) {
+    int64_t pow2 = int64_t(1) << k;
+    divisors.insert(divisors.end(), {pow2, -pow2, pow2 + 1, -pow2 - 1});
+  }
+  int64_t min = std::numeric_limits<int64_t>::min();
+  int64_t max = std::numeric_limits<int64_t>::max();
+  divisors.insert(divisors.end(), {min, min + 1, max, max - 1, 1000000007,
+                                   -999999999989, 0x5555555555555555});
+  std::vector<int64_t> dividends = {min, min + 1, max, max - 1};
+  for (int64_t x = -130; x <= 130; ++x) {
+    dividends.push_back(x);
+  }
+  uint64_t seed = 42;
+  for (size_t i = 0; i < 64; ++i) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    dividends.push_back(static_cast<int64_t>(seed));
+    dividends.push_back(static_cast<int64_t>(seed) >> (i % 64));
+  }
+  for (auto &&divisor : divisors) {
+    Compiler div_comp;
+    build_div_by_const(div_comp, INST_DIV, divisor);
+    Compiler mod_comp;
+    build_div_by_const(mod_comp, INST_MOD, divisor);
+    ASSERT_FALSE(has_inst(*div_comp.graph().get_entry(), INST_DIV));
+    ASSERT_FALSE(has_inst(*mod_comp.graph().get_entry(), INST_MOD));
+    for (auto &&x : dividends) {
+      ASSERT_EQ(evaluate(div_comp.graph(), {x}), eval_div(x, divisor))
+          << x << " / " << divisor;
+      ASSERT_EQ(evaluate(mod_comp.graph(), {x}), eval_mod(x, divisor))
+          << x << " % " << divisor;
+    }
+  }
+}
+
+TEST(CoreTest, peephole_div_by_zero) {
+  Compiler comp;
+  build_div_by_const(comp, INST_DIV, 0);
+  ASSERT_TRUE(has_inst(*comp.graph().get_entry(), INST_DIV));
+}
+
+TEST(CoreTest, pattern_match) {
+  using namespace pattern;
+  ProgramGraph graph;
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto var = builder.create_param_load(0);
+  auto three = builder.create_int_constant(3);
+  auto add = builder.create_iadd(three, var);
+  auto sub = builder.create_isub(three, var);
+  auto shl = builder.create_shl(add, builder.create_int_constant(2));
+  Instruction *x = nullptr;
+  int64_t c = 0;
+  // Commutable operation matches with swapped operands
+  ASSERT_TRUE(match(add, m_Add(m_Value(x), m_AnyConst(c))));
+  ASSERT_EQ(x, var);
+  ASSERT_EQ(c, 3);
+  ASSERT_FALSE(match(sub, m_Sub(m_Value(x), m_AnyConst(c))));
+  ASSERT_TRUE(match(sub, m_Sub(m_Const(3), m_Same(var))));
+  ASSERT_FALSE(match(add, m_Sub(m_Value(), m_Value())));
+  Instruction *inner = nullptr;
+  ASSERT_TRUE(match(shl, m_Shl(m_Bind(inner, m_Add(m_Value(x), m_Const(3))),
+                               m_Const(2))));
+  ASSERT_EQ(inner, add);
+  ASSERT_EQ(x, var);
+}
+
+TEST(CoreTest, peephole_worklist) {
+  Compiler comp;
+  comp.register_pass<Peephole>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  // ret ((((x >> 20) >> 30) >> 20) & -1) - (x - x) -> ret 0
+  auto var = builder.create_param_load(0);
+  auto shr0 = builder.create_shr(var, builder.create_int_constant(20));
+  auto shr1 = builder.create_shr(shr0, builder.create_int_constant(30));
+  auto shr2 = builder.create_shr(shr1, builder.create_int_constant(20));
+  auto mask = builder.create_and(builder.create_int_constant(-1), shr2);
+  auto zero = builder.create_isub(var, var);
+  auto ret = builder.create_ret(builder.create_isub(mask, zero));
+  dump_graph(graph, "PeepWorklistTest0");
   comp.run_all_passes();
-  dump_graph(graph, "PeepDivShrTest1");
-  auto ret_input = ret_inst->get_input();
-  ASSERT_EQ(ret_input->get_opcode(), INST_SHR);
-  ASSERT_EQ(ret_input->get_type(), INTEGER);
-  auto result_shr = dynamic_cast<BitShift *>(ret_input);
-  ASSERT_EQ(result_shr->get_lhs()->get_id(), var->get_id());
-  ASSERT_EQ(result_shr->get_rhs()->get_opcode(), INST_CONST);
-  ASSERT_EQ(result_shr->get_rhs()->get_type(), INTEGER);
-  auto result_const =
-      dynamic_cast<LoadConstant<int64_t> *>(result_shr->get_rhs())->get_value();
-  ASSERT_EQ(result_const, power);
+  dump_graph(graph, "PeepWorklistTest1");
+  ASSERT_TRUE(match(ret->get_input(), pattern::m_Const(0)));
+}
+
+TEST(CoreTest, induction_variables) {
+  Compiler comp;
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // bb0: N = param 0
+  // bb1: i = phi [bb0: 0, bb2: i_next]
+  //      if (i < N) goto bb2 else goto bb3
+  // bb2: shl_iv = i << 2
+  //      add_iv = shl_iv + 3
+  //      sub_iv = add_iv - i
+  //      not_iv = i * i
+  //      i_next = i + 1
+  // bb3: ret i
+  builder.set_insert_point(bb0);
+  auto zero = builder.create_int_constant(0);
+  auto N = builder.create_param_load(0);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto iter = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, iter, N);
+  builder.set_insert_point(bb2);
+  auto shl_iv = builder.create_shl(iter, builder.create_int_constant(2));
+  auto add_iv = builder.create_iadd(shl_iv, builder.create_int_constant(3));
+  auto sub_iv = builder.create_isub(add_iv, iter);
+  auto not_iv = builder.create_imul(iter, iter);
+  auto iter_next = builder.create_iadd(iter, builder.create_int_constant(1));
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  builder.create_ret(iter);
+  iter->add_option(bb0, zero);
+  iter->add_option(bb2, iter_next);
+
+  dump_graph(graph, "InductionVarsTest");
+  auto &&ivs = comp.get_or_create<InductionVariableAnalysis>(comp);
+  auto basic = ivs.get_basic(*iter);
+  ASSERT_NE(basic, nullptr);
+  ASSERT_EQ(basic->step, 1);
+  ASSERT_EQ(basic->update, iter_next);
+  ASSERT_EQ(ivs.get_basic_ivs(bb1->get_id()).size(), 1);
+  auto check_iv = [&ivs, iter](Instruction *inst, int64_t scale,
+                               int64_t offset) {
+    auto iv = ivs.get(*inst);
+    ASSERT_NE(iv, nullptr);
+    ASSERT_EQ(iv->base, iter);
+    ASSERT_EQ(iv->scale, scale);
+    ASSERT_EQ(iv->offset, offset);
+  };
+  check_iv(iter, 1, 0);
+  check_iv(shl_iv, 4, 0);
+  check_iv(add_iv, 4, 3);
+  check_iv(sub_iv, 3, 3);
+  check_iv(iter_next, 1, 1);
+  ASSERT_EQ(ivs.get(*not_iv), nullptr);
+  ASSERT_EQ(ivs.get(*N), nullptr);
+}
+
+TEST(CoreTest, loop_strength_reduction) {
+  Compiler comp;
+  comp.register_pass<LoopStrengthReduction>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // bb0: N = param 0
+  // bb1: iter = phi [bb0: 2, bb2: iter_next]
+  //      res = phi [bb0: 1, bb2: res_next]
+  //      if (iter > N) goto bb3 else goto bb2
+  // bb2: scaled = iter * 8
+  //      res_next = res + scaled
+  //      iter_next = iter + 1
+  // bb3: ret res
+  builder.set_insert_point(bb0);
+  auto res_init = builder.create_int_constant(1);
+  auto iter_init = builder.create_int_constant(2);
+  auto N = builder.create_param_load(0);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto iter = builder.create_phi(INTEGER);
+  auto res = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_G, bb2, bb3, iter, N);
+  builder.set_insert_point(bb2);
+  auto scaled = builder.create_imul(iter, builder.create_int_constant(8));
+  auto res_next = builder.create_iadd(res, scaled);
+  auto iter_next = builder.create_iadd(iter, builder.create_int_constant(1));
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  builder.create_ret(res);
+  iter->add_option(bb0, iter_init);
+  iter->add_option(bb2, iter_next);
+  res->add_option(bb0, res_init);
+  res->add_option(bb2, res_next);
+
+  dump_graph(graph, "StrengthReductionTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "StrengthReductionTest1");
+  ASSERT_FALSE(has_inst(*bb2, INST_MUL));
+  // res_next = res + rec, rec = phi [bb0: 16, bb2: rec + 8]
+  auto rec = res_next->get_rhs();
+  ASSERT_TRUE(rec->is_phi());
+  ASSERT_EQ(rec->get_bb(), bb1);
+  auto rec_phi = static_cast<PhiInstruction *>(rec);
+  auto rec_init = rec_phi->get_value_for(bb0);
+  ASSERT_EQ(rec_init->get_opcode(), INST_CONST);
+  ASSERT_EQ(static_cast<LoadConstant<int64_t> *>(rec_init)->get_value(), 16);
+  auto rec_next = rec_phi->get_value_for(bb2);
+  ASSERT_EQ(rec_next->get_opcode(), INST_ADD);
+  ASSERT_EQ(rec_next->get_input(0), rec);
+  auto step = rec_next->get_input(1);
+  ASSERT_EQ(static_cast<LoadConstant<int64_t> *>(step)->get_value(), 8);
+}
+
+TEST(CoreTest, redundant_iv_elimination) {
+  Compiler comp;
+  comp.register_pass<LoopStrengthReduction>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // i and k are the same counter, dead is never read outside its cycle.
+  builder.set_insert_point(bb0);
+  auto zero = builder.create_int_constant(0);
+  auto k_init = builder.create_int_constant(0);
+  auto N = builder.create_param_load(0);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto i = builder.create_phi(INTEGER);
+  auto k = builder.create_phi(INTEGER);
+  auto dead = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, i, N);
+  builder.set_insert_point(bb2);
+  auto i_next = builder.create_iadd(i, builder.create_int_constant(1));
+  auto k_next = builder.create_iadd(k, builder.create_int_constant(1));
+  auto dead_next = builder.create_iadd(dead, builder.create_int_constant(3));
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  auto ret = builder.create_ret(k);
+  i->add_option(bb0, zero);
+  i->add_option(bb2, i_next);
+  k->add_option(bb0, k_init);
+  k->add_option(bb2, k_next);
+  dead->add_option(bb0, zero);
+  dead->add_option(bb2, dead_next);
+
+  dump_graph(graph, "RedundantIVTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "RedundantIVTest1");
+  size_t num_phis = std::count_if(bb1->begin(), bb1->end(),
+                                  [](auto &&inst) { return inst.is_phi(); });
+  ASSERT_EQ(num_phis, 1);
+  ASSERT_EQ(ret->get_input(), i);
+  ASSERT_EQ(bb2->size(), 3);
+}
+
+TEST(CoreTest, redundant_iv_early_user) {
+  Compiler comp;
+  comp.register_pass<LoopStrengthReduction>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // Update of duplicate IV k is used before update of i is computed.
+  builder.set_insert_point(bb0);
+  auto zero = builder.create_int_constant(0);
+  auto N = builder.create_param_load(0);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto i = builder.create_phi(INTEGER);
+  auto k = builder.create_phi(INTEGER);
+  auto acc = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, i, N);
+  builder.set_insert_point(bb2);
+  auto k_next = builder.create_iadd(k, builder.create_int_constant(1));
+  auto use = builder.create_iadd(acc, k_next);
+  auto i_next = builder.create_iadd(i, builder.create_int_constant(1));
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  builder.create_ret(acc);
+  i->add_option(bb0, zero);
+  i->add_option(bb2, i_next);
+  k->add_option(bb0, zero);
+  k->add_option(bb2, k_next);
+  acc->add_option(bb0, zero);
+  acc->add_option(bb2, use);
+
+  comp.run_all_passes();
+  dump_graph(graph, "RedundantIVEarlyUserTest");
+  ASSERT_EQ(k->get_bb(), nullptr);
+  ASSERT_EQ(k_next->get_bb(), bb2);
+  ASSERT_EQ(k_next->get_input(0), i);
+  ASSERT_EQ(use->get_input(1), k_next);
+  // Every input defined in bb2 precedes its user.
+  std::set<const Instruction *> seen;
+  for (auto &&inst : *bb2) {
+    for (auto it = inst.inputs_begin(); it != inst.inputs_end(); ++it) {
+      if ((*it)->get_bb() == bb2) {
+        ASSERT_TRUE(seen.count(*it));
+      }
+    }
+    seen.insert(&inst);
+  }
+}
+
+// bb0: x = param 0
+// bb1: i = phi [bb0: start, bb2: i + step]
+//      s = phi [bb0: 0, bb2: s + (i ^ x)]
+//      if (i flag bound) goto bb2 else goto bb3
+// bb3: ret s
+BasicBlock *build_xor_sum_loop(Compiler &comp, int64_t start, int64_t bound,
+                               int64_t step, CmpFlag flag) {
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto x = builder.create_param_load(0);
+  auto start_const = builder.create_int_constant(start);
+  auto zero = builder.create_int_constant(0);
+  auto bound_const = builder.create_int_constant(bound);
+  auto step_const = builder.create_int_constant(step);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto iter = builder.create_phi(INTEGER);
+  auto sum = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(flag, bb3, bb2, iter, bound_const);
+  builder.set_insert_point(bb2);
+  auto sum_next = builder.create_iadd(sum, builder.create_xor(iter, x));
+  auto iter_next = builder.create_iadd(iter, step_const);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  builder.create_ret(sum);
+  iter->add_option(bb0, start_const);
+  iter->add_option(bb2, iter_next);
+  sum->add_option(bb0, zero);
+  sum->add_option(bb2, sum_next);
+  return bb1;
+}
+
+int64_t ref_xor_sum(int64_t start, int64_t bound, int64_t step, CmpFlag flag,
+                    int64_t x) {
+  int64_t sum = 0;
+  for (int64_t i = start; eval_cmp(flag, i, bound); i += step) {
+    sum += i ^ x;
+  }
+  return sum;
+}
+
+uint64_t get_trip_count(Compiler &comp, BasicBlock *header) {
+  auto &&loops = comp.get_or_create<LoopTreeAnalysis>(comp);
+  auto &&ivs = comp.get_or_create<InductionVariableAnalysis>(comp);
+  auto &&trips = LoopUnroll::get_trip_count(loops.get_loop(*header), ivs);
+  EXPECT_TRUE(trips.has_value());
+  return trips.value_or(0);
+}
+
+TEST(CoreTest, loop_unroll_full) {
+  Compiler comp;
+  comp.register_pass<LoopUnroll>();
+  comp.register_pass<RmUnused>();
+  auto header = build_xor_sum_loop(comp, 0, 5, 1, CMP_L);
+  ASSERT_EQ(get_trip_count(comp, header), 5);
+  dump_graph(comp.graph(), "UnrollFullTest0");
+  comp.run_all_passes();
+  dump_graph(comp.graph(), "UnrollFullTest1");
+  // Only root loop is left
+  ASSERT_EQ(comp.get_or_create<LoopTreeAnalysis>(comp).get().size(), 1);
+  for (int64_t x : {0, 7, -3}) {
+    ASSERT_EQ(evaluate(comp.graph(), {x}), ref_xor_sum(0, 5, 1, CMP_L, x));
+  }
+}
+
+TEST(CoreTest, loop_unroll_partial) {
+  Compiler comp;
+  comp.register_pass<LoopUnroll>();
+  comp.register_pass<RmUnused>();
+  auto header = build_xor_sum_loop(comp, 3, 106, 1, CMP_L);
+  ASSERT_EQ(get_trip_count(comp, header), 103);
+  dump_graph(comp.graph(), "UnrollPartialTest0");
+  comp.run_all_passes();
+  dump_graph(comp.graph(), "UnrollPartialTest1");
+  auto &&loops = comp.get_or_create<LoopTreeAnalysis>(comp);
+  ASSERT_EQ(loops.get().size(), 2);
+  auto &&loop = loops.get_loop(*header);
+  ASSERT_EQ(std::distance(loop.begin(), loop.end()),
+            2 * LoopUnroll::DEFAULT_FACTOR);
+  for (int64_t x : {0, 7, -3}) {
+    ASSERT_EQ(evaluate(comp.graph(), {x}), ref_xor_sum(3, 106, 1, CMP_L, x));
+  }
+}
+
+TEST(CoreTest, loop_unroll_trip_count) {
+  struct {
+    int64_t start;
+    int64_t bound;
+    int64_t step;
+    CmpFlag flag;
+    uint64_t trips;
+  } loops[] = {{20, 1, -2, CMP_G, 10},  {0, 10, 3, CMP_LE, 4},
+               {10, 10, 1, CMP_L, 0},   {-5, 15, 5, CMP_NE, 4},
+               {100, 0, -7, CMP_GE, 15}, {3, 3, 1, CMP_EQ, 1}};
+  for (auto &&ref : loops) {
+    Compiler comp;
+    comp.register_pass<LoopUnroll>(4, 64);
+    auto header =
+        build_xor_sum_loop(comp, ref.start, ref.bound, ref.step, ref.flag);
+    ASSERT_EQ(get_trip_count(comp, header), ref.trips);
+    comp.run_all_passes();
+    for (int64_t x : {0, 5}) {
+      ASSERT_EQ(evaluate(comp.graph(), {x}),
+                ref_xor_sum(ref.start, ref.bound, ref.step, ref.flag, x));
+    }
+  }
+}
+
+TEST(CoreTest, loop_unroll_budget) {
+  Compiler comp;
+  comp.register_pass<LoopUnroll>(4, 8);
+  build_xor_sum_loop(comp, 0, 1000, 1, CMP_L);
+  size_t num_blocks = comp.graph().size();
+  comp.run_all_passes();
+  ASSERT_EQ(comp.graph().size(), num_blocks);
+}
+
+TEST(CoreTest, loop_rotation) {
+  struct {
+    int64_t start;
+    int64_t bound;
+    int64_t step;
+    CmpFlag flag;
+  } loops[] = {{0, 10, 1, CMP_L}, {10, 10, 1, CMP_L}, {20, 1, -2, CMP_G}};
+  for (auto &&ref : loops) {
+    Compiler comp;
+    comp.register_pass<LoopRotation>();
+    auto header =
+        build_xor_sum_loop(comp, ref.start, ref.bound, ref.step, ref.flag);
+    auto body = header->get_true_successor();
+    dump_graph(comp.graph(), "LoopRotationTest0");
+    comp.run_all_passes();
+    dump_graph(comp.graph(), "LoopRotationTest1");
+    // Body is the new header, old header is latch with conditional backedge.
+    auto &&loops = comp.get_or_create<LoopTreeAnalysis>(comp);
+    ASSERT_EQ(loops.get().size(), 2);
+    ASSERT_TRUE(body->is_loop_header());
+    auto &&loop = loops.get_loop(*body);
+    ASSERT_EQ(loop.get_latches(), std::vector<BasicBlock *>{header});
+    ASSERT_FALSE(has_inst(*header, INST_PHI));
+    ASSERT_EQ(count_insts(*body, INST_PHI), 2);
+    ASSERT_EQ(header->back().get_opcode(), INST_COND_BR);
+    // Dedicated preheader
+    auto preheader = std::find_if(
+        body->pred_begin(), body->pred_end(),
+        [header](BasicBlock *pred) { return pred != header; });
+    ASSERT_EQ((*preheader)->get_num_successors(), 1);
+    for (int64_t x : {0, 7, -3}) {
+      ASSERT_EQ(evaluate(comp.graph(), {x}),
+                ref_xor_sum(ref.start, ref.bound, ref.step, ref.flag, x));
+    }
+  }
+}
+
+TEST(CoreTest, loop_rotation_nested) {
+  Compiler comp;
+  comp.register_pass<LoopRotation>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  MKBB(4);
+  MKBB(5);
+  builder.set_entry_point(bb0);
+  // for (i = 0, s = 0; t = i * a0, i < 4; ++i)
+  //   for (j = 0; j < i; ++j)
+  //     s += t + j
+  // ret s + t
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto zero = builder.create_int_constant(0);
+  auto one = builder.create_int_constant(1);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto iter_i = builder.create_phi(INTEGER);
+  auto sum = builder.create_phi(INTEGER);
+  auto t = builder.create_imul(iter_i, a0);
+  builder.create_conditional_branch(CMP_L, bb5, bb2, iter_i,
+                                    builder.create_int_constant(4));
+  builder.set_insert_point(bb2);
+  auto iter_j = builder.create_phi(INTEGER);
+  auto inner_sum = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb4, bb3, iter_j, iter_i);
+  builder.set_insert_point(bb3);
+  auto sum_next = builder.create_iadd(inner_sum, builder.create_iadd(t, iter_j));
+  auto j_next = builder.create_iadd(iter_j, one);
+  builder.create_branch(bb2);
+  builder.set_insert_point(bb4);
+  auto i_next = builder.create_iadd(iter_i, one);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb5);
+  builder.create_ret(builder.create_iadd(sum, t));
+  iter_i->add_option(bb0, zero);
+  iter_i->add_option(bb4, i_next);
+  sum->add_option(bb0, zero);
+  sum->add_option(bb4, inner_sum);
+  iter_j->add_option(bb1, zero);
+  iter_j->add_option(bb3, j_next);
+  inner_sum->add_option(bb1, sum);
+  inner_sum->add_option(bb3, sum_next);
+
+  auto ref = [](int64_t a) {
+    int64_t s = 0;
+    int64_t i = 0;
+    for (; i < 4; ++i) {
+      for (int64_t j = 0; j < i; ++j) {
+        s += i * a + j;
+      }
+    }
+    return s + i * a;
+  };
+  dump_graph(graph, "LoopRotationNestedTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "LoopRotationNestedTest1");
+
+  // Both loops are rotated
+  auto &&loops = comp.get_or_create<LoopTreeAnalysis>(comp);
+  ASSERT_EQ(loops.get().size(), 3);
+  for (auto &&bb : {bb1, bb2}) {
+    ASSERT_FALSE(bb->is_loop_header());
+    ASSERT_FALSE(has_inst(*bb, INST_PHI));
+    ASSERT_EQ(bb->back().get_opcode(), INST_COND_BR);
+  }
+  ASSERT_TRUE(bb3->is_loop_header());
+  ASSERT_EQ(loops.get_depth(*bb3), 2);
+  for (int64_t x : {0, 3, -5}) {
+    ASSERT_EQ(evaluate(graph, {x}), ref(x));
+  }
+}
+
+TEST(CoreTest, value_range_ops) {
+  constexpr ValueRange small{0, 9};
+  static_assert(join(small, ValueRange::constant(20)) == ValueRange{0, 20});
+  static_assert(intersect(small, ValueRange{5, 30}) == ValueRange{5, 9});
+  static_assert(intersect(small, ValueRange{10, 30}).is_empty());
+  static_assert(narrow(small, CMP_L, ValueRange::constant(5)) ==
+                ValueRange{0, 4});
+  static_assert(narrow(small, CMP_GE, ValueRange{3, 7}) == ValueRange{3, 9});
+  static_assert(narrow(small, CMP_NE, ValueRange::constant(0)) ==
+                ValueRange{1, 9});
+  static_assert(narrow(small, CMP_G, ValueRange::constant(9)).is_empty());
+  static_assert(compare(CMP_L, small, ValueRange::constant(10)) == true);
+  static_assert(compare(CMP_GE, small, ValueRange{10, 20}) == false);
+  static_assert(compare(CMP_NE, small, ValueRange{20, 30}) == true);
+  static_assert(!compare(CMP_L, small, ValueRange::constant(5)).has_value());
+  static_assert(!compare(CMP_EQ, ValueRange::empty(), small).has_value());
+}
+
+TEST(CoreTest, range_analysis_loop) {
+  Compiler comp;
+  auto header = build_xor_sum_loop(comp, 0, 10, 1, CMP_L);
+  auto &&ranges = comp.get_or_create<RangeAnalysis>(comp);
+  auto &&iter = header->front();
+  auto &&branch = static_cast<ConditionalBranchInstruction &>(header->back());
+  auto body = branch.get_true_block();
+  auto exit = branch.get_false_block();
+  auto iter_next = iter.get_input(1);
+  ASSERT_EQ(ranges.get_range(iter), (ValueRange{0, 10}));
+  ASSERT_EQ(ranges.get_range_at(iter, *body), (ValueRange{0, 9}));
+  ASSERT_EQ(ranges.get_range_at(iter, *exit), ValueRange::constant(10));
+  ASSERT_EQ(ranges.get_range(*iter_next), (ValueRange{1, 10}));
+  ASSERT_FALSE(ranges.get_branch_outcome(branch).has_value());
+}
+
+TEST(CoreTest, range_simplification) {
+  Compiler comp;
+  comp.register_pass<RangeSimplification>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // bb0:
+  // y = a0 & 255
+  // if (a0 < 10) { goto bb1 } else { goto bb3 }
+  builder.set_insert_point(bb0);
+  auto x = builder.create_param_load(0);
+  auto y = builder.create_and(x, builder.create_int_constant(255));
+  builder.create_conditional_branch(CMP_L, bb3, bb1, x,
+                                    builder.create_int_constant(10));
+  // bb1:
+  // if (a0 < 20) { goto bb2 } else { goto bb3 }
+  builder.set_insert_point(bb1);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, x,
+                                    builder.create_int_constant(20));
+  // bb2:
+  // ret (y / 8 + y % 4) + y >> 8
+  builder.set_insert_point(bb2);
+  auto div = builder.create_idiv(y, builder.create_int_constant(8));
+  auto mod = builder.create_mod(y, builder.create_int_constant(4));
+  auto high = builder.create_shr(y, builder.create_int_constant(8));
+  auto ret = builder.create_ret(
+      builder.create_iadd(builder.create_iadd(div, mod), high));
+  // bb3:
+  // ret y
+  builder.set_insert_point(bb3);
+  builder.create_ret(y);
+
+  std::vector<int64_t> args = {-300, -1, 0, 7, 9, 10, 255, 300};
+  std::vector<int64_t> expected;
+  for (auto &&arg : args) {
+    expected.push_back(evaluate(graph, {arg}));
+  }
+  dump_graph(graph, "RangeSimplificationTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "RangeSimplificationTest1");
+
+  ASSERT_EQ(bb1->back().get_opcode(), INST_BRANCH);
+  ASSERT_EQ(bb1->get_uncond_successor(), bb2);
+  ASSERT_FALSE(has_inst(*bb2, INST_DIV));
+  ASSERT_FALSE(has_inst(*bb2, INST_MOD));
+  ASSERT_TRUE(has_inst(*bb2, INST_AND));
+  ASSERT_EQ(high->get_bb(), nullptr);
+  ASSERT_EQ(ret->get_input()->get_input(1)->get_opcode(), INST_CONST);
+  for (size_t idx = 0; idx < args.size(); ++idx) {
+    ASSERT_EQ(evaluate(graph, {args[idx]}), expected[idx]) << args[idx];
+  }
+}
+
+TEST(CoreTest, known_bits_ops) {
+  constexpr auto five = KnownBits::constant(5);
+  constexpr auto three = KnownBits::constant(3);
+  static_assert(known_add(five, three) == KnownBits::constant(8));
+  static_assert(known_sub(three, five) == KnownBits::constant(-2));
+  static_assert(known_xor(five, three) == KnownBits::constant(6));
+  static_assert(known_shr(KnownBits::constant(-1), 60) ==
+                KnownBits::constant(15));
+  static_assert(known_ashr(KnownBits::constant(-16), 2) ==
+                KnownBits::constant(-4));
+  // Unknown value with 4 lower bits cleared
+  constexpr auto aligned = known_shl(KnownBits{}, 4);
+  static_assert(aligned.zeros == 0xF && aligned.ones == 0);
+  static_assert(known_add(aligned, three).zeros == 0xC);
+  static_assert(known_add(aligned, three).ones == 0x3);
+  static_assert(known_mul(aligned, aligned).zeros == 0xFF);
+  static_assert(known_and(aligned, three) == KnownBits::constant(0));
+  static_assert(meet(five, three) == (KnownBits{~uint64_t(7), 1}));
+}
+
+TEST(CoreTest, known_bits_loop) {
+  Compiler comp;
+  auto &&graph = comp.graph();
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // for (i = 0; i < 100; i += 4) {}
+  // ret i | 1
+  builder.set_insert_point(bb0);
+  auto zero = builder.create_int_constant(0);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto iter = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, iter,
+                                    builder.create_int_constant(100));
+  builder.set_insert_point(bb2);
+  auto iter_next = builder.create_iadd(iter, builder.create_int_constant(4));
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  auto res = builder.create_or(iter, builder.create_int_constant(1));
+  builder.create_ret(res);
+  iter->add_option(bb0, zero);
+  iter->add_option(bb2, iter_next);
+
+  auto &&known = comp.get_or_create<KnownBitsAnalysis>(comp);
+  ASSERT_EQ(known.get(*iter).zeros, 3);
+  ASSERT_EQ(known.get(*iter_next).zeros, 3);
+  ASSERT_EQ(known.get(*res).zeros, 2);
+  ASSERT_EQ(known.get(*res).ones, 1);
+  auto &&demanded = comp.get_or_create<DemandedBitsAnalysis>(comp);
+  ASSERT_EQ(demanded.get(*iter), ~uint64_t(0));
+}
+
+TEST(CoreTest, bit_simplification) {
+  Compiler comp;
+  comp.register_pass<BitSimplification>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto constant = [&builder](int64_t value) {
+    return builder.create_int_constant(value);
+  };
+  // high = (a0 << 8) & -256
+  // low = a0 & 255
+  // joined = high | low
+  // same_low = (low << 56) >> 56
+  // low_byte = (joined ^ 0x10000) & 255
+  // ret joined + (same_low + low_byte)
+  auto x = builder.create_param_load(0);
+  auto high = builder.create_and(builder.create_shl(x, constant(8)),
+                                 constant(-256));
+  auto low = builder.create_and(x, constant(255));
+  auto joined = builder.create_or(high, low);
+  auto same_low = builder.create_shr(builder.create_shl(low, constant(56)),
+                                     constant(56));
+  auto low_byte = builder.create_and(
+      builder.create_xor(joined, constant(0x10000)), constant(255));
+  builder.create_ret(builder.create_iadd(
+      joined, builder.create_iadd(same_low, low_byte)));
+
+  std::vector<int64_t> args = {0, 1, -1, 255, 256, 0x12345, -0x12345};
+  std::vector<int64_t> expected;
+  for (auto &&arg : args) {
+    expected.push_back(evaluate(graph, {arg}));
+  }
+  dump_graph(graph, "BitSimplificationTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "BitSimplificationTest1");
+
+  ASSERT_FALSE(has_inst(*bb0, INST_OR));
+  ASSERT_FALSE(has_inst(*bb0, INST_XOR));
+  ASSERT_FALSE(has_inst(*bb0, INST_SHR));
+  ASSERT_EQ(high->get_bb(), nullptr);
+  ASSERT_EQ(same_low->get_bb(), nullptr);
+  for (size_t idx = 0; idx < args.size(); ++idx) {
+    ASSERT_EQ(evaluate(graph, {args[idx]}), expected[idx]) << args[idx];
+  }
+}
+
+TEST(CoreTest, demanded_bits_unused_value) {
+  Compiler comp;
+  comp.register_pass<BitSimplification>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  // ret ((a0 * a0) << 32 + a0) & 0xFFFF
+  auto x = builder.create_param_load(0);
+  auto square = builder.create_imul(x, x);
+  auto shifted = builder.create_shl(square, builder.create_int_constant(32));
+  auto sum = builder.create_iadd(shifted, x);
+  builder.create_ret(
+      builder.create_and(sum, builder.create_int_constant(0xFFFF)));
+
+  auto &&demanded = comp.get_or_create<DemandedBitsAnalysis>(comp);
+  ASSERT_EQ(demanded.get(*sum), 0xFFFF);
+  ASSERT_EQ(demanded.get(*shifted), 0xFFFF);
+  ASSERT_EQ(demanded.get(*square), 0);
+  ASSERT_EQ(demanded.get(*x), 0xFFFF);
+
+  comp.run_all_passes();
+  dump_graph(graph, "DemandedBitsTest");
+  ASSERT_EQ(square->get_bb(), nullptr);
+  ASSERT_FALSE(has_inst(*bb0, INST_MUL));
+  for (int64_t arg : std::vector<int64_t>{0, 7, -1, 0x123456789}) {
+    ASSERT_EQ(evaluate(graph, {arg}), arg & 0xFFFF) << arg;
+  }
+}
+
+TEST(CoreTest, reassociate_constants) {
+  Compiler comp;
+  comp.register_pass<Reassociation>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto constant = [&builder](int64_t value) {
+    return builder.create_int_constant(value);
+  };
+  // ret ((a0 + 1) + (a1 + 2)) + (((a0 & 0xFF0) & a1) & 0xFF)
+  auto a0 = builder.create_param_load(0);
+  auto a1 = builder.create_param_load(1);
+  auto sum = builder.create_iadd(builder.create_iadd(a0, constant(1)),
+                                 builder.create_iadd(a1, constant(2)));
+  auto mask = builder.create_and(
+      builder.create_and(builder.create_and(a0, constant(0xFF0)), a1),
+      constant(0xFF));
+  builder.create_ret(builder.create_iadd(sum, mask));
+
+  std::vector<std::vector<int64_t>> args = {
+      {0, 0}, {1, 2}, {-1, -1}, {0x1234, 0xFFFF}, {-100, 77}};
+  std::vector<int64_t> expected;
+  for (auto &&arg : args) {
+    expected.push_back(evaluate(graph, arg));
+  }
+  dump_graph(graph, "ReassociateConstTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "ReassociateConstTest1");
+
+  ASSERT_EQ(count_insts(*bb0, INST_CONST), 2);
+  ASSERT_EQ(count_insts(*bb0, INST_ADD), 3);
+  ASSERT_EQ(count_insts(*bb0, INST_AND), 2);
+  for (size_t idx = 0; idx < args.size(); ++idx) {
+    ASSERT_EQ(evaluate(graph, args[idx]), expected[idx]) << idx;
+  }
+}
+
+TEST(CoreTest, reassociate_absorbing) {
+  Compiler comp;
+  comp.register_pass<Reassociation>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  // ret (a0 & 0xF0) & (a1 & 0x0F)
+  auto a0 = builder.create_param_load(0);
+  auto a1 = builder.create_param_load(1);
+  auto ret = builder.create_ret(builder.create_and(
+      builder.create_and(a0, builder.create_int_constant(0xF0)),
+      builder.create_and(a1, builder.create_int_constant(0x0F))));
+  comp.run_all_passes();
+  ASSERT_EQ(bb0->size(), 2);
+  auto res = ret->get_input();
+  ASSERT_EQ(res->get_opcode(), INST_CONST);
+  ASSERT_EQ(dynamic_cast<LoadConstant<int64_t> *>(res)->get_value(), 0);
+}
+
+TEST(CoreTest, reassociate_loop_invariant) {
+  Compiler comp;
+  comp.register_pass<Reassociation>();
+  comp.register_pass<RmUnused>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // for (i = 0, sum = 0; i < 10; ++i)
+  //   sum = sum + ((i + a0) + a1)
+  // ret sum
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto a1 = builder.create_param_load(1);
+  auto zero = builder.create_int_constant(0);
+  auto one = builder.create_int_constant(1);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto iter = builder.create_phi(INTEGER);
+  auto sum = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, iter,
+                                    builder.create_int_constant(10));
+  builder.set_insert_point(bb2);
+  auto sum_next = builder.create_iadd(
+      sum, builder.create_iadd(builder.create_iadd(iter, a0), a1));
+  auto iter_next = builder.create_iadd(iter, one);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  builder.create_ret(sum);
+  iter->add_option(bb0, zero);
+  iter->add_option(bb2, iter_next);
+  sum->add_option(bb0, zero);
+  sum->add_option(bb2, sum_next);
+
+  auto expected = evaluate(graph, {3, 4});
+  dump_graph(graph, "ReassociateLoopTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "ReassociateLoopTest1");
+
+  // Invariant part is computed first: ((a0 + a1) + i) + sum
+  auto invariant = std::find_if(bb2->begin(), bb2->end(), [&](auto &&inst) {
+    return inst.get_opcode() == INST_ADD && inst.get_input(0) == a0 &&
+           inst.get_input(1) == a1;
+  });
+  ASSERT_NE(invariant, bb2->end());
+  ASSERT_EQ(count_insts(*bb2, INST_ADD), 4);
+  ASSERT_EQ(evaluate(graph, {3, 4}), expected);
+}
+
+TEST(CoreTest, gcm_hoist_invariant) {
+  Compiler comp;
+  comp.register_pass<GlobalCodeMotion>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // for (i = 0, sum = 0; i < 10; ++i)
+  //   sum = sum + (a0 * a1) + i / a1 + i / 4
+  // ret sum
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto a1 = builder.create_param_load(1);
+  auto zero = builder.create_int_constant(0);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto iter = builder.create_phi(INTEGER);
+  auto sum = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, iter,
+                                    builder.create_int_constant(10));
+  builder.set_insert_point(bb2);
+  auto invariant = builder.create_imul(a0, a1);
+  auto by_param = builder.create_idiv(iter, a1);
+  auto by_const = builder.create_idiv(iter, builder.create_int_constant(4));
+  auto sum_next = builder.create_iadd(
+      builder.create_iadd(builder.create_iadd(sum, invariant), by_param),
+      by_const);
+  auto iter_next = builder.create_iadd(iter, builder.create_int_constant(1));
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  builder.create_ret(sum);
+  iter->add_option(bb0, zero);
+  iter->add_option(bb2, iter_next);
+  sum->add_option(bb0, zero);
+  sum->add_option(bb2, sum_next);
+
+  auto expected = evaluate(graph, {3, 4});
+  dump_graph(graph, "GCMHoistTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "GCMHoistTest1");
+
+  ASSERT_EQ(invariant->get_bb(), bb0);
+  // Division by param may trap, so it is not hoisted.
+  ASSERT_EQ(by_param->get_bb(), bb2);
+  ASSERT_EQ(by_const->get_bb(), bb2);
+  ASSERT_EQ(by_const->get_input(1)->get_bb(), bb0);
+  ASSERT_EQ(sum_next->get_bb(), bb2);
+  ASSERT_EQ(evaluate(graph, {3, 4}), expected);
+}
+
+TEST(CoreTest, gcm_sink_to_branch) {
+  Compiler comp;
+  comp.register_pass<GlobalCodeMotion>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  builder.set_entry_point(bb0);
+  // t = a0 * a1; u = t + 1
+  // ret a0 < 0 ? u : 0
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto a1 = builder.create_param_load(1);
+  auto zero = builder.create_int_constant(0);
+  auto mul = builder.create_imul(a0, a1);
+  auto add = builder.create_iadd(mul, builder.create_int_constant(1));
+  builder.create_conditional_branch(CMP_L, bb2, bb1, a0, zero);
+  builder.set_insert_point(bb1);
+  builder.create_ret(add);
+  builder.set_insert_point(bb2);
+  builder.create_ret(zero);
+
+  auto expected_neg = evaluate(graph, {-3, 4});
+  auto expected_pos = evaluate(graph, {3, 4});
+  dump_graph(graph, "GCMSinkTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "GCMSinkTest1");
+
+  ASSERT_EQ(mul->get_bb(), bb1);
+  ASSERT_EQ(add->get_bb(), bb1);
+  // Constant used only by add is sunk as well.
+  ASSERT_EQ(bb1->size(), 4);
+  ASSERT_FALSE(has_inst(*bb0, INST_MUL));
+  ASSERT_EQ(evaluate(graph, {-3, 4}), expected_neg);
+  ASSERT_EQ(evaluate(graph, {3, 4}), expected_pos);
+}
+
+TEST(CoreTest, redundant_phi_scc) {
+  Compiler comp;
+  comp.register_pass<RedundantPhiElimination>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  MKBB(4);
+  MKBB(5);
+  builder.set_entry_point(bb0);
+  // for (i = 0, p = a0; i < 10; ++i)
+  //   for (j = 0; j < 3; ++j)
+  //     p = p
+  // ret p + i
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto zero = builder.create_int_constant(0);
+  auto one = builder.create_int_constant(1);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto outer_p = builder.create_phi(INTEGER);
+  auto iter_i = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb5, bb2, iter_i,
+                                    builder.create_int_constant(10));
+  builder.set_insert_point(bb2);
+  auto inner_p = builder.create_phi(INTEGER);
+  auto iter_j = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb4, bb3, iter_j,
+                                    builder.create_int_constant(3));
+  builder.set_insert_point(bb3);
+  auto j_next = builder.create_iadd(iter_j, one);
+  builder.create_branch(bb2);
+  builder.set_insert_point(bb4);
+  // Phi with single option is trivially redundant.
+  auto copy_i = builder.create_phi(INTEGER);
+  auto i_next = builder.create_iadd(copy_i, one);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb5);
+  auto sum = builder.create_iadd(outer_p, iter_i);
+  builder.create_ret(sum);
+  outer_p->add_option(bb0, a0);
+  outer_p->add_option(bb4, inner_p);
+  iter_i->add_option(bb0, zero);
+  iter_i->add_option(bb4, i_next);
+  inner_p->add_option(bb1, outer_p);
+  inner_p->add_option(bb3, inner_p);
+  iter_j->add_option(bb1, zero);
+  iter_j->add_option(bb3, j_next);
+  copy_i->add_option(bb2, iter_i);
+
+  auto expected = evaluate(graph, {7});
+  dump_graph(graph, "RedundantPhiTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "RedundantPhiTest1");
+
+  ASSERT_EQ(count_insts(*bb1, INST_PHI), 1);
+  ASSERT_EQ(count_insts(*bb2, INST_PHI), 1);
+  ASSERT_FALSE(has_inst(*bb4, INST_PHI));
+  ASSERT_EQ(sum->get_input(0), a0);
+  ASSERT_EQ(i_next->get_input(0), iter_i);
+  ASSERT_EQ(a0->get_num_users(), 1);
+  ASSERT_EQ(evaluate(graph, {7}), expected);
+}
+
+TEST(CoreTest, redundant_phi_inner_scc) {
+  Compiler comp;
+  comp.register_pass<RedundantPhiElimination>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  MKBB(4);
+  MKBB(5);
+  MKBB(6);
+  builder.set_entry_point(bb0);
+  // SCC {x, y, z} merges a0 and a1, but y only forwards x around inner loop:
+  //   bb1: x = phi [a0, bb0], [z, bb5]
+  //   bb2: y = phi [x, bb1], [y, bb2]
+  //   bb5: z = phi [y, bb3], [a1, bb4]
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto a1 = builder.create_param_load(1);
+  auto zero = builder.create_int_constant(0);
+  auto one = builder.create_int_constant(1);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto outer_x = builder.create_phi(INTEGER);
+  auto iter = builder.create_phi(INTEGER);
+  auto iter_next = builder.create_iadd(iter, one);
+  builder.create_conditional_branch(CMP_L, bb6, bb2, iter,
+                                    builder.create_int_constant(5));
+  builder.set_insert_point(bb2);
+  auto inner_y = builder.create_phi(INTEGER);
+  auto inner_next = builder.create_iadd(inner_y, a1);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, inner_next, zero);
+  builder.set_insert_point(bb3);
+  builder.create_conditional_branch(CMP_EQ, bb5, bb4, iter,
+                                    builder.create_int_constant(2));
+  builder.set_insert_point(bb4);
+  builder.create_branch(bb5);
+  builder.set_insert_point(bb5);
+  auto merge_z = builder.create_phi(INTEGER);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb6);
+  builder.create_ret(builder.create_iadd(outer_x, iter));
+  outer_x->add_option(bb0, a0);
+  outer_x->add_option(bb5, merge_z);
+  iter->add_option(bb0, zero);
+  iter->add_option(bb5, iter_next);
+  inner_y->add_option(bb1, outer_x);
+  inner_y->add_option(bb2, inner_y);
+  merge_z->add_option(bb3, inner_y);
+  merge_z->add_option(bb4, a1);
+
+  auto expected = evaluate(graph, {3, 4});
+  dump_graph(graph, "RedundantPhiInnerTest0");
+  comp.run_all_passes();
+  dump_graph(graph, "RedundantPhiInnerTest1");
+
+  ASSERT_FALSE(has_inst(*bb2, INST_PHI));
+  ASSERT_EQ(inner_next->get_input(0), outer_x);
+  ASSERT_EQ(merge_z->get_input(0), outer_x);
+  ASSERT_EQ(count_insts(*bb1, INST_PHI), 2);
+  ASSERT_EQ(count_insts(*bb5, INST_PHI), 1);
+  ASSERT_EQ(evaluate(graph, {3, 4}), expected);
+}
+
+// |a0 - a1| with subtraction on both sides of diamond.
+void build_abs_diff(IRBuilder &builder, BasicBlock *bb0, BasicBlock *bb1,
+                    BasicBlock *bb2, BasicBlock *bb3) {
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto a1 = builder.create_param_load(1);
+  builder.create_conditional_branch(CMP_G, bb2, bb1, a0, a1);
+  builder.set_insert_point(bb1);
+  auto pos = builder.create_isub(a0, a1);
+  builder.create_branch(bb3);
+  builder.set_insert_point(bb2);
+  auto neg = builder.create_isub(a1, a0);
+  builder.create_branch(bb3);
+  builder.set_insert_point(bb3);
+  auto phi = builder.create_phi(INTEGER);
+  phi->add_option(bb1, pos);
+  phi->add_option(bb2, neg);
+  builder.create_ret(phi);
+}
+
+TEST(CoreTest, if_conversion_diamond) {
+  Compiler comp;
+  comp.register_pass<IfConversion>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  build_abs_diff(builder, bb0, bb1, bb2, bb3);
+
+  dump_graph(graph, "IfConversionDiamond0");
+  comp.run_all_passes();
+  dump_graph(graph, "IfConversionDiamond1");
+
+  ASSERT_TRUE(bb1->empty());
+  ASSERT_TRUE(bb2->empty());
+  ASSERT_EQ(bb0->get_uncond_successor(), bb3);
+  ASSERT_EQ(count_insts(*bb0, INST_SUB), 2);
+  ASSERT_TRUE(has_inst(*bb0, INST_SELECT));
+  // Merge block has single predecessor, so its phi is replaced by select.
+  ASSERT_FALSE(has_inst(*bb3, INST_PHI));
+  ASSERT_EQ(evaluate(graph, {5, 3}), 2);
+  ASSERT_EQ(evaluate(graph, {3, 5}), 2);
+  ASSERT_EQ(evaluate(graph, {4, 4}), 0);
+  check_live_ranges(comp);
+}
+
+TEST(CoreTest, if_conversion_triangle) {
+  Compiler comp;
+  comp.register_pass<IfConversion>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  // x = a0; if (x < 0) x = -x; ret x + 1
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto zero = builder.create_int_constant(0);
+  builder.create_conditional_branch(CMP_L, bb2, bb1, a0, zero);
+  builder.set_insert_point(bb1);
+  auto neg = builder.create_isub(zero, a0);
+  builder.create_branch(bb2);
+  builder.set_insert_point(bb2);
+  auto phi = builder.create_phi(INTEGER);
+  phi->add_option(bb0, a0);
+  phi->add_option(bb1, neg);
+  builder.create_branch(bb3);
+  builder.set_insert_point(bb3);
+  builder.create_ret(builder.create_iadd(phi, builder.create_int_constant(1)));
+
+  comp.run_all_passes();
+  dump_graph(graph, "IfConversionTriangle");
+
+  ASSERT_TRUE(bb1->empty());
+  ASSERT_EQ(bb0->get_uncond_successor(), bb2);
+  ASSERT_EQ(neg->get_bb(), bb0);
+  ASSERT_TRUE(has_inst(*bb0, INST_SELECT));
+  ASSERT_FALSE(has_inst(*bb2, INST_PHI));
+  ASSERT_EQ(evaluate(graph, {-7}), 8);
+  ASSERT_EQ(evaluate(graph, {7}), 8);
+  check_live_ranges(comp);
+}
+
+TEST(CoreTest, select_range) {
+  Compiler comp;
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  // min(a0, 10) & 15
+  builder.set_insert_point(bb0);
+  auto a0 = builder.create_param_load(0);
+  auto c10 = builder.create_int_constant(10);
+  auto select = builder.create_select(CMP_G, a0, c10, c10, a0);
+  auto bits = builder.create_and(select, builder.create_int_constant(15));
+  builder.create_ret(bits);
+
+  // Chosen values are narrowed by condition of select.
+  auto range = comp.get_or_create<RangeAnalysis>(comp).get_range(*select);
+  ASSERT_EQ(range.min, ValueRange::k_min);
+  ASSERT_EQ(range.max, 10);
+  ASSERT_EQ(evaluate(graph, {42}), 10);
+  ASSERT_EQ(evaluate(graph, {3}), 3);
+}
+
+TEST(CoreTest, if_conversion_limits) {
+  // Division by parameter may trap, so it isn't speculated.
+  {
+    Compiler comp;
+    comp.register_pass<IfConversion>();
+    auto &&graph = comp.graph();
+    graph.create_param(INTEGER);
+    graph.create_param(INTEGER);
+    IRBuilder builder(graph);
+    MKBB(0);
+    MKBB(1);
+    MKBB(2);
+    builder.set_entry_point(bb0);
+    builder.set_insert_point(bb0);
+    auto a0 = builder.create_param_load(0);
+    auto a1 = builder.create_param_load(1);
+    auto zero = builder.create_int_constant(0);
+    builder.create_conditional_branch(CMP_EQ, bb1, bb2, a1, zero);
+    builder.set_insert_point(bb1);
+    auto div = builder.create_idiv(a0, a1);
+    builder.create_branch(bb2);
+    builder.set_insert_point(bb2);
+    auto phi = builder.create_phi(INTEGER);
+    phi->add_option(bb0, zero);
+    phi->add_option(bb1, div);
+    builder.create_ret(phi);
+
+    comp.run_all_passes();
+    ASSERT_EQ(div->get_bb(), bb1);
+    ASSERT_FALSE(has_inst(*bb0, INST_SELECT));
+    ASSERT_EQ(evaluate(graph, {6, 0}), 0);
+  }
+  // Diamond costs two subtractions and one select.
+  {
+    Compiler comp;
+    comp.register_pass<IfConversion>(2);
+    auto &&graph = comp.graph();
+    graph.create_param(INTEGER);
+    graph.create_param(INTEGER);
+    IRBuilder builder(graph);
+    MKBB(0);
+    MKBB(1);
+    MKBB(2);
+    MKBB(3);
+    build_abs_diff(builder, bb0, bb1, bb2, bb3);
+
+    comp.run_all_passes();
+    ASSERT_FALSE(bb1->empty());
+    ASSERT_FALSE(bb2->empty());
+    ASSERT_TRUE(has_inst(*bb3, INST_PHI));
+  }
+}
+
+// sq(x) = x * x
+// abs(x) = x < 0 ? -x : x
+// f(a, b) = sq(a) + abs(b) + abs(a)
+// fact(n) = n > 1 ? n * fact(n - 1) : 1
+struct InlineModule {
+  Module module;
+  funcid_t sq;
+  funcid_t abs;
+  funcid_t f;
+  funcid_t fact;
+
+  InlineModule() {
+    sq = module.create_function("sq");
+    abs = module.create_function("abs");
+    f = module.create_function("f");
+    fact = module.create_function("fact");
+    {
+      auto &&graph = module.get_function(sq);
+      IRBuilder builder(graph);
+      graph.create_param(INTEGER);
+      MKBB(0);
+      builder.set_entry_point(bb0);
+      builder.set_insert_point(bb0);
+      auto x = builder.create_param_load(0);
+      builder.create_ret(builder.create_imul(x, x));
+    }
+    {
+      auto &&graph = module.get_function(abs);
+      IRBuilder builder(graph);
+      graph.create_param(INTEGER);
+      MKBB(0);
+      MKBB(1);
+      MKBB(2);
+      builder.set_entry_point(bb0);
+      builder.set_insert_point(bb0);
+      auto x = builder.create_param_load(0);
+      auto zero = builder.create_int_constant(0);
+      builder.create_conditional_branch(CMP_L, bb2, bb1, x, zero);
+      builder.set_insert_point(bb1);
+      builder.create_ret(builder.create_isub(zero, x));
+      builder.set_insert_point(bb2);
+      builder.create_ret(x);
+    }
+    {
+      auto &&graph = module.get_function(f);
+      IRBuilder builder(graph);
+      graph.create_param(INTEGER);
+      graph.create_param(INTEGER);
+      MKBB(0);
+      builder.set_entry_point(bb0);
+      builder.set_insert_point(bb0);
+      auto a = builder.create_param_load(0);
+      auto b = builder.create_param_load(1);
+      auto sq_a = builder.create_call(sq, INTEGER, {a});
+      auto abs_b = builder.create_call(abs, INTEGER, {b});
+      auto abs_a = builder.create_call(abs, INTEGER, {a});
+      auto sum = builder.create_iadd(builder.create_iadd(sq_a, abs_b), abs_a);
+      builder.create_ret(sum);
+    }
+    {
+      auto &&graph = module.get_function(fact);
+      IRBuilder builder(graph);
+      graph.create_param(INTEGER);
+      MKBB(0);
+      MKBB(1);
+      MKBB(2);
+      builder.set_entry_point(bb0);
+      builder.set_insert_point(bb0);
+      auto n = builder.create_param_load(0);
+      auto one = builder.create_int_constant(1);
+      builder.create_conditional_branch(CMP_G, bb2, bb1, n, one);
+      builder.set_insert_point(bb1);
+      auto n_dec = builder.create_isub(n, one);
+      auto rec = builder.create_call(fact, INTEGER, {n_dec});
+      builder.create_ret(builder.create_imul(n, rec));
+      builder.set_insert_point(bb2);
+      builder.create_ret(one);
+    }
+  }
+};
+
+size_t count_calls(ProgramGraph &graph) {
+  size_t num_calls = 0;
+  for (auto &&bb : graph) {
+    num_calls += std::count_if(bb.begin(), bb.end(), [](auto &&inst) {
+      return inst.get_opcode() == INST_CALL;
+    });
+  }
+  return num_calls;
+}
+
+TEST(CoreTest, call_graph_sccs) {
+  InlineModule mod;
+  auto sccs = Inliner::get_call_sccs(mod.module);
+  ASSERT_EQ(sccs.size(), 4);
+  std::vector<size_t> order(mod.module.size());
+  for (size_t i = 0; i < sccs.size(); ++i) {
+    ASSERT_EQ(sccs[i].size(), 1);
+    order[sccs[i].front()] = i;
+  }
+  ASSERT_LT(order[mod.sq], order[mod.f]);
+  ASSERT_LT(order[mod.abs], order[mod.f]);
+}
+
+TEST(CoreTest, inliner) {
+  InlineModule mod;
+  auto &&f = mod.module.get_function(mod.f);
+  auto &&fact = mod.module.get_function(mod.fact);
+  std::vector<std::pair<int64_t, int64_t>> inputs = {
+      {3, -4}, {-5, 7}, {0, 0}};
+  std::vector<int64_t> expected;
+  for (auto &&[a, b] : inputs) {
+    expected.push_back(evaluate(f, {a, b}, &mod.module));
+  }
+  dump_graph(f, "InlinerTest0");
+  ASSERT_TRUE(Inliner().run(mod.module));
+  dump_graph(f, "InlinerTest1");
+  ASSERT_EQ(count_calls(f), 0);
+  // Recursive call is kept
+  ASSERT_EQ(count_calls(fact), 1);
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    auto &&[a, b] = inputs[i];
+    ASSERT_EQ(evaluate(f, {a, b}), expected[i]);
+  }
+  ASSERT_EQ(evaluate(fact, {5}, &mod.module), 120);
+  // Call blocks are split, each call adds callee body and continuation
+  RPOAnalysis rpo;
+  rpo.run(f);
+  ASSERT_EQ(rpo.blocks().size(), 11);
+}
+
+TEST(CoreTest, inliner_threshold) {
+  InlineModule mod;
+  auto &&f = mod.module.get_function(mod.f);
+  // sq costs 1, abs costs 3
+  ASSERT_TRUE(Inliner(2).run(mod.module));
+  ASSERT_EQ(count_calls(f), 2);
+  ASSERT_EQ(evaluate(f, {-3, 4}, &mod.module), 16);
+}
+
+Instruction *create_binary(IRBuilder &builder, InstOpcode opcode,
+                           Instruction *lhs, Instruction *rhs) {
+  switch (opcode) {
+  case INST_ADD:
+    return builder.create_iadd(lhs, rhs);
+  case INST_SUB:
+    return builder.create_isub(lhs, rhs);
+  case INST_MUL:
+    return builder.create_imul(lhs, rhs);
+  case INST_DIV:
+    return builder.create_idiv(lhs, rhs);
+  case INST_MOD:
+    return builder.create_mod(lhs, rhs);
+  case INST_MULH:
+    return builder.create_mulh(lhs, rhs);
+  case INST_SHL:
+    return builder.create_shl(lhs, rhs);
+  case INST_SHR:
+    return builder.create_shr(lhs, rhs);
+  case INST_ASHR:
+    return builder.create_ashr(lhs, rhs);
+  case INST_AND:
+    return builder.create_and(lhs, rhs);
+  case INST_OR:
+    return builder.create_or(lhs, rhs);
+  default:
+    return builder.create_xor(lhs, rhs);
+  }
+}
+
+TEST(CoreTest, jit_binary_ops) {
+  const std::vector<int64_t> values = {
+      0, 1, -1, 7, -7, 63, 64, 100, 1ll << 40, INT64_MAX, INT64_MIN};
+  for (auto opcode : {INST_ADD, INST_SUB, INST_MUL, INST_DIV, INST_MOD,
+                      INST_MULH, INST_SHL, INST_SHR, INST_ASHR, INST_AND,
+                      INST_OR, INST_XOR}) {
+    Compiler comp(X86Backend::NUM_REGS);
+    auto &&graph = comp.graph();
+    graph.create_param(INTEGER);
+    graph.create_param(INTEGER);
+    IRBuilder builder(graph);
+    MKBB(0);
+    builder.set_entry_point(bb0);
+    builder.set_insert_point(bb0);
+    auto lhs = builder.create_param_load(0);
+    auto rhs = builder.create_param_load(1);
+    builder.create_ret(create_binary(builder, opcode, lhs, rhs));
+
+    auto func = jit_compile(comp);
+    for (auto &&a : values) {
+      for (auto &&b : values) {
+        if ((opcode == INST_DIV || opcode == INST_MOD) && b == 0) {
+          continue;
+        }
+        ASSERT_EQ(func(a, b), evaluate(graph, {a, b}))
+            << inst_opc_to_str(opcode) << " " << a << " " << b;
+      }
+    }
+  }
+}
+
+// fib(n) with (x, y) swapped on every iteration:
+//   i = 0; a = 0; b = 1; x = p1; y = p2
+//   while (i < n) { t = a + b; a = b; b = t; swap(x, y); i++ }
+//   ret a * 1000 + x - ~y
+void build_fib_swap(ProgramGraph &graph) {
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto n = builder.create_param_load(0);
+  auto p1 = builder.create_param_load(1);
+  auto p2 = builder.create_param_load(2);
+  auto zero = builder.create_int_constant(0);
+  auto one = builder.create_int_constant(1);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto i = builder.create_phi(INTEGER);
+  auto a = builder.create_phi(INTEGER);
+  auto b = builder.create_phi(INTEGER);
+  auto x = builder.create_phi(INTEGER);
+  auto y = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb3, bb2, i, n);
+  builder.set_insert_point(bb2);
+  auto t = builder.create_iadd(a, b);
+  auto i_inc = builder.create_iadd(i, one);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb3);
+  auto res = builder.create_imul(a, builder.create_int_constant(1000));
+  res = builder.create_isub(builder.create_iadd(res, x), builder.create_not(y));
+  builder.create_ret(res);
+  i->add_option(bb0, zero);
+  i->add_option(bb2, i_inc);
+  a->add_option(bb0, zero);
+  a->add_option(bb2, b);
+  b->add_option(bb0, one);
+  b->add_option(bb2, t);
+  x->add_option(bb0, p1);
+  x->add_option(bb2, y);
+  y->add_option(bb0, p2);
+  y->add_option(bb2, x);
+}
+
+TEST(CoreTest, jit_loop_phis) {
+  // Few registers make values spilled, many registers don't fit into
+  // hardware ones and are kept in frame.
+  for (size_t num_regs : {size_t(1), size_t(2), size_t(4),
+                          X86Backend::NUM_REGS, size_t(30)}) {
+    Compiler comp(num_regs);
+    build_fib_swap(comp.graph());
+    auto func = jit_compile(comp);
+    for (int64_t n : {0, 1, 2, 3, 10, 91}) {
+      ASSERT_EQ(func(n, 5, -9), evaluate(comp.graph(), {n, 5, -9}))
+          << num_regs << " registers, n = " << n;
+    }
+  }
+}
+
+TEST(CoreTest, jit_select) {
+  Compiler comp(X86Backend::NUM_REGS);
+  comp.register_pass<IfConversion>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  build_abs_diff(builder, bb0, bb1, bb2, bb3);
+  comp.run_all_passes();
+  ASSERT_TRUE(has_inst(*bb0, INST_SELECT));
+
+  auto func = jit_compile(comp);
+  for (auto &&[a, b] : std::vector<std::pair<int64_t, int64_t>>{
+           {5, 3}, {3, 5}, {4, 4}, {-10, 10}}) {
+    ASSERT_EQ(func(a, b), evaluate(graph, {a, b}));
+  }
+}
+
+// Patterns of instruction selection:
+//   x = p0 + (p1 << 3) + 16; y = p0 * 5 - 7; z = 0 - p1; w = p0 * 8
+//   s = (x >> 2) ^ (y ashr 1); t = 3 < p1 ? s : 9
+//   if (5 < p0) ret t + z else ret w - y
+void build_isel_patterns(ProgramGraph &graph) {
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto p0 = builder.create_param_load(0);
+  auto p1 = builder.create_param_load(1);
+  auto x = builder.create_iadd(
+      builder.create_iadd(
+          p0, builder.create_shl(p1, builder.create_int_constant(3))),
+      builder.create_int_constant(16));
+  auto y = builder.create_isub(
+      builder.create_imul(p0, builder.create_int_constant(5)),
+      builder.create_int_constant(7));
+  auto z = builder.create_isub(builder.create_int_constant(0), p1);
+  auto w = builder.create_imul(p0, builder.create_int_constant(8));
+  auto s = builder.create_xor(
+      builder.create_shr(x, builder.create_int_constant(2)),
+      builder.create_ashr(y, builder.create_int_constant(1)));
+  auto t = builder.create_select(CMP_L, builder.create_int_constant(3), p1, s,
+                                 builder.create_int_constant(9));
+  builder.create_conditional_branch(CMP_L, bb2, bb1,
+                                    builder.create_int_constant(5), p0);
+  builder.set_insert_point(bb1);
+  builder.create_ret(builder.create_iadd(t, z));
+  builder.set_insert_point(bb2);
+  builder.create_ret(builder.create_isub(w, y));
+}
+
+TEST(CoreTest, jit_isel_patterns) {
+  for (size_t num_regs : {size_t(1), size_t(2), size_t(4),
+                          X86Backend::NUM_REGS, size_t(30)}) {
+    Compiler comp(num_regs);
+    build_isel_patterns(comp.graph());
+    auto func = jit_compile(comp);
+    for (int64_t a : {-100, -1, 0, 5, 6, 1000}) {
+      for (int64_t b : {-7ll, 0ll, 3ll, 4ll, 1ll << 40}) {
+        ASSERT_EQ(func(a, b), evaluate(comp.graph(), {a, b}))
+            << num_regs << " registers, " << a << " " << b;
+      }
+    }
+  }
+}
+
+TEST(CoreTest, isel_folds_trees) {
+  Compiler comp(X86Backend::NUM_REGS);
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto a = builder.create_param_load(0);
+  auto b = builder.create_param_load(1);
+  auto addr = builder.create_iadd(
+      builder.create_iadd(
+          a, builder.create_shl(b, builder.create_int_constant(3))),
+      builder.create_int_constant(16));
+  builder.create_ret(
+      builder.create_iadd(addr, builder.create_int_constant(7)));
+
+  auto func = X86ISel::select(comp);
+  size_t num_lea = 0;
+  size_t num_imm_alu = 0;
+  for (auto &&bb : func) {
+    for (auto &&inst : bb.insts) {
+      num_lea += inst.opcode == LIR_LEA;
+      num_imm_alu += inst.opcode == LIR_ALU && inst.srcs.size() == 2 &&
+                     inst.srcs[1].is_imm();
+    }
+  }
+  // Shift and two adds become one lea, last add takes immediate. Two
+  // params, lea, add and ret are left of ten IR instructions.
+  ASSERT_EQ(num_lea, 1);
+  ASSERT_EQ(num_imm_alu, 1);
+  ASSERT_EQ(func.get_num_insts(), 5);
+
+  auto lowered = X86Backend::lower(comp);
+  for (auto &&bb : lowered) {
+    for (auto &&inst : bb.insts) {
+      for (auto &&src : inst.srcs) {
+        ASSERT_FALSE(src.is_vreg());
+      }
+      ASSERT_FALSE(inst.dst.is_vreg());
+    }
+  }
+  ASSERT_EQ(jit_compile(comp)(3, 4), 3 + (4 << 3) + 16 + 7);
+}
+
+TEST(CoreTest, jit_unsupported) {
+  Compiler comp;
+  auto &&graph = comp.graph();
+  graph.create_param(FLOAT);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  builder.create_ret(builder.create_param_load(0));
+  ASSERT_THROW(jit_compile(comp), CodeGenError);
+
+  // Calls are resolved only in module.
+  InlineModule mod;
+  Compiler call_comp;
+  {
+    auto &&graph = call_comp.graph();
+    graph.create_param(INTEGER);
+    IRBuilder builder(graph);
+    MKBB(0);
+    builder.set_entry_point(bb0);
+    builder.set_insert_point(bb0);
+    auto x = builder.create_param_load(0);
+    builder.create_ret(builder.create_call(mod.sq, INTEGER, {x}));
+  }
+  ASSERT_THROW(jit_compile(call_comp), CodeGenError);
+}
+
+std::vector<uint8_t> make_const_function(int64_t value) {
+  X86Assembler masm;
+  masm.mov(RAX, value);
+  masm.ret();
+  return masm.finalize();
+}
+
+int64_t call_code(const void *code) {
+  return reinterpret_cast<int64_t (*)()>(code)();
+}
+
+TEST(CoreTest, code_cache_allocation) {
+  CodeCache cache(1 << 16);
+  std::vector<const void *> functions;
+  for (int64_t value = 0; value < 100; ++value) {
+    functions.push_back(cache.add(make_const_function(value)));
+  }
+  cache.make_executable();
+  for (int64_t value = 0; value < 100; ++value) {
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(functions[value]) %
+                  CodeCache::ALIGNMENT,
+              0);
+    ASSERT_EQ(call_code(functions[value]), value);
+  }
+  auto stats = cache.get_stats();
+  ASSERT_EQ(stats.num_regions, 1);
+  ASSERT_EQ(stats.num_live_chunks, 100);
+  ASSERT_EQ(stats.used_bytes, 100 * CodeCache::ALIGNMENT);
+  ASSERT_EQ(stats.num_protection_flips, 1);
+
+  // Writing flips region back, all regions are sealed in one batch.
+  auto code = cache.add(make_const_function(-1));
+  auto large = cache.add(std::vector<uint8_t>(1 << 17, 0xc3));
+  cache.make_executable();
+  ASSERT_EQ(call_code(code), -1);
+  ASSERT_EQ(call_code(functions[42]), 42);
+  stats = cache.get_stats();
+  ASSERT_EQ(stats.num_regions, 2);
+  ASSERT_EQ(stats.num_protection_flips, 4);
+  ASSERT_EQ(cache.get_chunk_size(large), 1 << 17);
+}
+
+TEST(CoreTest, code_cache_eviction) {
+  CodeCache cache(1 << 16);
+  std::vector<uint8_t *> chunks;
+  for (size_t i = 0; i < 4; ++i) {
+    chunks.push_back(cache.allocate(100));
+  }
+  ASSERT_EQ(cache.get_chunk_size(chunks[0]), 128);
+  // Freed chunk is the best fit for the same size.
+  cache.free(chunks[1]);
+  ASSERT_EQ(cache.allocate(128), chunks[1]);
+  cache.free(chunks[0]);
+  cache.free(chunks[2]);
+  // Neighbours are coalesced.
+  cache.free(chunks[1]);
+  auto stats = cache.get_stats();
+  ASSERT_EQ(stats.num_free_chunks, 2);
+  ASSERT_EQ(stats.num_evictions, 4);
+  ASSERT_EQ(cache.allocate(300), chunks[0]);
+  cache.free(chunks[0]);
+  cache.free(chunks[3]);
+  stats = cache.get_stats();
+  ASSERT_EQ(stats.num_free_chunks, 1);
+  ASSERT_EQ(stats.largest_free_chunk, stats.reserved_bytes);
+  ASSERT_EQ(stats.used_bytes, 0);
+
+  std::ostringstream os;
+  os << stats;
+  ASSERT_NE(os.str().find("code_cache.num_evictions 6\n"), std::string::npos);
+}
+
+TEST(CoreTest, code_cache_huge_pages) {
+  CodeCache cache(CodeCache::DEFAULT_REGION_SIZE, /*use_huge_pages=*/true);
+  auto code = cache.add(make_const_function(7));
+  cache.make_executable();
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(code) % CodeCache::DEFAULT_REGION_SIZE,
+            0);
+  ASSERT_EQ(call_code(code), 7);
+}
+
+// Adds caller(a, b) of weighted(p0, ..., p7) and fact to module.
+funcid_t add_weighted_caller(InlineModule &mod) {
+  // weighted(p0, ..., p7) = sum (i + 1) * p_i, parameters beyond six are
+  // passed on stack.
+  auto weighted = mod.module.create_function("weighted");
+  {
+    auto &&graph = mod.module.get_function(weighted);
+    IRBuilder builder(graph);
+    MKBB(0);
+    builder.set_entry_point(bb0);
+    builder.set_insert_point(bb0);
+    Instruction *sum = builder.create_int_constant(0);
+    for (size_t i = 0; i < 8; ++i) {
+      graph.create_param(INTEGER);
+      auto p = builder.create_param_load(i);
+      auto weight = builder.create_int_constant(i + 1);
+      sum = builder.create_iadd(sum, builder.create_imul(p, weight));
+    }
+    builder.create_ret(sum);
+  }
+  // caller(a, b) = weighted(a, b, ..., a + 6, b + 7) - fact(b) + a * b
+  // Parameters stay live across calls.
+  auto caller = mod.module.create_function("caller");
+  {
+    auto &&graph = mod.module.get_function(caller);
+    graph.create_param(INTEGER);
+    graph.create_param(INTEGER);
+    IRBuilder builder(graph);
+    MKBB(0);
+    builder.set_entry_point(bb0);
+    builder.set_insert_point(bb0);
+    auto a = builder.create_param_load(0);
+    auto b = builder.create_param_load(1);
+    std::vector<Instruction *> args;
+    for (int64_t i = 0; i < 8; ++i) {
+      auto base = i % 2 == 0 ? a : b;
+      args.push_back(
+          builder.create_iadd(base, builder.create_int_constant(i)));
+    }
+    auto w = builder.create_call(weighted, INTEGER, args);
+    auto fact = builder.create_call(mod.fact, INTEGER, {b});
+    auto res = builder.create_iadd(builder.create_isub(w, fact),
+                                   builder.create_imul(a, b));
+    builder.create_ret(res);
+  }
+  return caller;
+}
+
+TEST(CoreTest, jit_module_calls) {
+  InlineModule mod;
+  auto caller = add_weighted_caller(mod);
+  for (auto tier : {CodeTier::OPTIMIZING, CodeTier::BASELINE}) {
+    JitModule jit(mod.module, nullptr, tier);
+    // All functions share one region, which is sealed once.
+    ASSERT_EQ(jit.get_code_cache().get_stats().num_regions, 1);
+    ASSERT_EQ(jit.get_code_cache().get_stats().num_protection_flips, 1);
+    ASSERT_EQ(jit.get_function(mod.fact)(10), 3628800);
+    ASSERT_EQ(jit.get_function(mod.f)(-3, 4),
+              evaluate(mod.module.get_function(mod.f), {-3, 4}, &mod.module));
+    for (auto &&[a, b] : std::vector<std::pair<int64_t, int64_t>>{
+             {1, 2}, {-5, 7}, {100, 0}}) {
+      ASSERT_EQ(
+          jit.get_function(caller)(a, b),
+          evaluate(mod.module.get_function(caller), {a, b}, &mod.module));
+    }
+  }
+}
+
+TEST(CoreTest, lazy_jit_module) {
+  InlineModule mod;
+  auto caller = add_weighted_caller(mod);
+  LazyJitModule jit(mod.module);
+  ASSERT_EQ(jit.get_num_compiled(), 0);
+  ASSERT_EQ(jit.get_function(mod.fact)(10), 3628800);
+  // Recursive calls go through the patched entry.
+  ASSERT_EQ(jit.get_num_compiled(), 1);
+  ASSERT_EQ(jit.get_tier(mod.fact), CodeTier::BASELINE);
+  ASSERT_FALSE(jit.get_tier(mod.sq).has_value());
+  auto check = [&] {
+    for (auto &&[a, b] : std::vector<std::pair<int64_t, int64_t>>{
+             {1, 2}, {-5, 7}, {100, 0}}) {
+      ASSERT_EQ(
+          jit.get_function(caller)(a, b),
+          evaluate(mod.module.get_function(caller), {a, b}, &mod.module));
+    }
+  };
+  // Stack parameters of weighted pass through its resolver stub.
+  check();
+  ASSERT_EQ(jit.get_num_compiled(), 3);
+  ASSERT_FALSE(jit.get_tier(mod.f).has_value());
+
+  jit.tier_up(caller);
+  ASSERT_EQ(jit.get_tier(caller), CodeTier::OPTIMIZING);
+  check();
+  // Callee which wasn't called is compiled by tier up.
+  jit.tier_up(mod.f);
+  ASSERT_EQ(jit.get_function(mod.f)(-3, 4),
+            evaluate(mod.module.get_function(mod.f), {-3, 4}, &mod.module));
+  ASSERT_EQ(jit.get_num_compiled(), 7);
+}
+
+TEST(CoreTest, lazy_jit_concurrent_tier_up) {
+  InlineModule mod;
+  auto caller = add_weighted_caller(mod);
+  LazyJitModule jit(mod.module);
+  std::vector<int64_t> expected;
+  for (int64_t a = 0; a < 8; ++a) {
+    expected.push_back(
+        evaluate(mod.module.get_function(caller), {a, a - 3}, &mod.module));
+  }
+  std::atomic<bool> is_done = false;
+  std::atomic<size_t> num_mismatches = 0;
+  std::vector<std::thread> threads;
+  for (size_t idx = 0; idx < 4; ++idx) {
+    threads.emplace_back([&] {
+      auto &&func = jit.get_function(caller);
+      do {
+        for (int64_t a = 0; a < 8; ++a) {
+          if (func(a, a - 3) != expected[a]) {
+            ++num_mismatches;
+          }
+        }
+      } while (!is_done);
+    });
+  }
+  for (funcid_t id = 0; id < mod.module.size(); ++id) {
+    jit.tier_up(id);
+  }
+  is_done = true;
+  for (auto &&thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(num_mismatches, 0);
+  for (funcid_t id = 0; id < mod.module.size(); ++id) {
+    ASSERT_EQ(jit.get_tier(id), CodeTier::OPTIMIZING);
+  }
+}
+
+// offset(x) = x < c ? c - x : x, with unreachable block created first when
+// ids are shifted.
+void build_offset(ProgramGraph &graph, int64_t c, CmpFlag flag,
+                  bool shift_ids) {
+  IRBuilder builder(graph);
+  graph.create_param(INTEGER);
+  if (shift_ids) {
+    auto unused = graph.create_basic_block();
+    builder.set_insert_point(unused);
+    builder.create_ret(builder.create_int_constant(c));
+  }
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto x = builder.create_param_load(0);
+  auto cst = builder.create_int_constant(c);
+  builder.create_conditional_branch(flag, bb2, bb1, x, cst);
+  builder.set_insert_point(bb1);
+  builder.create_ret(builder.create_isub(cst, x));
+  builder.set_insert_point(bb2);
+  builder.create_ret(x);
+}
+
+TEST(CoreTest, graph_hash) {
+  auto hash = [](int64_t c, CmpFlag flag, bool shift_ids) {
+    ProgramGraph graph;
+    build_offset(graph, c, flag, shift_ids);
+    return hash_graph(graph);
+  };
+  auto base = hash(0, CMP_L, false);
+  ASSERT_EQ(base, hash(0, CMP_L, false));
+  ASSERT_EQ(base, hash(0, CMP_L, true));
+  ASSERT_NE(base, hash(1, CMP_L, false));
+  ASSERT_NE(base, hash(0, CMP_LE, false));
+
+  // offset(x) = x < 0 ? x - 0 : x
+  ProgramGraph graph;
+  {
+    IRBuilder builder(graph);
+    graph.create_param(INTEGER);
+    MKBB(0);
+    MKBB(1);
+    MKBB(2);
+    builder.set_entry_point(bb0);
+    builder.set_insert_point(bb0);
+    auto x = builder.create_param_load(0);
+    auto cst = builder.create_int_constant(0);
+    builder.create_conditional_branch(CMP_L, bb2, bb1, x, cst);
+    builder.set_insert_point(bb1);
+    builder.create_ret(builder.create_isub(x, cst));
+    builder.set_insert_point(bb2);
+    builder.create_ret(x);
+  }
+  ASSERT_NE(base, hash_graph(graph));
+  ASSERT_NE(AotCache::get_key(graph, "none"),
+            AotCache::get_key(graph, "default"));
+}
+
+TEST(CoreTest, aot_cache) {
+  auto path = testing::TempDir() + "kodjit_aot_cache_test.bin";
+  std::remove(path.c_str());
+  InlineModule mod;
+  auto check = [&mod](const JitModule &jit) {
+    ASSERT_EQ(jit.get_function(mod.fact)(10), 3628800);
+    for (int64_t a : {-3, 0, 5}) {
+      ASSERT_EQ(jit.get_function(mod.f)(a, 4),
+                evaluate(mod.module.get_function(mod.f), {a, 4}, &mod.module));
+    }
+  };
+  {
+    AotCache cache(path);
+    JitModule jit(mod.module, &cache);
+    check(jit);
+    ASSERT_EQ(cache.get_stats().num_misses, 4);
+    ASSERT_EQ(cache.get_stats().num_inserted, 4);
+    cache.save();
+  }
+  {
+    // Warm start maps code into different call table.
+    AotCache cache(path);
+    ASSERT_EQ(cache.get_stats().num_loaded, 4);
+    JitModule jit(mod.module, &cache);
+    check(jit);
+    ASSERT_EQ(cache.get_stats().num_hits, 4);
+    ASSERT_EQ(cache.get_stats().num_misses, 0);
+  }
+
+  // Corrupt the last code byte of some entry, only that entry is rejected.
+  std::vector<char> bytes;
+  {
+    std::ifstream file(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(file), {});
+  }
+  auto write = [&path](const std::vector<char> &content) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(content.data(), content.size());
+  };
+  // Header is 40 bytes, code of the first entry follows the table.
+  uint64_t code_offset = 0;
+  std::memcpy(&code_offset, bytes.data() + 40 + 8, sizeof(code_offset));
+  auto corrupted = bytes;
+  corrupted[code_offset] ^= 0xff;
+  write(corrupted);
+  {
+    AotCache cache(path);
+    JitModule jit(mod.module, &cache);
+    check(jit);
+    ASSERT_EQ(cache.get_stats().num_rejected, 1);
+    ASSERT_EQ(cache.get_stats().num_hits, 3);
+    ASSERT_EQ(cache.get_stats().num_misses, 1);
+    cache.save();
+  }
+  {
+    AotCache cache(path);
+    JitModule jit(mod.module, &cache);
+    ASSERT_EQ(cache.get_stats().num_hits, 4);
+  }
+
+  // Other format version and truncated file are ignored.
+  auto stale = bytes;
+  stale[8] ^= 0xff;
+  write(stale);
+  {
+    AotCache cache(path);
+    ASSERT_EQ(cache.get_stats().num_loaded, 0);
+    JitModule jit(mod.module, &cache);
+    check(jit);
+    ASSERT_EQ(cache.get_stats().num_misses, 4);
+  }
+  for (size_t size : {size_t{0}, size_t{20}, bytes.size() / 2}) {
+    write(std::vector<char>(bytes.begin(), bytes.begin() + size));
+    AotCache cache(path);
+    ASSERT_EQ(cache.get_stats().num_loaded, 0);
+    JitModule jit(mod.module, &cache);
+    check(jit);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(CoreTest, interpreter_binary_ops) {
+  const std::vector<int64_t> values = {
+      0, 1, -1, 7, -7, 63, 64, 100, 1ll << 40, INT64_MAX, INT64_MIN};
+  for (auto opcode : {INST_ADD, INST_SUB, INST_MUL, INST_DIV, INST_MOD,
+                      INST_MULH, INST_SHL, INST_SHR, INST_ASHR, INST_AND,
+                      INST_OR, INST_XOR}) {
+    ProgramGraph graph;
+    graph.create_param(INTEGER);
+    graph.create_param(INTEGER);
+    IRBuilder builder(graph);
+    MKBB(0);
+    builder.set_entry_point(bb0);
+    builder.set_insert_point(bb0);
+    auto lhs = builder.create_param_load(0);
+    auto rhs = builder.create_param_load(1);
+    builder.create_ret(create_binary(builder, opcode, lhs, rhs));
+
+    BytecodeFunction func(graph);
+    for (auto dispatch :
+         {Interpreter::Dispatch::THREADED, Interpreter::Dispatch::SWITCH}) {
+      Interpreter interp(dispatch);
+      for (auto &&a : values) {
+        for (auto &&b : values) {
+          if ((opcode == INST_DIV || opcode == INST_MOD) && b == 0) {
+            ASSERT_THROW(interp.run(func, {a, b}), InterpreterError);
+            continue;
+          }
+          ASSERT_EQ(interp.run(func, {a, b}), evaluate(graph, {a, b}))
+              << inst_opc_to_str(opcode) << " " << a << " " << b;
+        }
+      }
+    }
+  }
+}
+
+TEST(CoreTest, interpreter_loop_phis) {
+  ProgramGraph graph;
+  build_fib_swap(graph);
+  BytecodeFunction func(graph);
+  for (auto dispatch :
+       {Interpreter::Dispatch::THREADED, Interpreter::Dispatch::SWITCH}) {
+    Interpreter interp(dispatch);
+    for (int64_t n : {0, 1, 2, 3, 10, 91}) {
+      ASSERT_EQ(interp.run(func, {n, 5, -9}), evaluate(graph, {n, 5, -9}))
+          << "n = " << n;
+    }
+  }
+  ASSERT_THROW(Interpreter().run(func, {1, 2}), InterpreterError);
+}
+
+TEST(CoreTest, interpreter_select) {
+  Compiler comp;
+  comp.register_pass<IfConversion>();
+  auto &&graph = comp.graph();
+  graph.create_param(INTEGER);
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  build_abs_diff(builder, bb0, bb1, bb2, bb3);
+  comp.run_all_passes();
+  ASSERT_TRUE(has_inst(*bb0, INST_SELECT));
+
+  BytecodeFunction func(graph);
+  Interpreter interp;
+  for (auto &&[a, b] : std::vector<std::pair<int64_t, int64_t>>{
+           {5, 3}, {3, 5}, {4, 4}, {-10, 10}}) {
+    ASSERT_EQ(interp.run(func, {a, b}), evaluate(graph, {a, b}));
+  }
+}
+
+TEST(CoreTest, interpreter_module_calls) {
+  InlineModule mod;
+  for (auto dispatch :
+       {Interpreter::Dispatch::THREADED, Interpreter::Dispatch::SWITCH}) {
+    Interpreter interp(mod.module, dispatch);
+    ASSERT_EQ(interp.run(mod.fact, {10}), 3628800);
+    for (auto &&[a, b] : std::vector<std::pair<int64_t, int64_t>>{
+             {3, -4}, {-5, 7}, {0, 0}}) {
+      ASSERT_EQ(interp.run(mod.f, {a, b}),
+                evaluate(mod.module.get_function(mod.f), {a, b}, &mod.module));
+    }
+  }
+  // Each frame of fact takes few slots, so deep recursion overflows small
+  // stack.
+  Interpreter small(mod.module, Interpreter::DEFAULT_DISPATCH, 256);
+  ASSERT_EQ(small.run(mod.fact, {3}), 6);
+  ASSERT_THROW(small.run(mod.fact, {1000}), InterpreterError);
+
+  // Calls are resolved only in module.
+  BytecodeFunction f(mod.module.get_function(mod.f));
+  ASSERT_THROW(Interpreter().run(f, {1, 2}), InterpreterError);
+}
+
+// sum = 0; i = 0
+// while (i < n) {
+//   k = i * 3; j = 0
+//   while (j < i) { sum = sum + k + j; j++ }
+//   i++
+// }
+// ret sum
+void build_nested_loops(ProgramGraph &graph) {
+  graph.create_param(INTEGER);
+  IRBuilder builder(graph);
+  MKBB(0);
+  MKBB(1);
+  MKBB(2);
+  MKBB(3);
+  MKBB(4);
+  MKBB(5);
+  MKBB(6);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  auto n = builder.create_param_load(0);
+  auto zero = builder.create_int_constant(0);
+  auto one = builder.create_int_constant(1);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb1);
+  auto i = builder.create_phi(INTEGER);
+  auto sum = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb6, bb2, i, n);
+  builder.set_insert_point(bb2);
+  auto k = builder.create_imul(i, builder.create_int_constant(3));
+  builder.create_branch(bb3);
+  builder.set_insert_point(bb3);
+  auto j = builder.create_phi(INTEGER);
+  auto inner_sum = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, bb5, bb4, j, i);
+  builder.set_insert_point(bb4);
+  auto sum_inc = builder.create_iadd(builder.create_iadd(inner_sum, k), j);
+  auto j_inc = builder.create_iadd(j, one);
+  builder.create_branch(bb3);
+  builder.set_insert_point(bb5);
+  auto i_inc = builder.create_iadd(i, one);
+  builder.create_branch(bb1);
+  builder.set_insert_point(bb6);
+  builder.create_ret(sum);
+  i->add_option(bb0, zero);
+  i->add_option(bb5, i_inc);
+  sum->add_option(bb0, zero);
+  sum->add_option(bb5, inner_sum);
+  j->add_option(bb2, zero);
+  j->add_option(bb4, j_inc);
+  inner_sum->add_option(bb2, sum);
+  inner_sum->add_option(bb4, sum_inc);
+}
+
+TEST(CoreTest, interpreter_loop_profile) {
+  ProgramGraph graph;
+  build_nested_loops(graph);
+  BytecodeFunction func(graph);
+  // Inner loop is counted in the outer one.
+  ASSERT_EQ(func.get_loop_headers(), std::vector<bbid_t>{1});
+  Interpreter interp;
+  ASSERT_EQ(interp.run(func, {10}), evaluate(graph, {10}));
+  ASSERT_EQ(func.get_profile().calls, 1);
+  ASSERT_EQ(func.get_profile().backedges[0], 10 + 45);
+}
+
+TEST(CoreTest, osr_graph) {
+  ProgramGraph graph;
+  build_nested_loops(graph);
+  ProgramGraph osr;
+  // Value of k is computed between headers, so inner loop can't be entered.
+  ASSERT_FALSE(TieredRuntime::build_osr_graph(graph, 3, osr).has_value());
+
+  ProgramGraph outer;
+  auto slots = TieredRuntime::build_osr_graph(graph, 1, outer);
+  ASSERT_TRUE(slots.has_value());
+  // i, sum and n
+  ASSERT_EQ(slots->size(), 3);
+  ASSERT_EQ(outer.get_num_params(), 3);
+  ASSERT_EQ(outer.get_param(2).get_type(), INTEGER);
+  // Continue from i = 4 with sum of the first four iterations.
+  std::vector<int64_t> args = {4, evaluate(graph, {4}), 10};
+  ASSERT_EQ(evaluate(outer, args), evaluate(graph, {10}));
+}
+
+TEST(CoreTest, tiered_osr) {
+  Module module;
+  auto fib = module.create_function("fib");
+  build_fib_swap(module.get_function(fib));
+  auto nested = module.create_function("nested");
+  build_nested_loops(module.get_function(nested));
+
+  TieredRuntime runtime(module, TieredRuntime::DEFAULT_CALL_THRESHOLD, 50);
+  ASSERT_EQ(runtime.run(fib, {10, 5, -9}),
+            evaluate(module.get_function(fib), {10, 5, -9}));
+  ASSERT_EQ(runtime.get_num_osr_entries(), 0);
+  // Loop leaves interpreter on 50th iteration.
+  ASSERT_EQ(runtime.run(fib, {91, 5, -9}),
+            evaluate(module.get_function(fib), {91, 5, -9}));
+  ASSERT_EQ(runtime.get_num_osr_entries(), 1);
+  ASSERT_FALSE(runtime.is_compiled(fib));
+
+  ASSERT_EQ(runtime.run(nested, {100}),
+            evaluate(module.get_function(nested), {100}));
+  ASSERT_EQ(runtime.get_num_osr_entries(), 2);
+}
+
+TEST(CoreTest, tiered_calls) {
+  InlineModule mod;
+  TieredRuntime runtime(mod.module, 5);
+  for (int64_t n = 0; n < 10; ++n) {
+    ASSERT_EQ(runtime.run(mod.f, {n - 5, 3 - n}),
+              evaluate(mod.module.get_function(mod.f), {n - 5, 3 - n},
+                       &mod.module));
+  }
+  // Callees are compiled together with hot function.
+  ASSERT_TRUE(runtime.is_compiled(mod.f));
+  ASSERT_TRUE(runtime.is_compiled(mod.sq));
+  ASSERT_TRUE(runtime.is_compiled(mod.abs));
+  // Recursive calls make fact hot during the first run.
+  ASSERT_FALSE(runtime.is_compiled(mod.fact));
+  ASSERT_EQ(runtime.run(mod.fact, {10}), 3628800);
+  ASSERT_TRUE(runtime.is_compiled(mod.fact));
+  ASSERT_EQ(runtime.run(mod.fact, {12}), 479001600);
+}
+
+TEST(CoreTest, binary_ir_graph) {
+  ProgramGraph graph;
+  build_nested_loops(graph);
+  auto bytes = write_binary_ir(graph);
+  ProgramGraph copy;
+  read_binary_ir(bytes.data(), bytes.size(), copy);
+  ASSERT_EQ(copy.size(), graph.size());
+  ASSERT_EQ(copy.get_instr_count(), graph.get_instr_count());
+  ASSERT_EQ(copy.get_entry()->get_id(), 0);
+  ASSERT_EQ(hash_graph(copy), hash_graph(graph));
+  for (int64_t n : {0, 1, 5, 10}) {
+    ASSERT_EQ(evaluate(copy, {n}), evaluate(graph, {n}));
+  }
+  // Read graph is already in canonical order.
+  ASSERT_EQ(write_binary_ir(copy), bytes);
+
+  // Unreachable blocks are dropped.
+  ProgramGraph offset;
+  build_offset(offset, -5, CMP_L, true);
+  bytes = write_binary_ir(offset);
+  ProgramGraph offset_copy;
+  read_binary_ir(bytes.data(), bytes.size(), offset_copy);
+  ASSERT_EQ(offset_copy.size(), 3);
+  ASSERT_EQ(hash_graph(offset_copy), hash_graph(offset));
+  ASSERT_THROW(read_binary_ir(bytes.data(), bytes.size(), offset_copy),
+               IRInvalidArgument);
+}
+
+TEST(CoreTest, baseline_binary_ops) {
+  const std::vector<int64_t> values = {
+      0, 1, -1, 7, -7, 63, 64, 100, 1ll << 40, INT64_MAX, INT64_MIN};
+  for (auto opcode : {INST_ADD, INST_SUB, INST_MUL, INST_DIV, INST_MOD,
+                      INST_MULH, INST_SHL, INST_SHR, INST_ASHR, INST_AND,
+                      INST_OR, INST_XOR}) {
+    // Constant rhs is encoded as immediate.
+    for (bool is_const_rhs : {false, true}) {
+      for (int64_t c : is_const_rhs ? std::vector<int64_t>{3, -1, 1ll << 40}
+                                    : std::vector<int64_t>{0}) {
+        ProgramGraph graph;
+        graph.create_param(INTEGER);
+        graph.create_param(INTEGER);
+        IRBuilder builder(graph);
+        MKBB(0);
+        builder.set_entry_point(bb0);
+        builder.set_insert_point(bb0);
+        auto lhs = builder.create_param_load(0);
+        Instruction *rhs = builder.create_param_load(1);
+        if (is_const_rhs) {
+          rhs = builder.create_int_constant(c);
+        }
+        builder.create_ret(create_binary(builder, opcode, lhs, rhs));
+
+        auto func = jit_compile_baseline(graph);
+        for (auto &&a : values) {
+          for (auto &&b : values) {
+            auto divisor = is_const_rhs ? c : b;
+            if ((opcode == INST_DIV || opcode == INST_MOD) && divisor == 0) {
+              continue;
+            }
+            ASSERT_EQ(func(a, b), evaluate(graph, {a, b}))
+                << inst_opc_to_str(opcode) << " " << a << " " << b;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(CoreTest, baseline_control_flow) {
+  {
+    // Phis of loop header swap their values.
+    ProgramGraph graph;
+    build_fib_swap(graph);
+    auto func = jit_compile_baseline(graph);
+    for (int64_t n : {0, 1, 2, 3, 10, 91}) {
+      ASSERT_EQ(func(n, 5, -9), evaluate(graph, {n, 5, -9})) << n;
+    }
+  }
+  {
+    ProgramGraph graph;
+    build_nested_loops(graph);
+    auto func = jit_compile_baseline(graph);
+    for (int64_t n : {0, 1, 5, 30}) {
+      ASSERT_EQ(func(n), evaluate(graph, {n})) << n;
+    }
+  }
+  {
+    ProgramGraph graph;
+    build_isel_patterns(graph);
+    auto func = jit_compile_baseline(graph);
+    for (int64_t a : {-100, -1, 0, 5, 6, 1000}) {
+      for (int64_t b : {-7ll, 0ll, 3ll, 4ll, 1ll << 40}) {
+        ASSERT_EQ(func(a, b), evaluate(graph, {a, b})) << a << " " << b;
+      }
+    }
+  }
+  for (auto flag : {CMP_L, CMP_GE, CMP_EQ}) {
+    ProgramGraph graph;
+    build_offset(graph, 10, flag, true);
+    auto func = jit_compile_baseline(graph);
+    for (int64_t x : {-5, 9, 10, 11}) {
+      ASSERT_EQ(func(x), evaluate(graph, {x})) << x;
+    }
+  }
+}
+
+TEST(CoreTest, baseline_unsupported) {
+  ProgramGraph graph;
+  graph.create_param(FLOAT);
+  IRBuilder builder(graph);
+  MKBB(0);
+  builder.set_entry_point(bb0);
+  builder.set_insert_point(bb0);
+  builder.create_ret(builder.create_param_load(0));
+  ASSERT_THROW(jit_compile_baseline(graph), CodeGenError);
+}
+
+// Module of functions built by test helpers, weighted and caller call other
+// functions.
+funcid_t build_service_module(InlineModule &mod) {
+  auto caller = add_weighted_caller(mod);
+  build_nested_loops(
+      mod.module.get_function(mod.module.create_function("nested")));
+  build_fib_swap(mod.module.get_function(mod.module.create_function("fib")));
+  build_isel_patterns(
+      mod.module.get_function(mod.module.create_function("patterns")));
+  for (auto flag : {CMP_L, CMP_GE, CMP_NE}) {
+    build_offset(mod.module.get_function(mod.module.create_function("offset")),
+                 10, flag, flag == CMP_GE);
+  }
+  return caller;
+}
+
+TEST(CoreTest, compilation_service_deterministic) {
+  InlineModule mod;
+  auto caller = build_service_module(mod);
+  auto &&module = mod.module;
+  std::vector<const void *> call_table(module.size());
+  for (auto tier : {CodeTier::OPTIMIZING, CodeTier::BASELINE}) {
+    // Every function compiled alone by fresh compiler.
+    std::vector<AotCache::Entry> expected;
+    for (funcid_t id = 0; id < module.size(); ++id) {
+      Compiler comp(X86Backend::NUM_REGS);
+      IRCloner(comp.graph()).clone_graph(module.get_function(id));
+      auto &&entry = expected.emplace_back();
+      if (tier == CodeTier::BASELINE) {
+        entry.code = X86Baseline::emit(comp.graph(), call_table.data(),
+                                       &entry.relocations);
+      } else {
+        comp.register_default_passes();
+        comp.run_all_passes();
+        entry.code =
+            X86Backend::emit(comp, call_table.data(), &entry.relocations);
+      }
+    }
+    for (size_t num_threads : {1, 4}) {
+      CompilationService service(num_threads, tier);
+      ASSERT_EQ(service.get_num_threads(), num_threads);
+      // Second batch runs on reset compilers.
+      for (size_t batch = 0; batch < 2; ++batch) {
+        auto results = service.compile(module, call_table.data());
+        ASSERT_EQ(results.size(), module.size());
+        for (funcid_t id = 0; id < module.size(); ++id) {
+          ASSERT_TRUE(results[id].error.empty()) << results[id].error;
+          ASSERT_EQ(results[id].code, expected[id].code)
+              << module.get_name(id) << ", " << num_threads << " threads";
+          ASSERT_EQ(results[id].relocations.size(),
+                    expected[id].relocations.size());
+          for (size_t idx = 0; idx < results[id].relocations.size(); ++idx) {
+            ASSERT_EQ(results[id].relocations[idx].offset,
+                      expected[id].relocations[idx].offset);
+            ASSERT_EQ(results[id].relocations[idx].callee,
+                      expected[id].relocations[idx].callee);
+          }
+        }
+      }
+    }
+
+    CompilationService service(3, tier);
+    auto results = service.compile(module, call_table.data());
+    CodeCache cache;
+    for (funcid_t id = 0; id < module.size(); ++id) {
+      call_table[id] = cache.add(results[id].code);
+    }
+    cache.make_executable();
+    JitFunction func(call_table[caller], results[caller].code.size());
+    ASSERT_EQ(func(-5, 7),
+              evaluate(module.get_function(caller), {-5, 7}, &module));
+  }
+}
+
+TEST(CoreTest, compilation_service_errors) {
+  ProgramGraph invalid;
+  invalid.create_param(FLOAT);
+  {
+    IRBuilder builder(invalid);
+    auto &&graph = invalid;
+    MKBB(0);
+    builder.set_entry_point(bb0);
+    builder.set_insert_point(bb0);
+    builder.create_ret(builder.create_param_load(0));
+  }
+  ProgramGraph nested;
+  build_nested_loops(nested);
+  CompilationService service(2);
+  auto results = service.compile({&nested, &invalid, &nested});
+  ASSERT_EQ(results.size(), 3);
+  ASSERT_TRUE(results[0].error.empty());
+  ASSERT_FALSE(results[1].error.empty());
+  ASSERT_TRUE(results[1].code.empty());
+  ASSERT_EQ(results[2].code, results[0].code);
+  ASSERT_TRUE(service.compile(std::vector<ProgramGraph *>{}).empty());
+}
+
+TEST(CoreTest, binary_ir_module) {
+  InlineModule mod;
+  auto bytes = write_binary_module(mod.module);
+  auto path = testing::TempDir() + "kodjit_binary_ir_test.kir";
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+  }
+  Module module;
+  read_binary_module_file(path, module);
+  std::remove(path.c_str());
+  ASSERT_EQ(module.size(), mod.module.size());
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    ASSERT_EQ(module.get_name(id), mod.module.get_name(id));
+    ASSERT_EQ(hash_graph(module.get_function(id)),
+              hash_graph(mod.module.get_function(id)));
+  }
+  ASSERT_EQ(evaluate(module.get_function(mod.fact), {10}, &module), 3628800);
+  ASSERT_EQ(evaluate(module.get_function(mod.f), {-3, 4}, &module),
+            evaluate(mod.module.get_function(mod.f), {-3, 4}, &mod.module));
+  ASSERT_THROW(read_binary_module(bytes.data(), bytes.size(), module),
+               IRInvalidArgument);
+}
+
+TEST(CoreTest, binary_ir_malformed) {
+  InlineModule mod;
+  auto bytes = write_binary_module(mod.module);
+  for (size_t size = 0; size < bytes.size(); ++size) {
+    Module module;
+    ASSERT_THROW(read_binary_module(bytes.data(), size, module),
+                 IRFormatError);
+  }
+  // Damaged buffers are either rejected or read as some valid graph.
+  for (size_t pos = 0; pos < bytes.size(); ++pos) {
+    for (uint8_t mask : {0x01, 0x80, 0xff}) {
+      auto damaged = bytes;
+      damaged[pos] ^= mask;
+      Module module;
+      try {
+        read_binary_module(damaged.data(), damaged.size(), module);
+      } catch (const IRFormatError &) {
+      }
+    }
+  }
+}
+
+TEST(CoreTest, ir_parser_round_trip) {
+  InlineModule mod;
+  std::stringstream text;
+  IRPrinter(text).print_module(mod.module);
+  Module module;
+  parse_module(text.str(), module);
+  ASSERT_EQ(module.size(), mod.module.size());
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    ASSERT_EQ(module.get_name(id), mod.module.get_name(id));
+    ASSERT_EQ(hash_graph(module.get_function(id)),
+              hash_graph(mod.module.get_function(id)));
+  }
+  ASSERT_EQ(evaluate(module.get_function(mod.fact), {10}, &module), 3628800);
+  // Parsed functions are numbered in order of the text, so the second
+  // round gives the same text.
+  std::stringstream first;
+  IRPrinter(first).print_module(module);
+  Module reparsed;
+  parse_module(first.str(), reparsed);
+  std::stringstream second;
+  IRPrinter(second).print_module(reparsed);
+  ASSERT_EQ(first.str(), second.str());
+}
+
+TEST(CoreTest, ir_parser_forward_refs) {
+  // Blocks are out of dominance order, values are used before definition.
+  const char *text = R"(
+# nested loops
+func nested(int) {
+bb0:
+  i0: param int0
+  i1: const int 0
+  i2: const int 1
+  i3: b bb1
+bb1:
+  i4: phi int [0: bb0 i1]; [1: bb5 i20];
+  i5: phi int [0: bb0 i1]; [1: bb5 i11];
+  i6: b.if lt i4, i0 F: bb6 T: bb2
+bb4:
+  i13: add int int i11 int i9
+  i14: add int int i13 int i10
+  i15: add int int i10 int i2
+  i16: b bb3
+bb2:
+  i7: const int 3
+  i9: mul int int i4 int i7
+  i8: b bb3
+bb3:
+  i10: phi int [0: bb2 i1]; [1: bb4 i15];
+  i11: phi int [0: bb2 i5]; [1: bb4 i14];
+  i12: b.if lt i10, i4 F: bb5 T: bb4
+bb5:
+  i20: add int int i4 int i2
+  i21: b bb1
+bb6:
+  i22: ret int int i5
+}
+)";
+  Module module;
+  parse_module(text, module);
+  ProgramGraph graph;
+  build_nested_loops(graph);
+  auto &&parsed = module.get_function(0);
+  ASSERT_EQ(hash_graph(parsed), hash_graph(graph));
+  for (int64_t n : {0, 3, 10}) {
+    ASSERT_EQ(evaluate(parsed, {n}), evaluate(graph, {n}));
+  }
+  // Block without terminator.
+  Module fallthrough;
+  parse_module("func f(int) {\nbb0:\n  i0: param int0\n  -> bb1\n"
+               "bb1:\n  i1: ret int int i0\n}\n",
+               fallthrough);
+  ASSERT_EQ(evaluate(fallthrough.get_function(0), {7}), 7);
+}
+
+TEST(CoreTest, ir_parser_errors) {
+  auto get_error = [](const std::string &body) -> std::string {
+    Module module;
+    try {
+      parse_module("func f(int) {\nbb0:\n" + body + "}\n", module);
+    } catch (const IRParseError &error) {
+      return error.what();
+    }
+    return "";
+  };
+  ASSERT_EQ(get_error("  i0: ret int int i1\n"), "3:19: undefined value i1");
+  ASSERT_EQ(get_error("  i0: b bb3\n"), "3:9: undefined block bb3");
+  ASSERT_EQ(get_error("  i0: param int0\n  i0: ret int int i0\n"),
+            "4:3: redefinition of i0");
+  ASSERT_EQ(get_error("  i0: load int0\n"), "3:7: unknown opcode 'load'");
+  ASSERT_EQ(get_error("  i0: param int3\n"), "3:7: Invalid parameter index");
+  ASSERT_EQ(get_error("  i0: param int0\n  i1: ret int float i0\n"),
+            "4:21: type mismatch of i0");
+  ASSERT_EQ(get_error("  i0: call int f1\n  i1: ret int int i0\n"),
+            "3:16: unknown function f1");
+  ASSERT_EQ(get_error("  i0: const int 99999999999999999999\n"),
+            "3:17: integer out of range");
+  ASSERT_EQ(get_error("  i0: param int0 int1\n"), "3:18: expected end of line");
+  Module module;
+  ASSERT_THROW(parse_module("func f() {\n  i0: const int 1\n}\n", module),
+               IRParseError);
+  ASSERT_THROW(parse_module("func f() {\nbb0:\n", module), IRParseError);
 }
 
 #undef MKBB
@@ -126,6 +126,64 @@ TEST(IRTests, cond_br_test) {
   dumpCFG("cond_br_test.dot", prog);
 }
 
+TEST(IRTests, select_test) {
+  ProgramGraph prog;
+  IRBuilder builder(prog);
+
+  BasicBlock *entry = prog.create_basic_block();
+  builder.set_entry_point(entry);
+  builder.set_insert_point(entry);
+
+  auto lhs = builder.create_param_load(prog.create_param(OperandType::INTEGER));
+  auto rhs = builder.create_param_load(prog.create_param(OperandType::INTEGER));
+  auto flt = builder.create_param_load(prog.create_param(OperandType::FLOAT));
+
+  auto select = builder.create_select(CMP_L, lhs, rhs, lhs, rhs);
+  ASSERT_EQ(select->get_type(), OperandType::INTEGER);
+  ASSERT_EQ(select->get_flag(), CMP_L);
+  ASSERT_EQ(select->get_true_value(), lhs);
+  ASSERT_EQ(select->get_false_value(), rhs);
+  // Compared values are used by select too.
+  ASSERT_EQ(lhs->get_num_users(), 2);
+
+  ASSERT_THROW(builder.create_select(CMP_L, lhs, rhs, lhs, flt),
+               IROperandError);
+  ASSERT_THROW(builder.create_select(CMP_L, flt, rhs, lhs, rhs),
+               IROperandError);
+
+  verify_inst_sequence({INST_PARAM, INST_PARAM, INST_PARAM, INST_SELECT},
+                       entry);
+}
+
+TEST(IRTests, predecessors_test) {
+  ProgramGraph prog;
+  IRBuilder builder(prog);
+
+  BasicBlock *entry = prog.create_basic_block();
+  BasicBlock *false_bb = prog.create_basic_block();
+  BasicBlock *true_bb = prog.create_basic_block();
+  BasicBlock *epilogue = prog.create_basic_block();
+  builder.set_entry_point(entry);
+
+  builder.set_insert_point(entry);
+  auto par = builder.create_param_load(prog.create_param(OperandType::INTEGER));
+  builder.create_conditional_branch(CMP_EQ, false_bb, true_bb, par, par);
+  builder.set_insert_point(false_bb);
+  builder.create_branch(epilogue);
+  builder.set_insert_point(true_bb);
+  builder.create_branch(epilogue);
+
+  auto num_preds = [](BasicBlock *bb) {
+    return std::distance(bb->pred_begin(), bb->pred_end());
+  };
+  ASSERT_EQ(num_preds(entry), 0);
+  ASSERT_EQ(num_preds(false_bb), 1);
+  ASSERT_EQ(num_preds(true_bb), 1);
+  ASSERT_EQ(num_preds(epilogue), 2);
+  ASSERT_EQ(*false_bb->pred_begin(), entry);
+  ASSERT_EQ(*true_bb->pred_begin(), entry);
+}
+
 TEST(IRTests, factorial) {
   ProgramGraph prog;
   IRBuilder builder(prog);
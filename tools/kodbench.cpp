@@ -0,0 +1,315 @@
+// Benchmarks of code generation on synthetic modules.
+//
+//   startup:    time from IR to the first result of every function,
+//               compiled by the baseline code generator or by the optimizing
+//               pipeline.
+//   throughput: functions compiled per second by CompilationService with
+//               1 to N threads.
+
+#include <CodeGen/CompilationService.hpp>
+#include <CodeGen/ExecutableMemory.hpp>
+#include <CodeGen/Jit.hpp>
+#include <CodeGen/X86Backend.hpp>
+#include <CodeGen/X86Baseline.hpp>
+#include <Core/Compiler.h>
+#include <IR/IRBuilder.hpp>
+#include <IR/IRCloner.hpp>
+#include <IR/Module.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <string_view>
+#include <vector>
+
+using namespace koda;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string_view command;
+  size_t num_functions = 1000;
+  size_t num_ops = 50;
+  uint32_t seed = 1;
+  // Zero means one per hardware thread.
+  size_t max_threads = 0;
+  CodeTier tier = CodeTier::OPTIMIZING;
+};
+
+constexpr const char *USAGE = R"(usage: kodbench <command> [options]
+
+commands:
+  startup             time from IR to the first result of each function
+                      for baseline and optimizing code generators
+  throughput          functions compiled per second by compilation service
+                      with 1, 2, 4, ... threads up to the maximum
+
+options:
+  --functions=<n>     number of generated functions (default: 1000)
+  --ops=<n>           arithmetic instructions per function (default: 50)
+  --seed=<n>          seed of generated functions (default: 1)
+  --threads=<n>       maximum number of threads for throughput
+                      (default: number of hardware threads)
+  --baseline          throughput of baseline code generator instead of
+                      optimizing one
+)";
+
+constexpr int64_t ARGS[] = {3, -5, 4};
+
+// f(a, b, n) { acc = a; for (i = 0; i < n; i++) acc = ops(acc, i, a, b);
+// ret acc }, ops are random arithmetic over previous values.
+void build_function(ProgramGraph &graph, size_t num_ops, std::mt19937 &rng) {
+  for (size_t idx = 0; idx < 3; ++idx) {
+    graph.create_param(INTEGER);
+  }
+  IRBuilder builder(graph);
+  auto entry = graph.create_basic_block();
+  auto header = graph.create_basic_block();
+  auto body = graph.create_basic_block();
+  auto exit = graph.create_basic_block();
+  builder.set_entry_point(entry);
+  builder.set_insert_point(entry);
+  auto a = builder.create_param_load(0);
+  auto b = builder.create_param_load(1);
+  auto n = builder.create_param_load(2);
+  auto zero = builder.create_int_constant(0);
+  auto one = builder.create_int_constant(1);
+  builder.create_branch(header);
+  builder.set_insert_point(header);
+  auto i = builder.create_phi(INTEGER);
+  auto acc = builder.create_phi(INTEGER);
+  builder.create_conditional_branch(CMP_L, exit, body, i, n);
+  builder.set_insert_point(body);
+  std::vector<Instruction *> values = {acc, i, a, b};
+  auto pick = [&values, &rng] {
+    return values[std::uniform_int_distribution<size_t>(
+        0, values.size() - 1)(rng)];
+  };
+  for (size_t idx = 0; idx < num_ops; ++idx) {
+    auto lhs = pick();
+    auto rhs = pick();
+    auto imm = builder.create_int_constant(
+        std::uniform_int_distribution<int64_t>(1, 7)(rng));
+    Instruction *value = nullptr;
+    switch (std::uniform_int_distribution<int>(0, 7)(rng)) {
+    case 0:
+      value = builder.create_iadd(lhs, rhs);
+      break;
+    case 1:
+      value = builder.create_isub(lhs, imm);
+      break;
+    case 2:
+      value = builder.create_imul(lhs, imm);
+      break;
+    case 3:
+      value = builder.create_xor(lhs, rhs);
+      break;
+    case 4:
+      value = builder.create_and(lhs, rhs);
+      break;
+    case 5:
+      value = builder.create_shl(lhs, imm);
+      break;
+    case 6:
+      value = builder.create_ashr(lhs, imm);
+      break;
+    default:
+      value = builder.create_select(CMP_L, lhs, rhs, rhs, imm);
+      break;
+    }
+    values.push_back(value);
+  }
+  auto i_inc = builder.create_iadd(i, one);
+  builder.create_branch(header);
+  builder.set_insert_point(exit);
+  builder.create_ret(acc);
+  i->add_option(entry, zero);
+  i->add_option(body, i_inc);
+  acc->add_option(entry, a);
+  acc->add_option(body, values.back());
+}
+
+void build_module(Module &module, const Options &options) {
+  std::mt19937 rng(options.seed);
+  for (size_t idx = 0; idx < options.num_functions; ++idx) {
+    auto id = module.create_function("f" + std::to_string(idx));
+    build_function(module.get_function(id), options.num_ops, rng);
+  }
+}
+
+struct TierStats {
+  Clock::duration compile{};
+  Clock::duration first_call{};
+  size_t code_size = 0;
+  std::vector<int64_t> results;
+};
+
+template <typename Emit> TierStats measure(const Module &module, Emit &&emit) {
+  TierStats stats;
+  for (funcid_t id = 0; id < module.size(); ++id) {
+    auto start = Clock::now();
+    auto code = emit(module.get_function(id));
+    JitFunction func(ExecutableMemory::from_code(code));
+    auto compiled = Clock::now();
+    stats.results.push_back(func(ARGS[0], ARGS[1], ARGS[2]));
+    auto done = Clock::now();
+    stats.compile += compiled - start;
+    stats.first_call += done - compiled;
+    stats.code_size += code.size();
+  }
+  return stats;
+}
+
+int run_startup(const Options &options) {
+  Module module;
+  build_module(module, options);
+  auto baseline = measure(module, [](ProgramGraph &graph) {
+    return X86Baseline::emit(graph);
+  });
+  auto optimizing = measure(module, [](ProgramGraph &graph) {
+    Compiler comp(X86Backend::NUM_REGS);
+    IRCloner(comp.graph()).clone_graph(graph);
+    comp.register_default_passes();
+    comp.run_all_passes();
+    return X86Backend::emit(comp);
+  });
+  if (baseline.results != optimizing.results) {
+    std::cerr << "kodbench: results of tiers differ\n";
+    return 1;
+  }
+  auto num_functions = static_cast<double>(module.size());
+  auto per_function = [num_functions](Clock::duration time) {
+    return std::chrono::duration<double, std::micro>(time).count() /
+           num_functions;
+  };
+  std::printf("%zu functions, %zu ops each\n", options.num_functions,
+              options.num_ops);
+  std::printf("%-12s %14s %14s %14s %12s\n", "tier", "compile us/fn",
+              "first run us", "total us/fn", "code B/fn");
+  for (auto &&[name, stats] : {std::pair{"baseline", &baseline},
+                               std::pair{"optimizing", &optimizing}}) {
+    std::printf("%-12s %14.2f %14.2f %14.2f %12.0f\n", name,
+                per_function(stats->compile), per_function(stats->first_call),
+                per_function(stats->compile + stats->first_call),
+                stats->code_size / num_functions);
+  }
+  return 0;
+}
+
+// Every thread count compiles the whole module, code must not depend on it.
+int run_throughput(const Options &options) {
+  Module module;
+  build_module(module, options);
+  auto max_threads = options.max_threads != 0
+                         ? options.max_threads
+                         : std::max(1u, std::thread::hardware_concurrency());
+  std::vector<size_t> thread_counts;
+  for (size_t count = 1; count < max_threads; count *= 2) {
+    thread_counts.push_back(count);
+  }
+  thread_counts.push_back(max_threads);
+  std::printf("%zu functions, %zu ops each, %s tier\n", options.num_functions,
+              options.num_ops,
+              options.tier == CodeTier::BASELINE ? "baseline" : "optimizing");
+  std::printf("%-8s %12s %12s %10s %10s\n", "threads", "time ms", "fn/s",
+              "speedup", "steals");
+  std::vector<CompiledFunction> reference;
+  double base_time = 0;
+  for (auto &&count : thread_counts) {
+    CompilationService service(count, options.tier);
+    auto start = Clock::now();
+    auto results = service.compile(module, nullptr);
+    auto time = std::chrono::duration<double>(Clock::now() - start).count();
+    for (auto &&result : results) {
+      if (!result.error.empty()) {
+        std::cerr << "kodbench: " << result.error << "\n";
+        return 1;
+      }
+    }
+    if (reference.empty()) {
+      reference = std::move(results);
+      base_time = time;
+    } else if (!std::equal(results.begin(), results.end(), reference.begin(),
+                           [](auto &&lhs, auto &&rhs) {
+                             return lhs.code == rhs.code;
+                           })) {
+      std::cerr << "kodbench: code depends on number of threads\n";
+      return 1;
+    }
+    std::printf("%-8zu %12.2f %12.0f %10.2f %10zu\n", count, time * 1000,
+                module.size() / time, base_time / time,
+                service.get_num_steals());
+  }
+  return 0;
+}
+
+std::optional<size_t> parse_number(std::string_view value) {
+  char *end = nullptr;
+  auto number = std::strtoull(value.data(), &end, 10);
+  if (value.empty() || end != value.data() + value.size() || number == 0) {
+    return std::nullopt;
+  }
+  return number;
+}
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  if (argc < 2) {
+    return std::nullopt;
+  }
+  Options options;
+  options.command = argv[1];
+  for (int idx = 2; idx < argc; ++idx) {
+    std::string_view arg = argv[idx];
+    if (arg == "--baseline") {
+      options.tier = CodeTier::BASELINE;
+      continue;
+    }
+    auto eq = arg.find('=');
+    auto name = arg.substr(0, eq);
+    auto value = parse_number(
+        eq == std::string_view::npos ? "" : arg.substr(eq + 1));
+    if (!value) {
+      std::cerr << "kodbench: invalid option '" << arg << "'\n";
+      return std::nullopt;
+    }
+    if (name == "--functions") {
+      options.num_functions = *value;
+    } else if (name == "--ops") {
+      options.num_ops = *value;
+    } else if (name == "--seed") {
+      options.seed = static_cast<uint32_t>(*value);
+    } else if (name == "--threads") {
+      options.max_threads = *value;
+    } else {
+      std::cerr << "kodbench: unknown option '" << arg << "'\n";
+      return std::nullopt;
+    }
+  }
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  auto options = parse_options(argc, argv);
+  if (!options) {
+    std::cerr << USAGE;
+    return 2;
+  }
+  if (options->command == "startup") {
+    return run_startup(*options);
+  }
+  if (options->command == "throughput") {
+    return run_throughput(*options);
+  }
+  std::cerr << "kodbench: unknown command '" << options->command << "'\n"
+            << USAGE;
+  return 2;
+}
@@ -0,0 +1,258 @@
+// Command line driver: reads modules in textual or binary IR, runs pass
+// pipeline over their functions and prints the result.
+
+#include <CodeGen/X86Backend.hpp>
+#include <Core/Compiler.h>
+#include <Core/Passes.hpp>
+#include <IR/BinaryIR.hpp>
+#include <IR/IRBuilder.hpp>
+#include <IR/IRCloner.hpp>
+#include <IR/IRParser.hpp>
+#include <IR/IRPrinter.hpp>
+#include <IR/Module.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace koda;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class PrintMode { TEXT, DOT, NONE };
+
+struct Options {
+  std::vector<std::string_view> passes;
+  bool time_passes = false;
+  bool codegen = false;
+  PrintMode print = PrintMode::TEXT;
+  size_t repeat = 1;
+  std::vector<std::string> files;
+};
+
+constexpr const char *USAGE = R"(usage: kodjit [options] <file>...
+
+Reads modules in textual or binary IR, runs pass pipeline over each
+function and prints the result.
+
+options:
+  --passes=<list>     comma separated pass names, "default" or "none"
+                      (default: none)
+  --codegen           emit x86-64 code after the passes
+  --time-passes       report time of each stage on stderr
+  --repeat=<n>        compile each function n times, for profiling
+  --print=<mode>      text, dot or none (default: text)
+  --list-passes       print names of passes and exit
+)";
+
+// Accumulated time of pipeline stage, stages are reported in order of their
+// first run.
+class Timings final {
+  std::vector<std::pair<std::string, Clock::duration>> m_stages;
+
+public:
+  template <typename Func> void measure(std::string_view stage, Func &&func) {
+    auto start = Clock::now();
+    func();
+    add(stage, Clock::now() - start);
+  }
+
+  void add(std::string_view stage, Clock::duration time) {
+    for (auto &&[name, total] : m_stages) {
+      if (name == stage) {
+        total += time;
+        return;
+      }
+    }
+    m_stages.emplace_back(stage, time);
+  }
+
+  void print(std::FILE *out) const {
+    Clock::duration total{};
+    for (auto &&[name, time] : m_stages) {
+      total += time;
+    }
+    std::fprintf(out, "===== kodjit timings =====\n");
+    for (auto &&[name, time] : m_stages) {
+      auto ms = std::chrono::duration<double, std::milli>(time).count();
+      auto percent = total.count() == 0 ? 0.0 : 100.0 * time / total;
+      std::fprintf(out, "%12.3f ms %6.1f%%  %s\n", ms, percent, name.c_str());
+    }
+    std::fprintf(out, "%12.3f ms %6.1f%%  total\n",
+                 std::chrono::duration<double, std::milli>(total).count(),
+                 100.0);
+  }
+};
+
+std::optional<std::vector<std::string_view>> parse_pipeline(std::string_view list) {
+  if (list == "default") {
+    return get_default_pipeline();
+  }
+  std::vector<std::string_view> passes;
+  if (list == "none") {
+    return passes;
+  }
+  while (!list.empty()) {
+    auto end = list.find(',');
+    auto name = list.substr(0, end);
+    if (!create_pass(name)) {
+      std::cerr << "kodjit: unknown pass '" << name << "'\n";
+      return std::nullopt;
+    }
+    passes.push_back(name);
+    list = end == std::string_view::npos ? "" : list.substr(end + 1);
+  }
+  return passes;
+}
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  Options options;
+  for (int idx = 1; idx < argc; ++idx) {
+    std::string_view arg = argv[idx];
+    auto value = [&arg](std::string_view option) {
+      return arg.substr(option.size());
+    };
+    if (arg.rfind("--passes=", 0) == 0) {
+      auto passes = parse_pipeline(value("--passes="));
+      if (!passes) {
+        return std::nullopt;
+      }
+      options.passes = std::move(*passes);
+    } else if (arg == "--codegen") {
+      options.codegen = true;
+    } else if (arg == "--time-passes") {
+      options.time_passes = true;
+    } else if (arg.rfind("--repeat=", 0) == 0) {
+      options.repeat = std::strtoull(value("--repeat=").data(), nullptr, 10);
+      if (options.repeat == 0) {
+        std::cerr << "kodjit: invalid repeat count\n";
+        return std::nullopt;
+      }
+    } else if (arg == "--print=text") {
+      options.print = PrintMode::TEXT;
+    } else if (arg == "--print=dot") {
+      options.print = PrintMode::DOT;
+    } else if (arg == "--print=none") {
+      options.print = PrintMode::NONE;
+    } else if (arg == "--list-passes") {
+      for (auto &&name : get_pass_names()) {
+        std::cout << name << "\n";
+      }
+      std::exit(0);
+    } else if (arg == "--help" || arg == "-h") {
+      std::cout << USAGE;
+      std::exit(0);
+    } else if (arg.rfind("-", 0) == 0) {
+      std::cerr << "kodjit: unknown option '" << arg << "'\n";
+      return std::nullopt;
+    } else {
+      options.files.emplace_back(arg);
+    }
+  }
+  if (options.files.empty()) {
+    std::cerr << "kodjit: no input files\n";
+    return std::nullopt;
+  }
+  return options;
+}
+
+// Binary modules are recognized by their magic, other files are text.
+void load_module(const std::string &path, Module &module, Timings &timings) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("can't open file");
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  auto data = contents.str();
+  timings.measure("parse", [&data, &module] {
+    if (data.compare(0, 4, "KIRM") == 0) {
+      read_binary_module(reinterpret_cast<const uint8_t *>(data.data()),
+                         data.size(), module);
+    } else {
+      parse_module(data, module);
+    }
+  });
+}
+
+bool compile_function(const Options &options, const Module &module,
+                      funcid_t id, Timings &timings) {
+  std::vector<const void *> call_table(module.size());
+  for (size_t iteration = 0; iteration < options.repeat; ++iteration) {
+    Compiler comp(X86Backend::NUM_REGS);
+    timings.measure("clone", [&comp, &module, id] {
+      IRCloner(comp.graph()).clone_graph(module.get_function(id));
+    });
+    for (auto &&name : options.passes) {
+      auto pass = create_pass(name);
+      timings.measure(name, [&pass, &comp] { pass->run(comp); });
+    }
+    if (options.codegen) {
+      try {
+        timings.measure("codegen", [&comp, &call_table] {
+          X86Backend::emit(comp, call_table.data());
+        });
+      } catch (const CodeGenError &error) {
+        std::cerr << "kodjit: " << module.get_name(id) << ": " << error.what()
+                  << "\n";
+        return false;
+      }
+    }
+    if (iteration + 1 != options.repeat) {
+      continue;
+    }
+    IRPrinter printer(std::cout);
+    if (options.print == PrintMode::TEXT) {
+      printer.print_function(comp.graph(), module.get_name(id));
+    } else if (options.print == PrintMode::DOT &&
+               comp.graph().get_entry() != nullptr) {
+      printer.print_prog_graph(comp.graph());
+      std::cout << "\n";
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  auto options = parse_options(argc, argv);
+  if (!options) {
+    std::cerr << USAGE;
+    return 2;
+  }
+  Timings timings;
+  bool is_ok = true;
+  for (auto &&path : options->files) {
+    Module module;
+    try {
+      load_module(path, module, timings);
+    } catch (const std::exception &error) {
+      std::cerr << "kodjit: " << path << ": " << error.what() << "\n";
+      is_ok = false;
+      continue;
+    }
+    for (funcid_t id = 0; id < module.size(); ++id) {
+      try {
+        is_ok &= compile_function(*options, module, id, timings);
+      } catch (const IRInvalidArgument &error) {
+        std::cerr << "kodjit: " << module.get_name(id) << ": " << error.what()
+                  << "\n";
+        is_ok = false;
+      }
+    }
+  }
+  if (options->time_passes) {
+    timings.print(stderr);
+  }
+  return is_ok ? 0 : 1;
+}